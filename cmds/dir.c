@@ -19,6 +19,8 @@
 
 ****************************************************************************/
 
+#include <time.h>
+
 #include "os.h"
 #include "mem.h"
 #include "terminal.h"
@@ -29,22 +31,11 @@
 
 // dir command code
 
-// TODO: date/time
-typedef struct {
-	const char 	*name;
-	unsigned int	len;
-	int		attr;
-	int		estimate;
-	int		etype;		// FS_DIR_MOD_*
-	int		splat;
-	int		ftype;		// DIR/PRG/SEQ/...
-} dirinfo_t;
-
 const char *ftypes[9] = {
 	"DEL", "SEQ", "PRG", "USR", "REL", "??5", "??6", "??7", "DIR"
 };
 
-static int parse_dir_packet(const uint8_t *buf, int len, dirinfo_t *dir) {
+int parse_dir_packet(const uint8_t *buf, int len, dirinfo_t *dir) {
 	
 	memset(dir, 0, sizeof(dirinfo_t));
 
@@ -61,13 +52,32 @@ static int parse_dir_packet(const uint8_t *buf, int len, dirinfo_t *dir) {
 	dir->attr = buf[FS_DIR_ATTR];
 	dir->ftype = buf[FS_DIR_ATTR] & FS_DIR_ATTR_TYPEMASK;
 
-	// TODO: date/time
+	// the server sends its local time, which is the start of the epoch
+	// if the file has no date
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = buf[FS_DIR_YEAR];
+	tm.tm_mon = buf[FS_DIR_MONTH];
+	tm.tm_mday = buf[FS_DIR_DAY];
+	tm.tm_hour = buf[FS_DIR_HOUR];
+	tm.tm_min = buf[FS_DIR_MIN];
+	tm.tm_sec = buf[FS_DIR_SEC];
+	tm.tm_isdst = -1;
+	dir->mtime = mktime(&tm);
+	if (dir->mtime < 24 * 3600) {
+		dir->mtime = 0;
+	}
 	
 	dir->etype = buf[FS_DIR_MODE];
 
 	dir->name = (const char*) buf+FS_DIR_NAME;
 
-	return 0;
+	const uint8_t *end = memchr(buf+FS_DIR_NAME, 0, len-FS_DIR_NAME);
+	if (end == NULL) {
+		log_error("received unterminated directory entry name\n");
+		return -1;
+	}
+	return end + 1 - buf;
 }
 
 static void print_long_packet(dirinfo_t *dir) {
@@ -170,7 +180,7 @@ static int dir_single(int sockfd, int type, const char *name) {
 	buf[0] = '$';
 	parse_filename(buf, strlen((char*)buf), 256, &ninfo, PARSEHINT_LOAD);
 
-	int rv = send_longcmd(sockfd, FS_OPEN_DR, pkgfd, &ninfo);
+	int rv = send_longcmd(sockfd, FS_OPEN_DRP, pkgfd, &ninfo);
 
 	if (rv >= 0) {
 		rv = recv_packet(sockfd, buf, 256);
@@ -196,23 +206,31 @@ static int dir_single(int sockfd, int type, const char *name) {
 				break;
 			}
 
-			rv = parse_dir_packet(buf + FSP_DATA, buf[FSP_LEN] - FSP_DATA, &dir);
-
-			if (rv < 0) {
-				break;
+			// the packet contains one or more entries
+			for (int p = FSP_DATA; p < buf[FSP_LEN]; p += rv) {
+				rv = parse_dir_packet(buf + p, buf[FSP_LEN] - p, &dir);
+
+				if (rv < 0) {
+					break;
+				}
+
+				switch (type) {
+				case 2:
+					print_long_packet(&dir);
+					break;
+				case 1:
+					print_ls_packet(&dir);
+					break;
+				default:
+					print_dir_packet(&dir);
+					break;
+				}
 			}
-
-			switch (type) {
-			case 2:
-				print_long_packet(&dir);
-				break;
-			case 1:
-				print_ls_packet(&dir);
-				break;
-			default:
-				print_dir_packet(&dir);
+			
+			if (rv < 0) {
 				break;
 			}
+			rv = CBM_ERROR_OK;
 			
 			if (buf[FSP_CMD] == FS_DATA_EOF) {
 				break;
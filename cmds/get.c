@@ -39,6 +39,7 @@
 static int cmd_get_int(int sockfd, int type, int argc, const char *argv[]) {
 
 	int force = 0;
+	int recursive = 0;
 	int rv = CBM_ERROR_OK;
 
 	int p = 0;
@@ -48,6 +49,9 @@ static int cmd_get_int(int sockfd, int type, int argc, const char *argv[]) {
 		case 'f':
 			force = 1;
 			break;
+		case 'r':
+			recursive = 1;
+			break;
 		case '-':
 			// break options
 			p++;
@@ -75,110 +79,39 @@ endopts:
 		argc--;
 	}
 
-	// check if file exists and what type it is
-	struct stat statbuf;
-
-	// truncate the opened file?
-	int trunc = 0;
+	xfer_t xf;
+	xfer_init(&xf, sockfd, 0, force);
 
-	if (stat(trgname, &statbuf) < 0) {
-		if (errno != ENOENT) {
-			// we do not overwrite, so NOENT is totally acceptable, if not wanted
-			rv = errno_to_error(errno);
-			log_errno("Error accessing '%s'\n", trgname);
-			return rv;
-		}
-	} else {
-		// no error - so file exists
-		if (!force) {
-			log_error("Target file exists!\n");
-			return CBM_ERROR_FILE_EXISTS;
-		}
-		if (S_IFDIR == (statbuf.st_mode & S_IFMT)) {
-			log_error("Target path is a directory!\n");
-			return CBM_ERROR_FILE_TYPE_MISMATCH;
+	if (recursive) {
+		// copy the directories' contents into the target directory
+		for (; (rv == CBM_ERROR_OK) && (p < argc); p++) {
+			rv = xfer_add_tree(&xf, argv[p], trgname);
 		}
-		if (S_IFLNK == (statbuf.st_mode & S_IFMT)) {
-			log_error("Target path is a symlink!\n");
-			return CBM_ERROR_FILE_TYPE_MISMATCH;
-		}
-		if (S_IFREG == (statbuf.st_mode & S_IFMT)) {
-			// only regular files are truncated, sockets, devices, ... are not
-			trunc = 1;
+		if (rv == CBM_ERROR_OK) {
+			rv = xfer_run(&xf);
 		}
+		xfer_free(&xf);
+		return rv;
 	}
+
 	// open target file
-	int outfd = open(trgname, O_CREAT | O_WRONLY | (trunc ? O_TRUNC : 0), S_IRUSR | S_IWUSR | S_IRGRP);
-	if (outfd < 0) {
-		rv = errno_to_error(errno);
-		log_errno("Could not open target file for writing!\n");
+	int outfd = -1;
+	rv = xfer_open_local(trgname, force, &outfd);
+	if (rv != CBM_ERROR_OK) {
 		return rv;
 	}
 
-	// now look at the source files
-	
-	const int BUFLEN = 255;
-	uint8_t *name = mem_alloc_c(BUFLEN+1, "parse buffer");
-	uint8_t *buf = mem_alloc_c(BUFLEN+1, "msg buffer");
-	uint8_t pkgfd = 0;
-	nameinfo_t ninfo;
-
-	rv = CBM_ERROR_OK;
-
-	for (; (rv == CBM_ERROR_OK) && (p < argc); p++) {
-
-		// note that parse_filename parses in-place, nameinfo then points to name buffer
-		strncpy((char*)name, argv[p], BUFLEN);
-		name[BUFLEN] = 0;
-
-		parse_filename(name, strlen((const char*)name), BUFLEN, &ninfo, PARSEHINT_LOAD);
-
-		if (send_longcmd(sockfd, FS_OPEN_RD, pkgfd, &ninfo)) {
-
-			if ((recv_packet(sockfd, buf, 256) > 0) 
-			 	&& buf[FSP_CMD] == FS_REPLY && buf[FSP_DATA] == CBM_ERROR_OK) {
-
-		    		// receive data packets until EOF
-		    		do {
-					if (send_cmd(sockfd, FS_READ, pkgfd) < 0) {
-						rv = errno_to_error(errno);
-						log_errno("Unable to send read request!\n");
-						break;
-					}
-
-					if (recv_packet(sockfd, buf, 256) < 0) {
-						rv = errno_to_error(errno);
-						log_errno("Could not receive packet!\n");
-						break;
-					}
-					if (buf[FSP_CMD] != FS_DATA && buf[FSP_CMD] != FS_DATA_EOF) {
-						log_error("Received unexpected packet of type %d!\n", buf[FSP_CMD]);
-						rv = CBM_ERROR_FAULT;
-						break;
-					}
-
-					if (write(outfd, buf + FSP_DATA, buf[FSP_LEN]-FSP_DATA) < 0) {
-						rv = errno_to_error(errno);
-						log_errno("Error writing to file!\n");
-						break;
-					}
-					if (buf[FSP_CMD] == FS_DATA_EOF) {
-						break;
-					}
-		    		} while(rv == 0); 
-
-		    		send_cmd(sockfd, FS_CLOSE, pkgfd);
-				recv_packet(sockfd, buf, 256);
-			}
-		}
+	// now look at the source files, which are concatenated in order
+	xf.channels = 1;
+	for (; p < argc; p++) {
+		xfer_add_fd(&xf, argv[p], outfd, FS_OPEN_RD);
 	}
+	rv = xfer_run(&xf);
 
 	if (close(outfd) < 0) {
 		log_errno("Could not close target file!");
 	}
 
-	mem_free(buf);
-	mem_free(name);
 	return rv;
 
 }
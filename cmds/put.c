@@ -33,8 +33,6 @@
 #include "cerrno.h"
 
 
-#define MAX_BUFFER_SIZE                 64
-
 // put/save command code
 
 
@@ -42,6 +40,7 @@ static int cmd_put_int(int sockfd, int type, int argc, const char *argv[]) {
 
 	// TODO: unify with get
         int force = 0;
+        int recursive = 0;
         int rv = CBM_ERROR_OK;
 
         int p = 0;
@@ -51,6 +50,9 @@ static int cmd_put_int(int sockfd, int type, int argc, const char *argv[]) {
                 case 'f':
                         force = 1;
                         break;
+                case 'r':
+                        recursive = 1;
+                        break;
                 case '-':
                         // break options
                         p++;
@@ -78,12 +80,26 @@ endopts:
         	argc--;
 	}
 
+	xfer_t xf;
+	xfer_init(&xf, sockfd, 1, force);
+
+	if (recursive) {
+		// copy the directories' contents into the target directory
+		for (; (rv == CBM_ERROR_OK) && (p < argc); p++) {
+			rv = xfer_add_tree(&xf, trgname, argv[p]);
+		}
+		if (rv == CBM_ERROR_OK) {
+			rv = xfer_run(&xf);
+		}
+		xfer_free(&xf);
+		return rv;
+	}
+
 	// look at the target file
 
 	const int BUFLEN = 255;	
 	uint8_t *name = mem_alloc_c(BUFLEN+1, "parse buffer");
-	uint8_t *buf = mem_alloc_c(BUFLEN+1, "msg buffer");
-	uint8_t pkgfd = 0;
+	char *remote = NULL;
 	nameinfo_t ninfo;
 	nameinfo_init(&ninfo);
 
@@ -95,75 +111,22 @@ endopts:
 
 	if (ninfo.trg.name == NULL || strlen((char*)ninfo.trg.name) == 0) {
 		// replace target name with first source name (maybe addressed as drive: only)
-		ninfo.trg.name = (uint8_t*)argv[p];
-		ninfo.trg.namelen = strlen(argv[p]);
+		remote = mem_alloc_c(strlen(trgname) + strlen(argv[p]) + 1, "put target");
+		strcpy(remote, trgname);
+		strcat(remote, argv[p]);
+	} else {
+		remote = mem_alloc_str2(trgname, "put target");
 	}
 
-        if (send_longcmd(sockfd, force ? FS_OPEN_OW : FS_OPEN_WR, pkgfd, &ninfo)) {
-	        if ((recv_packet(sockfd, buf, 256) > 0)
-                	&& buf[FSP_CMD] == FS_REPLY) {
-		       	
-			if (buf[FSP_DATA] == CBM_ERROR_OK) {
-
-		            for (; (rv == CBM_ERROR_OK) && (p < argc); p++) {
-				
-				int infd;
-
-				const char *srcname = argv[p];
-				infd = open(srcname, O_RDONLY);
-				if (infd < 0) {
-					rv = errno_to_error(errno);
-					log_errno("Error opening file '%s'\n", srcname);
-					break;
-				}
-
-                                // receive data packets until EOF
-				ssize_t n = 0;
-                                do {
-                                        if ((n = read(infd, buf + FSP_DATA, MAX_BUFFER_SIZE-FSP_DATA)) < 0) {
-                                                rv = errno_to_error(errno);
-                                                log_errno("Error reading from file!\n");
-                                                break;
-                                        }
-
-					// prepare send buffer
-					buf[FSP_LEN] = FSP_DATA + n;
-					buf[FSP_CMD] = (n == 0) ? FS_WRITE_EOF : FS_WRITE;
-					buf[FSP_FD] = pkgfd;
-
-					if (send_packet(sockfd, buf, buf[FSP_LEN]) < 0) {
-                                                rv = errno_to_error(errno);
-                                                log_errno("Unable to send read request!\n");
-                                                break;
-                                        }
-
-                                        if (recv_packet(sockfd, buf, BUFLEN+1) < 0) {
-                                                rv = errno_to_error(errno);
-                                                log_errno("Could not receive packet!\n");
-                                                break;
-                                        }
-                                        if (buf[FSP_CMD] != FS_REPLY) {
-                                                log_error("Received unexpected packet of type %d!\n", buf[FSP_CMD]);
-                                                rv = CBM_ERROR_FAULT;
-                                                break;
-                                        }
-				} while (n > 0);
-
-			        if (close(infd) < 0) {
-			                log_errno("Could not close source file!");
-			        }
-			    }
-			} else {
-				log_error("Error opening file: %d\n", buf[FSP_DATA]);
-				rv = buf[FSP_DATA];
-			}
-		} else {
-			log_error("Problem receiving reply to open\n");
-		}
-	} else {
-		log_error("Problem sending open\n");
+	// source files are concatenated, by appending all but the first
+	xf.channels = 1;
+	for (int i = p; i < argc; i++) {
+		uint8_t opencmd = (i > p) ? FS_OPEN_AP : (force ? FS_OPEN_OW : FS_OPEN_WR);
+		xfer_add(&xf, remote, argv[i], opencmd);
 	}
-	mem_free(buf);
+	rv = xfer_run(&xf);
+
+	mem_free(remote);
 	mem_free(name);
 	return rv;
 
@@ -0,0 +1,693 @@
+/****************************************************************************
+
+    xd2031 filesystem server - command frontend
+    Copyright (C) 2018 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "os.h"
+#include "mem.h"
+#include "terminal.h"
+#include "wireformat.h"
+#include "name.h"
+#include "xdcmd.h"
+#include "cerrno.h"
+
+
+// sync command code
+//
+// Mirrors a local directory tree to the server or the other way. Both
+// sides are listed, and a file is only transferred if it is missing on
+// the target, or its size or date say it has changed. When they cannot
+// tell - disk images only give the size in blocks and have no dates -
+// the server file is read, and its content hash compared to the one of
+// the local file. The server has no checksum command, but reading is
+// still a lot cheaper than writing into an image. The reads as well as
+// the transfers run pipelined, see xfer.c.
+
+// a file to compare by content
+typedef struct sync_cmp_s sync_cmp_t;
+struct sync_cmp_s {
+	sync_cmp_t	*next;
+	char		*remote;
+	char		*local;
+	FILE		*tmp;		// receives the server file
+};
+
+typedef struct {
+	int		isget;		// server to local
+	int		delete;		// delete what is not in the source
+	int		checksum;	// compare content whenever the size matches
+	int		dryrun;		// only report what would be done
+	xfer_t		xf;		// the transfers
+	xfer_t		cmpxf;		// the reads of server files to compare
+	sync_cmp_t	*cmps;
+	char		*dels[MAX_NAMEINFO_FILES];	// server deletions in the next batch
+	int		ndels;
+	// statistics
+	int		checked;
+	int		unchanged;
+	int		compared;
+	int		deleted;
+	int		dirs;
+} sync_t;
+
+// one entry in a directory, from either side
+typedef struct {
+	const char	*name;
+	int		isdir;
+	unsigned long	size;
+	int		estimate;	// size is only known in blocks
+	time_t		mtime;		// 0 if not known
+} sync_entry_t;
+
+static type_t entry_type = {
+	"sync_entry",
+	sizeof(sync_entry_t),
+	NULL
+};
+
+static int sync_dir(sync_t *s, const char *remote, const char *local, int trgnew);
+
+// --------------------------------------------------------------------------
+// directory lists
+
+// the server lists and opens host file names without wrapping, so disk
+// images (and e.g. P00 files) are files, and keep their names
+static int sync_isdir(const xfer_dirent_t *e) {
+	return e->info.etype == FS_DIR_MOD_DIR;
+}
+
+// a comma in a server file name starts the file type and access options,
+// so e.g. the host file "foo,s" can not be opened under its name
+static int sync_skip(const char *dir, const char *name) {
+	if (strchr(name, ',') != NULL) {
+		log_warn("Skipping '%s' in '%s', as the name has a comma\n", name, dir);
+		return 1;
+	}
+	return 0;
+}
+
+static int sync_entry_cmp(const void *a, const void *b) {
+	return strcmp(((const sync_entry_t*)a)->name, ((const sync_entry_t*)b)->name);
+}
+
+static int sync_list_remote(sync_t *s, const char *remote, xfer_dirent_t **outlist,
+		sync_entry_t **outents, int *outnum) {
+
+	int rv = xfer_read_dir(&s->xf, remote, outlist);
+
+	int n = 0;
+	for (xfer_dirent_t *e = *outlist; e != NULL; e = e->next) {
+		n++;
+	}
+	sync_entry_t *ents = mem_alloc_n(n + 1, &entry_type);
+
+	n = 0;
+	for (xfer_dirent_t *e = *outlist; e != NULL; e = e->next) {
+		if (sync_skip(remote, e->info.name)) {
+			continue;
+		}
+		ents[n].name = e->info.name;
+		ents[n].isdir = sync_isdir(e);
+		ents[n].size = e->info.len;
+		ents[n].estimate = (e->info.attr & FS_DIR_ATTR_ESTIMATE) ? 1 : 0;
+		ents[n].mtime = e->info.mtime;
+		n++;
+	}
+	qsort(ents, n, sizeof(sync_entry_t), sync_entry_cmp);
+
+	*outents = ents;
+	*outnum = n;
+	return rv;
+}
+
+static int sync_list_local(const char *local, sync_entry_t **outents, int *outnum) {
+
+	int rv = CBM_ERROR_OK;
+	int max = 16;
+	int n = 0;
+	sync_entry_t *ents = mem_alloc_n(max, &entry_type);
+
+	DIR *dir = opendir(local);
+	if (dir == NULL) {
+		log_errno("Could not open directory '%s'\n", local);
+		rv = errno_to_error(errno);
+	} else {
+		struct dirent *de;
+		while ((de = readdir(dir)) != NULL) {
+			if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")
+				|| sync_skip(local, de->d_name)) {
+				continue;
+			}
+			char *path = malloc_path(local, de->d_name);
+			struct stat statbuf;
+
+			if (stat(path, &statbuf) < 0) {
+				log_errno("Error accessing '%s'\n", path);
+			} else
+			if (S_IFDIR == (statbuf.st_mode & S_IFMT)
+				|| S_IFREG == (statbuf.st_mode & S_IFMT)) {
+				if (n >= max) {
+					max *= 2;
+					ents = mem_realloc_n(max, &entry_type, ents);
+				}
+				ents[n].name = mem_alloc_str2(de->d_name, "sync_entry_name");
+				ents[n].isdir = (S_IFDIR == (statbuf.st_mode & S_IFMT));
+				ents[n].size = statbuf.st_size;
+				ents[n].estimate = 0;
+				ents[n].mtime = statbuf.st_mtime;
+				n++;
+			}
+			mem_free(path);
+		}
+		closedir(dir);
+	}
+	qsort(ents, n, sizeof(sync_entry_t), sync_entry_cmp);
+
+	*outents = ents;
+	*outnum = n;
+	return rv;
+}
+
+static void sync_free_local(sync_entry_t *ents, int num) {
+
+	for (int i = 0; i < num; i++) {
+		mem_free((char*)ents[i].name);
+	}
+	mem_free(ents);
+}
+
+// --------------------------------------------------------------------------
+// deletions
+
+// delete the files in the batch with a single command
+static int sync_flush_dels(sync_t *s) {
+
+	uint8_t *name = mem_alloc_c(XFER_BUFLEN + 1, "parse buffer");
+	uint8_t buf[XFER_BUFLEN + 1];
+	nameinfo_t ninfo;
+	int rv = CBM_ERROR_OK;
+
+	if (s->ndels == 0) {
+		mem_free(name);
+		return rv;
+	}
+
+	name[0] = 0;
+	for (int i = 0; i < s->ndels; i++) {
+		if (i > 0) {
+			strcat((char*)name, ",");
+		}
+		strcat((char*)name, s->dels[i]);
+	}
+
+	if (s->dryrun) {
+		for (int i = 0; i < s->ndels; i++) {
+			printf("delete %s\n", s->dels[i]);
+		}
+		s->deleted += s->ndels;
+	} else {
+		nameinfo_init(&ninfo);
+		parse_cmd_pars(name, strlen((const char*)name), FS_DELETE, &ninfo);
+
+		rv = CBM_ERROR_FAULT;
+		if (send_longcmd(s->xf.sockfd, FS_DELETE, FSFD_CMD, &ninfo) >= 0
+			&& recv_packet(s->xf.sockfd, buf, XFER_BUFLEN + 1) > 0
+			&& buf[FSP_CMD] == FS_REPLY) {
+			rv = buf[FSP_DATA];
+			if (rv == CBM_ERROR_SCRATCHED) {
+				s->deleted += buf[FSP_DATA+1];
+				rv = CBM_ERROR_OK;
+			}
+		}
+		if (rv != CBM_ERROR_OK) {
+			log_error("Could not delete '%s': %d\n", name, rv);
+		}
+	}
+
+	for (int i = 0; i < s->ndels; i++) {
+		mem_free(s->dels[i]);
+	}
+	s->ndels = 0;
+	mem_free(name);
+	return rv;
+}
+
+static int sync_del_remote(sync_t *s, const char *remote, int isdir) {
+
+	int rv = CBM_ERROR_OK;
+
+	if (strpbrk(remote, "*?,=") != NULL) {
+		// would be taken as pattern or name list
+		log_warn("Not deleting '%s', as the name has wildcards\n", remote);
+		return rv;
+	}
+
+	if (!isdir) {
+		// the names (up to 255 bytes each) must fit into one packet
+		size_t len = strlen(remote);
+		for (int i = 0; i < s->ndels; i++) {
+			len += strlen(s->dels[i]) + 1;
+		}
+		if (s->ndels >= MAX_NAMEINFO_FILES || len > XFER_BUFLEN - FSP_DATA - 2 * MAX_NAMEINFO_FILES) {
+			rv = sync_flush_dels(s);
+		}
+		s->dels[s->ndels++] = mem_alloc_str2(remote, "sync_del");
+		return rv;
+	}
+
+	// a directory is emptied first
+	xfer_dirent_t *list = NULL;
+	rv = xfer_read_dir(&s->xf, remote, &list);
+	for (xfer_dirent_t *e = list; rv == CBM_ERROR_OK && e != NULL; e = e->next) {
+		char *path = xfer_remote_path(remote, e->info.name);
+		rv = sync_del_remote(s, path, sync_isdir(e));
+		mem_free(path);
+	}
+	xfer_free_dir(list);
+
+	if (rv == CBM_ERROR_OK) {
+		rv = sync_flush_dels(s);
+	}
+	if (rv == CBM_ERROR_OK && s->dryrun) {
+		printf("delete %s/\n", remote);
+	} else
+	if (rv == CBM_ERROR_OK) {
+		uint8_t *name = mem_alloc_c(XFER_BUFLEN + 1, "parse buffer");
+		uint8_t buf[XFER_BUFLEN + 1];
+		nameinfo_t ninfo;
+
+		strncpy((char*)name, remote, XFER_BUFLEN);
+		name[XFER_BUFLEN] = 0;
+
+		nameinfo_init(&ninfo);
+		parse_cmd_pars(name, strlen((const char*)name), FS_RMDIR, &ninfo);
+
+		rv = CBM_ERROR_FAULT;
+		if (send_longcmd(s->xf.sockfd, FS_RMDIR, FSFD_CMD, &ninfo) >= 0
+			&& recv_packet(s->xf.sockfd, buf, XFER_BUFLEN + 1) > 0
+			&& buf[FSP_CMD] == FS_REPLY) {
+			rv = buf[FSP_DATA];
+			if (rv == CBM_ERROR_SCRATCHED) {
+				rv = CBM_ERROR_OK;
+			}
+		}
+		if (rv != CBM_ERROR_OK) {
+			log_error("Could not delete directory '%s': %d\n", remote, rv);
+		}
+		mem_free(name);
+	}
+	return rv;
+}
+
+static int sync_del_local(sync_t *s, const char *local, int isdir) {
+
+	int rv = CBM_ERROR_OK;
+
+	if (isdir) {
+		sync_entry_t *ents = NULL;
+		int num = 0;
+
+		rv = sync_list_local(local, &ents, &num);
+		for (int i = 0; rv == CBM_ERROR_OK && i < num; i++) {
+			char *path = malloc_path(local, ents[i].name);
+			rv = sync_del_local(s, path, ents[i].isdir);
+			mem_free(path);
+		}
+		sync_free_local(ents, num);
+
+		if (rv == CBM_ERROR_OK && s->dryrun) {
+			printf("delete %s/\n", local);
+		} else
+		if (rv == CBM_ERROR_OK && rmdir(local) < 0) {
+			log_errno("Could not delete directory '%s'\n", local);
+			rv = errno_to_error(errno);
+		}
+		return rv;
+	}
+
+	if (s->dryrun) {
+		printf("delete %s\n", local);
+	} else
+	if (unlink(local) < 0) {
+		log_errno("Could not delete '%s'\n", local);
+		return errno_to_error(errno);
+	}
+	s->deleted++;
+	return rv;
+}
+
+// --------------------------------------------------------------------------
+// comparing files
+
+// FNV-1a
+static int sync_hash(int fd, uint64_t *outhash) {
+
+	uint8_t buf[4096];
+	uint64_t h = 0xcbf29ce484222325ULL;
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (ssize_t i = 0; i < n; i++) {
+			h = (h ^ buf[i]) * 0x100000001b3ULL;
+		}
+	}
+	if (n < 0) {
+		log_errno("Error reading file!\n");
+		return errno_to_error(errno);
+	}
+	*outhash = h;
+	return CBM_ERROR_OK;
+}
+
+// transfer a file from the source to the target side
+static void sync_transfer(sync_t *s, const char *remote, const char *local) {
+
+	log_debug("sync %s %s\n", remote, local);
+
+	if (s->dryrun) {
+		printf("%s %s\n", s->isget ? "get" : "put", s->isget ? remote : local);
+		s->xf.files++;
+		return;
+	}
+	xfer_add(&s->xf, remote, local, s->isget ? FS_OPEN_RD : FS_OPEN_OW);
+}
+
+// compare the source and target entries of a file
+static void sync_file(sync_t *s, const char *remote, const char *local,
+		const sync_entry_t *rent, const sync_entry_t *lent) {
+
+	const sync_entry_t *src = s->isget ? rent : lent;
+	const sync_entry_t *trg = s->isget ? lent : rent;
+	int compare = 0;
+
+	s->checked++;
+
+	if (rent->estimate) {
+		// an image file has at least one block
+		unsigned long blocks = (lent->size + 253) / 254;
+		if (blocks == 0) {
+			blocks = 1;
+		}
+		if (blocks != (rent->size + 253) / 254) {
+			sync_transfer(s, remote, local);
+			return;
+		}
+		compare = 1;
+	} else
+	if (rent->size != lent->size) {
+		sync_transfer(s, remote, local);
+		return;
+	} else
+	if (s->checksum || src->mtime == 0 || trg->mtime == 0) {
+		compare = 1;
+	} else
+	if (src->mtime > trg->mtime) {
+		// modified after the last sync
+		sync_transfer(s, remote, local);
+		return;
+	}
+
+	if (!compare) {
+		s->unchanged++;
+		return;
+	}
+
+	sync_cmp_t *cmp = mem_alloc_c(sizeof(sync_cmp_t), "sync_cmp");
+	cmp->tmp = tmpfile();
+	if (cmp->tmp == NULL) {
+		log_errno("Could not create temporary file!\n");
+		mem_free(cmp);
+		sync_transfer(s, remote, local);
+		return;
+	}
+	cmp->remote = mem_alloc_str2(remote, "sync_cmp_remote");
+	cmp->local = mem_alloc_str2(local, "sync_cmp_local");
+	cmp->next = s->cmps;
+	s->cmps = cmp;
+
+	xfer_add_fd(&s->cmpxf, remote, fileno(cmp->tmp), FS_OPEN_RD);
+}
+
+// read the server files to compare, and queue the ones that differ
+static int sync_compare(sync_t *s) {
+
+	int rv = xfer_run(&s->cmpxf);
+
+	while (s->cmps != NULL) {
+		sync_cmp_t *cmp = s->cmps;
+		s->cmps = cmp->next;
+
+		if (rv == CBM_ERROR_OK) {
+			uint64_t rhash = 0;
+			uint64_t lhash = 1;
+			int fd = open(cmp->local, O_RDONLY);
+
+			if (fd < 0) {
+				log_errno("Error opening file '%s'\n", cmp->local);
+			} else {
+				lseek(fileno(cmp->tmp), 0, SEEK_SET);
+				if (sync_hash(fileno(cmp->tmp), &rhash) == CBM_ERROR_OK) {
+					sync_hash(fd, &lhash);
+				}
+				close(fd);
+			}
+			s->compared++;
+			if (rhash == lhash) {
+				s->unchanged++;
+			} else {
+				sync_transfer(s, cmp->remote, cmp->local);
+			}
+		}
+		fclose(cmp->tmp);
+		mem_free(cmp->remote);
+		mem_free(cmp->local);
+		mem_free(cmp);
+	}
+	return rv;
+}
+
+// --------------------------------------------------------------------------
+// walking the trees
+
+// a directory that is only on the source side
+static int sync_newdir(sync_t *s, const char *remote, const char *local) {
+
+	int rv = CBM_ERROR_OK;
+
+	s->dirs++;
+	if (!s->dryrun) {
+		rv = s->isget ? xfer_mkdir_local(local) : xfer_mkdir_remote(&s->xf, remote);
+	}
+	if (rv == CBM_ERROR_OK) {
+		rv = sync_dir(s, remote, local, 1);
+	}
+	return rv;
+}
+
+// sync a directory; trgnew is set when the target directory was just
+// created, so it does not need to be listed
+static int sync_dir(sync_t *s, const char *remote, const char *local, int trgnew) {
+
+	xfer_dirent_t *rlist = NULL;
+	sync_entry_t *rents = NULL;
+	sync_entry_t *lents = NULL;
+	int rnum = 0;
+	int lnum = 0;
+	int rv = CBM_ERROR_OK;
+
+	if (s->isget) {
+		rv = sync_list_remote(s, remote, &rlist, &rents, &rnum);
+		if (rv == CBM_ERROR_OK && !trgnew) {
+			rv = sync_list_local(local, &lents, &lnum);
+		}
+	} else {
+		rv = sync_list_local(local, &lents, &lnum);
+		if (rv == CBM_ERROR_OK && !trgnew) {
+			rv = sync_list_remote(s, remote, &rlist, &rents, &rnum);
+		}
+	}
+
+	// merge the sorted lists
+	int r = 0;
+	int l = 0;
+	while (rv == CBM_ERROR_OK && (r < rnum || l < lnum)) {
+
+		int c = (r >= rnum) ? 1 : (l >= lnum) ? -1 : strcmp(rents[r].name, lents[l].name);
+		const sync_entry_t *rent = (c <= 0) ? &rents[r] : NULL;
+		const sync_entry_t *lent = (c >= 0) ? &lents[l] : NULL;
+		const sync_entry_t *src = s->isget ? rent : lent;
+		const sync_entry_t *trg = s->isget ? lent : rent;
+		const char *name = rent ? rent->name : lent->name;
+
+		char *rpath = xfer_remote_path(remote, name);
+		char *lpath = malloc_path(local, name);
+
+		if (trg != NULL && (src == NULL || src->isdir != trg->isdir)) {
+			if (s->delete) {
+				rv = s->isget ? sync_del_local(s, lpath, trg->isdir)
+						: sync_del_remote(s, rpath, trg->isdir);
+				if (rv == CBM_ERROR_OK && src != NULL) {
+					// make room for the new entry
+					rv = sync_flush_dels(s);
+				}
+				trg = NULL;
+			} else
+			if (src != NULL) {
+				log_warn("Not replacing '%s' with a %s\n", s->isget ? lpath : rpath,
+						src->isdir ? "directory" : "file");
+				src = NULL;
+			}
+		}
+
+		if (rv == CBM_ERROR_OK && src != NULL) {
+			if (src->isdir) {
+				rv = (trg == NULL) ? sync_newdir(s, rpath, lpath) : sync_dir(s, rpath, lpath, 0);
+			} else
+			if (trg == NULL) {
+				s->checked++;
+				sync_transfer(s, rpath, lpath);
+			} else {
+				sync_file(s, rpath, lpath, rent, lent);
+			}
+		}
+
+		mem_free(rpath);
+		mem_free(lpath);
+
+		if (c <= 0) {
+			r++;
+		}
+		if (c >= 0) {
+			l++;
+		}
+	}
+
+	xfer_free_dir(rlist);
+	if (rents != NULL) {
+		mem_free(rents);
+	}
+	if (lents != NULL) {
+		sync_free_local(lents, lnum);
+	}
+	return rv;
+}
+
+// --------------------------------------------------------------------------
+
+int cmd_sync(int sockfd, int argc, const char *argv[]) {
+
+	sync_t s;
+	int rv = CBM_ERROR_OK;
+
+	memset(&s, 0, sizeof(s));
+
+	int p = 0;
+	// parse options
+	while ((p < argc) && (argv[p][0] == '-')) {
+		switch(argv[p][1]) {
+		case 'g':
+			s.isget = 1;
+			break;
+		case 'd':
+			s.delete = 1;
+			break;
+		case 'c':
+			s.checksum = 1;
+			break;
+		case 'n':
+			s.dryrun = 1;
+			break;
+		case '-':
+			// break options
+			p++;
+			goto endopts;
+		default:
+			log_error("Unknown option '%c'\n", argv[p][1]);
+			return CBM_ERROR_SYNTAX_INVAL;
+		}
+		p++;
+	}
+endopts:
+
+	if ((argc - p) != 2) {
+		log_error("Need a local directory and a server directory!\n");
+		return CBM_ERROR_SYNTAX_NONAME;
+	}
+	const char *local = argv[p];
+	const char *remote = argv[p+1];
+
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// the target files are overwritten
+	xfer_init(&s.xf, sockfd, !s.isget, 1);
+	xfer_init(&s.cmpxf, sockfd, 0, 1);
+	s.xf.nowrap = 1;
+	s.cmpxf.nowrap = 1;
+
+	if (!s.dryrun) {
+		rv = s.isget ? xfer_mkdir_local(local) : xfer_mkdir_remote(&s.xf, remote);
+	}
+	if (rv == CBM_ERROR_OK) {
+		rv = sync_dir(&s, remote, local, 0);
+	}
+	if (rv == CBM_ERROR_OK) {
+		rv = sync_flush_dels(&s);
+	}
+	if (rv == CBM_ERROR_OK) {
+		rv = sync_compare(&s);
+	}
+	if (rv == CBM_ERROR_OK && !s.dryrun) {
+		rv = xfer_run(&s.xf);
+	}
+	// in case of errors
+	xfer_free(&s.xf);
+	xfer_free(&s.cmpxf);
+	while (s.cmps != NULL) {
+		sync_cmp_t *cmp = s.cmps;
+		s.cmps = cmp->next;
+		fclose(cmp->tmp);
+		mem_free(cmp->remote);
+		mem_free(cmp->local);
+		mem_free(cmp);
+	}
+	for (int i = 0; i < s.ndels; i++) {
+		mem_free(s.dels[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%d files checked, %d unchanged (%d compared by content)\n",
+		s.checked, s.unchanged, s.compared);
+	printf("%d files transferred (%ld bytes), %d deleted, %d directories created\n",
+		s.xf.files, s.xf.bytes, s.deleted, s.dirs);
+	printf("%ld bytes read to compare, %.2f seconds\n", s.cmpxf.bytes, secs);
+
+	return rv;
+}
+
@@ -92,7 +92,8 @@ int send_longcmd(int sockfd, uint8_t cmd, uint8_t fd, nameinfo_t *ninfo) {
 
 // TODO: copy from pcrunner.c, need to put in common code
 // Note: also similarly in the server (with async reads)
-// besides: I think this actually fails for partial reads as wrp=rdp=0 at the start
+// The buffer is kept between calls, as with pipelined requests a read
+// may return more than one packet
 
 char buf[8192];
 int wrp = 0;
@@ -105,9 +106,6 @@ int recv_packet(int fd, uint8_t *outbuf, int buflen) {
         int plen, cmd;
         int n;
 
-        wrp = 0;
-        rdp = 0;
-
         for(;;) {
 
               // as long as we have more than FSP_LEN bytes in the buffer
@@ -142,6 +140,15 @@ int recv_packet(int fd, uint8_t *outbuf, int buflen) {
                 }
               }
 
+              if (rdp) {
+                // make room for the rest of the packet
+                if(rdp!=wrp) {
+                  memmove(buf, buf+rdp, wrp-rdp);
+                }
+                wrp -= rdp;
+                rdp = 0;
+              }
+
               n = read(fd, buf+wrp, 8192-wrp);
               //log_debug("read->%d\n", n);
               if (n == 0) {
@@ -154,14 +161,6 @@ int recv_packet(int fd, uint8_t *outbuf, int buflen) {
                 return -1;
               }
               wrp+=n;
-              if(rdp && (wrp==8192 || rdp==wrp)) {
-                if(rdp!=wrp) {
-                  memmove(buf, buf+rdp, wrp-rdp);
-                }
-                wrp -= rdp;
-                rdp = 0;
-              }
-
             }
 }
 
@@ -205,6 +204,128 @@ static int cmd_info(int sockfd, int argc, const char *argv[]) {
 	return 0;
 }
 
+// receive a text sent in FS_DATA packets up to the FS_DATA_EOF, and write it to out
+static int recv_text(int sockfd, FILE *out) {
+
+	uint8_t *buf = mem_alloc_c(256, "text buffer");
+	int rv = CBM_ERROR_OK;
+
+	do {
+		if (recv_packet(sockfd, buf, 256) <= 0) {
+			log_errno("Could not receive packet!\n");
+			exit(1);
+		}
+		if (buf[FSP_CMD] != FS_DATA && buf[FSP_CMD] != FS_DATA_EOF) {
+			// e.g. an FS_REPLY error from a server that does not know the command
+			rv = (buf[FSP_CMD] == FS_REPLY) ? buf[FSP_DATA] : CBM_ERROR_FAULT;
+			break;
+		}
+		fwrite(buf + FSP_DATA, 1, buf[FSP_LEN] - FSP_DATA, out);
+	} while (buf[FSP_CMD] != FS_DATA_EOF);
+
+	mem_free(buf);
+	return rv;
+}
+
+static int cmd_metrics(int sockfd, int argc, const char *argv[]) {
+
+	log_debug("cmd_metrics(sockfd=%d, argc=%d, argv[]=%s\n",
+		sockfd, argc, argc>0 ? argv[0] : "-");
+
+	FILE *out = stdout;
+	int rv = CBM_ERROR_FAULT;
+
+	if (argc > 0) {
+		out = fopen(argv[0], "w");
+		if (out == NULL) {
+			log_errno("Could not open metrics file %s\n", argv[0]);
+			return CBM_ERROR_FAULT;
+		}
+	}
+
+	if (send_cmd(sockfd, FS_METRICS, FSFD_CMD) >= 0) {
+		rv = recv_text(sockfd, out);
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return rv;
+}
+
+static int cmd_flush(int sockfd, int argc, const char *argv[]) {
+
+	log_debug("cmd_flush(sockfd=%d, argc=%d, argv[]=%s\n",
+		sockfd, argc, argc>0 ? argv[0] : "-");
+
+	int rv = CBM_ERROR_FAULT;
+
+	if (send_cmd(sockfd, FS_FLUSH, FSFD_CMD) >= 0) {
+		uint8_t reply[256];
+		if (recv_packet(sockfd, reply, 256) > FSP_DATA) {
+			rv = reply[FSP_DATA];
+		}
+	}
+	if (rv != CBM_ERROR_OK) {
+		log_error("Flush failed with error %d\n", rv);
+	}
+	return rv;
+}
+
+static int cmd_trace(int sockfd, int argc, const char *argv[]) {
+
+	log_debug("cmd_trace(sockfd=%d, argc=%d, argv[]=%s\n",
+		sockfd, argc, argc>0 ? argv[0] : "-");
+
+	uint8_t buf[FSP_DATA + 1];
+	FILE *out = stdout;
+	int rv = CBM_ERROR_FAULT;
+
+	if (argc < 1) {
+		log_error("Missing 'on', 'off' or 'dump'\n");
+		return CBM_ERROR_SYNTAX_UNKNOWN;
+	}
+	if (!strcmp("on", argv[0])) {
+		buf[FSP_DATA] = FS_TRACE_ON;
+	} else
+	if (!strcmp("off", argv[0])) {
+		buf[FSP_DATA] = FS_TRACE_OFF;
+	} else
+	if (!strcmp("dump", argv[0])) {
+		buf[FSP_DATA] = FS_TRACE_DUMP;
+		if (argc > 1) {
+			out = fopen(argv[1], "w");
+			if (out == NULL) {
+				log_errno("Could not open trace file %s\n", argv[1]);
+				return CBM_ERROR_FAULT;
+			}
+		}
+	} else {
+		log_error("Unknown trace sub-command '%s'\n", argv[0]);
+		return CBM_ERROR_SYNTAX_UNKNOWN;
+	}
+
+	buf[FSP_CMD] = FS_TRACE;
+	buf[FSP_LEN] = FSP_DATA + 1;
+	buf[FSP_FD] = FSFD_CMD;
+
+	if (send_packet(sockfd, buf, FSP_DATA + 1) >= 0) {
+		if (buf[FSP_DATA] == FS_TRACE_DUMP) {
+			rv = recv_text(sockfd, out);
+		} else {
+			uint8_t reply[256];
+			if (recv_packet(sockfd, reply, 256) > FSP_DATA) {
+				rv = reply[FSP_DATA];
+			}
+		}
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return rv;
+}
+
 
 // --------------------------------------------------------------------------
 // command dispatch code
@@ -220,6 +341,20 @@ static const cmdtab_t cmdtab[] = {
 	{	"info",		cmd_info,
 			"Get info from the server",
 			{ NULL } },
+	{	"metrics",	cmd_metrics,
+			"Get the server metrics (request counters and latencies, I/O, memory, poll loop) in Prometheus text format:",
+			{	"[<file>]            write to the file instead of stdout (without log messages)",
+			NULL }},
+	{	"flush",	cmd_flush,
+			"Write back the file data buffered in the server, and sync written files to disk",
+			{ NULL } },
+	{	"trace",	cmd_trace,
+			"Control request tracing in the server:",
+			{	"on                  start recording trace spans (clears the old ones)",
+				"off                 stop recording",
+				"dump [<file>]       write the recorded spans as Chrome trace-event JSON,",
+				"                    to the file instead of stdout (without log messages)",
+			NULL }},
 	{	"assign",	cmd_assign,
 			"Assign a drive to a new drivespec with parameters:",
 			{ 	"<drivespec>    '<drive>:[<prov>]=<path>'", 
@@ -241,15 +376,19 @@ static const cmdtab_t cmdtab[] = {
 			{	"[options] <local_file> <drive:>[<target_file>]",
 				"[options] <local_file_1> [ <local_file_2> ... ] <drive:>[<target_file>]",
 				"[options] <local_and_target_file>",
+				"[options] -r <local_dir_1> [ <local_dir_2> ... ] <drive:><target_dir>",
 				"Options:",
 				"-f                  overwrite existing file (default is not to overwrite)",
+				"-r                  copy the directories' contents, with subdirectories",
 			NULL }},
 	{	"get",	cmd_get,
 			"Get file(s) from the CBM server filesystem. Multiple source files are concatenated.",
 			{	"[options] <drive:><src_file_1> [ <drive:><src_file_2> ... ] <local_target_file>",
 				"[options] <source_and_local_file>",
+				"[options] -r <drive:><src_dir_1> [ <drive:><src_dir_2> ... ] <local_target_dir>",
 				"Options:",
 				"-f                  overwrite existing files (default is not to overwrite)",
+				"-r                  copy the directories' contents, with subdirectories",
 			NULL }},
 	{	"rm",	cmd_rm,
 			"Delete file(s) from the CBM server filesystem. Multiple files or patterns can be specified.",
@@ -277,6 +416,15 @@ static const cmdtab_t cmdtab[] = {
 			"Change to a new directory.",
 			{	"<drive:><pattern>",
 			NULL }},
+	{	"sync", cmd_sync,
+			"Mirror a local directory to the server, only transferring changed files, and report statistics.",
+			{	"[options] <local_dir> <drive:><dir>",
+				"Options:",
+				"-g                  mirror the server directory into the local one instead",
+				"-d                  delete files and directories that are not in the source",
+				"-c                  compare the content of files with the same size, even if the dates tell",
+				"-n                  only show what would be transferred",
+			NULL }},
 };
 
 const int numcmds = sizeof(cmdtab) / sizeof(cmdtab_t);
@@ -326,6 +474,7 @@ void assert_single_char(const char *argv) {
 int main(int argc, const char *argv[]) {
 
 	const char *socket = NULL;
+	char *home_socket = NULL;
 
 	mem_init();
 	atexit(mem_exit);
@@ -380,16 +529,16 @@ endpars:
 
         if (socket == NULL) {
                 const char *home = os_get_home_dir();
-                socket = malloc_path(home, ".xdtools");
+                socket = home_socket = malloc_path(home, ".xdtools");
         }
 
 	int sockfd = socket_open(socket, 0);
 	if (sockfd < 0) {
 		log_errno("Could not open socket %s\n", socket);
-		mem_free(socket);
+		mem_free(home_socket);
 		exit(1);
 	}
-	mem_free(socket);
+	mem_free(home_socket);
 
 	// --------------------------------------------
 	// find our command either as ending part of the name of the binary ...
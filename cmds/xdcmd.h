@@ -31,12 +31,30 @@ extern int cmd_move(int sockfd, int argc, const char *argv[]);
 extern int cmd_copy(int sockfd, int argc, const char *argv[]);
 extern int cmd_assign(int sockfd, int argc, const char *argv[]);
 extern int cmd_cd(int sockfd, int argc, const char *argv[]);
+extern int cmd_sync(int sockfd, int argc, const char *argv[]);
 
 // --------------------------------------------------------------------------
 // helpers
 
 void log_cbmerr(uint8_t cerrno, uint8_t track, uint8_t sect);
 
+// a directory entry as received from the server
+typedef struct {
+	const char 	*name;
+	unsigned int	len;
+	int		attr;
+	int		estimate;
+	int		etype;		// FS_DIR_MOD_*
+	int		splat;
+	int		ftype;		// DIR/PRG/SEQ/...
+	time_t		mtime;		// last modification, 0 if not known
+} dirinfo_t;
+
+// parse a directory entry from the data of a directory packet; dir->name points into buf.
+// Returns the length of the entry, as a packet from FS_OPEN_DRP may hold several entries,
+// or -1 on error
+int parse_dir_packet(const uint8_t *buf, int len, dirinfo_t *dir);
+
 // --------------------------------------------------------------------------
 // send/receive packets
 
@@ -51,4 +69,67 @@ int send_longcmd(int sockfd, uint8_t cmd, uint8_t fd, nameinfo_t *ninfo);
 
 int recv_packet(int fd, uint8_t *outbuf, int buflen);
 
+// --------------------------------------------------------------------------
+// pipelined file transfers
+
+// number of files transferred in parallel, and requests in flight for each
+#define	XFER_CHANNELS	4
+#define	XFER_WINDOW	8
+
+// maximum packet length
+#define	XFER_BUFLEN	255
+
+typedef struct xfer_job_s xfer_job_t;
+
+typedef struct {
+	int		sockfd;
+	int		isput;		// local files to the server, or the other way
+	int		force;		// overwrite existing files
+	int		channels;	// files in parallel, 1 keeps the order
+	int		nowrap;		// host file names, e.g. "foo.d64" is a file, not a directory
+	xfer_job_t	*first;		// queue of files to transfer
+	xfer_job_t	*last;
+	int		files;		// statistics: files transferred
+	long		bytes;		// and data bytes in them
+} xfer_t;
+
+void xfer_init(xfer_t *xf, int sockfd, int isput, int force);
+
+// queue a transfer between a server file and a local file, where
+// opencmd is the FS_OPEN_* used for the server file
+void xfer_add(xfer_t *xf, const char *remote, const char *local, uint8_t opencmd);
+
+// same, but with an open local file that is not closed at the end
+void xfer_add_fd(xfer_t *xf, const char *remote, int localfd, uint8_t opencmd);
+
+// queue all files in a directory and its subdirectories; the target
+// directories are created
+int xfer_add_tree(xfer_t *xf, const char *remote, const char *local);
+
+// run (and remove) the queued transfers, returns the first error
+int xfer_run(xfer_t *xf);
+
+// remove the queued transfers without running them
+void xfer_free(xfer_t *xf);
+
+// open a local file for writing, with the checks for existing files
+int xfer_open_local(const char *name, int force, int *outfd);
+
+// append a name to a server path ("0:" or "0:foo" or "0:foo/")
+char *xfer_remote_path(const char *base, const char *name);
+
+// create a directory, if it does not exist yet
+int xfer_mkdir_local(const char *name);
+int xfer_mkdir_remote(xfer_t *xf, const char *remote);
+
+typedef struct xfer_dirent_s xfer_dirent_t;
+struct xfer_dirent_s {
+	xfer_dirent_t	*next;
+	dirinfo_t	info;		// info.name is owned by the entry
+};
+
+// read the files and subdirectories in a server directory; must not
+// be called while xfer_run() is running
+int xfer_read_dir(xfer_t *xf, const char *remote, xfer_dirent_t **outlist);
+void xfer_free_dir(xfer_dirent_t *list);
 
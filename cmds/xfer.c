@@ -0,0 +1,701 @@
+/****************************************************************************
+
+    xd2031 filesystem server - command frontend
+    Copyright (C) 2018 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "os.h"
+#include "mem.h"
+#include "terminal.h"
+#include "wireformat.h"
+#include "name.h"
+#include "xdcmd.h"
+#include "cerrno.h"
+
+
+// Pipelined file transfers for get and put.
+//
+// The server answers the requests on a connection in the order they are
+// sent, so instead of waiting for each reply, up to XFER_WINDOW requests
+// are sent per channel, for up to XFER_CHANNELS files at the same time.
+// A FIFO of the requests in flight tells which channel a reply is for.
+//
+// Reads are sent before the end of the file is known; the replies to
+// the reads behind the FS_DATA_EOF are ignored.
+
+// channel states
+#define	XFER_FREE	0
+#define	XFER_OPENING	1	// open sent
+#define	XFER_ACTIVE	2	// reading/writing data
+#define	XFER_CLOSING	3	// close sent
+
+struct xfer_job_s {
+	xfer_job_t	*next;
+	char		*remote;	// server file name, with drive
+	char		*local;		// local file name, or NULL if localfd is used
+	int		localfd;
+	uint8_t		opencmd;	// FS_OPEN_* for the server file
+};
+
+typedef struct {
+	xfer_job_t	*job;		// NULL if free
+	int		state;
+	int		fd;		// local file
+	int		inflight;	// requests sent but not answered yet
+	int		eof;		// end of file seen (get) or sent (put)
+	int		rv;		// first error
+} xfer_chan_t;
+
+// requests in flight, for each the channel it was sent on
+#define	XFER_MAXREQ	(XFER_CHANNELS * (XFER_WINDOW + 1))
+
+typedef struct {
+	uint8_t		chan[XFER_MAXREQ];
+	int		rp;
+	int		num;
+} xfer_queue_t;
+
+static type_t job_type = {
+	"xfer_job",
+	sizeof(xfer_job_t),
+	NULL
+};
+
+void xfer_init(xfer_t *xf, int sockfd, int isput, int force) {
+
+	xf->sockfd = sockfd;
+	xf->isput = isput;
+	xf->force = force;
+	xf->channels = XFER_CHANNELS;
+	xf->nowrap = 0;
+	xf->first = NULL;
+	xf->last = NULL;
+	xf->files = 0;
+	xf->bytes = 0;
+}
+
+static xfer_job_t *xfer_add_int(xfer_t *xf, const char *remote, uint8_t opencmd) {
+
+	xfer_job_t *job = mem_alloc(&job_type);
+
+	job->next = NULL;
+	job->remote = mem_alloc_str2(remote, "xfer_remote");
+	job->local = NULL;
+	job->localfd = -1;
+	job->opencmd = opencmd;
+
+	if (xf->last == NULL) {
+		xf->first = job;
+	} else {
+		xf->last->next = job;
+	}
+	xf->last = job;
+
+	return job;
+}
+
+void xfer_add(xfer_t *xf, const char *remote, const char *local, uint8_t opencmd) {
+
+	xfer_job_t *job = xfer_add_int(xf, remote, opencmd);
+	job->local = mem_alloc_str2(local, "xfer_local");
+}
+
+void xfer_add_fd(xfer_t *xf, const char *remote, int localfd, uint8_t opencmd) {
+
+	xfer_job_t *job = xfer_add_int(xf, remote, opencmd);
+	job->localfd = localfd;
+}
+
+static void xfer_job_free(xfer_job_t *job) {
+
+	mem_free(job->remote);
+	if (job->local != NULL) {
+		mem_free(job->local);
+	}
+	mem_free(job);
+}
+
+void xfer_free(xfer_t *xf) {
+
+	while (xf->first != NULL) {
+		xfer_job_t *job = xf->first;
+		xf->first = job->next;
+		xfer_job_free(job);
+	}
+	xf->last = NULL;
+}
+
+// --------------------------------------------------------------------------
+// local files
+
+int xfer_open_local(const char *name, int force, int *outfd) {
+
+	int rv = CBM_ERROR_OK;
+	struct stat statbuf;
+
+	// truncate the opened file?
+	int trunc = 0;
+
+	if (stat(name, &statbuf) < 0) {
+		if (errno != ENOENT) {
+			// we do not overwrite, so NOENT is totally acceptable, if not wanted
+			rv = errno_to_error(errno);
+			log_errno("Error accessing '%s'\n", name);
+			return rv;
+		}
+	} else {
+		// no error - so file exists
+		if (!force) {
+			log_error("Target file '%s' exists!\n", name);
+			return CBM_ERROR_FILE_EXISTS;
+		}
+		if (S_IFDIR == (statbuf.st_mode & S_IFMT)) {
+			log_error("Target path '%s' is a directory!\n", name);
+			return CBM_ERROR_FILE_TYPE_MISMATCH;
+		}
+		if (S_IFLNK == (statbuf.st_mode & S_IFMT)) {
+			log_error("Target path '%s' is a symlink!\n", name);
+			return CBM_ERROR_FILE_TYPE_MISMATCH;
+		}
+		if (S_IFREG == (statbuf.st_mode & S_IFMT)) {
+			// only regular files are truncated, sockets, devices, ... are not
+			trunc = 1;
+		}
+	}
+	int fd = open(name, O_CREAT | O_WRONLY | (trunc ? O_TRUNC : 0), S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd < 0) {
+		rv = errno_to_error(errno);
+		log_errno("Could not open target file '%s' for writing!\n", name);
+		return rv;
+	}
+	*outfd = fd;
+	return rv;
+}
+
+// --------------------------------------------------------------------------
+// sending requests
+
+static int xfer_send(xfer_t *xf, xfer_queue_t *q, int chan, const uint8_t *buf) {
+
+	if (send_packet(xf->sockfd, buf, buf[FSP_LEN]) < 0) {
+		log_errno("Unable to send request!\n");
+		return errno_to_error(errno);
+	}
+	q->chan[(q->rp + q->num) % XFER_MAXREQ] = chan;
+	q->num++;
+	return CBM_ERROR_OK;
+}
+
+static int xfer_send_cmd(xfer_t *xf, xfer_queue_t *q, int chan, uint8_t cmd) {
+
+	uint8_t buf[FSP_DATA];
+
+	buf[FSP_CMD] = cmd;
+	buf[FSP_FD] = chan;
+	buf[FSP_LEN] = FSP_DATA;
+
+	return xfer_send(xf, q, chan, buf);
+}
+
+static int xfer_send_open(xfer_t *xf, xfer_queue_t *q, int chan, xfer_job_t *job) {
+
+	uint8_t *name = mem_alloc_c(XFER_BUFLEN + 1, "parse buffer");
+	nameinfo_t ninfo;
+
+	// note that parse_filename parses in-place, nameinfo then points to name buffer
+	strncpy((char*)name, job->remote, XFER_BUFLEN);
+	name[XFER_BUFLEN] = 0;
+
+	nameinfo_init(&ninfo);
+	parse_filename(name, strlen((const char*)name), XFER_BUFLEN, &ninfo, PARSEHINT_LOAD);
+	ninfo.pars.nowrap = xf->nowrap;
+
+	int rv = CBM_ERROR_OK;
+	if (send_longcmd(xf->sockfd, job->opencmd, chan, &ninfo) < 0) {
+		log_errno("Unable to send open request!\n");
+		rv = errno_to_error(errno);
+	} else {
+		q->chan[(q->rp + q->num) % XFER_MAXREQ] = chan;
+		q->num++;
+	}
+	mem_free(name);
+	return rv;
+}
+
+static int xfer_send_write(xfer_t *xf, xfer_queue_t *q, int chan, xfer_chan_t *c) {
+
+	uint8_t buf[XFER_BUFLEN];
+
+	ssize_t n = read(c->fd, buf + FSP_DATA, XFER_BUFLEN - FSP_DATA);
+	if (n < 0) {
+		log_errno("Error reading from file!\n");
+		return errno_to_error(errno);
+	}
+
+	buf[FSP_LEN] = FSP_DATA + n;
+	buf[FSP_CMD] = (n == 0) ? FS_WRITE_EOF : FS_WRITE;
+	buf[FSP_FD] = chan;
+
+	if (n == 0) {
+		c->eof = 1;
+	}
+	xf->bytes += n;
+	return xfer_send(xf, q, chan, buf);
+}
+
+// start the next job on a free channel
+static int xfer_start(xfer_t *xf, xfer_queue_t *q, int chan, xfer_chan_t *c) {
+
+	xfer_job_t *job = xf->first;
+	int rv = CBM_ERROR_OK;
+
+	xf->first = job->next;
+	if (xf->first == NULL) {
+		xf->last = NULL;
+	}
+
+	c->job = job;
+	c->inflight = 0;
+	c->eof = 0;
+	c->rv = CBM_ERROR_OK;
+	c->fd = job->localfd;
+
+	if (c->fd < 0) {
+		if (xf->isput) {
+			c->fd = open(job->local, O_RDONLY);
+			if (c->fd < 0) {
+				rv = errno_to_error(errno);
+				log_errno("Error opening file '%s'\n", job->local);
+			}
+		} else {
+			rv = xfer_open_local(job->local, xf->force, &c->fd);
+		}
+	}
+
+	if (rv == CBM_ERROR_OK) {
+		log_debug("%s %s\n", job->remote, job->local ? job->local : "");
+		rv = xfer_send_open(xf, q, chan, job);
+	}
+	if (rv == CBM_ERROR_OK) {
+		c->state = XFER_OPENING;
+	}
+	return rv;
+}
+
+// done with the job on the channel
+static void xfer_finish(xfer_chan_t *c) {
+
+	if (c->job->localfd < 0 && c->fd >= 0) {
+		if (close(c->fd) < 0) {
+			log_errno("Could not close file '%s'!", c->job->local);
+		}
+	}
+	xfer_job_free(c->job);
+	c->job = NULL;
+	c->fd = -1;
+	c->state = XFER_FREE;
+}
+
+// send what can be sent on a channel
+static int xfer_fill(xfer_t *xf, xfer_queue_t *q, int chan, xfer_chan_t *c) {
+
+	int rv = CBM_ERROR_OK;
+
+	if (c->state != XFER_ACTIVE) {
+		return rv;
+	}
+
+	while (rv == CBM_ERROR_OK && c->rv == CBM_ERROR_OK
+			&& !c->eof && c->inflight < XFER_WINDOW) {
+		if (xf->isput) {
+			rv = xfer_send_write(xf, q, chan, c);
+		} else {
+			rv = xfer_send_cmd(xf, q, chan, FS_READ);
+		}
+		if (rv == CBM_ERROR_OK) {
+			c->inflight++;
+		} else {
+			c->rv = rv;
+		}
+	}
+
+	if (rv == CBM_ERROR_OK && c->inflight == 0
+			&& (c->eof || c->rv != CBM_ERROR_OK)) {
+		rv = xfer_send_cmd(xf, q, chan, FS_CLOSE);
+		c->state = XFER_CLOSING;
+	}
+	return rv;
+}
+
+// handle the reply for a channel
+static void xfer_reply(xfer_t *xf, xfer_chan_t *c, const uint8_t *buf) {
+
+	int len = buf[FSP_LEN] - FSP_DATA;
+
+	switch (c->state) {
+	case XFER_OPENING:
+		if (buf[FSP_CMD] == FS_REPLY && buf[FSP_DATA] == CBM_ERROR_OK) {
+			c->state = XFER_ACTIVE;
+		} else {
+			log_error("Error opening file '%s': %d\n", c->job->remote, buf[FSP_DATA]);
+			c->rv = (buf[FSP_CMD] == FS_REPLY) ? buf[FSP_DATA] : CBM_ERROR_FAULT;
+			xfer_finish(c);
+		}
+		return;
+	case XFER_CLOSING:
+		if (c->rv == CBM_ERROR_OK) {
+			xf->files++;
+		}
+		xfer_finish(c);
+		return;
+	default:
+		break;
+	}
+
+	c->inflight--;
+
+	if (c->rv != CBM_ERROR_OK) {
+		// only wait for the requests in flight
+		return;
+	}
+
+	if (xf->isput) {
+		if (buf[FSP_CMD] != FS_REPLY || buf[FSP_DATA] != CBM_ERROR_OK) {
+			log_error("Error writing file '%s': %d\n", c->job->remote, buf[FSP_DATA]);
+			c->rv = (buf[FSP_CMD] == FS_REPLY) ? buf[FSP_DATA] : CBM_ERROR_FAULT;
+		}
+		return;
+	}
+
+	if (c->eof) {
+		// reads sent behind the end of file
+		return;
+	}
+	if (buf[FSP_CMD] != FS_DATA && buf[FSP_CMD] != FS_DATA_EOF) {
+		log_error("Received unexpected packet of type %d!\n", buf[FSP_CMD]);
+		c->rv = CBM_ERROR_FAULT;
+		return;
+	}
+	if (write(c->fd, buf + FSP_DATA, len) < 0) {
+		log_errno("Error writing to file!\n");
+		c->rv = errno_to_error(errno);
+		return;
+	}
+	xf->bytes += len;
+	if (buf[FSP_CMD] == FS_DATA_EOF) {
+		c->eof = 1;
+	}
+}
+
+int xfer_run(xfer_t *xf) {
+
+	xfer_chan_t chans[XFER_CHANNELS];
+	xfer_queue_t q;
+	uint8_t buf[XFER_BUFLEN + 1];
+	int rv = CBM_ERROR_OK;
+
+	int nchans = xf->channels;
+	if (nchans < 1 || nchans > XFER_CHANNELS) {
+		nchans = XFER_CHANNELS;
+	}
+
+	q.rp = 0;
+	q.num = 0;
+
+	for (int i = 0; i < nchans; i++) {
+		chans[i].job = NULL;
+		chans[i].state = XFER_FREE;
+		chans[i].fd = -1;
+	}
+
+	for (;;) {
+
+		for (int i = 0; i < nchans; i++) {
+			xfer_chan_t *c = &chans[i];
+			int crv = CBM_ERROR_OK;
+
+			if (c->state == XFER_FREE) {
+				// after an error, only finish what is running
+				if (rv == CBM_ERROR_OK && xf->first != NULL) {
+					crv = xfer_start(xf, &q, i, c);
+					if (crv != CBM_ERROR_OK) {
+						xfer_finish(c);
+					}
+				}
+			} else {
+				crv = xfer_fill(xf, &q, i, c);
+			}
+			if (rv == CBM_ERROR_OK) {
+				rv = crv;
+			}
+		}
+
+		if (q.num == 0) {
+			// all done (or no way to continue)
+			break;
+		}
+
+		if (recv_packet(xf->sockfd, buf, XFER_BUFLEN + 1) <= 0) {
+			log_errno("Could not receive packet!\n");
+			rv = CBM_ERROR_FAULT;
+			break;
+		}
+
+		int chan = q.chan[q.rp];
+		q.rp = (q.rp + 1) % XFER_MAXREQ;
+		q.num--;
+
+		if (buf[FSP_FD] != chan) {
+			log_warn("Reply for channel %d, expected %d\n", buf[FSP_FD], chan);
+		}
+
+		xfer_chan_t *c = &chans[chan];
+		xfer_reply(xf, c, buf);
+		if (rv == CBM_ERROR_OK) {
+			// the first error ends the transfer, after closing what is open
+			rv = c->rv;
+		}
+	}
+
+	for (int i = 0; i < nchans; i++) {
+		if (chans[i].job != NULL) {
+			xfer_finish(&chans[i]);
+		}
+	}
+	// jobs not started because of an error
+	xfer_free(xf);
+
+	return rv;
+}
+
+// --------------------------------------------------------------------------
+// recursive transfers
+
+char *xfer_remote_path(const char *base, const char *name) {
+
+	size_t l = strlen(base);
+	char *path = mem_alloc_c(l + strlen(name) + 2, "xfer_remote_path");
+
+	strcpy(path, base);
+	if (l > 0 && base[l-1] != ':' && base[l-1] != '/') {
+		strcat(path, "/");
+	}
+	strcat(path, name);
+	return path;
+}
+
+int xfer_mkdir_local(const char *name) {
+
+	struct stat statbuf;
+
+	if (stat(name, &statbuf) == 0 && S_IFDIR == (statbuf.st_mode & S_IFMT)) {
+		return CBM_ERROR_OK;
+	}
+	if (mkdir(name, S_IRWXU | S_IRGRP | S_IXGRP) < 0) {
+		log_errno("Could not create directory '%s'\n", name);
+		return errno_to_error(errno);
+	}
+	return CBM_ERROR_OK;
+}
+
+int xfer_mkdir_remote(xfer_t *xf, const char *remote) {
+
+	uint8_t *name = mem_alloc_c(XFER_BUFLEN + 1, "parse buffer");
+	uint8_t buf[XFER_BUFLEN + 1];
+	nameinfo_t ninfo;
+	int rv = CBM_ERROR_FAULT;
+
+	strncpy((char*)name, remote, XFER_BUFLEN);
+	name[XFER_BUFLEN] = 0;
+
+	nameinfo_init(&ninfo);
+	parse_cmd_pars(name, strlen((const char*)name), FS_MKDIR, &ninfo);
+
+	if (send_longcmd(xf->sockfd, FS_MKDIR, FSFD_CMD, &ninfo) >= 0
+		&& recv_packet(xf->sockfd, buf, XFER_BUFLEN + 1) > 0
+		&& buf[FSP_CMD] == FS_REPLY) {
+		rv = buf[FSP_DATA];
+		if (rv == CBM_ERROR_FILE_EXISTS) {
+			// directory exists already
+			rv = CBM_ERROR_OK;
+		}
+	}
+	if (rv != CBM_ERROR_OK) {
+		log_error("Could not create directory '%s': %d\n", remote, rv);
+	}
+	mem_free(name);
+	return rv;
+}
+
+int xfer_read_dir(xfer_t *xf, const char *remote, xfer_dirent_t **outlist) {
+
+	uint8_t *name = mem_alloc_c(XFER_BUFLEN + 1, "parse buffer");
+	uint8_t buf[XFER_BUFLEN + 1];
+	uint8_t chan = XFER_CHANNELS;
+	xfer_dirent_t **lastp = outlist;
+	nameinfo_t ninfo;
+	int rv = CBM_ERROR_FAULT;
+
+	// read all entries in the directory; disk images only list their
+	// files with an explicit pattern
+	char *path = xfer_remote_path(remote, "*");
+	name[0] = '$';
+	strncpy((char*)name+1, path, XFER_BUFLEN - 1);
+	name[XFER_BUFLEN] = 0;
+	mem_free(path);
+
+	nameinfo_init(&ninfo);
+	parse_filename(name, strlen((char*)name), XFER_BUFLEN, &ninfo, PARSEHINT_LOAD);
+	ninfo.pars.nowrap = xf->nowrap;
+
+	if (send_longcmd(xf->sockfd, FS_OPEN_DRP, chan, &ninfo) >= 0
+		&& recv_packet(xf->sockfd, buf, XFER_BUFLEN + 1) > 0) {
+
+		rv = (buf[FSP_CMD] == FS_REPLY) ? buf[FSP_DATA] : CBM_ERROR_FAULT;
+
+		while (rv == CBM_ERROR_OK) {
+			if (send_cmd(xf->sockfd, FS_READ, chan) < 0
+				|| recv_packet(xf->sockfd, buf, XFER_BUFLEN + 1) <= 0) {
+				rv = CBM_ERROR_FAULT;
+				break;
+			}
+			if (buf[FSP_CMD] != FS_DATA && buf[FSP_CMD] != FS_DATA_EOF) {
+				rv = (buf[FSP_CMD] == FS_REPLY) ? buf[FSP_DATA] : CBM_ERROR_FAULT;
+				break;
+			}
+
+			// the packet contains one or more entries
+			for (int p = FSP_DATA; rv == CBM_ERROR_OK && p < buf[FSP_LEN]; ) {
+				dirinfo_t info;
+				int n = parse_dir_packet(buf + p, buf[FSP_LEN] - p, &info);
+				if (n < 0) {
+					rv = CBM_ERROR_FAULT;
+					break;
+				}
+				p += n;
+
+				// files in disk images are listed with the image path
+				const char *sep = strrchr(info.name, '/');
+				if (sep != NULL && sep[1] != 0) {
+					info.name = sep + 1;
+				}
+
+				if ((info.etype == FS_DIR_MOD_FIL || info.etype == FS_DIR_MOD_DIR)
+					&& strcmp(info.name, ".") && strcmp(info.name, "..")) {
+					xfer_dirent_t *e = mem_alloc_c(sizeof(xfer_dirent_t), "xfer_dirent");
+					e->next = NULL;
+					e->info = info;
+					e->info.name = mem_alloc_str2(info.name, "xfer_dirent_name");
+					*lastp = e;
+					lastp = &e->next;
+				}
+			}
+			if (rv != CBM_ERROR_OK || buf[FSP_CMD] == FS_DATA_EOF) {
+				break;
+			}
+		}
+
+		send_cmd(xf->sockfd, FS_CLOSE, chan);
+		recv_packet(xf->sockfd, buf, XFER_BUFLEN + 1);
+	}
+	if (rv != CBM_ERROR_OK) {
+		log_error("Could not read directory '%s': %d\n", remote, rv);
+	}
+	mem_free(name);
+	return rv;
+}
+
+void xfer_free_dir(xfer_dirent_t *list) {
+
+	while (list != NULL) {
+		xfer_dirent_t *e = list;
+		list = e->next;
+		mem_free((char*)e->info.name);
+		mem_free(e);
+	}
+}
+
+int xfer_add_tree(xfer_t *xf, const char *remote, const char *local) {
+
+	int rv = CBM_ERROR_OK;
+
+	if (xf->isput) {
+		// local to server
+		rv = xfer_mkdir_remote(xf, remote);
+
+		DIR *dir = NULL;
+		if (rv == CBM_ERROR_OK) {
+			dir = opendir(local);
+			if (dir == NULL) {
+				log_errno("Could not open directory '%s'\n", local);
+				rv = errno_to_error(errno);
+			}
+		}
+		struct dirent *de;
+		while (rv == CBM_ERROR_OK && (de = readdir(dir)) != NULL) {
+			if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+				continue;
+			}
+			char *lpath = malloc_path(local, de->d_name);
+			char *rpath = xfer_remote_path(remote, de->d_name);
+			struct stat statbuf;
+
+			if (stat(lpath, &statbuf) < 0) {
+				log_errno("Error accessing '%s'\n", lpath);
+			} else
+			if (S_IFDIR == (statbuf.st_mode & S_IFMT)) {
+				rv = xfer_add_tree(xf, rpath, lpath);
+			} else
+			if (S_IFREG == (statbuf.st_mode & S_IFMT)) {
+				xfer_add(xf, rpath, lpath, xf->force ? FS_OPEN_OW : FS_OPEN_WR);
+			}
+			mem_free(lpath);
+			mem_free(rpath);
+		}
+		if (dir != NULL) {
+			closedir(dir);
+		}
+	} else {
+		// server to local
+		xfer_dirent_t *list = NULL;
+
+		rv = xfer_mkdir_local(local);
+		if (rv == CBM_ERROR_OK) {
+			rv = xfer_read_dir(xf, remote, &list);
+		}
+		for (xfer_dirent_t *e = list; rv == CBM_ERROR_OK && e != NULL; e = e->next) {
+			char *lpath = malloc_path(local, e->info.name);
+			char *rpath = xfer_remote_path(remote, e->info.name);
+			if (e->info.etype == FS_DIR_MOD_DIR) {
+				rv = xfer_add_tree(xf, rpath, lpath);
+			} else {
+				xfer_add(xf, rpath, lpath, FS_OPEN_RD);
+			}
+			mem_free(lpath);
+			mem_free(rpath);
+		}
+		xfer_free_dir(list);
+	}
+	return rv;
+}
@@ -47,11 +47,74 @@ static char const* const IN_ROM charsets[] = {
 	CSET_PETSCII_NAME_P
 };
 
-static unic_t (IN_ROM *to_unic_funcs[])(const char **ptr) = {
-	isolatin1_to_unic,
-	petscii_to_unic
+// ------------------------------------------------------------------------------
+// translation tables, so a name is converted with one lookup per character
+// instead of the range checks in petscii.h
+
+// PETSCII to ASCII, see petscii_to_ascii()
+static const uint8_t IN_ROM petscii_to_ascii_tab[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,  // 00
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,  // 10
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,  // 20
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,  // 30
+	0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,  // 40
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,  // 50
+	0x60, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,  // 60
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,  // 70
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,  // 80
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,  // 90
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,  // a0
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,  // b0
+	0xc0, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,  // c0
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,  // d0
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,  // e0
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff   // f0
+};
+
+// ASCII to PETSCII, see ascii_to_petscii()
+static const uint8_t IN_ROM ascii_to_petscii_tab[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,  // 00
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,  // 10
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,  // 20
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,  // 30
+	0x40, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,  // 40
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,  // 50
+	0x60, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,  // 60
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,  // 70
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,  // 80
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,  // 90
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,  // a0
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,  // b0
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,  // c0
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,  // d0
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,  // e0
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff   // f0
+};
+
+// table to convert each charset to ASCII, NULL for ASCII itself
+static const uint8_t * const IN_ROM to_ascii_tabs[] = {
+	NULL,
+	petscii_to_ascii_tab
 };
 
+/** 
+ * to unicode
+ */
+static unic_t petscii_to_unic(const char **ptr) {
+        unic_t c = rom_read_byte(&petscii_to_ascii_tab[(uint8_t) **ptr]);
+        (*ptr)++;       // petscii is single char
+        return c;
+}
+
+/** 
+ * to unicode
+ */
+static unic_t isolatin1_to_unic(const char **ptr) {
+        unic_t c = (uint8_t) **ptr;
+        (*ptr)++;       // iso-8859-1 is single char
+        return c;
+}
+
 // ------------------------------------------------------------------------------
 
 // scan the given pattern until a delimiter character is reached
@@ -61,10 +124,14 @@ static unic_t (IN_ROM *to_unic_funcs[])(const char **ptr) = {
 const char *cconv_scan(const char *pattern, charset_t cset, char delim, const char *match, bool *matched) {
 
 	*matched = false;
-	unic_t (*to_unic)(const char **ptr) = to_unic_funcs[cset];
+	const uint8_t *tab = (const uint8_t *) rom_read_pointer(&to_ascii_tabs[cset]);
 	unic_t c;
 
-	while ( (c = to_unic(&pattern)) != 0) {
+	while ( (c = (uint8_t) *pattern) != 0) {
+		pattern++;
+		if (tab) {
+			c = rom_read_byte(&tab[c]);
+		}
 		if (c == delim) {
 			return pattern;
 		}
@@ -108,24 +175,24 @@ int cconv_identity(const char *in, const uint8_t inlen, char *out, const uint8_t
 	return 0;
 }
 
+// convert a whole name through a translation table
+static inline int cconv_table(const uint8_t *tab, const char *in, const uint8_t inlen, 
+		char *out, const uint8_t outlen) {
+	uint8_t n = min(inlen, outlen);
+	for (uint8_t i = 0; i < n; i++) {
+		out[i] = rom_read_byte(&tab[(uint8_t) in[i]]);
+	}
+	return n;
+}
+
 static int cconv_ascii2petscii(const char *in, const uint8_t inlen, char *out, const uint8_t outlen) {
 	//printf("cconv_ascii2petscii(%s)\n", in);
-	uint8_t i = 0;
-	while (i < inlen && i < outlen) {
-		*(out++) = ascii_to_petscii(*(in++));
-		i++;
-	}
-	return i;
+	return cconv_table(ascii_to_petscii_tab, in, inlen, out, outlen);
 }
 
 static int cconv_petscii2ascii(const char *in, const uint8_t inlen, char *out, const uint8_t outlen) {
 	//printf("cconv_petscii2ascii(%s)\n", in);
-	uint8_t i = 0;
-	while (i < inlen && i < outlen) {
-		*(out++) = petscii_to_ascii(*(in++));
-		i++;
-	}
-	return i;
+	return cconv_table(petscii_to_ascii_tab, in, inlen, out, outlen);
 }
 
 // ------------------------------------------------------------------------------
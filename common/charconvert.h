@@ -34,25 +34,6 @@
 
 typedef uint16_t unic_t;
 
-/** 
- * to unicode
- */
-static inline unic_t petscii_to_unic(const char **ptr) {
-        unic_t c = petscii_to_ascii(**ptr);
-        (*ptr)++;       // petscii is single char
-        return c;
-}
-
-/** 
- * to unicode
- */
-static inline unic_t isolatin1_to_unic(const char **ptr) {
-        unic_t c = **ptr;
-        (*ptr)++;       // iso-8859-1 is single char
-        return c;
-}
-
-
 // charset number is defined by supported charset table, -1 is unsupported
 typedef signed char charset_t;
 
@@ -116,3 +116,26 @@ const char *command_to_name(command_t cmd) {
 	}
 	return cmd_string;
 }
+
+#if defined(SERVER) || defined(PCTEST)
+
+// names of the FS_* wire commands, by command number
+
+static const char *fs_cmd_tab[] = {
+	"TERM", "OPEN_RD", "OPEN_WR", "OPEN_RW", "OPEN_OW", "OPEN_AP", "OPEN_DR",
+	"READ", "WRITE", "WRITE_EOF", "REPLY", "DATA", "DATA_EOF", "SEEK", "CLOSE",
+	"MOVE", "DELETE", "FORMAT", "CHKDSK", "RMDIR", "MKDIR", "CHDIR", "ASSIGN",
+	"SETOPT", "RESET", "BLOCK", "GETDATIM", "POSITION", "OPEN_DIRECT", "CHARSET",
+	"COPY", "DUPLICATE", "INITIALIZE", "INFO", "METRICS", "TRACE", "OPEN_DRP",
+	"FLUSH"
+};
+
+const char *fs_command_to_name(uint8_t cmd) {
+
+	if (cmd < sizeof(fs_cmd_tab) / sizeof(fs_cmd_tab[0])) {
+		return fs_cmd_tab[cmd];
+	}
+	return NULL;
+}
+
+#endif
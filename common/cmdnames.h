@@ -28,4 +28,9 @@
 command_t command_find(uint8_t * input, uint8_t * len);
 const char *command_to_name(command_t cmd);
 
+#if defined(SERVER) || defined(PCTEST)
+// name of an FS_* wire command, NULL if unknown
+const char *fs_command_to_name(uint8_t cmd);
+#endif
+
 #endif
@@ -20,17 +20,16 @@
 ****************************************************************************/
 
 /*
- * This file is a disk image provider implementation
+ * This file provides the disk image geometry
  *
- * In this file the actual command work is done for
- * Commodore disk images of type d64, d71, d80, d81, d82
+ * It is shared by the server's disk image provider and the firmware's
+ * FAT provider, for Commodore disk images of type d64, d71, d80, d81, d82
  */
 
 #include <inttypes.h>
+#include <stdbool.h>
 
-#include "log.h"
 #include "diskimgs.h"
-#include "stdbool.h"
 
 
 /* functions for computing last sector number in track */
@@ -139,51 +138,50 @@ static int LBA81(int t, int s)
            read it.  We will therefore use 4090 as our limit. */
 
 //                          ID DOSVer Tr  Se  S  B  Of  TB  D  I  SS  Blck   Rel  sec/tr   map  Dir_T/S Hdr_S/P  BAM blocks                   ErrTbl
-static Disk_Image_t d64 = { 64, "2A", 35, 21, 1, 1,  4, 35, 3, 10, 0,  683,  706, LSEC64, LBA64, 18, 1, 0, 144, { 18, 0,  0, 0,  0, 0,  0, 0 }, 0};
-static Disk_Image_t d71 = { 71, "2A", 35, 21, 2, 2,  4, 35, 3, 6,  0, 1366,  706, LSEC71, LBA71, 18, 1, 0, 144, { 18, 0, 53, 0,  0, 0,  0, 0 }, 0};
-static Disk_Image_t d81 = { 81, "3D", 80, 40, 1, 2, 16, 40, 1, 1,  1, 3200, 3026, LSEC81, LBA81, 40, 3, 0,   4, { 40, 1, 40, 2,  0, 0,  0, 0 }, 0};
-static Disk_Image_t d80 = { 80, "2C", 77, 29, 1, 2,  6, 50, 3, 5,  0, 2083,  726, LSEC80, LBA80, 39, 1, 0,   6, { 38, 0, 38, 3,  0, 0,  0, 0 }, 0};
-static Disk_Image_t d82 = { 82, "2C", 77, 29, 2, 4,  6, 50, 3, 5,  1, 4166, 4126, LSEC82, LBA82, 39, 1, 0,   6, { 38, 0, 38, 3, 38, 6, 38, 9 }, 0};
+static const Disk_Image_t d64 = { 64, "2A", 35, 21, 1, 1,  4, 35, 3, 10, 0,  683,  706, LSEC64, LBA64, 18, 1, 0, 144, { 18, 0,  0, 0,  0, 0,  0, 0 }, 0};
+static const Disk_Image_t d71 = { 71, "2A", 35, 21, 2, 2,  4, 35, 3, 6,  0, 1366,  706, LSEC71, LBA71, 18, 1, 0, 144, { 18, 0, 53, 0,  0, 0,  0, 0 }, 0};
+static const Disk_Image_t d81 = { 81, "3D", 80, 40, 1, 2, 16, 40, 1, 1,  1, 3200, 3026, LSEC81, LBA81, 40, 3, 0,   4, { 40, 1, 40, 2,  0, 0,  0, 0 }, 0};
+static const Disk_Image_t d80 = { 80, "2C", 77, 29, 1, 2,  6, 50, 3, 5,  0, 2083,  726, LSEC80, LBA80, 39, 1, 0,   6, { 38, 0, 38, 3,  0, 0,  0, 0 }, 0};
+static const Disk_Image_t d82 = { 82, "2C", 77, 29, 2, 4,  6, 50, 3, 5,  1, 4166, 4126, LSEC82, LBA82, 39, 1, 0,   6, { 38, 0, 38, 3, 38, 6, 38, 9 }, 0};
 
 
-int diskimg_identify(Disk_Image_t *di, unsigned int filesize) {
+int diskimg_identify(Disk_Image_t *di, uint32_t filesize) {
 
-   	if (filesize == d64.Blocks * 256) {
+   	if (filesize == (uint32_t) d64.Blocks * 256) {
 		*di = d64;
 	} else
-	if (filesize == d64.Blocks * 256 + d64.Blocks) {
+	if (filesize == (uint32_t) d64.Blocks * 256 + d64.Blocks) {
 		*di = d64;
 		di->HasErrorTable = true;
 	} else
-	if (filesize == d71.Blocks * 256) {
+	if (filesize == (uint32_t) d71.Blocks * 256) {
 		*di = d71;
 	} else
-	if (filesize == d71.Blocks * 256 + d71.Blocks) {
+	if (filesize == (uint32_t) d71.Blocks * 256 + d71.Blocks) {
 		*di = d71;
 		di->HasErrorTable = true;
 	} else
-	if (filesize == d80.Blocks * 256) {
+	if (filesize == (uint32_t) d80.Blocks * 256) {
 		*di = d80;
 	} else
-	if (filesize == d80.Blocks * 256 + d80.Blocks) {
+	if (filesize == (uint32_t) d80.Blocks * 256 + d80.Blocks) {
 		*di = d80;
 		di->HasErrorTable = true;
 	} else
-	if (filesize == d82.Blocks * 256) {
+	if (filesize == (uint32_t) d82.Blocks * 256) {
 		*di = d82;
 	} else
-	if (filesize == d82.Blocks * 256 + d82.Blocks) {
+	if (filesize == (uint32_t) d82.Blocks * 256 + d82.Blocks) {
 		*di = d82;
 		di->HasErrorTable = true;
 	} else
-	if (filesize == d81.Blocks * 256) {
+	if (filesize == (uint32_t) d81.Blocks * 256) {
 		*di = d81;
 	} else
-	if (filesize == d81.Blocks * 256 + d81.Blocks) {
+	if (filesize == (uint32_t) d81.Blocks * 256 + d81.Blocks) {
 		*di = d81;
 		di->HasErrorTable = true;
 	} else {
-		log_error("Invalid/unsupported disk image\n");
 		return 0; // not an image file
 	}
 
@@ -29,6 +29,8 @@
 #ifndef DISKIMG_H
 #define DISKIMG_H
 
+#include <inttypes.h>
+
 #define  MAX_BUFFER_SIZE  64
 
 #define	BLK_OFFSET_NEXT_TRACK	0
@@ -70,7 +72,11 @@ typedef struct Disk_Image {
 	uint8_t HasErrorTable;	// Error table appended
 } Disk_Image_t;
 
-int diskimg_identify(Disk_Image_t * di, unsigned int filesize);
+/**
+ * set up the geometry from the size of the image file (with or without
+ * error table); returns 0 if the size does not match a supported image
+ */
+int diskimg_identify(Disk_Image_t * di, uint32_t filesize);
 
 /* Commodore Floppy Formats
 
@@ -447,6 +447,16 @@ uint8_t assemble_filename_packet(uint8_t *trg, nameinfo_t *nameinfo) {
 			p += strlen((char*)p);
 		}
 	}
+#ifdef SERVER
+	if (nameinfo->pars.nowrap) {
+		if (p > trg) {
+			*p++ = ',';
+		}
+		*p++ = 'W';
+		*p++ = '=';
+		*p++ = '0';
+	}
+#endif
 	// terminate string even if no options
 	*p++ = 0;
 
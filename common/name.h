@@ -60,6 +60,10 @@ typedef struct {
 typedef struct {
         uint8_t filetype;
         uint16_t recordlen;
+#ifdef SERVER
+	uint8_t inram;		// keep a disk image in memory (",ram" assign option)
+	uint8_t nowrap;		// host file names, without wrapping ("W=0" open option)
+#endif
 } openpars_t;
 
 typedef struct {
@@ -184,8 +188,9 @@ static inline void drive_and_name_free(drive_and_name_t *dnt, int num_dnt) {
 		return;
 	}
 	for (int i = 0; i < num_dnt; i++) {
-		mem_free(dnt[i].drivename);
-		mem_free(dnt[i].name);
+		// drivename and name may have been moved on while parsing
+		mem_free(dnt[i].drivename_m);
+		mem_free(dnt[i].name_m);
 	}
 }
 
@@ -104,6 +104,18 @@
 #define   FS_INITIALIZE  32     /* initialize (e.g. free buffers and remove file locks) */
 
 #define   FS_INFO  	 33     /* server sends info about the server to drive (or command) */
+#define   FS_METRICS 	 34     /* server sends its metrics as text, in FS_DATA packets up to FS_DATA_EOF */
+#define   FS_TRACE 	 35     /* control request tracing in the server, with an FS_TRACE_* payload byte */
+#define   FS_OPEN_DRP    36     /* open a directory for reading, with several entries packed into each FS_DATA packet */
+#define   FS_FLUSH       37     /* write back buffered file data on the server, and sync written files to disk */
+
+/*
+ * FS_TRACE sub-commands. ON and OFF are answered with FS_REPLY, DUMP with the
+ * recorded spans as Chrome trace-event JSON in FS_DATA packets up to FS_DATA_EOF
+ */
+#define   FS_TRACE_OFF	 0
+#define   FS_TRACE_ON	 1
+#define   FS_TRACE_DUMP	 2
     
 /*
  * BLOCK and DIRECT commands
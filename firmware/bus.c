@@ -76,14 +76,6 @@
 #define	BUSSEC_CLOSE	0xe0	// secaddr for close
 
 
-/* -------------------------------------------------------------------------
- *  Error and command channel handling
- */
-
-
-static errormsg_t error;
-
-
 /* 
  * send a RESET request and open a receive channel for setopt (X command line
  * options packets 
@@ -95,8 +87,6 @@ static uint8_t secaddr_offset_counter;
 
 void bus_init() {
 	secaddr_offset_counter = 0;
-
-	set_error(&error, CBM_ERROR_DOSVERSION);
 }
 
 uint8_t get_default_device_address(void) {
@@ -125,6 +115,8 @@ void bus_init_bus(const char *name, bus_t *bus) {
 	bus->rtconf.name = name;
 	rtconfig_init_rtc(&(bus->rtconf), get_default_device_address());
 
+	set_error(&bus->error, CBM_ERROR_DOSVERSION);
+
 	bus->channel = NULL;
 }
 
@@ -188,7 +180,7 @@ static int16_t cmd_handler (bus_t *bus)
 	if (secaddr == CMD_SECADDR) {
       		/* Handle commands */
 		// zero termination
-      		rv = command_execute(bus_secaddr_adjust(bus, secaddr), bus, &error, _cmd_callback);
+      		rv = command_execute(bus_secaddr_adjust(bus, secaddr), bus, &bus->error, _cmd_callback);
 
 		// change device address after command
 		//bus_for_irq->current_device_address = bus_for_irq->rtconf.device_address;
@@ -205,7 +197,7 @@ static int16_t cmd_handler (bus_t *bus)
       		debug_printf("Open file secaddr=%02x, name='%s'\n",
          		secaddr, bus->command.command_buffer);
 #endif
-      		rv = file_open(bus_secaddr_adjust(bus, secaddr), bus, &error, 
+      		rv = file_open(bus_secaddr_adjust(bus, secaddr), bus, &bus->error, 
 							_cmd_callback, openflag);
     	}
 
@@ -229,9 +221,9 @@ static int16_t cmd_handler (bus_t *bus)
 #endif
 		// result of the open
 		if (bus_for_irq->errnum == CBM_ERROR_SCRATCHED) {
-			set_error_tsd(&error, bus_for_irq->errnum, bus_for_irq->errparam, 0, errdrive);
+			set_error_tsd(&bus->error, bus_for_irq->errnum, bus_for_irq->errparam, 0, errdrive);
 		} else {
-                	set_error_tsd(&error, bus_for_irq->errnum, 0, 0, errdrive);
+                	set_error_tsd(&bus->error, bus_for_irq->errnum, 0, 0, errdrive);
 		}
 
 #ifdef DEBUG_BUS
@@ -295,7 +287,7 @@ int16_t bus_sendbyte(bus_t *bus, uint8_t data, uint8_t with_eoi) {
 	if (err) debug_printf("last_push_error: %d (ch=%p)\n", err, bus->channel);
 	if (err != CBM_ERROR_OK) {
 	  int8_t errdrive = bus->rtconf.errmsg_with_drive ? bus->channel->drive : -1;
-	  set_error_tsd(&error, err, 0, 0, errdrive);
+	  set_error_tsd(&bus->error, err, 0, 0, errdrive);
 	  st |= STAT_WRTIMEOUT;
 	  bus->channel = NULL;
 	}
@@ -322,19 +314,19 @@ int16_t bus_receivebyte(bus_t *bus, uint8_t *data, uint8_t preload) {
 
 	if (secaddr == CMD_SECADDR) {
 
-		*data = error.error_buffer[error.readp];
+		*data = bus->error.error_buffer[bus->error.readp];
 
-		if (error.error_buffer[error.readp+1] == 0) {
+		if (bus->error.error_buffer[bus->error.readp+1] == 0) {
 			// send EOF
 			st |= STAT_EOF;
 		}
 		if (!(preload & BUS_PRELOAD)) {
 			// the real thing
-			error.readp++;
-			if (error.error_buffer[error.readp] == 0) {
+			bus->error.readp++;
+			if (bus->error.error_buffer[bus->error.readp] == 0) {
 				// finished reading the error message
 				// set OK
-				set_error_tsd(&error, CBM_ERROR_OK, 0, 0, errdrive);
+				set_error_tsd(&bus->error, CBM_ERROR_OK, 0, 0, errdrive);
 			}
 		}
 	} else {
@@ -342,7 +334,7 @@ int16_t bus_receivebyte(bus_t *bus, uint8_t *data, uint8_t preload) {
 		// if still NULL, error
 		debug_printf("Bus: Setting file not open on secaddr %d\n", bus->secondary & 0x1f);
 
-		set_error_tsd(&error, CBM_ERROR_FILE_NOT_OPEN, 0, 0, errdrive);
+		set_error_tsd(&bus->error, CBM_ERROR_FILE_NOT_OPEN, 0, 0, errdrive);
 		st = STAT_NODEV | STAT_RDTIMEOUT;
 	    } else {
 		int8_t err;
@@ -361,7 +353,7 @@ int16_t bus_receivebyte(bus_t *bus, uint8_t *data, uint8_t preload) {
 			}
 		}
 		if (err != CBM_ERROR_OK) {
-			set_error_tsd(&error, err, 0, 0, errdrive);
+			set_error_tsd(&bus->error, err, 0, 0, errdrive);
 		}
 	    }
 	}
@@ -459,7 +451,7 @@ void bus_close(bus_t *bus) {
 			if (bus_for_irq->errnum != CBM_ERROR_OK) {
 				channel_t *chan = channel_find(bus_secaddr_adjust(bus, secaddr));
 				int8_t errdrive = bus->rtconf.errmsg_with_drive ? (chan ? chan->drive : 0)  : -1;
-				set_error_tsd(&error, bus_for_irq->errnum, bus_for_irq->errparam, bus_for_irq->errparam2, errdrive);
+				set_error_tsd(&bus->error, bus_for_irq->errnum, bus_for_irq->errparam, bus_for_irq->errparam2, errdrive);
 			}
 		}
         }
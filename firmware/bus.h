@@ -27,6 +27,7 @@
 #include "channel.h"
 #include "rtconfig.h"
 #include "provider.h"
+#include "errormsg.h"
 
 /*
  * IEEE488 impedance layer
@@ -62,7 +63,7 @@ typedef struct {
 
 	// command channel
 	cmd_t command;		// command buffer
-	//errormsg_t    error;          // error message - is currently shared between busses
+	errormsg_t error;	// error message for the command channel
 
 	// runtime config, like unit number, last used drive etc
 	rtconfig_t rtconf;
@@ -39,6 +39,11 @@ void device_setup(int argc, const char* argv[]);
 // one polling loop iteration for the device
 void device_loop(void);
 
+#ifndef __AVR__
+// sleep until the device or the server connection has something to do
+void device_idle(void);
+#endif
+
 // lock device, so no commands come in from the IEC bus
 void device_lock(void);
 // unlock device, so commands can come in from the IEC bus
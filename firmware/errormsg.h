@@ -25,9 +25,7 @@
 */
 
 /**
- * Note that this error message code is deficient for a device that 
- * has both IEEE and IEC busses, as it only supports a single error 
- * state.
+ * Error message state for a command channel; each bus keeps its own.
  */
 #ifndef ERRORMSG_H
 #define ERRORMSG_H
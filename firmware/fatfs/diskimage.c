@@ -0,0 +1,228 @@
+/****************************************************************************
+
+    Serial line filesystem server
+    Copyright (C) 2014 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ff.h"
+#include "diskimgs.h"
+#include "diskimage.h"
+#include "petscii.h"
+#include "charconvert.h"
+#include "wildcard.h"
+#include "debug.h"
+
+// size of a directory entry, and offset of the entry data behind the
+// block link (the first entry shares its first two bytes with the link)
+#define DIR_ENTRY_SIZE     32
+#define DIR_ENTRY_DATA     2
+#define DIR_ENTRY_DATALEN  30
+
+// ----- Blocks ------------------------------------------------------------
+
+static FRESULT seek_block(FIL *fp, const Disk_Image_t *di, uint8_t track,
+                          uint8_t sector, uint16_t offset)
+{
+   int lba = di->LBA(track, sector);
+
+   if(lba < 0) {
+      debug_printf("dimg: illegal block %u/%u\n", track, sector);
+      return FR_INT_ERR;
+   }
+   return f_lseek(fp, (DWORD) lba * 256 + offset);
+}
+
+static FRESULT read_bytes(FIL *fp, void *buf, UINT len) {
+   UINT br;
+   FRESULT fres = f_read(fp, buf, len, &br);
+
+   if(fres == FR_OK && br != len) fres = FR_INT_ERR;   // truncated image
+   return fres;
+}
+
+// Make the block the current one of the chain, and read its link.
+// A chain longer than the disk must loop, which ends with an error
+static FRESULT enter_block(FIL *fp, const Disk_Image_t *di, dimg_chain_t *c,
+                           uint8_t track, uint8_t sector)
+{
+   BYTE link[2];
+   FRESULT fres;
+
+   if(c->count >= di->Blocks) {
+      debug_printf("dimg: block chain loops at %u/%u\n", track, sector);
+      return FR_INT_ERR;
+   }
+   if((fres = seek_block(fp, di, track, sector, 0))) return fres;
+   if((fres = read_bytes(fp, link, 2))) return fres;
+
+   c->track = track;
+   c->sector = sector;
+   c->next_track = link[BLK_OFFSET_NEXT_TRACK];
+   c->next_sector = link[BLK_OFFSET_NEXT_SECTOR];
+   c->rp = 2;
+   c->count++;
+   return FR_OK;
+}
+
+// Convert a $a0 padded PETSCII name to a zero-terminated ASCII string
+static void copy_name(char *dest, const BYTE *src, uint8_t len) {
+   while(len-- && *src != 0xa0) *dest++ = petscii_to_ascii(*src++);
+   *dest = 0;
+}
+
+// ----- Disk --------------------------------------------------------------
+
+FRESULT dimg_header(FIL *fp, const Disk_Image_t *di, char *name) {
+   BYTE buf[16];
+   FRESULT fres;
+
+   if((fres = seek_block(fp, di, di->DirTrack, di->HdrSector, di->HdrOffset)))
+      return fres;
+   if((fres = read_bytes(fp, buf, sizeof buf))) return fres;
+   copy_name(name, buf, sizeof buf);
+   return FR_OK;
+}
+
+FRESULT dimg_blocks_free(FIL *fp, const Disk_Image_t *di, uint16_t *free_blocks) {
+   uint8_t increment = 1 + ((di->Sectors + 7) >> 3);
+   uint8_t track = 1;
+   BYTE fbl;
+   FRESULT fres;
+
+   *free_blocks = 0;
+   for(uint8_t b = 0; b < 4 && di->bamts[b * 2]; b++) {
+      uint8_t bam_track = di->bamts[b * 2];
+      uint8_t bam_sector = di->bamts[b * 2 + 1];
+      uint16_t offset = di->BAMOffset;
+
+      if(di->ID == 71 && track > di->Tracks) {
+         // the second side's free block counts are in the first BAM block
+         bam_track = di->bamts[0];
+         bam_sector = di->bamts[1];
+         offset = 221;
+         increment = 1;
+      }
+      for(uint8_t i = 0; i < di->TracksPerBAM && track <= di->Tracks * di->Sides;
+          i++, track++, offset += increment) {
+         if(track == di->DirTrack) continue;
+         if((fres = seek_block(fp, di, bam_track, bam_sector, offset))) return fres;
+         if((fres = read_bytes(fp, &fbl, 1))) return fres;
+         *free_blocks += fbl;
+      }
+   }
+   return FR_OK;
+}
+
+// ----- Directory ---------------------------------------------------------
+
+FRESULT dimg_open_dir(FIL *fp, const Disk_Image_t *di, dimg_chain_t *dc) {
+   FRESULT fres;
+
+   dc->count = 0;
+   fres = enter_block(fp, di, dc, di->DirTrack, di->DirSector);
+
+   dc->rp = 0;   // offset of the first entry
+   return fres;
+}
+
+FRESULT dimg_read_dir(FIL *fp, const Disk_Image_t *di, dimg_chain_t *dc,
+                      dimg_entry_t *entry)
+{
+   BYTE buf[DIR_ENTRY_DATALEN];
+   FRESULT fres;
+
+   for(;;) {
+      if(dc->rp >= 256) {
+         if(!dc->next_track) return FR_NO_FILE;
+         if((fres = enter_block(fp, di, dc, dc->next_track, dc->next_sector)))
+            return fres;
+         dc->rp = 0;
+      }
+      if((fres = seek_block(fp, di, dc->track, dc->sector, dc->rp + DIR_ENTRY_DATA)))
+         return fres;
+      if((fres = read_bytes(fp, buf, sizeof buf))) return fres;
+      dc->rp += DIR_ENTRY_SIZE;
+
+      if(buf[0]) break;    // skip unused entries
+   }
+
+   entry->type = buf[0];
+   entry->track = buf[1];
+   entry->sector = buf[2];
+   copy_name(entry->name, buf + 3, 16);
+   entry->blocks = buf[28] | (buf[29] << 8);
+   return FR_OK;
+}
+
+FRESULT dimg_find(FIL *fp, const Disk_Image_t *di, const char *pattern,
+                  bool advanced_wildcards, dimg_entry_t *entry)
+{
+   dimg_chain_t dc;
+   FRESULT fres;
+
+   if((fres = dimg_open_dir(fp, di, &dc))) return fres;
+   while((fres = dimg_read_dir(fp, di, &dc, entry)) == FR_OK) {
+      if((entry->type & 0x80) && (entry->type & 0x07)
+            && compare_pattern(entry->name, pattern, advanced_wildcards)) {
+         debug_printf("dimg: found '%s' at %u/%u\n",
+                      entry->name, entry->track, entry->sector);
+         break;
+      }
+   }
+   return fres;
+}
+
+// ----- Files -------------------------------------------------------------
+
+FRESULT dimg_open_file(FIL *fp, const Disk_Image_t *di, uint8_t track,
+                       uint8_t sector, dimg_chain_t *fc)
+{
+   fc->count = 0;
+   return enter_block(fp, di, fc, track, sector);
+}
+
+FRESULT dimg_read(FIL *fp, const Disk_Image_t *di, dimg_chain_t *fc,
+                  BYTE *buf, UINT len, UINT *transferred, bool *eof)
+{
+   FRESULT fres = FR_OK;
+   uint16_t last;
+   UINT n;
+
+   *transferred = 0;
+   for(;;) {
+      last = fc->next_track ? 255 : fc->next_sector;
+      if(fc->rp > last) {
+         if(!fc->next_track) break;
+         if((fres = enter_block(fp, di, fc, fc->next_track, fc->next_sector))) break;
+         continue;
+      }
+      if(*transferred >= len) break;
+
+      // the file pointer is still behind the data read before
+      n = last + 1 - fc->rp;
+      if(n > len - *transferred) n = len - *transferred;
+      if((fres = read_bytes(fp, buf + *transferred, n))) break;
+      fc->rp += n;
+      *transferred += n;
+   }
+   *eof = (!fc->next_track && fc->rp > fc->next_sector);
+   return fres;
+}
@@ -0,0 +1,94 @@
+/****************************************************************************
+
+    Serial line filesystem server
+    Copyright (C) 2014 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+/*
+ * Read-only access to Commodore disk images (d64, d71, d81, ...) stored
+ * as files on the FAT file system, so the FAT provider can serve them
+ * without the server. The geometry comes from common/diskimgs.c, see
+ * diskimg_identify().
+ *
+ * All functions work on a FIL opened for reading on the image file; as
+ * each channel has its own FIL, the FatFs sector buffer in it keeps the
+ * current 512 byte sector, i.e. two image blocks.
+ */
+
+#ifndef DISKIMAGE_H
+#define DISKIMAGE_H
+
+#include <stdbool.h>
+
+#include "ff.h"
+#include "diskimgs.h"
+
+// directory entry of a file in the image
+typedef struct {
+   uint8_t  type;          // file type with closed/locked bits, 0 if unused
+   uint8_t  track;         // first block of the file
+   uint8_t  sector;
+   uint16_t blocks;        // file size in blocks
+   char     name[16 + 1];  // ASCII, without the $a0 padding
+} dimg_entry_t;
+
+// position in a chain of blocks (file or directory)
+typedef struct {
+   uint8_t  track;         // current block
+   uint8_t  sector;
+   uint8_t  next_track;    // link to the next block, 0 in the last block
+   uint8_t  next_sector;   // ... where it is the index of the last used byte
+   uint16_t rp;            // read offset in the current block
+   uint16_t count;         // blocks entered, to stop on a looping chain
+} dimg_chain_t;
+
+/**
+ * get the disk name from the header block
+ */
+FRESULT dimg_header(FIL *fp, const Disk_Image_t *di, char *name);
+
+/**
+ * start reading the directory; dimg_read_dir() returns the used entries
+ * one by one, and FR_NO_FILE after the last one
+ */
+FRESULT dimg_open_dir(FIL *fp, const Disk_Image_t *di, dimg_chain_t *dc);
+FRESULT dimg_read_dir(FIL *fp, const Disk_Image_t *di, dimg_chain_t *dc,
+                      dimg_entry_t *entry);
+
+/**
+ * find the first closed, non-deleted file matching the pattern;
+ * FR_NO_FILE if there is none
+ */
+FRESULT dimg_find(FIL *fp, const Disk_Image_t *di, const char *pattern,
+                  bool advanced_wildcards, dimg_entry_t *entry);
+
+/**
+ * start reading the file with the given first block, and read up to len
+ * bytes from it with dimg_read()
+ */
+FRESULT dimg_open_file(FIL *fp, const Disk_Image_t *di, uint8_t track,
+                       uint8_t sector, dimg_chain_t *fc);
+FRESULT dimg_read(FIL *fp, const Disk_Image_t *di, dimg_chain_t *fc,
+                  BYTE *buf, UINT len, UINT *transferred, bool *eof);
+
+/**
+ * sum up the free blocks in the BAM (without the directory track)
+ */
+FRESULT dimg_blocks_free(FIL *fp, const Disk_Image_t *di, uint16_t *free_blocks);
+
+#endif
@@ -49,6 +49,7 @@
 #include "ff.h"
 #include "errcompat.h"
 #include "wildcard.h"
+#include "diskimage.h"
 
 #define  DEBUG_FAT
 
@@ -98,12 +99,41 @@ static FATFS Fatfs[_VOLUMES];   // File system object for each logical drive
 #define AVAILABLE -1
 enum enum_dir_state { DIR_INACTIVE, DIR_HEAD, DIR_FILES, DIR_FOOTER };
 
+// Files opened for reading only get a read-ahead buffer (if one is free),
+// which is filled with several contiguous sectors per disk_read(), so the
+// SD card can stream them with a single multi-block read command (CMD18)
+#ifndef FAT_READAHEAD_SECTORS
+#   define FAT_READAHEAD_SECTORS 4
+#endif
+#ifndef FAT_READAHEAD_BUFFERS
+#   define FAT_READAHEAD_BUFFERS 1
+#endif
+
+// Size of the cluster link map for fast seek (_USE_FASTSEEK), in DWORDs;
+// holds (FAT_CLMT_SIZE - 2) / 2 fragments. More fragmented files are read
+// by following the FAT as usual
+#ifndef FAT_CLMT_SIZE
+#   define FAT_CLMT_SIZE 16
+#endif
+
+typedef struct {
+   int8_t chan;          // owner channel # or AVAILABLE
+   UINT   rp;            // read pointer into buf
+   UINT   wp;            // number of valid bytes in buf
+   BYTE   buf[FAT_READAHEAD_SECTORS * _MAX_SS];
+} readahead_t;
+static readahead_t readahead[FAT_READAHEAD_BUFFERS];
+
 // Channel table (holds dir state/file data)
 static struct {
    int8_t chan;          // entry used by channel # or AVAILABLE
    int8_t dir_state;     // DIR_INACTIVE for files
                          // or DIR_* when reading directories
    FIL    f;             // file data
+   readahead_t *ra;      // read-ahead buffer or NULL
+   DWORD  clmt[FAT_CLMT_SIZE]; // cluster link map of files opened for reading
+   const Disk_Image_t *di; // f is a disk image, or NULL for FAT files
+   dimg_chain_t chain;   // position in the disk image file or directory
 } tbl[FAT_MAX_FILES];
 
 // Each drive has a current directory
@@ -113,6 +143,8 @@ static struct {
 typedef struct {
    int8_t drive;                   // AVAILABLE when not assigned
    TCHAR cwd[_MAX_LFN + 1];        // current working directory
+   TCHAR image[13];                // mounted disk image (8.3 name in cwd)
+   Disk_Image_t di;                // and its geometry
 } fat_assign_t;
 static fat_assign_t fat_assign[FAT_MAX_ASSIGNS];
 static void* last_epdata = NULL;   // Used to detect if f_chdir needed,
@@ -125,6 +157,7 @@ static struct {
    uint8_t drive;                  // CBM drive number
    char   mask[_MAX_LFN + 1];      // search mask for files
    char   headline[16 + 1];        // headline of directory listing
+   bool   advanced_wildcards;      // from the rtconfig at FS_OPEN_DR
 } dir;
 
 
@@ -132,8 +165,9 @@ static struct {
 
 // helper functions
 static cbm_errno_t fs_read_dir(void *epdata, int8_t channelno, bool advanced_wildcards, packet_t *packet);
-static cbm_errno_t fs_move(char *buf);
-static void fs_delete(char *path, packet_t *p, bool advanced_wildcards);
+static cbm_errno_t image_read_dir(int8_t tblpos, bool advanced_wildcards, packet_t *packet);
+static cbm_errno_t fs_move(char *to, char *from);
+static void fs_delete(char *names[], uint8_t num_names, packet_t *p, bool advanced_wildcards);
 
 // Copy a filename/path limited to 16 characters
 // If the path is too long, copy only the last characters preceeded by ".."
@@ -148,12 +182,44 @@ static void shortname(char* dest, const char* src) {
 }
 
 
+// Split a filename packet (see assemble_filename_packet()): an option
+// string, then for each file the drive number and the zero-terminated name.
+// Returns the number of names, which are pointed to by names[], and the
+// drive of the first one
+static uint8_t packet_names(packet_t *txbuf, uint8_t *drive, char *names[]) {
+   char *p = (char *) txbuf->buffer;
+   char *end = p + packet_get_contentlen(txbuf);
+   uint8_t num = 0;
+
+   p += strnlen(p, end - p) + 1;   // skip options
+   while(p + 1 < end && num < MAX_NAMEINFO_FILES) {
+      if(!num) *drive = *p;
+      p++;
+      names[num++] = p;
+      p += strnlen(p, end - p) + 1;
+   }
+   return num;
+}
+
+
 // ----- File / Channel table ----------------------------------------------
 
 static void tbl_init(void) {
    for(uint8_t i=0; i < FAT_MAX_FILES; i++) {
       tbl[i].chan = AVAILABLE;
       tbl[i].dir_state = DIR_INACTIVE;
+      tbl[i].ra = NULL;
+      tbl[i].di = NULL;
+   }
+   for(uint8_t i=0; i < FAT_READAHEAD_BUFFERS; i++) {
+      readahead[i].chan = AVAILABLE;
+   }
+}
+
+static void tbl_free_readahead(uint8_t pos) {
+   if(tbl[pos].ra) {
+      tbl[pos].ra->chan = AVAILABLE;
+      tbl[pos].ra = NULL;
    }
 }
 
@@ -173,11 +239,14 @@ static FIL *tbl_ins_file(uint8_t chan) {
       if(tbl[i].chan == chan) {
          debug_printf("#%d already exists @%d\n", chan, i);
          tbl[i].dir_state = DIR_INACTIVE;
+         tbl[i].di = NULL;
+         tbl_free_readahead(i);
          return &tbl[i].f;
       }
       if(tbl[i].chan == AVAILABLE) {
          tbl[i].chan = chan;
          tbl[i].dir_state = DIR_INACTIVE;
+         tbl[i].di = NULL;
          debug_printf("#%d found in file table @ %d\n", chan, i);
          return &tbl[i].f;
       }
@@ -191,12 +260,14 @@ static cbm_errno_t tbl_ins_dir(int8_t chan) {
       if(tbl[i].chan == chan) {
          debug_printf("dir_state #%d := DIR_HEAD\n", i);
          tbl[i].dir_state = DIR_HEAD;
+         tbl[i].di = NULL;
          return CBM_ERROR_OK;
       }
       if(tbl[i].chan == AVAILABLE) {
          debug_printf("@%d initialized with DIR_HEAD\n", i);
          tbl[i].chan = chan;
          tbl[i].dir_state = DIR_HEAD;
+         tbl[i].di = NULL;
          return CBM_ERROR_OK;
       }
    }
@@ -221,21 +292,256 @@ static cbm_errno_t tbl_close_file(uint8_t chan) {
    FRESULT fres = FR_OK;
 
    if((pos = tbl_chpos(chan)) != AVAILABLE) {
-      if(tbl[pos].dir_state == DIR_INACTIVE) {
+      if(tbl[pos].dir_state == DIR_INACTIVE || tbl[pos].di) {
+         // disk image directories are read from the image file
          fres = f_close(&tbl[pos].f);
          debug_printf("f_close (#%d @%d): %d\n", chan, pos, fres);
       } else {
          fres = f_closedir(&dir.D);
          debug_printf("f_closedir: %d\n", fres);
       }
+      tbl_free_readahead(pos);
       tbl[pos].chan = AVAILABLE;
       tbl[pos].dir_state = DIR_INACTIVE;
+      tbl[pos].di = NULL;
    } else {
       debug_printf("f_close (#%d): nothing to do\n", chan);
    }
    return combine(cres, fres);
 }
 
+// ----- Reading files -----------------------------------------------------
+
+// Map the cluster chain of a file just opened for reading for fast seek
+static void tbl_map_clusters(uint8_t pos, FIL *fp) {
+   FRESULT fres;
+
+   tbl[pos].clmt[0] = FAT_CLMT_SIZE;
+   fp->cltbl = tbl[pos].clmt;
+   if((fres = f_lseek(fp, CREATE_LINKMAP))) {
+      // too fragmented (FR_NOT_ENOUGH_CORE), follow the FAT instead
+      debug_printf("CREATE_LINKMAP #%d: %d\n", tbl[pos].chan, fres);
+      fp->cltbl = NULL;
+   }
+}
+
+// Prepare a file just opened for reading: map its cluster chain for fast
+// seek and attach a free read-ahead buffer
+static void tbl_prepare_read(uint8_t chan, FIL *fp) {
+   int8_t pos = tbl_chpos(chan);
+
+   if(pos < 0) return;
+
+   tbl_map_clusters(pos, fp);
+
+   for(uint8_t i=0; i < FAT_READAHEAD_BUFFERS; i++) {
+      if(readahead[i].chan == AVAILABLE) {
+         readahead[i].chan = chan;
+         readahead[i].rp = 0;
+         readahead[i].wp = 0;
+         tbl[pos].ra = &readahead[i];
+         debug_printf("#%d uses read-ahead buffer %d\n", chan, i);
+         break;
+      }
+   }
+}
+
+// Read up to len bytes from the file, through its read-ahead buffer if it
+// has one. As the buffer is refilled with whole sectors from the start of
+// the file on, the file pointer stays sector aligned, and f_read() reads
+// the sectors directly into the buffer with multi-sector disk_read() calls.
+static FRESULT tbl_read_file(uint8_t chan, FIL *fp, BYTE *buf, UINT len,
+                             UINT *transferred, bool *eof)
+{
+   int8_t pos = tbl_chpos(chan);
+   readahead_t *ra = (pos < 0) ? NULL : tbl[pos].ra;
+   FRESULT fres = FR_OK;
+   UINT n;
+
+   if(pos >= 0 && tbl[pos].di) {
+      // a file in a disk image, read through the sector buffer of the FIL
+      return dimg_read(fp, tbl[pos].di, &tbl[pos].chain, buf, len, transferred, eof);
+   }
+
+   if(!ra) {
+      fres = f_read(fp, buf, len, transferred);
+      *eof = (fp->fptr == fp->fsize);
+      return fres;
+   }
+
+   *transferred = 0;
+   while(*transferred < len) {
+      if(ra->rp == ra->wp) {
+         if(fp->fptr == fp->fsize) break;
+         ra->rp = 0;
+         fres = f_read(fp, ra->buf, sizeof(ra->buf), &ra->wp);
+         if(fres != FR_OK || !ra->wp) break;
+      }
+      n = ra->wp - ra->rp;
+      if(n > len - *transferred) n = len - *transferred;
+      memcpy(buf + *transferred, ra->buf + ra->rp, n);
+      ra->rp += n;
+      *transferred += n;
+   }
+   *eof = (ra->rp == ra->wp && fp->fptr == fp->fsize);
+   return fres;
+}
+
+// ----- Disk images -------------------------------------------------------
+
+// Mount the disk image file at path (relative to the current directory)
+// for the assign, and change into the directory that holds it.
+// Returns false if path is not a supported disk image
+static bool mount_image(fat_assign_t *a, char *path) {
+   FILINFO Finfo;
+   char *d;
+
+#  ifdef _USE_LFN
+      Finfo.lfname = NULL;   // the short name is used to open the image
+      Finfo.lfsize = 0;
+#  endif
+
+   if(f_stat(path, &Finfo) != FR_OK || (Finfo.fattrib & AM_DIR)) return false;
+   if(!diskimg_identify(&a->di, Finfo.fsize)) return false;
+
+   splitpath(path, &d);
+   if(f_chdir(d)) return false;
+   strcpy(a->image, Finfo.fname);
+   debug_printf("mounted d%d image '%s'\n", a->di.ID, a->image);
+   return true;
+}
+
+// Open the first file in the mounted image that matches the pattern
+static cbm_errno_t image_open_file(fat_assign_t *a, int8_t chan, const char *pattern,
+                                   bool advanced_wildcards, FRESULT *fres)
+{
+   cbm_errno_t cres = CBM_ERROR_OK;
+   dimg_entry_t entry;
+   FIL *fp = tbl_ins_file(chan);
+   int8_t pos = tbl_chpos(chan);
+
+   if(!fp) return CBM_ERROR_NO_CHANNEL;
+
+   tbl[pos].di = &a->di;
+   if((*fres = f_open(fp, a->image, FA_READ | FA_OPEN_EXISTING)) == FR_OK) {
+      tbl_map_clusters(pos, fp);
+      *fres = dimg_find(fp, &a->di, pattern, advanced_wildcards, &entry);
+   }
+   if(*fres == FR_OK) {
+      if((entry.type & FS_DIR_ATTR_TYPEMASK) == FS_DIR_TYPE_REL) {
+         cres = CBM_ERROR_FILE_TYPE_MISMATCH;
+      } else {
+         *fres = dimg_open_file(fp, &a->di, entry.track, entry.sector, &tbl[pos].chain);
+      }
+   }
+   debug_printf("image FS_OPEN_RD '%s' #%d, res=%d/%d\n", pattern, chan, cres, *fres);
+   if(cres || *fres) tbl_close_file(chan);
+   return cres;
+}
+
+// Open the directory of the mounted image, with the files matching the mask
+static cbm_errno_t image_open_dir(fat_assign_t *a, int8_t chan, uint8_t drive,
+                                  const char *mask, bool advanced_wildcards, FRESULT *fres)
+{
+   cbm_errno_t cres;
+   int8_t pos;
+   FIL *fp;
+
+   if((cres = tbl_ins_dir(chan))) return cres;
+   pos = tbl_chpos(chan);
+   fp = &tbl[pos].f;
+
+   tbl[pos].di = &a->di;
+   if((*fres = f_open(fp, a->image, FA_READ | FA_OPEN_EXISTING)) == FR_OK) {
+      tbl_map_clusters(pos, fp);
+      if((*fres = dimg_header(fp, &a->di, dir.headline)) == FR_OK) {
+         *fres = dimg_open_dir(fp, &a->di, &tbl[pos].chain);
+      }
+   }
+   if(*fres) {
+      tbl_close_file(chan);
+      return CBM_ERROR_OK;
+   }
+
+   strncpy(dir.mask, *mask ? mask : "*", sizeof dir.mask);
+   dir.mask[sizeof(dir.mask) - 1] = 0;
+   dir.drive = drive;
+   dir.advanced_wildcards = advanced_wildcards;
+   return CBM_ERROR_OK;
+}
+
+// Next entry of the image directory that matches the mask
+static cbm_errno_t image_read_dir(int8_t tblpos, bool advanced_wildcards, packet_t *packet) {
+   char *p = (char *) packet->buffer;
+   dimg_entry_t entry;
+   FRESULT fres;
+
+   do {
+      fres = dimg_read_dir(&tbl[tblpos].f, tbl[tblpos].di, &tbl[tblpos].chain, &entry);
+      if(fres != FR_OK) {
+         if(fres != FR_NO_FILE) debug_printf("dimg_read_dir: %d\n", fres);
+         tbl[tblpos].dir_state = DIR_FOOTER;
+         return CBM_ERROR_OK;
+      }
+   } while(!compare_pattern(entry.name, dir.mask, advanced_wildcards));
+
+   // with FS_DIR_ATTR_ESTIMATE, the block count goes into the
+   // second and third byte, see dirconverter.c
+   p[FS_DIR_LEN]   = 0;
+   p[FS_DIR_LEN+1] = entry.blocks & 255;
+   p[FS_DIR_LEN+2] = entry.blocks >> 8;
+   p[FS_DIR_LEN+3] = 0;
+
+   // no dates in disk images
+   memset(p + FS_DIR_YEAR, 0, FS_DIR_MODE - FS_DIR_YEAR);
+
+   // bit 7 of the file type is set for closed files, but
+   // FS_DIR_ATTR_SPLAT is set for open ones
+   p[FS_DIR_MODE] = FS_DIR_MOD_FIL;
+   p[FS_DIR_ATTR] = (entry.type ^ FS_DIR_ATTR_SPLAT)
+                  | FS_DIR_ATTR_ESTIMATE | FS_DIR_ATTR_LOCKED;
+
+   strcpy(p + FS_DIR_NAME, entry.name);
+   packet_update_wp(packet, FS_DIR_NAME + strlen(p+FS_DIR_NAME));
+   return CBM_ERROR_OK;
+}
+
+// Commands for an assign with a mounted disk image. Returns false for
+// those handled as usual: channel data, closing channels and CHDIR
+static bool image_submit_call(fat_assign_t *a, int8_t channelno, uint8_t cmd,
+                              char *path, uint8_t drive, bool advanced_wildcards,
+                              int8_t *cres, int8_t *fres)
+{
+   FRESULT res = FR_OK;
+
+   switch(cmd) {
+      case FS_OPEN_RD:
+         *cres = image_open_file(a, channelno, path, advanced_wildcards, &res);
+         break;
+
+      case FS_OPEN_DR:
+         *cres = image_open_dir(a, channelno, drive, path, advanced_wildcards, &res);
+         break;
+
+      case FS_OPEN_WR:
+      case FS_OPEN_RW:
+      case FS_OPEN_OW:
+      case FS_OPEN_AP:
+      case FS_MKDIR:
+      case FS_RMDIR:
+      case FS_MOVE:
+      case FS_DELETE:
+         // disk images are mounted read-only
+         *cres = CBM_ERROR_WRITE_PROTECT;
+         break;
+
+      default:
+         return false;
+   }
+   *fres = res;
+   return true;
+}
+
 // ----- Provider routines -------------------------------------------------
 
 static void fat_provider_init(void) {
@@ -245,6 +551,7 @@ static void fat_provider_init(void) {
    for(uint8_t i=0; i < FAT_MAX_ASSIGNS; i++) {
       fat_assign[i].drive = AVAILABLE;
       fat_assign[i].cwd[0] = 0;
+      fat_assign[i].image[0] = 0;
    }
    res = disk_initialize(0);
    debug_printf("disk_initialize: %u", res); debug_putcrlf();
@@ -278,18 +585,23 @@ static void *prov_assign(uint8_t drive, const char *petscii_parameter) {
             debug_printf("f_getcwd: %d\n", res);
             return NULL;
          }
-         if((res = f_chdir(parameter))) {
+         if((res = f_chdir(parameter)) == FR_OK) {
+            strncpy(fat_assign[i].cwd, parameter, sizeof(fat_assign[i].cwd)-1);
+            fat_assign[i].cwd[sizeof(fat_assign[i].cwd) - 1] = 0;
+            fat_assign[i].image[0] = 0;
+         } else if(mount_image(&fat_assign[i], parameter)) {
+            // assigned to a disk image, in the directory
+            // mount_image() changed into
+            f_getcwd(fat_assign[i].cwd, sizeof(fat_assign[i].cwd));
+         } else {
             debug_printf("f_chdir(%s): %d\n", parameter, res);
             return NULL;
-         } else {
-            // CHDIR success, restore current directory
-            if((res = f_chdir(cwd))) {
-               debug_printf("f_chdir(%s): %d\n", cwd, res);
-               return NULL;
-            }
          }
-         strncpy(fat_assign[i].cwd, parameter, sizeof(fat_assign[i].cwd)-1);
-         fat_assign[i].cwd[sizeof(fat_assign[i].cwd) - 1] = 0;
+         // CHDIR success, restore current directory
+         if((res = f_chdir(cwd))) {
+            debug_printf("f_chdir(%s): %d\n", cwd, res);
+            return NULL;
+         }
          fat_assign[i].drive = drive;
          debug_printf("fat_assign at %u p=%p\n", i, &fat_assign[i]);
          return &fat_assign[i];
@@ -305,6 +617,7 @@ static void prov_free(void *epdata) {
    fat_assign_t* p = (fat_assign_t*) epdata;
    p->drive = AVAILABLE;
    p->cwd[0] = 0;
+   p->image[0] = 0;
    last_epdata = NULL; // force chdir
 }
 
@@ -316,7 +629,8 @@ static void fat_submit(void *epdata, packet_t *buf) {
 static void fat_submit_call_data(void *epdata, int8_t channelno, packet_t *txbuf, packet_t *rxbuf, 
    uint8_t (*callback)(int8_t channelno, int8_t errnum, packet_t *packet))
 {
-   // TODO: this breaks when reading the directory, as there rtconfig is needed for some reason
+   // data calls have no rtconfig; FS_READ on a directory uses the
+   // wildcard setting saved when it was opened
    fat_submit_call_cmd(epdata, channelno, txbuf, rxbuf, NULL, callback);
 }
 
@@ -330,10 +644,16 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
    int8_t fres = FR_OK;
    int8_t cres = CBM_ERROR_OK;
    int8_t reply_as_usual = true;
+   bool served = false;
    UINT transferred = 0;
    FIL *fp;
-   char *path = (char *) (txbuf->buffer + 1);
-   uint8_t len = txbuf->len - 1;
+   char *names[MAX_NAMEINFO_FILES];
+   uint8_t num_names = 0;
+   uint8_t drive = 0;
+   char *path = "";
+   uint8_t len;
+   fat_assign_t *assign = (fat_assign_t*) epdata;
+   bool advanced_wildcards = fatfs_rtc ? fatfs_rtc->advanced_wildcards : false;
 
    FILINFO Finfo;  // holds file information returned by f_readdir/f_stat
                    // the long file name *lfname must be stored externally:
@@ -362,8 +682,32 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
    } else debug_puts("Same drive again.\n");
 
    switch(txbuf->type) {
+      case FS_READ:
+      case FS_WRITE:
+      case FS_WRITE_EOF:
+      case FS_CLOSE:
+         // data only
+         break;
+      default:
+         num_names = packet_names(txbuf, &drive, names);
+         if(num_names) path = names[0];
+         break;
+   }
+
+   if(assign && assign->image[0]) {
+      served = image_submit_call(assign, channelno, txbuf->type, path, drive,
+                                 advanced_wildcards, &cres, &fres);
+   }
+
+   if(!served) switch(txbuf->type) {
       case FS_CHDIR:
          debug_printf("CHDIR into '%s'\n", path);
+         if(assign && assign->image[0]) {
+            // leave the disk image, ".." is the directory it is in
+            assign->image[0] = 0;
+            if(!strcmp(path, "..")) break;
+         }
+         if(assign && mount_image(assign, path)) break;
          fres = f_chdir(path);
          break;
 
@@ -386,6 +730,7 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
             fres = f_open(fp, path, FA_READ | FA_OPEN_EXISTING);
             debug_printf("FS_OPEN_RD '%s' #%d, res=%d\n",
                                     path, channelno, fres);
+            if(fres == FR_OK) tbl_prepare_read(channelno, fp);
          } else {
             // too many files!
             cres = CBM_ERROR_NO_CHANNEL;
@@ -457,10 +802,10 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
             dirmask given, is not a directory --> show matching files
             no dirmask given                  --> show all directory entries
          */
-         debug_printf("FS_OPEN_DIR for drive %d, ", txbuf->buffer[0]);
+         debug_printf("FS_OPEN_DIR for drive %d, ", drive);
          char *b, *d;
-         if (txbuf->len > 2) { // 2 bytes: drive number and zero terminator
-            debug_printf("dirmask '%s'\n", txbuf->buffer + 1);
+         if (*path) {
+            debug_printf("dirmask '%s'\n", path);
             // If path is a directory, list its contents
             if(f_stat(path, &Finfo) == FR_OK && Finfo.fattrib & AM_DIR) {
                debug_printf("'%s' is a directory\n", path);
@@ -484,7 +829,8 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
             shortname(dir.headline, dir.mask);
             strcpy(dir.mask, "*");
          }
-         dir.drive = txbuf->buffer[0];
+         dir.drive = drive;
+         dir.advanced_wildcards = advanced_wildcards;
          fres = tbl_ins_dir(channelno);
          break;
 
@@ -496,12 +842,16 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
 
       case FS_MOVE:
          // rename / move a file
-         fres = fs_move(path);
+         if(num_names < 2) {
+            cres = CBM_ERROR_SYNTAX_NONAME;
+         } else {
+            cres = fs_move(names[0], names[1]);
+         }
          break;
 
       case FS_DELETE:
          reply_as_usual = false;
-         fs_delete(path, rxbuf, fatfs_rtc->advanced_wildcards); // replies via rxbuf
+         fs_delete(names, num_names, rxbuf, advanced_wildcards); // replies via rxbuf
          break;
 
       case FS_READ:
@@ -514,11 +864,13 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
             cres = CBM_ERROR_FILE_NOT_OPEN;
          } else if(ds) {
             // Read directory
-            cres = fs_read_dir(epdata, channelno, fatfs_rtc->advanced_wildcards, rxbuf);
+            cres = fs_read_dir(epdata, channelno, dir.advanced_wildcards, rxbuf);
          } else {
             // Read file
+            bool eof;
             fp = tbl_find_file(channelno);
-            fres = f_read(fp, rxbuf->buffer, rxbuf->len, &transferred);
+            fres = tbl_read_file(channelno, fp, rxbuf->buffer, rxbuf->len,
+                                 &transferred, &eof);
             debug_printf("%d/%d bytes read from #%d, fres=%d\n",
                          transferred, rxbuf->len, channelno, fres);
             if(fres != FR_OK) {
@@ -528,7 +880,7 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
             } else {
                // a DATA packet mirrors the READ request when ok
                rxbuf->wp = transferred;
-               if(fp->fptr == fp->fsize) {
+               if(eof) {
                   rxbuf->type = FS_DATA_EOF;
                } else {
                   rxbuf->type = FS_DATA;
@@ -546,11 +898,6 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
                fres = f_write(fp, txbuf->buffer, len, &transferred);
                debug_printf("%d/%d bytes written to #%d, res=%d\n",
                             transferred, len, channelno, fres);
-               if(fres == FR_OK) {
-                  // a REPLY mirrors the WRITE request when ok
-                  txbuf->type = FS_REPLY;
-                  reply_as_usual = false;
-               }
             }
          } else {
             debug_printf("No channel for FS_WRITE/FS_WRITE_EOF #%d\n", channelno);
@@ -574,6 +921,7 @@ static void fat_submit_call_cmd(void *epdata, int8_t channelno, packet_t *txbuf,
    cres = combine(cres, fres);
    if(reply_as_usual) {
       rxbuf->type = FS_REPLY;   // return error code with FS_REPLY
+      rxbuf->wp = 0;            // rxbuf may be the request packet itself
       packet_write_char(rxbuf, cres);
    }
    callback(channelno, cres, rxbuf);
@@ -625,6 +973,7 @@ cbm_errno_t fs_read_dir(void *epdata, int8_t channelno, bool advanced_wildcards,
       case DIR_FILES:
          // Files and directories
          debug_puts("fs_read_dir/DIR_FILES"); debug_putcrlf();
+         if(tbl[tblpos].di) return image_read_dir(tblpos, advanced_wildcards, packet);
          for(;;) {
             fres = f_readdir(&dir.D, &Finfo);
             if(fres != FR_OK || !Finfo.fname[0]) {
@@ -698,11 +1047,22 @@ cbm_errno_t fs_read_dir(void *epdata, int8_t channelno, bool advanced_wildcards,
          FATFS *fs = &Fatfs[0];
          DWORD free_clusters;
          DWORD free_bytes = 0;   // fallback default size
-         fres = f_getfree("0:/", &free_clusters, &fs);
-         if(fres == FR_OK) {
-            // assuming 512 bytes/sector ==> * 512 ==> << 9
-            free_bytes = (free_clusters * fs->csize) << 9;
-         } else debug_printf("f_getfree: %d\n", fres);
+         p[FS_DIR_ATTR] = 0;
+         if(tbl[tblpos].di) {
+            // free blocks, in the second and third byte (see above)
+            uint16_t free_blocks;
+            fres = dimg_blocks_free(&tbl[tblpos].f, tbl[tblpos].di, &free_blocks);
+            if(fres == FR_OK) {
+               free_bytes = (DWORD) free_blocks << 8;
+               p[FS_DIR_ATTR] = FS_DIR_ATTR_ESTIMATE;
+            } else debug_printf("dimg_blocks_free: %d\n", fres);
+         } else {
+            fres = f_getfree("0:/", &free_clusters, &fs);
+            if(fres == FR_OK) {
+               // assuming 512 bytes/sector ==> * 512 ==> << 9
+               free_bytes = (free_clusters * fs->csize) << 9;
+            } else debug_printf("f_getfree: %d\n", fres);
+         }
          p[FS_DIR_LEN] = free_bytes & 255;
          p[FS_DIR_LEN+1] = (free_bytes >> 8) & 255;
          p[FS_DIR_LEN+2] = (free_bytes >> 16) & 255;
@@ -717,22 +1077,12 @@ cbm_errno_t fs_read_dir(void *epdata, int8_t channelno, bool advanced_wildcards,
 
 // ----- Rename a file or directory ----------------------------------------
 
-static cbm_errno_t fs_move(char *buf) {
+static cbm_errno_t fs_move(char *to, char *from) {
    // Rename/move a file or directory
    // DO NOT RENAME/MOVE OPEN OBJECTS!
    FRESULT fres;
-   uint8_t p = 0;
-   char *from, *to;
    FILINFO fileinfo;
 
-   // first find the two names separated by '='
-   while (buf[p] != 0 && buf[p] != '=') p++;
-   if (!buf[p]) return CBM_ERROR_SYNTAX_NONAME;
-
-   buf[p] = 0;
-   from = buf + p + 1;
-   to = buf;
-
    debug_printf("FS_MOVE '%s' to '%s'", from, to); debug_putcrlf();
 
    if((fres = f_stat(to, &fileinfo)) == FR_OK)
@@ -752,23 +1102,20 @@ cbm_errno_t _scratch(const char *path) {
    return conv_fresult(fres);
 }
 
-/* Deletes one or more file masks separated by commas
+/* Deletes one or more file masks
    Limits the reported number of scratched files to 99
    Returns CBM_ERROR_SCRATCHED plus number of scratched files
    Returns only the error but not the number of scratched files
    in case of any errors
 */
-static void fs_delete(char *path, packet_t *packet, bool advanced_wildcards) {
+static void fs_delete(char *names[], uint8_t num_names, packet_t *packet, bool advanced_wildcards) {
    cbm_errno_t cres = CBM_ERROR_OK;
    uint16_t files_scratched = 0;
-   char *pnext;
 
-   while(path) {
-      pnext = strchr(path, ',');
-      if(pnext) *pnext = 0;
-      debug_printf("Scratching '%s'...\n", path);
+   for(uint8_t i = 0; i < num_names; i++) {
+      debug_printf("Scratching '%s'...\n", names[i]);
 
-      cres = traverse(path,
+      cres = traverse(names[i],
          advanced_wildcards,
          0,                   // don't limit number of files to scratch
          &files_scratched,    // counts matches
@@ -777,12 +1124,10 @@ static void fs_delete(char *path, packet_t *packet, bool advanced_wildcards) {
          _scratch);
 
       if(cres) break;
-
-      path = pnext ? pnext + 1 : NULL;
    }
 
    if(cres) {
-      packet_write_char(packet, conv_fresult(cres));
+      packet_write_char(packet, cres);
    } else {
       packet_write_char(packet, CBM_ERROR_SCRATCHED);
       packet_write_char(packet, (files_scratched > 99)?99:files_scratched);
@@ -36,10 +36,14 @@
 #define	_USE_STRFUNC	0	/* 0:Disable or 1-2:Enable */
 /* To enable string functions, set _USE_STRFUNC to 1 or 2. */ 
      
+#ifdef PC
+#define	_USE_MKFS		1	/* the PC build formats new FAT image files */
+#else
 #define	_USE_MKFS		0	/* 0:Disable or 1:Enable */
+#endif
 /* To enable f_mkfs() function, set _USE_MKFS to 1 and set _FS_READONLY to 0 */ 
      
-#define	_USE_FASTSEEK	0	/* 0:Disable or 1:Enable */
+#define	_USE_FASTSEEK	1	/* 0:Disable or 1:Enable */
 /* To enable fast seek feature, set _USE_FASTSEEK to 1. */ 
      
 #define _USE_LABEL		0	/* 0:Disable or 1:Enable */
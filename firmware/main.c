@@ -102,6 +102,10 @@ void device_unlock(void) {
 // waiting for a response from the server
 
 void main_delay() {
+#ifndef __AVR__
+	// instead of spinning, sleep until there is something to do
+	device_idle();
+#endif
 	serial_delay();
 }
 
@@ -32,6 +32,7 @@
 #include <string.h>
 #include <stdbool.h>
 
+#include "config.h"
 #include "device.h"
 #include "rtconfig.h"
 #include "rtconfig2.h"
@@ -45,11 +46,14 @@
 #include "term.h"
 #include "led.h"
 
+// devices with more busses can set the number in config.h
+#ifndef MAX_RTCONFIG
 #if HAS_EEPROM
 #define	MAX_RTCONFIG	3
 #else
 #define	MAX_RTCONFIG	1
 #endif
+#endif
 
 #define	RTC_DEBUG	0
 
@@ -160,6 +164,23 @@ static void do_charset() {
 	// so serial_lock is set
 }
 
+static uint8_t flush_callback(int8_t channelno, int8_t errno, packet_t *rxpacket) {
+
+	// the reply carries the write error if any, but there is no one to tell
+	device_unlock();
+	// callback returns 1 to continue receiving on this channel
+        return 0;
+}
+
+static void do_flush() {
+
+        // prepare FS_FLUSH packet
+        packet_set_filled(&outpack, FSFD_CMD, FS_FLUSH, 0);
+
+	// send the FS_FLUSH packet
+        endpoint->provider->submit_call_data(endpoint->provdata, FSFD_CMD, &outpack, &outpack, flush_callback);
+}
+
 static void do_setopt(char *buf, uint8_t len) {
 	// find the correct rtconfig
 	for (uint8_t i = 0; i < num_rtcs; i++) {
@@ -353,6 +374,11 @@ cbm_errno_t rtconfig_set(rtconfig_t *rtc, const char *cmd) {
 			reset_mcu();
 		}
 		break;
+	case 'S':
+		// write back the data buffered in the server, and sync it to disk
+		do_flush();
+		er = CBM_ERROR_OK;
+		break;
 	case 'C':
 		// TEST code
 		// look for "C=<charsetname>"
@@ -40,7 +40,15 @@
 // max. drives for the FAT provider (each holds a current directory)
 #define FAT_MAX_ASSIGNS                 10
 
+// number of emulated drives, each with its own sock488 socket and bus.
+// A bus uses 16 channel numbers, and only channel numbers below FSFD_CMD
+// (124) are available for files, so this can be 7 max.
+#define	SOCK488_MAX_DRIVES		7
+
 // number of maximum open channels
-#define       MAX_CHANNELS              4  
+#define       MAX_CHANNELS              (4 * SOCK488_MAX_DRIVES)
+
+// one runtime config per drive
+#define	MAX_RTCONFIG			SOCK488_MAX_DRIVES
     
 #endif	/*  */
@@ -31,9 +31,14 @@
 #include "debug.h"
 #include "uarthw.h"
 #include "sock488.h"
+#include "sockbuf.h"
+#include "fatimage.h"
 
 void device_init(void) {
 
+#ifdef USE_FAT
+	fatimage_init();
+#endif
 	sock488_init();
 }
 
@@ -61,7 +66,7 @@ void device_setup(int argc, const char *argv[]) {
 			}
 			break;
 		case 'C':
-			// client socket
+			// client socket, given once per emulated drive
 			if (p < argc - 1) {
 			 	p++;
 				socketname = argv[p];
@@ -71,6 +76,17 @@ void device_setup(int argc, const char *argv[]) {
 				printf("setup: parameter -C requires socket name\n");
 			}
 			break;
+#ifdef USE_FAT
+		case 'F':
+			// FAT image file for the FAT provider
+			if (p < argc - 1) {
+			 	p++;
+				fatimage_set_file(argv[p]);
+			} else {
+				printf("setup: parameter -F requires image file name\n");
+			}
+			break;
+#endif
 		}
 		p++;
 	}
@@ -82,3 +98,12 @@ void device_loop(void) {
 	sock488_mainloop_iteration();
 }
 
+/**
+ * main_delay() is called from the main loop and whenever the firmware waits
+ * for a reply from the server, so block until one of the sockets has data
+ */
+void device_idle(void) {
+
+	sockbuf_wait();
+}
+
@@ -0,0 +1,183 @@
+/*
+    Titel:	 Socket server
+    Copyright (C) 2014  Andre Fachat <afachat@gmx.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "ff.h"
+#include "diskio.h"
+
+#include "fatimage.h"
+
+#define	SECTOR_SIZE	512
+
+static const char *image_name = NULL;
+static int image_fd = -1;
+static DSTATUS image_status = STA_NOINIT;
+
+// access statistics, printed on exit, to see how FatFs uses the "card"
+static unsigned long num_reads = 0;
+static unsigned long num_read_sectors = 0;
+static unsigned long num_writes = 0;
+static unsigned long num_write_sectors = 0;
+
+static void fatimage_stats(void) {
+
+	printf("fatimage: %lu reads (%lu sectors), %lu writes (%lu sectors)\n",
+		num_reads, num_read_sectors, num_writes, num_write_sectors);
+}
+
+void fatimage_set_file(const char *name) {
+
+	image_name = name;
+}
+
+void fatimage_init(void) {
+
+	int created = 0;
+
+	if (image_name == NULL) {
+		return;
+	}
+
+	image_fd = open(image_name, O_RDWR);
+	if (image_fd < 0 && errno == EACCES) {
+		image_fd = open(image_name, O_RDONLY);
+		image_status = STA_PROTECT;
+	} else
+	if (image_fd < 0 && errno == ENOENT) {
+		image_fd = open(image_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (image_fd >= 0) {
+			if (ftruncate(image_fd, FATIMAGE_NEW_SIZE) < 0) {
+				printf("fatimage: could not size %s (%s)\n", image_name, strerror(errno));
+				close(image_fd);
+				image_fd = -1;
+			} else {
+				created = 1;
+			}
+		}
+	}
+	if (image_fd < 0) {
+		printf("fatimage: could not open %s (%s)\n", image_name, strerror(errno));
+		return;
+	}
+
+	if (created) {
+		FATFS fs;
+		FRESULT res;
+
+		printf("fatimage: formatting new image %s\n", image_name);
+		f_mount(&fs, "", 0);
+		// no partition table, automatic cluster size
+		res = f_mkfs("", 1, 0);
+		f_mount(NULL, "", 0);
+		if (res != FR_OK) {
+			printf("fatimage: formatting failed with %d\n", res);
+		}
+	}
+
+	atexit(fatimage_stats);
+}
+
+// ----------------------------------------------------------------------
+// FatFs disk I/O interface, see fatfs/diskio.h
+
+DSTATUS disk_initialize(BYTE pdrv) {
+
+	if (pdrv != 0 || image_fd < 0) {
+		return STA_NOINIT | STA_NODISK;
+	}
+	image_status &= ~STA_NOINIT;
+	return image_status;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+
+	if (pdrv != 0 || image_fd < 0) {
+		return STA_NOINIT | STA_NODISK;
+	}
+	return image_status;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+
+	size_t len = (size_t) count * SECTOR_SIZE;
+
+	if (pdrv != 0 || count == 0) return RES_PARERR;
+	if (image_status & STA_NOINIT) return RES_NOTRDY;
+
+	num_reads++;
+	num_read_sectors += count;
+
+	if (pread(image_fd, buff, len, (off_t) sector * SECTOR_SIZE) != (ssize_t) len) {
+		return RES_ERROR;
+	}
+	return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+
+	size_t len = (size_t) count * SECTOR_SIZE;
+
+	if (pdrv != 0 || count == 0) return RES_PARERR;
+	if (image_status & STA_NOINIT) return RES_NOTRDY;
+	if (image_status & STA_PROTECT) return RES_WRPRT;
+
+	num_writes++;
+	num_write_sectors += count;
+
+	if (pwrite(image_fd, buff, len, (off_t) sector * SECTOR_SIZE) != (ssize_t) len) {
+		return RES_ERROR;
+	}
+	return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+
+	struct stat st;
+
+	if (pdrv != 0) return RES_PARERR;
+	if (image_status & STA_NOINIT) return RES_NOTRDY;
+
+	switch (cmd) {
+	case CTRL_SYNC:
+		// written data is in the host's page cache already
+		return RES_OK;
+	case GET_SECTOR_COUNT:
+		if (fstat(image_fd, &st) < 0) {
+			return RES_ERROR;
+		}
+		*(DWORD*)buff = st.st_size / SECTOR_SIZE;
+		return RES_OK;
+	case GET_SECTOR_SIZE:
+		*(WORD*)buff = SECTOR_SIZE;
+		return RES_OK;
+	case GET_BLOCK_SIZE:
+		*(DWORD*)buff = 1;
+		return RES_OK;
+	}
+	return RES_PARERR;
+}
+
@@ -0,0 +1,43 @@
+/*
+    Titel:	 Socket server
+    Copyright (C) 2014  Andre Fachat <afachat@gmx.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA  02110-1301, USA.
+*/
+
+/**
+ * FatFs disk I/O on a FAT image file, replacing the SD card of the
+ * standalone devices, so the FAT provider can be run on the PC
+ */
+
+#ifndef FATIMAGE_H
+#define FATIMAGE_H
+
+// size of a newly created image file
+#define	FATIMAGE_NEW_SIZE	(32l * 1024 * 1024)
+
+/**
+ * set the name of the image file; called from device_setup()
+ */
+void fatimage_set_file(const char *name);
+
+/**
+ * open the image file; if it does not exist, it is created and
+ * formatted with an empty FAT file system
+ */
+void fatimage_init(void);
+
+#endif
@@ -24,99 +24,110 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
-#include <time.h>
 
 #include "bus.h"
 #include "sock488.h"
 #include "socket.h"
+#include "sockbuf.h"
+#include "config.h"
 
 
 #undef	S488_DEBUG
 
 
-static bus_t sock488_bus;
-
-static const char *socket_name = NULL;
-static int socket_fd = -1;
+/**
+ * Each drive is a separate bus on its own socket, with its own device
+ * address, runtime config and channel numbers (see bus_init_bus()). All
+ * drives share the single connection to the server.
+ */
+typedef struct {
+	const char	*socket_name;
+	int		listen_fd;
+	char		name[12];	// bus / rtconfig name, for X options
+	bus_t		bus;
+	sockbuf_t	buf;
+} sock488_t;
+
+static sock488_t drives[SOCK488_MAX_DRIVES];
+static uint8_t num_drives = 0;
+static uint8_t num_connected = 0;
 
 void sock488_set_socket(const char *socketname) {
 
-	socket_name = socketname;
+	if (num_drives >= SOCK488_MAX_DRIVES) {
+		printf("Too many drives, ignoring socket %s\n", socketname);
+		return;
+	}
+	drives[num_drives].socket_name = socketname;
+	num_drives++;
 }
 
 void sock488_init() {
 
-	bus_init_bus("sock488", &sock488_bus);
-	sock488_bus.active = 1;
-
-	if (socket_name == NULL) {
+	if (num_drives == 0) {
 		printf("No client socket name given - terminating!\n");
 		exit(-3);
 	}
 
-	socket_fd = socket_open(socket_name);
+	// create all sockets first, so the clients can connect in any order
+	for (uint8_t i = 0; i < num_drives; i++) {
+		sock488_t *drv = &drives[i];
 
-	if (socket_fd < 0) {
-		printf("Error opening sock488 socket\n");
-		exit(-1);
+		drv->listen_fd = socket_listen(drv->socket_name);
+		if (drv->listen_fd < 0) {
+			printf("Error opening sock488 socket\n");
+			exit(-1);
+		}
+	}
+
+	for (uint8_t i = 0; i < num_drives; i++) {
+		sock488_t *drv = &drives[i];
+
+		// first drive keeps the old name, so existing X options still work
+		if (i == 0) {
+			strcpy(drv->name, "sock488");
+		} else {
+			snprintf(drv->name, sizeof(drv->name), "sock488-%d", i);
+		}
+
+		bus_init_bus(drv->name, &drv->bus);
+		drv->bus.active = 1;
+		// consecutive device addresses, can be changed with U= X option
+		drv->bus.rtconf.device_address += i;
+
+		int socket_fd = socket_accept(drv->listen_fd);
+
+		if (socket_fd < 0) {
+			printf("Error opening sock488 socket\n");
+			exit(-1);
+		}
+
+		sockbuf_init(&drv->buf, socket_fd, "s488 ");
+		// a client going away only ends its own drive
+		drv->buf.exit_on_eof = 0;
+		num_connected++;
 	}
 }
 
 /**
- * submit a byte to the send buffer
+ * number of bytes a command starting with cmd occupies on the socket
  */
-static void send_byte(int8_t data) {
- 	ssize_t wsize = write(socket_fd, &data, 1);
-	while (wsize < 0 && errno == EAGAIN) {
-		// wait 10ms
-		struct timespec sleeptime = { 0, 10000000l };
-		nanosleep(&sleeptime, NULL);
- 	       	wsize = write(socket_fd, &data, 1);
-	}
+static uint8_t cmd_len(uint8_t cmd) {
 
-       	if (wsize == 0) {
-               printf("Could not write to fd=%d, data=%02x\n", socket_fd, data);
-       	} else
-       	if (wsize < 0) {
-               printf("Error writing %02x to fd %d: errno=%d (%s)\n", data, socket_fd, errno, strerror(errno));
-        }
-}
+	cmd &= ~(S488_EOF | S488_ACK);
 
-static char read_byte() {
-	char data;
-
-	ssize_t rsize = read(socket_fd, &data, 1);
-	if (rsize == 0) {
-                printf("End of file on s488 socket (fd=%d)!\n", socket_fd);
-                exit(-1);
-        } else
-        if (rsize < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        // ok, just no data currently available
-                        return -1;
-                }
-                printf("Unrecoverable error on read ->%d (%s)\n", errno, strerror(errno));
-                exit(-2);
-        }
-
-	return data;
+	return (cmd == S488_ATN || cmd == S488_SEND) ? 2 : 1;
 }
 
 /**
- * this is called from the main loop. It has to check whether we get some
- * data from the socket and feeds it to the bus_* methods:
- *	bus_attention()
- * 	bus_sendbyte()
- * It also offers bytes from
- *	bus_receivebyte()
- * to the server and acknowledges it
+ * handle a single, completely received command
  */
-void sock488_mainloop_iteration() {
+static void handle_cmd(bus_t *bus, sockbuf_t *sb) {
 
 	int16_t par_status = 0;
 
 	uint8_t tmp = 0;
-	uint8_t indata = read_byte();
+	uint8_t indata = sockbuf_get(sb);
 	uint8_t data = 0;
 
 	uint8_t eof = indata & S488_EOF;
@@ -127,41 +138,41 @@ void sock488_mainloop_iteration() {
 	switch (indata) {
 
 		case S488_ATN:
-			data = read_byte();
-			bus_attention(&sock488_bus, data);
+			data = sockbuf_get(sb);
+			bus_attention(bus, data);
 			break;
 		case S488_SEND:
-			data = read_byte();
-			bus_sendbyte(&sock488_bus, data, eof ? BUS_FLUSH : 0);
+			data = sockbuf_get(sb);
+			bus_sendbyte(bus, data, eof ? BUS_FLUSH : 0);
 			break;
 		case S488_REQ:
 			if (ack) {
 				// acknowledge old byte
-				bus_receivebyte(&sock488_bus, &tmp, 0);
+				bus_receivebyte(bus, &tmp, 0);
 			}
 
 			eof = 0;
 			tout = 0;
 
-			par_status = bus_receivebyte(&sock488_bus, &data, BUS_PRELOAD);
+			par_status = bus_receivebyte(bus, &data, BUS_PRELOAD);
 #ifdef S488_DEBUG
 			printf("got: %02x, e=%02x, a=%02x, t=%02x -> par_status=%04x, data=%02x\n", indata, eof, ack, tout, par_status, data);
 #endif
 			if (par_status & STAT_RDTIMEOUT) {
 				tout = S488_TIMEOUT;
-				send_byte(S488_OFFER | tout);
+				sockbuf_put(sb, S488_OFFER | tout);
 			} else {
 				if (par_status & STAT_EOF) {
 					eof = S488_EOF;
 				}
-				send_byte(S488_OFFER | eof );
-				send_byte(data);
+				sockbuf_put(sb, S488_OFFER | eof );
+				sockbuf_put(sb, data);
 			}
 			break;
 		case 0:
 			if (ack) {
 				// acknowledge old byte
-				bus_receivebyte(&sock488_bus, &tmp, 0);
+				bus_receivebyte(bus, &tmp, 0);
 			}
 			break;
 		default:
@@ -170,7 +181,60 @@ void sock488_mainloop_iteration() {
 
 }
 
+/**
+ * this is called from the main loop. It has to check whether we get some
+ * data from the socket and feeds it to the bus_* methods:
+ *	bus_attention()
+ * 	bus_sendbyte()
+ * It also offers bytes from
+ *	bus_receivebyte()
+ * to the server and acknowledges it
+ *
+ * All complete commands received with a single read() are processed,
+ * and the replies are sent with a single write() at the end.
+ * While commands are processed, the bus sockets are not considered in
+ * sockbuf_wait(), so that waiting for the server does not wake up on
+ * bus data that can only be handled in the next iteration.
+ *
+ * The drives are served one after the other.
+ */
+void sock488_mainloop_iteration() {
+
+	// do not wake up on bus data while we wait for the server
+	for (uint8_t i = 0; i < num_drives; i++) {
+		drives[i].buf.idle = 0;
+	}
+
+	for (uint8_t i = 0; i < num_drives; i++) {
+		sockbuf_t *sb = &drives[i].buf;
+		bus_t *bus = &drives[i].bus;
+
+		if (sb->fd < 0) {
+			continue;
+		}
 
+		sockbuf_fill(sb);
 
+		if (sb->fd < 0) {
+			// client has gone, so close its files
+			channel_close_range(bus_secaddr_adjust(bus, 0), bus_secaddr_adjust(bus, CMD_SECADDR));
+			num_connected--;
+			if (num_connected == 0) {
+				printf("All sock488 clients gone - terminating!\n");
+				exit(-1);
+			}
+			continue;
+		}
+
+		while (sockbuf_avail(sb) > 0
+			&& sockbuf_avail(sb) >= cmd_len(sockbuf_peek(sb, 0))) {
+			handle_cmd(bus, sb);
+		}
 
+		sockbuf_flush(sb, 1);
+	}
 
+	for (uint8_t i = 0; i < num_drives; i++) {
+		drives[i].buf.idle = 1;
+	}
+}
@@ -32,6 +32,9 @@
 
 void sock488_init(void);
 
+// add a drive listening on the given socket; the n-th drive (from 0)
+// gets device address default+n and the name "sock488-<n>" ("sock488"
+// for the first one) for X options
 void sock488_set_socket(const char *socket_name);
 
 void sock488_mainloop_iteration();
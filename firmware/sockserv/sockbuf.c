@@ -0,0 +1,179 @@
+/*
+    Titel:	 Socket server
+    Copyright (C) 2014  Andre Fachat <afachat@gmx.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA  02110-1301, USA.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "sockbuf.h"
+
+static sockbuf_t *buffers[SOCKBUF_MAX];
+static uint8_t num_buffers = 0;
+
+void sockbuf_init(sockbuf_t *sb, int fd, const char *prefix) {
+
+	sb->fd = fd;
+	sb->prefix = prefix;
+	sb->rx_rp = 0;
+	sb->rx_wp = 0;
+	sb->tx_rp = 0;
+	sb->tx_wp = 0;
+	sb->idle = 1;
+	sb->active = 0;
+	sb->exit_on_eof = 1;
+
+	if (num_buffers < SOCKBUF_MAX) {
+		buffers[num_buffers++] = sb;
+	} else {
+		printf("%sToo many socket buffers, not waiting on fd=%d\n", prefix, fd);
+	}
+}
+
+uint16_t sockbuf_fill(sockbuf_t *sb) {
+
+	if (sb->fd < 0) {
+		return sb->rx_wp - sb->rx_rp;
+	}
+
+	if (sb->rx_rp == sb->rx_wp) {
+		sb->rx_rp = 0;
+		sb->rx_wp = 0;
+	} else
+	if (sb->rx_rp > 0) {
+		// move a partial command to the front
+		memmove(sb->rxbuf, sb->rxbuf + sb->rx_rp, sb->rx_wp - sb->rx_rp);
+		sb->rx_wp -= sb->rx_rp;
+		sb->rx_rp = 0;
+	}
+
+	if (sb->rx_wp >= SOCKBUF_SIZE) {
+		return sb->rx_wp;
+	}
+
+	ssize_t rsize = read(sb->fd, sb->rxbuf + sb->rx_wp, SOCKBUF_SIZE - sb->rx_wp);
+	if (rsize == 0) {
+		printf("%sEnd of file on socket (fd=%d)!\n", sb->prefix, sb->fd);
+		if (sb->exit_on_eof) {
+			exit(-1);
+		}
+		close(sb->fd);
+		sb->fd = -1;
+	} else
+	if (rsize < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			printf("%sUnrecoverable error on read ->%d (%s)\n", sb->prefix, errno, strerror(errno));
+			exit(-2);
+		}
+		// ok, just no data currently available
+	} else {
+		sb->rx_wp += rsize;
+		sb->active = 1;
+	}
+	return sb->rx_wp - sb->rx_rp;
+}
+
+int16_t sockbuf_get(sockbuf_t *sb) {
+
+	if (sb->rx_rp == sb->rx_wp) {
+		if (sockbuf_fill(sb) == 0) {
+			return -1;
+		}
+	}
+	return sb->rxbuf[sb->rx_rp++];
+}
+
+void sockbuf_put(sockbuf_t *sb, uint8_t data) {
+
+	if (sb->tx_wp >= SOCKBUF_SIZE) {
+		sockbuf_flush(sb, 1);
+	}
+	sb->txbuf[sb->tx_wp++] = data;
+}
+
+void sockbuf_flush(sockbuf_t *sb, uint8_t wait) {
+
+	while (sb->fd >= 0 && sb->tx_rp < sb->tx_wp) {
+		ssize_t wsize = write(sb->fd, sb->txbuf + sb->tx_rp, sb->tx_wp - sb->tx_rp);
+		if (wsize < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				printf("%sError writing to fd %d: errno=%d (%s)\n", sb->prefix, sb->fd, errno, strerror(errno));
+				// drop the data, as the original byte-wise code did
+				break;
+			}
+			if (!wait) {
+				return;
+			}
+			struct pollfd pfd = { sb->fd, POLLOUT, 0 };
+			poll(&pfd, 1, -1);
+		} else
+		if (wsize == 0) {
+			printf("%sCould not write to fd=%d\n", sb->prefix, sb->fd);
+			break;
+		} else {
+			sb->tx_rp += wsize;
+		}
+	}
+	sb->tx_rp = 0;
+	sb->tx_wp = 0;
+}
+
+void sockbuf_wait(void) {
+
+	struct pollfd pfds[SOCKBUF_MAX];
+	uint8_t n = 0;
+	uint8_t active = 0;
+
+	for (uint8_t i = 0; i < num_buffers; i++) {
+		sockbuf_t *sb = buffers[i];
+
+		sockbuf_flush(sb, 1);
+
+		active |= sb->active;
+		sb->active = 0;
+	}
+
+	if (active) {
+		return;
+	}
+
+	for (uint8_t i = 0; i < num_buffers; i++) {
+		sockbuf_t *sb = buffers[i];
+
+		if (sb->idle && sb->fd >= 0) {
+			if (sockbuf_avail(sb) > 0) {
+				// still work to do
+				return;
+			}
+			pfds[n].fd = sb->fd;
+			pfds[n].events = POLLIN;
+			pfds[n].revents = 0;
+			n++;
+		}
+	}
+
+	if (n > 0) {
+		poll(pfds, n, SOCKBUF_WAIT_MS);
+	}
+}
+
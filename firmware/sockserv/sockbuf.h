@@ -0,0 +1,116 @@
+/*
+    Titel:	 Socket server
+    Copyright (C) 2014  Andre Fachat <afachat@gmx.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA  02110-1301, USA.
+*/
+
+/**
+ * Buffered byte I/O on a non-blocking socket.
+ *
+ * Bytes are received with a single large read() when the receive buffer
+ * runs empty, and transmit bytes are collected until sockbuf_flush()
+ * pushes them out with a single write().
+ */
+
+#ifndef SOCKBUF_H
+#define SOCKBUF_H
+
+#include <inttypes.h>
+
+#include "config.h"
+
+#define	SOCKBUF_SIZE	4096
+
+// max number of buffers that can be waited on:
+// the server connection plus one per drive
+#define	SOCKBUF_MAX	(1 + SOCK488_MAX_DRIVES)
+
+// max time to sleep in sockbuf_wait() when nothing happens
+#define	SOCKBUF_WAIT_MS	1000
+
+typedef struct {
+	int		fd;
+	const char	*prefix;	// log prefix
+	uint8_t		idle;		// owner waits for input, see sockbuf_wait()
+	uint8_t		active;		// data received since last sockbuf_wait()
+	uint8_t		exit_on_eof;	// terminate on EOF, otherwise close the socket
+	uint16_t	rx_rp;
+	uint16_t	rx_wp;
+	uint16_t	tx_rp;
+	uint16_t	tx_wp;
+	uint8_t		rxbuf[SOCKBUF_SIZE];
+	uint8_t		txbuf[SOCKBUF_SIZE];
+} sockbuf_t;
+
+/**
+ * set up the buffer for the given socket and register it with
+ * sockbuf_wait()
+ */
+void sockbuf_init(sockbuf_t *sb, int fd, const char *prefix);
+
+/**
+ * read whatever is available from the socket into the receive buffer;
+ * returns the number of bytes available in the buffer.
+ * Terminates the program on read errors. On EOF the program is terminated
+ * as well, unless exit_on_eof is cleared; then the socket is closed and
+ * fd set to -1.
+ */
+uint16_t sockbuf_fill(sockbuf_t *sb);
+
+/**
+ * number of received bytes available without reading the socket
+ */
+static inline uint16_t sockbuf_avail(sockbuf_t *sb) {
+	return sb->rx_wp - sb->rx_rp;
+}
+
+/**
+ * look at a received byte without consuming it; offset must be
+ * less than sockbuf_avail()
+ */
+static inline uint8_t sockbuf_peek(sockbuf_t *sb, uint16_t offset) {
+	return sb->rxbuf[sb->rx_rp + offset];
+}
+
+/**
+ * get a byte from the receive buffer, refilling it from the socket
+ * when empty. Returns -1 when no byte is available.
+ */
+int16_t sockbuf_get(sockbuf_t *sb);
+
+/**
+ * queue a byte for sending; flushes (and waits) if the buffer is full
+ */
+void sockbuf_put(sockbuf_t *sb, uint8_t data);
+
+/**
+ * write out the transmit buffer. If wait is set, wait until all of
+ * it has been written, otherwise only write what the socket takes.
+ */
+void sockbuf_flush(sockbuf_t *sb, uint8_t wait);
+
+/**
+ * block until one of the sockets of the buffers marked idle becomes
+ * readable, or SOCKBUF_WAIT_MS have passed. Pending transmit data of
+ * all buffers is flushed first, and there is no wait at all if a
+ * buffer still has unprocessed received data, or if data has been
+ * received since the last call (so the caller gets the chance to
+ * check whether that was what it waited for).
+ */
+void sockbuf_wait(void);
+
+#endif
@@ -34,17 +34,17 @@
 #define	LOG_PREFIX	"s488_sock "
 
 /**
- * open a named unix socket, listen on it and return the first connection
+ * open a named unix socket and listen on it
  *
  * TODO: unify with pcserver/socket.c
  */
-int socket_open(const char *socketname) {
+int socket_listen(const char *socketname) {
 
         printf(LOG_PREFIX "Opening socket %s for requests\n", socketname);
 
-        int sockfd, clientfd;
-        socklen_t servlen, clientlen;
-        struct sockaddr_un client_addr, server_addr;
+        int sockfd;
+        socklen_t servlen;
+        struct sockaddr_un server_addr;
 
         sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
         if (sockfd < 0) {
@@ -65,6 +65,18 @@ int socket_open(const char *socketname) {
 
         listen(sockfd,0);
 
+        return sockfd;
+}
+
+/**
+ * wait for and return the first connection on a socket from socket_listen()
+ */
+int socket_accept(int sockfd) {
+
+        int clientfd;
+        socklen_t clientlen;
+        struct sockaddr_un client_addr;
+
         clientlen = sizeof(client_addr);
         clientfd = accept(sockfd,(struct sockaddr *)&client_addr,&clientlen);
         while (clientfd < 0) {
@@ -85,4 +97,3 @@ int socket_open(const char *socketname) {
 }
 
 
-
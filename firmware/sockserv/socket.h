@@ -21,6 +21,8 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
-int socket_open(const char *socket_name);
+int socket_listen(const char *socket_name);
+
+int socket_accept(int sockfd);
 
 #endif
@@ -36,11 +36,13 @@
 
 #include "debug.h"
 #include "uarthw.h"
+#include "sockbuf.h"
 
 #define LOG_PREFIX 	"s488_uart "
 
 static const char *socket_name = NULL;
 static int socket_fd = -1;
+static sockbuf_t uart_buf;
 
 void uarthw_set_socket(const char *socketname) {
 	socket_name = socketname;
@@ -103,6 +105,8 @@ void uarthw_init() {
 		printf(LOG_PREFIX "Terminating!\n");
 		exit (-3);
 	}
+
+	sockbuf_init(&uart_buf, socket_fd, LOG_PREFIX);
 }
 
 /**
@@ -115,22 +119,13 @@ int8_t uarthw_can_send() {
 
 /**
  * submit a byte to the send buffer
+ *
+ * The byte is only queued; the buffer is written out with a single
+ * write() on the next uarthw_receive() call, i.e. once per serial_delay()
+ * after the serial code has queued all it currently has to send.
  */
 void uarthw_send(int8_t data) {
-        ssize_t wsize = write(socket_fd, &data, 1);
-        while (wsize < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                // wait 10ms
-                struct timespec sleeptime = { 0, 10000000l };
-                nanosleep(&sleeptime, NULL);
-                wsize = write(socket_fd, &data, 1);
-        }
-
-	if (wsize == 0) {
-		printf(LOG_PREFIX "Could not write to fd=%d, data=%02x\n", socket_fd, data);
-	} else
-	if (wsize < 0) { 
-		printf(LOG_PREFIX "Error writing to server on fd %d: errno=%d (%s)\n", socket_fd, errno, strerror(errno));
-	}
+	sockbuf_put(&uart_buf, data);
 }
 
 /**
@@ -139,27 +134,15 @@ void uarthw_send(int8_t data) {
  */
 int16_t uarthw_receive() {
 
-	uint8_t data;
-
 	if (socket_fd < 0) {
 		return -1;
 	}
 
-	ssize_t rsize = read(socket_fd, &data, 1);
-	if (rsize == 0) {
-		printf(LOG_PREFIX "End of file on socket!\n");
-		exit(-1);
-	} else
-	if (rsize < 0) {
-		if (errno == EAGAIN || errno == EWOULDBLOCK) {
-			// ok, just no data currently available
-			return -1;
-		}
-		printf(LOG_PREFIX "Unrecoverable error on read ->%d (%s)\n", errno, strerror(errno));
-		exit(-2);
+	if (sockbuf_avail(&uart_buf) == 0) {
+		// push out what has been queued before polling for new data
+		sockbuf_flush(&uart_buf, 1);
 	}
 
-	return ((int16_t)data) & 0xff;
+	return sockbuf_get(&uart_buf);
 }
 
-
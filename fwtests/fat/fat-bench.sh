@@ -0,0 +1,36 @@
+#!/bin/bash
+#
+# Runs the fwrunner load generator against the firmware FAT provider,
+# on a FAT image file (see the sockserv firmware -F option) that is
+# created and formatted by the firmware in the run directory.
+#
+# Use as "./fat-bench.sh -C -q -L <loads> -b <iterations>", see ../func.sh
+# for the other options.
+#
+
+THISDIR=`dirname $0`
+
+# necessary files to copy to temp
+TESTFILES=""
+
+# files to compare after test
+COMPAREFILES=""
+
+# server options
+SERVEROPTS="-v"
+
+#firmware options
+FWOPTS=-Xsock488:E=-
+
+# FAT image file in the run directory
+FATIMAGE="fat.img"
+
+# assign drive 0 to the FAT provider before the load generator runs
+LOADGENOPTS="-c A0:FAT=/"
+
+FILTER=
+
+########################
+# source and execute actual functionality
+. ../func.sh
+
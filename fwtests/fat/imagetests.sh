@@ -0,0 +1,36 @@
+#!/bin/bash
+#
+# call this script without params to run all *.frs tests in this directory
+# against the firmware FAT provider, on the FAT image file fat.img (see the
+# sockserv firmware -F option), which holds the disk images F255.D64 (one
+# file of 255 bytes) and BIG.D64 (one file of 664 blocks).
+# Providing a .frs file as parameter only runs the given test script
+#
+# For the options see ../func.sh
+#
+
+THISDIR=`dirname $0`
+
+# necessary files to copy to temp
+TESTFILES="fat.img"
+
+# files to compare after test
+COMPAREFILES=""
+
+# server options
+SERVEROPTS="-v"
+
+#firmware options
+# switch off drive in error messages; also restricts track/sector to two chars
+FWOPTS=-Xsock488:E=-
+
+# FAT image file in the run directory
+FATIMAGE="fat.img"
+
+EXCLUDE=""
+FILTER=
+
+########################
+# source and execute actual functionality
+. ../func.sh
+
@@ -47,6 +47,10 @@ function usage() {
 	echo "       -e                      ignore an expected DIFF and show the real results"
 	echo "       +E                      create an expected ERR file that is compared to later outcomes"
 	echo "       -E                      ignore an expected ERR file and show the real results"
+	echo "       -L <loads>              run the fwrunner load generator with the given loads"
+	echo "                               (load,save,dir,rel,seq or all) instead of the scripts"
+	echo "       -b <n>                  number of load generator iterations (default 1), results"
+	echo "                               are written to loadgen.bench"
 	echo "       -h                      show this help"
 }
 
@@ -106,6 +110,9 @@ DIFFIGNORE=0
 ERRCREATE=0
 ERRIGNORE=0
 
+LOADGEN=""
+ITERATIONS=1
+
 TMPDIR=`mktemp -d`
 OWNDIR=1	
 
@@ -174,6 +181,22 @@ while test $# -gt 0; do
 	OWNDIR=0
 	shift 2;
 	;;
+  -L)
+	if test $# -lt 2; then
+		echo "Option -L needs the list of loads as parameter"
+		exit -1;
+	fi;
+	LOADGEN="$2"
+	shift 2;
+	;;
+  -b)
+	if test $# -lt 2; then
+		echo "Option -b needs the number of iterations as parameter"
+		exit -1;
+	fi;
+	ITERATIONS="$2"
+	shift 2;
+	;;
   +e)
 	DIFFCREATE=1
 	shift;
@@ -234,7 +257,10 @@ fi
 ########################
 
 # scripts to run
-if [ "x$*" = "x" ]; then
+if [ "x$LOADGEN" != "x" ]; then
+	# load generator replaces the scripts
+	TESTSCRIPTS="loadgen"
+elif [ "x$*" = "x" ]; then
         SCRIPTS=$THISDIR/*${FILTER}.frs
         SCRIPTS=`basename -a $SCRIPTS`;
 
@@ -279,6 +305,12 @@ fi;
 
 DEBUGFILE="$TMPDIR"/gdb.ex
 
+# FAT image file for the firmware FAT provider; created and formatted
+# by the firmware if it does not exist
+if test "x$FATIMAGE" != "x"; then
+	FWOPTS="$FWOPTS -F $TMPDIR/$FATIMAGE"
+fi
+
 
 ########################
 # stdout
@@ -302,9 +334,13 @@ fi
 # prepare files
 #
 
-for i in $TESTSCRIPTS; do
-	cp "$THISDIR/$i" "$TMPDIR"
-done;
+if test "x$LOADGEN" = "x"; then
+	for i in $TESTSCRIPTS; do
+		cp "$THISDIR/$i" "$TMPDIR"
+	done;
+fi;
+
+RESULTDIR=`pwd`
 
 
 ########################
@@ -334,6 +370,12 @@ for script in $TESTSCRIPTS; do
 	CSOCKET=csocket_$script
 	RUNNERLOG=runnerlog_$script
 
+	if test "x$LOADGEN" = "x"; then
+		RUNNERARGS="$script"
+	else
+		RUNNERARGS="$LOADGENOPTS -L $LOADGEN -b $ITERATIONS -r $RESULTDIR/$script.bench"
+	fi
+
 	# overwrite test files in each iteration, just in case
 	for i in $TESTFILES; do
 		if [ -f ${THISDIR}/${i}.gz ]; then
@@ -373,8 +415,8 @@ for script in $TESTSCRIPTS; do
 		if test "x$RDEBUG" != "x"; then
 
 			# start test runner before server, so we can use gdb on firmware
-			echo "Starting runner as: $RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $script"
-			$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $script &
+			echo "Starting runner as: $RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $RUNNERARGS"
+			$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $RUNNERARGS &
 			RUNNERPID=$!
 			trap "kill -TERM $SERVERPID $RUNNERPID" INT
 
@@ -393,15 +435,15 @@ for script in $TESTSCRIPTS; do
 			# wait till server is up, just to be sure
 			while [ ! -S $TMPDIR/$CSOCKET ]; do sleep 0.1; done
 
-			echo "Starting runner as: $RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $script"
-			#$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $script 2>&1 | sed -u -e "s%$TMPDIR%%g" | tail -n +3 | tee $TMPDIR/$RUNNERLOG;
-			$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $script 2>&1 | tee $TMPDIR/$RUNNERLOG.1;
+			echo "Starting runner as: $RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $RUNNERARGS"
+			#$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $RUNNERARGS 2>&1 | sed -u -e "s%$TMPDIR%%g" | tail -n +3 | tee $TMPDIR/$RUNNERLOG;
+			$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $RUNNERARGS 2>&1 | tee $TMPDIR/$RUNNERLOG.1;
 			RESULT=${PIPESTATUS[0]}
 			# remove tempdir from log, so it can be compared
 			cat $TMPDIR/$RUNNERLOG.1 | sed -e "s%$TMPDIR%%g" | tail -n +3 > $TMPDIR/$RUNNERLOG
 			rm $TMPDIR/$RUNNERLOG.1 
 
-			#gdb -ex "break main" -ex "run $RVERBOSE -w -d $TMPDIR/$CSOCKET $script" $RUNNER
+			#gdb -ex "break main" -ex "run $RVERBOSE -w -d $TMPDIR/$CSOCKET $RUNNERARGS" $RUNNER
 			#RESULT=$?
 			
 			if [ $ERRCREATE -eq 1 ]; then
@@ -451,7 +493,7 @@ for script in $TESTSCRIPTS; do
 		#fi;
 	else
 		# start testrunner before server and in background, so gdb can take console
-		$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $script &
+		$RUNNER $RVERBOSE -w -d $TMPDIR/$CSOCKET $RUNNERARGS &
 		$FIRMWARE $FWOPTS -S $TMPDIR/$SSOCKET -C $TMPDIR/$CSOCKET &
 		SERVERPID=$!
 		trap "kill -TERM $SERVERPID" INT
@@ -539,6 +581,10 @@ if test $CLEAN -ge 2; then
 		rm -f $TMPDIR/$i;
 	done;
 
+	if test "x$FATIMAGE" != "x"; then
+		rm -f $TMPDIR/$FATIMAGE;
+	fi;
+
         rm -f $TMPDIR/stdout.log  
         rm -f $TMPDIR/summary.log  
 
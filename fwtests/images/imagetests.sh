@@ -0,0 +1,34 @@
+#!/bin/bash
+#
+# call this script without params to run all *.frs tests in this directory
+# (except the *-ram.frs tests, see ramtests.sh)
+# against the server file system, with the (empty) disk image base.d64
+# accessed by path like "BASE.D64/FILE", not assigned to a drive. This
+# mounts the image on each open, from the cache of unused image endpoints
+# when it is still there.
+# Providing a .frs file as parameter only runs the given test script
+#
+# For the options see ../func.sh
+#
+
+THISDIR=`dirname $0`
+
+# necessary files to copy to temp
+TESTFILES="base.d64"
+
+# files to compare after test
+COMPAREFILES=""
+
+# server options
+SERVEROPTS="-v -A0:fs=."
+
+#firmware options
+# switch off drive in error messages; also restricts track/sector to two chars
+FWOPTS=-Xsock488:E=-
+
+EXCLUDE="*-ram.frs"
+FILTER=
+
+########################
+# source and execute actual functionality
+. ../func.sh
@@ -0,0 +1,35 @@
+#!/bin/bash
+#
+# call this script without params to run all *-ram.frs tests in this directory
+# against the (empty) disk image base.d64, assigned to drive 0 with the "ram"
+# option, so it is kept in memory. The tests write the image back with "XS"
+# before it is compared.
+# Providing a .frs file as parameter only runs the given test script
+#
+# For the options see ../func.sh
+#
+
+THISDIR=`dirname $0`
+
+# necessary files to copy to temp
+TESTFILES="base.d64"
+
+# the (empty) journal is left next to the image
+CUSTOMPOSTCMD="rm -f base.d64.jnl"
+
+# files to compare after test
+COMPAREFILES="base.d64"
+
+# server options
+SERVEROPTS="-v -A0:fs=base.d64,ram"
+
+#firmware options
+# switch off drive in error messages; also restricts track/sector to two chars
+FWOPTS=-Xsock488:E=-
+
+EXCLUDE=""
+FILTER=ram
+
+########################
+# source and execute actual functionality
+. ../func.sh
@@ -34,70 +34,112 @@
 //------------------------------------------------------------------------------------
 // Mapping from channel number for open files to endpoint providers
 // These are set when the channel is opened
-// TODO: make mem_alloc'd
 
+// used when no connection has selected its table (yet)
+static chantable_t default_table;
 
-chan_t chantable[MAX_NUMBER_OF_ENDPOINTS];
+static chantable_t *chantable = &default_table;
 
+// number of open channels over all tables
+static int num_open = 0;
+
+
+static void chan_clear(chan_t *chan) {
+	chan->channo = -1;
+	chan->fp = NULL;
+	chan->num_pattern = 0;
+	chan->searchpattern = NULL;
+	chan->searchdrv = -1;
+	chan->packed = 0;
+	chan->nowrap = 0;
+	chan->drive = -1;
+}
+
+static void chan_free_pattern(chan_t *chan) {
+	drive_and_name_free(chan->searchpattern, chan->num_pattern);
+	mem_free(chan->searchpattern);
+}
+
+void channel_table_init(chantable_t *tab) {
+	for (int i = 0; i < MAX_CHANNEL_NO; i++) {
+		chan_clear(&tab->chan[i]);
+	}
+}
+
+void channel_table_free(chantable_t *tab) {
+	for (int i = 0; i < MAX_CHANNEL_NO; i++) {
+		chan_t *chan = &tab->chan[i];
+		if (chan->channo >= 0) {
+			log_warn("Closing open file for channel %d\n", chan->channo);
+			if (chan->fp != NULL) {
+				chan->fp->handler->fclose(chan->fp, NULL, NULL);
+			}
+			chan_free_pattern(chan);
+			chan_clear(chan);
+			num_open--;
+		}
+	}
+	if (chantable == tab) {
+		chantable = &default_table;
+	}
+}
+
+void channel_use(chantable_t *tab) {
+	chantable = tab;
+}
 
 void channel_init() {
-       int i;
-        for(i=0;i<MAX_NUMBER_OF_ENDPOINTS;i++) {
-          chantable[i].channo = -1;
-        }
+	channel_table_init(&default_table);
+	chantable = &default_table;
 }
 
 chan_t *channel_get(int chan) {
 
-       int i;
-        for(i=0;i<MAX_NUMBER_OF_ENDPOINTS;i++) {
-               if (chantable[i].channo == chan) {
-                       return &chantable[i];
-               }
-        }
-       log_info("Did not find open file for channel %d\n", chan);
-       return NULL;
+	if (chan >= 0 && chan < MAX_CHANNEL_NO
+		&& chantable->chan[chan].channo == chan) {
+		return &chantable->chan[chan];
+	}
+	log_info("Did not find open file for channel %d\n", chan);
+	return NULL;
 }
 
 void channel_free(int channo) {
-       int i;
-        for(i=0;i<MAX_NUMBER_OF_ENDPOINTS;i++) {
-               if (chantable[i].channo == channo) {
-                       chantable[i].channo = -1;
-                       chantable[i].fp = NULL;
-		       drive_and_name_free(chantable[i].searchpattern, chantable[i].num_pattern);
-		       chantable[i].searchpattern = NULL;
-		       chantable[i].searchdrv = -1;
-               }
-        }
+
+	if (channo >= 0 && channo < MAX_CHANNEL_NO
+		&& chantable->chan[channo].channo == channo) {
+		chan_t *chan = &chantable->chan[channo];
+		chan_free_pattern(chan);
+		chan_clear(chan);
+		num_open--;
+	}
 }
 
 void channel_set(int channo, file_t *fp) {
-       int i;
-        for(i=0;i<MAX_NUMBER_OF_ENDPOINTS;i++) {
-               // we overwrite existing entries, to "heal" leftover cruft
-               // just in case...
-		if (chantable[i].channo == channo) {
-			log_error("Closing leftover file for channel %d\n", channo);
-			if (chantable[i].fp != NULL) {
-				chantable[i].fp->handler->fclose(chantable[i].fp, NULL, NULL);
-			}
-			chantable[i].fp = NULL;
-			chantable[i].channo = -1;
-			chantable[i].num_pattern = 0;
-			chantable[i].searchpattern = NULL;
-		        chantable[i].searchdrv = -1;
+
+	if (channo < 0 || channo >= MAX_CHANNEL_NO) {
+		log_error("Illegal channel number %d\n", channo);
+		return;
+	}
+
+	chan_t *chan = &chantable->chan[channo];
+
+	// we overwrite existing entries, to "heal" leftover cruft
+	// just in case...
+	if (chan->channo == channo) {
+		log_error("Closing leftover file for channel %d\n", channo);
+		if (chan->fp != NULL) {
+			chan->fp->handler->fclose(chan->fp, NULL, NULL);
 		}
-               if (chantable[i].channo == -1) {
-                       chantable[i].channo = channo;
-                       chantable[i].fp = fp;
-		       chantable[i].num_pattern = 0;
-		       chantable[i].searchpattern = NULL;
-		       chantable[i].searchdrv = -1;
-                       return;
-               }
-        }
-       log_error("Did not find free ep slot for channel %d\n", channo);
+		chan_free_pattern(chan);
+	} else {
+		num_open++;
+	}
+	chan_clear(chan);
+	chan->channo = channo;
+	chan->fp = fp;
 }
 
+int channel_num_open() {
+	return num_open;
+}
 
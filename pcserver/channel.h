@@ -33,6 +33,10 @@
 // Mapping from channel number for open files to endpoint providers
 // These are set when the channel is opened
 
+// channel numbers are taken from the FSP_FD byte of a packet, which
+// is positive, so a channel table is indexed directly with it
+#define	MAX_CHANNEL_NO	128
+
 typedef struct {
        int              channo;
        file_t           *fp;
@@ -40,13 +44,47 @@ typedef struct {
        int              searchdrv;
        int		num_pattern;
        drive_and_name_t *searchpattern;
+       // directory opened with FS_OPEN_DRP, i.e. pack several entries into a packet
+       int		packed;
+       // directory opened with the "W=0" option, i.e. list host file names without wrapping
+       int		nowrap;
+       // drive the channel was opened on, -1 if unknown (for the metrics)
+       int		drive;
 } chan_t;
 
+// each connection (device or tools client) has its own channel table,
+// so their channel numbers do not collide
+typedef struct {
+	chan_t		chan[MAX_CHANNEL_NO];
+} chantable_t;
+
 void channel_init();
 void channel_free(int channo);
 void channel_set(int channo, file_t * fp);
 chan_t *channel_get(int chan);
 
+/**
+ * number of open channels, over all connections
+ */
+int channel_num_open();
+
+/**
+ * init a channel table with all channels unused
+ */
+void channel_table_init(chantable_t *tab);
+
+/**
+ * close all files still open in a channel table, when its
+ * connection is closed
+ */
+void channel_table_free(chantable_t *tab);
+
+/**
+ * set the channel table the channel_* functions work on, i.e. the 
+ * one of the connection whose packet is being executed
+ */
+void channel_use(chantable_t *tab);
+
 static inline file_t *channel_to_file(int chan) {
 	chan_t *channel = channel_get(chan);
 	return channel ? channel->fp : NULL;
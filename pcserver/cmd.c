@@ -88,6 +88,7 @@ void cmd_init() {
 void cmd_free() {
 
 	xcmd_free();
+	resolve_cache_invalidate(NULL);
 	handler_free();
 	provider_free();
 }
@@ -107,18 +108,26 @@ int cmd_assign_cmdline(const char *inname, charset_t cset) {
 	nameinfo_t ninfo;
 	nameinfo_init(&ninfo);
 
+	openpars_t pars;
+	openpars_init_options(&pars);
+
 	parse_cmd_pars(name, strlen((char*)name), CMD_ASSIGN, &ninfo);
 	if (ninfo.cmd != CMD_ASSIGN) {
 		err = CBM_ERROR_SYNTAX_NONAME;
 	} else
-	if (ninfo.num_files != 1) {
+	if (ninfo.num_files < 1) {
                 log_error("Wrong number of parameters!\n");
                 err = CBM_ERROR_SYNTAX_NONAME;
 	}
 
+	// further "files" are assign options, like in "0:fs=games.d81,ram"
+	for (int i = 1; err == CBM_ERROR_OK && i < ninfo.num_files; i++) {
+		err = openpars_assign_option(ninfo.file[i].name, &pars);
+	}
+
 	if (err == CBM_ERROR_OK) {
 
-		err = provider_assign(ninfo.trg.drive, &ninfo.file[0], cset, true);
+		err = provider_assign(ninfo.trg.drive, &ninfo.file[0], cset, true, &pars);
 	}
 
 	mem_free(name);
@@ -129,14 +138,22 @@ int cmd_assign_packet(const char *inname, int inlen, charset_t cset) {
 
 	int rv = CBM_ERROR_DRIVE_NOT_READY;
 	openpars_t pars;
-	int num_files = 2;
-	drive_and_name_t names[2];
+	openpars_t assignpars;
+	int num_files = 3;
+	drive_and_name_t names[3];
+
+	openpars_init_options(&assignpars);
 
 	rv = parse_filename_packet((uint8_t*) inname, inlen, &pars, names, &num_files);
 
+	if (rv == CBM_ERROR_OK && num_files == 3) {
+		// an assign option, like in "0:=fs:games.d81,ram"
+		rv = openpars_assign_option(names[2].name, &assignpars);
+	}
+
 	if (rv == CBM_ERROR_OK) {
 
-	    if (num_files == 2) {
+	    if (num_files >= 2) {
 
 
 		int drive = names[0].drive;
@@ -153,7 +170,7 @@ int cmd_assign_packet(const char *inname, int inlen, charset_t cset) {
 
 		log_debug("cmdline_assign '%s' = '%s'\n", provider_name, provider_parameter);
 
-		rv = provider_assign(drive, &names[1], cset, is_privileged ? true : false);
+		rv = provider_assign(drive, &names[1], cset, is_privileged ? true : false, &assignpars);
 	    } else {
 		log_error("Illegal number of parameters (%d)\n", num_files);
 		rv = CBM_ERROR_FAULT;
@@ -194,9 +211,11 @@ int cmd_open_file(int tfd, const char *inname, int namelen, charset_t cset, driv
 	    // note: may modify names.trg.name in-place
 	    rv = resolve_endpoint(&names[0], cset, is_privileged, &ep);
 	    if (rv == CBM_ERROR_OK) {
-		dir = endpoint_root(ep);
-		rv = resolve_dir((const char**)&names[0].name, cset, &dir);
+		rv = resolve_path(ep, (const char**)&names[0].name, cset, &dir);
 		if (rv == CBM_ERROR_OK) {
+			if (cmd != FS_OPEN_RD && cmd != FS_OPEN_DR) {
+				resolve_cache_invalidate(dir->endpoint);
+			}
 			// now resolve the actual filename
 			rv = resolve_open(dir, names, cset, &pars, cmd, &fp);
 			if (rv == CBM_ERROR_OK || rv == CBM_ERROR_OPEN_REL) {
@@ -240,7 +259,34 @@ int cmd_info(char *outbuf, int *outlen, charset_t outcset) {
 
 // ----------------------------------------------------------------------------------
 
-int cmd_read(int tfd, char *outbuf, int *outlen, int *readflag, charset_t outcset, drive_and_name_t *lastdrv) {
+/**
+ * read the next directory entry of the channel into outbuf;
+ * returns the resolve_scan error code, and the entry length in outlen
+ */
+static int read_dir_entry(chan_t *chan, char *outbuf, int *outlen, int *readflag, charset_t outcset, 
+		drive_and_name_t *lastdrv) {
+
+	direntry_t *direntry;
+	int rv = resolve_scan(chan->fp, chan->searchpattern, chan->num_pattern, outcset, true, chan->nowrap,
+			&direntry, readflag);
+	if (!rv) {
+		*outlen = dir_fill_entry_from_direntry(outbuf, outcset, lastdrv->drive, direntry, 
+				MAX_BUFFER_SIZE-FSP_DATA);
+		direntry->handler->declose(direntry);
+
+		if (READFLAG_EOF & *readflag) {
+			// end of dir - do we need another scan?
+			int rvx = drive_scan_next(chan->searchpattern, outcset, chan, lastdrv->drive);
+
+			if (rvx == CBM_ERROR_OK) {
+				*readflag &= ~READFLAG_EOF;
+			}
+		}
+	}
+	return rv;
+}
+
+int cmd_read(int tfd, char *outbuf, int outsize, int *outlen, int *readflag, charset_t outcset, drive_and_name_t *lastdrv) {
 	
 	int rv = CBM_ERROR_FILE_NOT_OPEN;
 
@@ -270,22 +316,21 @@ int cmd_read(int tfd, char *outbuf, int *outlen, int *readflag, charset_t outcse
 	if (fp != NULL) {
 		*readflag = 0;	// default just in case
 		if (fp->openmode == FS_OPEN_DR) {
-			direntry_t *direntry;
-			rv = resolve_scan(fp, chan->searchpattern, chan->num_pattern, outcset, true, &direntry, readflag);
+			int len = 0;
+			rv = read_dir_entry(chan, outbuf, &len, readflag, outcset, lastdrv);
 			if (!rv) {
-				rv = dir_fill_entry_from_direntry(outbuf, outcset, lastdrv->drive, direntry, 
-						MAX_BUFFER_SIZE-FSP_DATA);
-				direntry->handler->declose(direntry);
-	
-				if (READFLAG_EOF & *readflag) {
-					// end of dir - do we need another scan?
-					int rvx = drive_scan_next(chan->searchpattern, outcset, chan, lastdrv->drive);
-
-					if (rvx == CBM_ERROR_OK) {
-						*readflag &= ~READFLAG_EOF;
+				// a packed directory gets more entries, as long as the 
+				// next one is sure to fit. A scan error ends the packet,
+				// and is reported when the next packet is read
+				while (chan->packed && !(READFLAG_EOF & *readflag)
+					&& len + MAX_BUFFER_SIZE-FSP_DATA <= outsize) {
+					int n = 0;
+					if (read_dir_entry(chan, outbuf + len, &n, readflag, outcset, lastdrv)) {
+						break;
 					}
+					len += n;
 				}
-
+				rv = len;
 			}
 		} else {
 		    	rv = fp->handler->readfile(fp, outbuf, MAX_BUFFER_SIZE-FSP_DATA, readflag, outcset);
@@ -323,6 +368,12 @@ int cmd_write(int tfd, int cmd, const char *indata, int datalen) {
 #endif
 		if (fp->handler->writefile) {
 			rv = fp->handler->writefile(fp, indata, datalen, has_eof);
+			// a short count means the provider could not take all data yet
+			while (rv > 0 && rv < datalen) {
+				indata += rv;
+				datalen -= rv;
+				rv = fp->handler->writefile(fp, indata, datalen, has_eof);
+			}
 			if (rv < 0) {
 				// if negative, then it's an error
 				rv = -rv;
@@ -508,9 +559,9 @@ static int drive_scan_next(drive_and_name_t *dnt, charset_t cset,
        	rv = resolve_endpoint(&dnt[idx], cset, is_privileged, &ep);
 	dnt[idx].drive= searchdrv;
 	if (rv == CBM_ERROR_OK) {
-		file_t *fp = endpoint_root(ep); //ep->ptype->root(ep);
+		file_t *fp = NULL;
 
-		rv = resolve_dir((const char **)&dnt[idx].name, cset, &fp);
+		rv = resolve_path(ep, (const char **)&dnt[idx].name, cset, &fp);
 		if (rv == CBM_ERROR_OK) {
 			fp->openmode = FS_OPEN_DR;
 			chan->fp = fp;
@@ -522,7 +573,7 @@ static int drive_scan_next(drive_and_name_t *dnt, charset_t cset,
 	return rv;
 }
 
-int cmd_open_dir(int tfd, const char *inname, int namelen, charset_t cset, drive_and_name_t *lastdrv) {
+int cmd_open_dir(int tfd, const char *inname, int namelen, charset_t cset, drive_and_name_t *lastdrv, int cmd) {
 
 	int rv = CBM_ERROR_DRIVE_NOT_READY;
 	openpars_t pars;
@@ -543,6 +594,8 @@ int cmd_open_dir(int tfd, const char *inname, int namelen, charset_t cset, drive
 		chan->searchpattern = dnt;
 		chan->num_pattern = num_files;
 		chan->searchdrv = -1;
+		chan->packed = (cmd == FS_OPEN_DRP);
+		chan->nowrap = pars.nowrap;
 
 		rv = drive_scan_next(dnt, cset, chan, lastdrv->drive);
 	}
@@ -562,12 +615,11 @@ static int delete_name(drive_and_name_t *name, charset_t cset, endpoint_t **epp,
 	file_t *dir = NULL;
 
 	if (rv == CBM_ERROR_OK) {
-		dir = endpoint_root(ep); // ep->ptype->root(ep);
-		rv = resolve_dir((const char**)&name->name, cset, &dir);
+		rv = resolve_path(ep, (const char**)&name->name, cset, &dir);
 		while (rv == CBM_ERROR_OK) {
 			// now resolve the actual filenames
 			direntry_t *dirent = NULL;
-			rv = resolve_scan(dir, name, 1, cset, false, 
+			rv = resolve_scan(dir, name, 1, cset, false, false,
 					&dirent, NULL);
 			if (dirent) {
 				log_info("DELETE(%s / %s)\n", dir->filename, dirent->name);
@@ -606,6 +658,8 @@ int cmd_delete(const char *inname, int namelen, charset_t cset, char *outbuf, in
 	int rv = CBM_ERROR_DRIVE_NOT_READY;
 	int outdeleted = 0;
 
+	resolve_cache_invalidate(NULL);
+
 	openpars_t pars;
 	int num_files = MAX_NAMEINFO_FILES+1;
 	drive_and_name_t names[MAX_NAMEINFO_FILES+1];
@@ -641,8 +695,7 @@ static int mkdir_name(drive_and_name_t *name, charset_t cset, openpars_t *pars,
 	file_t *dir = NULL;
 
 	if (rv == CBM_ERROR_OK) {
-		dir = endpoint_root(ep); // ep->ptype->root(ep);
-		rv = resolve_dir((const char**)&name->name, cset, &dir);
+		rv = resolve_path(ep, (const char**)&name->name, cset, &dir);
 		if (rv == CBM_ERROR_OK) {
 			rv = resolve_open(dir, name, cset, pars, FS_MKDIR, NULL);
 		}
@@ -657,6 +710,8 @@ int cmd_mkdir(const char *inname, int namelen, charset_t cset) {
 
 	int rv = CBM_ERROR_DRIVE_NOT_READY;
 
+	resolve_cache_invalidate(NULL);
+
 	openpars_t pars;
 	int num_files = MAX_NAMEINFO_FILES+1;
 	drive_and_name_t names[MAX_NAMEINFO_FILES+1];
@@ -727,6 +782,8 @@ int cmd_move(const char *inname, int namelen, charset_t cset) {
 	int num_files = MAX_NAMEINFO_FILES+1;
 	drive_and_name_t names[MAX_NAMEINFO_FILES+1];
 
+	resolve_cache_invalidate(NULL);
+
 	rv = parse_filename_packet((uint8_t*) inname, namelen, &pars, names, &num_files);
 
 	if (num_files != 2) {
@@ -747,18 +804,16 @@ int cmd_move(const char *inname, int namelen, charset_t cset) {
 		    if (srcep == trgep) {
 
 			// find the source file
-			srcdir = endpoint_root(srcep); // srcep->ptype->root(srcep);
-			rv = resolve_dir((const char**)&names[1].name, cset, &srcdir);
+			rv = resolve_path(srcep, (const char**)&names[1].name, cset, &srcdir);
 
 			if (rv == CBM_ERROR_OK) {
 			    // now resolve the actual source filename into dirent
 			    rv = resolve_scan(srcdir, &names[1], 1, cset, 
-					    false, &dirent, NULL);
+					    false, false, &dirent, NULL);
 			    if (rv == CBM_ERROR_OK && dirent) {
 		
 				// find the target directory	
-				trgdir = endpoint_root(trgep); // trgep->ptype->root(trgep);
-				rv = resolve_dir((const char**)&names[0].name, cset, &trgdir);
+				rv = resolve_path(trgep, (const char**)&names[0].name, cset, &trgdir);
 
 				if (rv == CBM_ERROR_OK) {
 
@@ -802,8 +857,7 @@ static int copy_file(file_t *tofile, drive_and_name_t *name, charset_t cset) {
 	if (rv == CBM_ERROR_OK) {
 
 	    // find the target directory	
-	    srcdir = endpoint_root(srcep); // srcep->ptype->root(srcep);
-	    rv = resolve_dir((const char**)&name->name, cset, &srcdir);
+	    rv = resolve_path(srcep, (const char**)&name->name, cset, &srcdir);
 
 	    if (rv == CBM_ERROR_OK) {
 			
@@ -857,6 +911,8 @@ int cmd_copy(const char *inname, int namelen, charset_t cset) {
 	int num_files = MAX_NAMEINFO_FILES+1;
 	drive_and_name_t names[MAX_NAMEINFO_FILES+1];
 
+	resolve_cache_invalidate(NULL);
+
 	rv = parse_filename_packet((uint8_t*) inname, namelen, &pars, names, &num_files);
 
 	if (num_files < 2) {
@@ -871,8 +927,7 @@ int cmd_copy(const char *inname, int namelen, charset_t cset) {
 	    if (rv == CBM_ERROR_OK) {
 
 		// find the target directory	
-		trgdir = endpoint_root(trgep); // trgep->ptype->root(trgep);
-		rv = resolve_dir((const char**)&names[0].name, cset, &trgdir);
+		rv = resolve_path(trgep, (const char**)&names[0].name, cset, &trgdir);
 
 		if (rv == CBM_ERROR_OK) {
 			
@@ -949,6 +1004,8 @@ int cmd_format(const char *inname, int namelen, charset_t cset) {
 	drive_and_name_t names[2];
 	endpoint_t *ep = NULL;
 
+	resolve_cache_invalidate(NULL);
+
 	rv = parse_filename_packet((uint8_t*) inname, namelen, &pars, names, &num_files);
 
 	if (rv != CBM_ERROR_OK) {
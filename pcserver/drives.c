@@ -25,6 +25,10 @@
 ****************************************************************************/
 
 
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
 #include "log.h"
 #include "errors.h"
 #include "mem.h"
@@ -54,6 +58,13 @@ static type_t drives_type = {
 
 static registry_t drives;
 
+// sync policy per drive number, kept across assigns
+#define	MAX_SYNC_DRIVES	10
+
+static int drive_sync[MAX_SYNC_DRIVES];
+
+static const char *sync_names[] = { "none", "close", "always" };
+
 void drives_init() {
 	reg_init(&drives, "drives", 10);
 }
@@ -97,6 +108,7 @@ int drive_unassign(int drive) {
 			// free it
 			mem_free(ept);
 			ept = NULL;
+			provider_unassigned();
 			rv = CBM_ERROR_OK;
 			break;
                	}
@@ -113,10 +125,48 @@ void drive_assign(int drive, endpoint_t *newep) {
 	ept->ep = newep;
 	ept->cdpath = mem_alloc_str2("/", "root_cd_path");
 
+	if (drive >= 0 && drive < MAX_SYNC_DRIVES) {
+		newep->sync = drive_sync[drive];
+	}
+
 	// register new endpoint
 	reg_append(&drives, ept);
 }
 
+int drive_set_sync(const char *param) {
+
+	const char *p = param;
+
+	if (!isdigit(*p)) {
+		log_error("Missing drive number in sync policy '%s'\n", param);
+		return CBM_ERROR_SYNTAX_INVAL;
+	}
+	int drive = strtol(p, (char**)&p, 10);
+	if (*p != ':' || drive >= MAX_SYNC_DRIVES) {
+		log_error("Wrong drive in sync policy '%s'\n", param);
+		return CBM_ERROR_SYNTAX_INVAL;
+	}
+	p++;
+
+	for (int i = 0; i < (int)(sizeof(sync_names)/sizeof(sync_names[0])); i++) {
+		if (!strcmp(p, sync_names[i])) {
+			log_info("Set sync policy of drive %d to '%s'\n", drive, p);
+			drive_sync[drive] = i;
+
+			// also for an already assigned drive
+			drive_t *ept;
+			for (int j = 0; (ept = reg_get(&drives, j)) != NULL; j++) {
+				if (ept->drive == drive) {
+					ept->ep->sync = i;
+				}
+			}
+			return CBM_ERROR_OK;
+		}
+	}
+	log_error("Unknown sync policy '%s', use 'none', 'close' or 'always'\n", p);
+	return CBM_ERROR_SYNTAX_INVAL;
+}
+
 void drives_dump(const char *prefix, const char *eppref) {
 	for (int i = 0; ; i++) {
 		drive_t *ept = reg_get(&drives, i);
@@ -125,6 +175,7 @@ void drives_dump(const char *prefix, const char *eppref) {
 			log_debug("%s{\n", prefix);
 			log_debug("%sdrive=%d;\n", eppref, ept->drive);
 			log_debug("%scdpath='%s';\n", eppref, ept->cdpath);
+			log_debug("%ssync='%s';\n", eppref, sync_names[ept->ep->sync]);
 			log_debug("%sendpoint=%p ('%s');\n", eppref, ept->ep, 
 								ept->ep->ptype->name);
 			log_debug("%s}\n", prefix);
@@ -45,6 +45,12 @@ int drive_unassign(int drive);
 
 void drive_assign(int drive, endpoint_t *newep);
 
+/**
+ * set the sync policy of a drive from "<drive>:<policy>", with policy
+ * one of "none", "close" or "always" (see SYNC_* in provider.h)
+ */
+int drive_set_sync(const char *param);
+
 void drives_dump(const char *prefix, const char *eppref);
 
 #endif
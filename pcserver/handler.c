@@ -32,6 +32,7 @@
 #include "wireformat.h"
 #include "wildcard.h"
 #include "openpars.h"
+#include "trace.h"
 
 
 
@@ -98,6 +99,7 @@ int handler_wrap(direntry_t *dirent, direntry_t **outde) {
 
 	int err = CBM_ERROR_OK;
 	*outde = NULL;
+	trace_t tr = trace_begin();
 
 	for (int i = 0; ; i++) {
 		handler_t *handler = reg_get(&handlers, i);
@@ -105,8 +107,13 @@ int handler_wrap(direntry_t *dirent, direntry_t **outde) {
 			// no handler found
 			break;
 		}
+		if (handler->wrap == NULL
+			|| (handler->maywrap && handler->maywrap(dirent) == WRAP_NONE)) {
+			// does not wrap this entry
+			continue;
+		}
 		// outpattern then points into the pattern string
-		if ( handler->wrap && handler->wrap(dirent, outde) == CBM_ERROR_OK) {
+		if (handler->wrap(dirent, outde) == CBM_ERROR_OK) {
 			// worked ok.
 			if (*outde != NULL) {
 				// found a handler
@@ -116,13 +123,38 @@ int handler_wrap(direntry_t *dirent, direntry_t **outde) {
 		} else {
 			log_error("Got %d as error from handler %s\n", 
 				err, handler->name);
-			return err;
+			break;
 		}
 	}
 
+	trace_end(tr, "resolver", "handler_wrap", err);
 	return err;
 }
 
+int handler_maywrap(direntry_t *dirent, int *namelens, int maxnames) {
+
+	int n = 0;
+
+	for (int i = 0; ; i++) {
+		handler_t *handler = reg_get(&handlers, i);
+		if (handler == NULL) {
+			break;
+		}
+		if (handler->wrap == NULL) {
+			continue;
+		}
+		int l = handler->maywrap ? handler->maywrap(dirent) : WRAP_ANY_NAME;
+		if (l == WRAP_NONE) {
+			continue;
+		}
+		if (l < 0 || n >= maxnames) {
+			return -1;
+		}
+		namelens[n++] = l;
+	}
+	return n;
+}
+
 file_t *handler_parent(file_t *file) {
 	return file->parent;
 }
@@ -176,9 +208,16 @@ file_t* default_parent(file_t *file) {
 	return NULL;
 }
 
-int default_flush(file_t *file) {
+int default_flush(file_t *file, int durable) {
 	if (file->parent != NULL) {
-		return file->parent->handler->flush(file->parent);
+		return file->parent->handler->flush(file->parent, durable);
+	}
+	return CBM_ERROR_FAULT;
+}
+
+int default_info(file_t *file, direntry_t *outde) {
+	if (file->parent != NULL && file->parent->handler->info != NULL) {
+		return file->parent->handler->info(file->parent, outde);
 	}
 	return CBM_ERROR_FAULT;
 }
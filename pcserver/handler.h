@@ -51,6 +51,15 @@ file_t *handler_find(file_t * parent, uint8_t type, const char *name, charset_t
  */
 int handler_wrap(direntry_t *dirent, direntry_t **outde);
 
+/*
+ * cheap check, on the entry name only, under which names handler_wrap()
+ * may return the entry. Stores the lengths of the possible wrapped names
+ * (which are the start of the entry name, like "foo" for "foo.d64" or "foo,p")
+ * in namelens, and returns their number; returns -1 if the wrapped name is
+ * only known after wrapping (like the name in a P00 header).
+ */
+int handler_maywrap(direntry_t *dirent, int *namelens, int maxnames);
+
 /*
  * resolve a file_t from an endpoint, for a block operation
  */
@@ -108,7 +117,9 @@ int default_scratch(file_t *file);
 
 file_t* default_parent(file_t *file);
 
-int default_flush(file_t *file);
+int default_flush(file_t *file, int durable);
+
+int default_info(file_t *file, direntry_t *outde);
 
 size_t default_realsize(file_t *file);
 
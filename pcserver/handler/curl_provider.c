@@ -42,6 +42,7 @@
 #include <strings.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <poll.h>
 
 
 #include "wireformat.h"
@@ -50,6 +51,8 @@
 #include "log.h"
 #include "filetypes.h"
 #include "dir.h"
+#include "loop.h"
+#include "ringbuf.h"
 
 
 #define	MAX_BUFFER_SIZE	64
@@ -58,6 +61,10 @@
 
 #define	MAX_SESSIONS	10
 
+// receive buffer per file; the transfer is paused when a full write 
+// callback chunk does not fit anymore
+#define	CURL_RING_SIZE	(2 * CURL_MAX_WRITE_SIZE)
+
 extern provider_t ftp_provider;
 extern provider_t http_provider;
 
@@ -67,6 +74,10 @@ static handler_t curl_file_handler;
 static int curl_init_done = 0;
 // list of endpoints
 static registry_t endpoints;
+// shared multi handle for all transfers, driven from the poll loop
+static CURLM *multi = NULL;
+// sockets curl has told us about in socket_cb
+static registry_t sockets;
 
 static int curl_fclose(file_t *fp, char *outbuf, int *outlen);
 
@@ -86,7 +97,6 @@ struct curl_file_s {
 	file_t	file;			// embedded
 	int	chan;			// channel
 	CURL 	*session;		// curl session info
-	CURLM 	*multi;			// curl session info
 	char 	*path;			// path to current file
 	int	(*read_converter)(struct curl_endpoint_t *cep, curl_file_t *fp, char *retbuf, int len, int *eof);
 
@@ -94,10 +104,9 @@ struct curl_file_s {
 	int	wrbuflen;		// write transfer buffer length (for callback)
 	int	wrbufdatalen;		// write transfer buffer content length (for callback)
 	int	bufwp;			// buffer write pointer
-	char	*rdbuffer;		// read transfer buffer (for callback) - malloc'd
-	int	rdbuflen;		// read transfer buffer length (for callback)
-	int	rdbufdatalen;		// read transfer buffer content length (for callback)
-	int	bufrp;			// buffer read pointer
+	ringbuf_t rx;			// data received in the background, drained by FS_READ
+	int	paused;			// transfer paused as rx was full
+	int	done;			// transfer has finished
 	// directory read state
 	int	read_state;		// data for read_converter / read_file
 };
@@ -114,12 +123,14 @@ static void file_init(const type_t *t, void *obj) {
 
 	fp->chan = -1;
 	fp->session = NULL;
-	fp->multi = NULL;
 
-	fp->rdbuffer = NULL;
-	fp->rdbuflen = 0;
-	fp->rdbufdatalen = 0;
-	fp->bufrp = 0;
+	// ring is only allocated on open
+	fp->rx.data = NULL;
+	fp->rx.size = 0;
+	fp->rx.rp = 0;
+	fp->rx.len = 0;
+	fp->paused = 0;
+	fp->done = 0;
 
 	fp->wrbuffer = NULL;
 	fp->wrbuflen = 0;
@@ -167,6 +178,8 @@ static void endpoint_init(const type_t *t, void *obj) {
 
         fsep->base.is_temporary = 0;
         fsep->base.is_assigned = 0;
+        fsep->base.refcnt = 0;
+        fsep->base.sync = SYNC_NONE;
 
 	fsep->error_buffer[0] = 0;
 	fsep->name_buffer = NULL;
@@ -186,6 +199,17 @@ typedef struct {
 	direntry_t	de;
 } curl_dirent_t;
 
+typedef struct {
+	curl_socket_t	fd;
+	int		what;		// CURL_POLL_* from socket_cb
+} curl_sock_t;
+
+static type_t curl_sock_type = {
+	"curl_sock",
+	sizeof(curl_sock_t),
+	NULL
+};
+
 static void curl_dirent_init(const type_t *t, void *obj) {
 
 	(void) t;
@@ -225,6 +249,161 @@ static void curl_free_ep(registry_t *reg, void *en) {
 
 static void curl_end() {
 	reg_free(&endpoints, curl_free_ep);
+
+	if (multi != NULL) {
+		poll_set_timer(&multi, NULL, -1);
+		curl_multi_cleanup(multi);
+		multi = NULL;
+	}
+	reg_free(&sockets, NULL);
+}
+
+// ----------------------------------------------------------------------------------
+// multi handle integration into the poll loop
+
+// collect finished transfers
+static void check_done(void) {
+
+	int msgs_in_queue = 0;
+	CURLMsg *cmsg = NULL;
+
+	while ((cmsg = curl_multi_info_read(multi, &msgs_in_queue)) != NULL) {
+		if (cmsg->msg == CURLMSG_DONE) {
+			curl_file_t *fp = NULL;
+			curl_easy_getinfo(cmsg->easy_handle, CURLINFO_PRIVATE, (char**) &fp);
+			if (fp != NULL) {
+				CURLcode cc = cmsg->data.result;
+				if (cc != CURLE_OK) {
+					log_error("errorbuffer = %s\n", 
+						((curl_endpoint_t*)fp->file.endpoint)->error_buffer);
+				}
+				log_debug("transfer done for fp=%p, result=%d\n", fp, cc);
+				fp->done = 1;
+			}
+		}
+	}
+}
+
+static void socket_action(curl_socket_t s, int ev_bitmask) {
+
+	int running_handles = 0;
+
+	CURLMcode rv = curl_multi_socket_action(multi, s, ev_bitmask, &running_handles);
+	if (rv != CURLM_OK) {
+		log_error("curl_multi_socket_action returns %d\n", rv);
+	}
+	check_done();
+}
+
+static void sock_in(int fd, void *data) {
+	(void) data;
+	socket_action(fd, CURL_CSELECT_IN);
+}
+
+static void sock_out(int fd, void *data) {
+	(void) data;
+	socket_action(fd, CURL_CSELECT_OUT);
+}
+
+static void sock_err(int fd, void *data) {
+	(void) data;
+	// let curl read the EOF and remove the socket
+	socket_action(fd, CURL_CSELECT_IN | CURL_CSELECT_ERR);
+}
+
+static int socket_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+	(void) easy;
+	(void) userp;
+
+	curl_sock_t *sock = (curl_sock_t*) socketp;
+
+	if (what == CURL_POLL_REMOVE) {
+		if (sock != NULL) {
+			poll_unregister(s);
+			reg_remove(&sockets, sock);
+			mem_free(sock);
+		}
+		return 0;
+	}
+	if (sock == NULL) {
+		sock = mem_alloc(&curl_sock_type);
+		sock->fd = s;
+		reg_append(&sockets, sock);
+		curl_multi_assign(multi, s, sock);
+		poll_register_readwrite(s, NULL, sock_in, sock_out, sock_err);
+	}
+	sock->what = what;
+	poll_set_interest(s, what & CURL_POLL_IN, what & CURL_POLL_OUT);
+	return 0;
+}
+
+static void timer_expired(void *data) {
+	(void) data;
+	socket_action(CURL_SOCKET_TIMEOUT, 0);
+}
+
+static int timer_cb(CURLM *m, long timeout_ms, void *userp) {
+	(void) m;
+	(void) userp;
+
+	// -1 cancels the timer; never call socket_action from here
+	poll_set_timer(&multi, timer_expired, timeout_ms);
+	return 0;
+}
+
+// continue a paused transfer when the reader has made space
+static void resume(curl_file_t *fp) {
+
+	if (fp->paused && ringbuf_space(&fp->rx) >= CURL_MAX_WRITE_SIZE) {
+		fp->paused = 0;
+		// may call write_cb directly
+		curl_easy_pause(fp->session, CURLPAUSE_CONT);
+		check_done();
+	}
+}
+
+// wait for the transfer sockets only. This is outside of the poll loop, for
+// the directory scan that needs to return full entries
+static void wait_sockets(void) {
+
+	long timeout = -1;
+	curl_multi_timeout(multi, &timeout);
+	if (timeout < 0 || timeout > 1000) {
+		timeout = 1000;
+	}
+
+	int nfds = reg_size(&sockets);
+	struct pollfd fds[nfds > 0 ? nfds : 1];
+
+	for (int i = 0; i < nfds; i++) {
+		curl_sock_t *sock = reg_get(&sockets, i);
+		fds[i].fd = sock->fd;
+		fds[i].events = ((sock->what & CURL_POLL_IN) ? POLLIN : 0)
+				| ((sock->what & CURL_POLL_OUT) ? POLLOUT : 0);
+		fds[i].revents = 0;
+	}
+
+	int n = poll(fds, nfds, timeout);
+
+	if (n <= 0) {
+		socket_action(CURL_SOCKET_TIMEOUT, 0);
+		return;
+	}
+	for (int i = 0; i < nfds; i++) {
+		if (fds[i].revents) {
+			int ev = 0;
+			if (fds[i].revents & POLLIN) {
+				ev |= CURL_CSELECT_IN;
+			}
+			if (fds[i].revents & POLLOUT) {
+				ev |= CURL_CSELECT_OUT;
+			}
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				ev |= CURL_CSELECT_ERR;
+			}
+			socket_action(fds[i].fd, ev);
+		}
+	}
 }
 
 // note: curl_init is being called twice, for HTTP as well as FTP
@@ -240,6 +419,12 @@ static void curl_init() {
 			// error handling!
 		}
 
+		reg_init(&sockets, "curl_sockets", 10);
+
+		multi = curl_multi_init();
+		curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_cb);
+		curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_cb);
+
 		curl_init_done = 1;
 	}
 }
@@ -395,16 +580,13 @@ static void close_fd(curl_file_t *fp) {
 	reg_remove(&fp->file.endpoint->files, fp);
 
 	if (fp->session != NULL) {
-		curl_multi_remove_handle(fp->multi, fp->session);
+		curl_multi_remove_handle(multi, fp->session);
 		curl_easy_cleanup(fp->session);
-		curl_multi_cleanup(fp->multi);
-		if (fp->rdbuffer != NULL) {
-			free(fp->rdbuffer);
-		}
 		if (fp->wrbuffer != NULL) {
 			free(fp->wrbuffer);
 		}
 	}
+	ringbuf_free(&fp->rx);
 
 	mem_free(fp->file.filename);
 	mem_free(fp->path);
@@ -465,121 +647,28 @@ static int curl_fclose(file_t *fp, char *outbuf, int *outlen) {
 	return CBM_ERROR_OK;
 }
 
+// called by curl from the poll loop with received data
 static size_t write_cb(char *ptr, size_t size, size_t nmemb, void *user) {
 
 	curl_file_t *fp = (curl_file_t*) user;
 
-	fp->rdbufdatalen = 0;
-
-	long inlen = size * nmemb;
+	int inlen = size * nmemb;
 
 #ifdef DEBUG_CURL
-printf("write_cb-> %ld (buffer is %d): ", inlen, fp->rdbuflen);
-if (fp->rdbuflen > 0) {
-	printf("%02x ", ptr[0]);
-}
-printf("\n");
+	log_debug("write_cb-> %d (buffer has %d): ", inlen, fp->rx.len);
 #endif
 
-	if (inlen > fp->rdbuflen) {
-		free(fp->rdbuffer);	// fp->rdbuffer NULL is ok, nothing is done
-		int alloclen = inlen < 8192 ? 8192 : inlen;
-		fp->rdbuffer = malloc(alloclen);
-		if (fp->rdbuffer == NULL) {
-			// malloc failed
-			printf("malloc failed!\n");
-			return 0;
-		}
-		fp->rdbuflen = alloclen;
+	if (ringbuf_space(&fp->rx) < inlen) {
+		// curl keeps the data and re-delivers it when resumed
+		fp->paused = 1;
+		return CURL_WRITEFUNC_PAUSE;
 	}
-	memcpy(fp->rdbuffer, ptr, inlen);
-	
-	fp->rdbufdatalen = inlen;
-	fp->bufrp = 0;
+	ringbuf_put(&fp->rx, ptr, inlen);
 
 	return inlen;
 }
 
-static CURLMcode pull_data(curl_endpoint_t *cep, curl_file_t *fp, int *eof) {
-	int running_handles = 0;
-	
-	*eof = 0;
-	fp->rdbufdatalen = 0;
-	fp->bufrp = 0;
-
-	CURLMcode rv = CURLM_OK;
-	do {
-		rv = curl_multi_perform(fp->multi, &running_handles);
-#ifdef DEBUG_CURL
-		if (rv != 0 || running_handles != 1) {
-			printf("curl read file returns: %d, running=%d\n", rv, running_handles);
-		}
-#endif
-	} while (rv == CURLM_CALL_MULTI_PERFORM);
-
-	// note that on R/W files EOF will not be set by the read side ending,
-	// as the write side will keep running_handles>0, except of course this also
-	// ends
-	if (running_handles == 0) {
-		// no more data will be available
-		log_debug("pull_data sets EOF (running=0), rv=%d, datalen=%d\n", rv, fp->rdbufdatalen);
-		*eof = READFLAG_EOF;
-	}
-
-	int msgs_in_queue = 0;
-	CURLMsg *cmsg = NULL;
-	while ((cmsg = curl_multi_info_read(fp->multi, &msgs_in_queue)) != NULL) {
-#ifdef DEBUG_CURL	
-		printf("cmsg=%p, in queue=%d\n", (void*)cmsg, msgs_in_queue);
-#endif	
-		// we only added one easy handle, so easy_handle is known
-		CURLMSG msg = cmsg->msg;
-		if (msg == CURLMSG_DONE) {
-			CURLcode cc = cmsg->data.result;
-			//printf("cc = %d\n", cc);
-			if (cc != CURLE_OK) {
-				log_error("errorbuffer = %s\n", cep->error_buffer);
-			}
-			log_debug("pull_data sets EOF (err msg)\n");
-			*eof = READFLAG_EOF;
-			break;
-		}
-	}
-	return rv;
-}
-
-static int reply_with_data(curl_endpoint_t *cep, curl_file_t *fp, char *retbuf, int len, int *eof) {
-
-	// we already have some data to give back
-	int datalen = fp->rdbufdatalen - fp->bufrp;
-	if (datalen > len) {
-		// we have more data than requested
-		datalen = len;
-	}
-	memcpy(retbuf, &(fp->rdbuffer[fp->bufrp]), datalen);
-	fp->bufrp += datalen;
-
-	if (fp->rdbufdatalen <= fp->bufrp) {
-		// reached the end of the buffer
-		CURLMcode rv = CURLM_OK;
-		if (!fp->read_state) {		// set from previous pull_data
-			// try to pull in more, so we see if eof should be sent
-			rv = pull_data(cep, fp, &(fp->read_state));
-			if (rv != CURLM_OK) {
-				log_debug("reply_with_data sets EOF rv=%d, datalen=%d\n", rv, fp->rdbufdatalen);
-				*eof = READFLAG_EOF;
-			}
-		}
-
-		if (fp->read_state && fp->rdbufdatalen <= fp->bufrp) {
-			log_debug("reply with data sets EOF (2)\n");
-			*eof = READFLAG_EOF;
-		}
-	}
-	return datalen;
-}
-
-// read file data
+// read file data, only from what has already been received
 static int read_file(file_t *file, char *retbuf, int len, int *readflag, charset_t outcset) {
 
 	(void) outcset;
@@ -594,36 +683,23 @@ static int read_file(file_t *file, char *retbuf, int len, int *readflag, charset
 			return fp->read_converter((struct curl_endpoint_t*)cep, fp, retbuf, len, readflag);
 		}
 
-		if (fp->rdbufdatalen > fp->bufrp) {
-#ifdef DEBUG_CURL
-			printf("Got some data already: datalen=%d\n", fp->rdbufdatalen);
-#endif
-			return reply_with_data(cep, fp, retbuf, len, readflag);
-		}
-		// we don't have enough data to send something
-		CURLMcode rv = pull_data(cep, fp, &(fp->read_state));
+		len = ringbuf_get(&fp->rx, retbuf, len);
 
-		if (fp->rdbufdatalen > fp->bufrp) {
-			// we should now have some data to give back
-#ifdef DEBUG_CURL
-			printf("Pulled some data: datalen=%d, eof=%d\n", fp->rdbufdatalen, *readflag);
-#endif
-			return reply_with_data(cep, fp, retbuf, len, readflag);
-		}
-		// no data left
-			
-		if (fp->read_state != 0) {
-			log_warn("adding bogus zero byte, to make CBM noticing the EOF\n");
+		resume(fp);
+
+		if (fp->done && fp->rx.len == 0) {
 			*readflag = READFLAG_EOF;
-			*retbuf = 0;
-			return 1;
+			if (len == 0) {
+				log_warn("adding bogus zero byte, to make CBM noticing the EOF\n");
+				*retbuf = 0;
+				return 1;
+			}
 		}
 
-		if (rv == CURLM_OK) {
-			return 0;
-		}
-	
-	return -CBM_ERROR_FAULT;
+#ifdef DEBUG_CURL
+		log_debug("read_file returns %d bytes, eof=%d\n", len, *readflag);
+#endif
+	return len;
 }
 
 // ----------------------------------------------------------------------------------
@@ -678,6 +754,7 @@ static int curl_direntry2(file_t *dirfp, direntry_t **outentry, int isdirscan, i
 	de->de.parent = dirfp;
 
 	int eof = 0;	
+	int eol = 0;
 	int l = 0;
 	int len = 64;
 	char name[64];
@@ -696,28 +773,21 @@ static int curl_direntry2(file_t *dirfp, direntry_t **outentry, int isdirscan, i
 	case 1:
 		// file names
 #ifdef DEBUG_CURL
-		log_debug("get filename, bufdatalen=%d, bufrp=%d, eof=%d\n",
-			fp->rdbufdatalen, fp->bufrp, *readflag);
+		log_debug("get filename, datalen=%d, eof=%d\n", fp->rx.len, *readflag);
 #endif
 		de->de.mode = FS_DIR_MOD_FIL;
 		do {
-			while ((fp->rdbufdatalen <= fp->bufrp) && (eof == 0)) {
-
-				//log_debug("Trying to pull...\n");
-
-				CURLMcode rv = pull_data((curl_endpoint_t*)cep, fp, &eof);
-
-				if (rv != CURLM_OK) {
-					log_error("Error retrieving directory data (%d)\n", rv);
-					mem_free(de);
-					return CBM_ERROR_DIR_ERROR;
-				}
+			while (fp->rx.len == 0 && !fp->done) {
+				// the resolver needs the full entry now
+				resume(fp);
+				wait_sockets();
 			}
+			eof = (fp->rx.len == 0 && fp->done);
+
 			// find length of name
 			
-			while (fp->bufrp < fp->rdbufdatalen) {
-				char c = fp->rdbuffer[fp->bufrp];
-				fp->bufrp ++;
+			char c;
+			while (ringbuf_get(&fp->rx, &c, 1) > 0) {
 				if (c == 13) {
 					// ignore
 				} else
@@ -729,8 +799,9 @@ static int curl_direntry2(file_t *dirfp, direntry_t **outentry, int isdirscan, i
 					// end of name
 					*namep = 0;
 					l++;
+					eol = 1;
 #ifdef DEBUG_CURL
-					log_debug("bufrp=%d, datalen=%d\n", fp->bufrp, fp->rdbufdatalen);
+					log_debug("datalen=%d\n", fp->rx.len);
 #endif
 					break;
 				}
@@ -739,6 +810,7 @@ static int curl_direntry2(file_t *dirfp, direntry_t **outentry, int isdirscan, i
 						len, l+2);
 					*namep = 0;
 					l++;
+					eol = 1;
 					break;
 				}
 			}
@@ -750,7 +822,7 @@ static int curl_direntry2(file_t *dirfp, direntry_t **outentry, int isdirscan, i
 				*namep = 0;
 			}
 		}
-		while ((*namep != 0) && (eof == 0));	// not null byte, then not done
+		while (!eol && (eof == 0));
 		eof = 0;
 
 		de->de.name = (uint8_t*)mem_alloc_str2(name, "curl_direntry");
@@ -790,21 +862,15 @@ static int open_file(curl_file_t *file, openpars_t *pars, int type) {
 	curl_file_t *fp = (curl_file_t*) file;
 
 		// create session	
-		fp->multi = curl_multi_init();
-
-		if (fp->multi == NULL) {
-			log_error("multi session is NULL\n");
-			return rv;
-		}
-
 		fp->session = curl_easy_init();
 
 		if (fp->session == NULL) {
 			log_error("easy session is NULL\n");
-			curl_multi_cleanup(fp->multi);
 			return rv;
 		}
 
+		ringbuf_init(&fp->rx, CURL_RING_SIZE, "curl_rx");
+
 		// set options
 		curl_easy_setopt(fp->session, CURLOPT_VERBOSE, (long)1);
 		//curl_easy_setopt(fp->session, CURLOPT_WRITEFUNCTION, write_cb);
@@ -812,6 +878,7 @@ static int open_file(curl_file_t *file, openpars_t *pars, int type) {
 		//curl_easy_setopt(fp->session, CURLOPT_READFUNCTION, read_cb);
 		curl_easy_setopt(fp->session, CURLOPT_READDATA, fp);
 		curl_easy_setopt(fp->session, CURLOPT_ERRORBUFFER, &(cep->error_buffer));
+		curl_easy_setopt(fp->session, CURLOPT_PRIVATE, fp);
 
 		mem_free(cep->name_buffer);
 		cep->name_buffer = NULL;
@@ -865,7 +932,7 @@ static int open_rd(curl_file_t *file, openpars_t *pars, int type) {
 		//}	
 
 		//add to multi session
-		CURLMcode rv = curl_multi_add_handle(fp->multi, fp->session);
+		CURLMcode rv = curl_multi_add_handle(multi, fp->session);
 
 		printf("multi add returns %d\n", rv);
 
@@ -897,7 +964,7 @@ static int open_dr(curl_file_t *file, openpars_t *pars) {
 		mem_free(cmd);
 
 		//add to multi session
-		CURLMcode rv = curl_multi_add_handle(fp->multi, fp->session);
+		CURLMcode rv = curl_multi_add_handle(multi, fp->session);
 
 		printf("multi add returns %d\n", rv);
 
@@ -1111,7 +1178,10 @@ provider_t ftp_provider = {
 	curl_root,
 	NULL, 	// direct
 	NULL,	// format
-	curl_dump 	// dump
+	curl_dump, 	// dump
+	NULL,		// sync
+	NULL,		// unassigned
+	NULL		// uptodate
 };
 
 provider_t http_provider = {
@@ -1125,13 +1195,17 @@ provider_t http_provider = {
 	curl_root,
 	NULL, 	// direct
 	NULL,	// format
-	curl_dump 	// dump
+	curl_dump, 	// dump
+	NULL,		// sync
+	NULL,		// unassigned
+	NULL		// uptodate
 };
 
 static handler_t curl_file_handler = {
         "curl_file_handler",
         NULL, 		        // resolve2
         NULL,                   // wrap
+        NULL,			// maywrap
 	curl_fclose,		// fclose
 	curl_declose,		// declose
         curl_open2, 	       	// open2
@@ -1144,6 +1218,7 @@ static handler_t curl_file_handler = {
         NULL,                   // fs_create,              // create
         NULL,                   // fs_flush,               // flush data out to disk
         NULL,                   // fs_equals,              // check if two files (e.g. d64 files are the same)
+        NULL,                   // info
         NULL,                   // fs_realsize2,            // real size of file (same as file->filesize here)
         NULL,                   // fs_delete2,              // delete file
         NULL,                   // fs_mkdir,               // create a directory
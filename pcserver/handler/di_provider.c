@@ -40,6 +40,7 @@
 #include <libgen.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include "provider.h"
 #include "dir.h"
@@ -48,6 +49,9 @@
 #include "mem.h"
 #include "wireformat.h"
 #include "channel.h"
+#include "metrics.h"
+#include "trace.h"
+#include "loop.h"
 #include "wildcard.h"
 #include "openpars.h"
 
@@ -100,6 +104,20 @@ typedef struct {		// derived from endpoint_t
 	uint8_t U2_track;	// track  for U2 command
 	uint8_t U2_sector;	// sector for U2 command
 	//slot_t Slot;		// directory slot - should be deprecated!
+	// the image file when mounted, to check a cached endpoint before reuse
+	time_t img_moddate;	// modification date
+	long img_moddate_ns;	// sub-second part of it
+	uint32_t img_size;	// file size
+	uint64_t img_ino;	// file serial number
+	uint8_t img_written;	// set when written since, so these are outdated
+	uint8_t is_cached;	// set when in the cache of unused endpoints
+	uint8_t *ram;		// image contents when kept in memory, or NULL
+	uint8_t *ram_dirty;	// per block, set when only changed in memory
+	unsigned int ram_ndirty;	// number of blocks set in ram_dirty
+	file_t *Jp;		// journal of the blocks only changed in memory
+	unsigned int jnl_nrecs;	// number of records in the journal
+	time_t jnl_start;	// when the first of them was written
+	uint8_t jnl_synced;	// set when the journal may be on disk
 } di_endpoint_t;
 
 // buffer handling
@@ -134,12 +152,24 @@ extern provider_t di_provider;
 
 static registry_t di_endpoint_registry;
 
+// number of unused endpoints kept mounted, so re-entering an image
+// reuses the open image file, its geometry and the mapped BAM and 
+// directory blocks
+#define	DI_CACHE_MAX	4
+
+// unused endpoints, least recently used first
+static registry_t di_cache_registry;
+
 handler_t di_file_handler;
 handler_t di_img_file_handler;
 
 // prototypes
 static void di_write_slot(di_endpoint_t * diep, slot_t * slot);
 static void di_dump_file(file_t * fp, int recurse, int indent);
+static cbm_errno_t di_FLUSH(buf_t * bufp);
+static void di_FREBUF(buf_t ** bufp);
+static cbm_errno_t di_ram_checkpoint(di_endpoint_t * diep, int durable);
+static void di_ram_free(di_endpoint_t * diep);
 
 // ------------------------------------------------------------------
 // management of endpoints
@@ -151,7 +181,9 @@ static void endpoint_init(const type_t * t, void *obj)
 	reg_init(&(fsep->base.files), "di_endpoint_files", 16);
 	fsep->base.ptype = &di_provider;
 	fsep->base.is_assigned = 0;
+	fsep->base.refcnt = 0;
 	fsep->base.is_temporary = 0;
+	fsep->base.sync = SYNC_NONE;
 	fsep->bam1 = NULL;
 	fsep->bam2 = NULL;
 	fsep->dir = NULL;
@@ -160,6 +192,14 @@ static void endpoint_init(const type_t * t, void *obj)
 	fsep->buf[2] = NULL;
 	fsep->buf[3] = NULL;
 	fsep->buf[4] = NULL;
+	fsep->is_cached = 0;
+	fsep->ram = NULL;
+	fsep->ram_dirty = NULL;
+	fsep->ram_ndirty = 0;
+	fsep->Jp = NULL;
+	fsep->jnl_nrecs = 0;
+	fsep->jnl_start = 0;
+	fsep->jnl_synced = 0;
 }
 
 static type_t endpoint_type = {
@@ -272,15 +312,152 @@ static endpoint_t *di_newep(const char *path)
 	return (endpoint_t *) diep;
 }
 
+// *********
+// di_dropep
+// *********
+
+static void di_dropep(di_endpoint_t * cep)
+{
+	log_debug("di_dropep(%p)\n", cep);
+
+	// remove from list of endpoints
+	reg_remove(&di_endpoint_registry, cep);
+	if (cep->is_cached) {
+		reg_remove(&di_cache_registry, cep);
+		cep->is_cached = 0;
+	}
+
+	// close/free resources
+	if (cep->ram_ndirty > 0) {
+		di_ram_checkpoint(cep, cep->base.sync != SYNC_NONE);
+	}
+	di_ram_free(cep);
+	if (cep->Ip != NULL) {
+		cep->Ip->handler->fclose(cep->Ip, NULL, NULL);
+		cep->Ip = NULL;
+	}
+	di_FREBUF(&cep->bam1);
+	di_FREBUF(&cep->bam2);
+	di_FREBUF(&cep->dir);
+
+	mem_free(cep);
+}
+
+// ************
+// di_img_stamp
+// ************
+//
+// the image file as it is when mounted, to see later if it has been
+// changed from outside
+
+static void di_img_stamp(di_endpoint_t * diep, const direntry_t * de)
+{
+	diep->img_moddate = de->moddate;
+	diep->img_moddate_ns = de->moddate_ns;
+	diep->img_size = de->size;
+	diep->img_ino = de->ino;
+	diep->img_written = 0;
+}
+
+static int di_img_changed(const di_endpoint_t * diep, const direntry_t * de)
+{
+	return diep->img_moddate != de->moddate
+		|| diep->img_moddate_ns != de->moddate_ns
+		|| diep->img_size != de->size
+		|| diep->img_ino != de->ino;
+}
+
+static cbm_errno_t di_img_info(di_endpoint_t * diep, direntry_t * de)
+{
+	file_t *ip = diep->Ip;
+
+	memset(de, 0, sizeof(*de));
+	if (ip == NULL || ip->handler->info == NULL) {
+		return CBM_ERROR_FAULT;
+	}
+	return ip->handler->info(ip, de);
+}
+
+// take the image file as changed by ourselves as the new stamp
+static void di_img_restamp(di_endpoint_t * diep)
+{
+	direntry_t de;
+
+	if (diep->img_written) {
+		diep->Ip->handler->flush(diep->Ip, 0);
+		if (di_img_info(diep, &de) == CBM_ERROR_OK) {
+			di_img_stamp(diep, &de);
+		}
+	}
+}
+
+// ***********
+// di_uptodate
+// ***********
+//
+// check a mounted image, e.g. from the resolve cache, before it is used again
+
+static int di_uptodate(endpoint_t * ep)
+{
+	di_endpoint_t *diep = (di_endpoint_t *) ep;
+	direntry_t de;
+
+	if (diep->Ip == NULL || diep->Ip->handler->info == NULL) {
+		// cannot tell
+		return 1;
+	}
+	di_img_restamp(diep);
+
+	if (di_img_info(diep, &de) != CBM_ERROR_OK) {
+		// e.g. removed
+		return 0;
+	}
+	return !di_img_changed(diep, &de);
+}
+
+// *************
+// di_cache_trim
+// *************
+//
+// drop cached endpoints whose image drive has been unassigned, and
+// the least recently used ones beyond DI_CACHE_MAX
+
+static void di_cache_trim(void)
+{
+	di_endpoint_t *diep;
+
+	for (int i = 0; (diep = reg_get(&di_cache_registry, i)) != NULL; ) {
+		endpoint_t *imgep = diep->Ip->endpoint;
+		if (imgep->is_assigned == 0) {
+			di_dropep(diep);
+			// the cached image file kept the endpoint from being freed
+			imgep->ptype->freeep(imgep);
+		} else {
+			i++;
+		}
+	}
+
+	while (reg_size(&di_cache_registry) > DI_CACHE_MAX) {
+		di_dropep(reg_get(&di_cache_registry, 0));
+	}
+}
+
 // *********
 // di_freeep
 // *********
+//
+// the endpoint is not used anymore; images on assigned drives are
+// kept in the cache, others are dropped
 
 static void di_freeep(endpoint_t * ep)
 {
 	log_debug("di_freeep(%p)\n", ep);
 
 	di_endpoint_t *cep = (di_endpoint_t *) ep;
+	if (ep->refcnt > 0) {
+		// still referenced, e.g. from the resolve cache
+		return;
+	}
 	if (reg_size(&ep->files)) {
 		log_warn
 		    ("di_freeep(): trying to close endpoint %p with %d open files!\n",
@@ -291,16 +468,29 @@ static void di_freeep(endpoint_t * ep)
 		log_warn("Endpoint %p is still assigned\n", ep);
 		return;
 	}
-	// remove from list of endpoints
-	reg_remove(&di_endpoint_registry, cep);
 
-	// close/free resources
-	if (cep->Ip != NULL) {
-		cep->Ip->handler->fclose(cep->Ip, NULL, NULL);
-		cep->Ip = NULL;
+	if (cep->Ip == NULL || cep->Ip->endpoint->is_assigned == 0) {
+		di_dropep(cep);
+		return;
+	}
+
+	// write back what is still buffered, as the image may be 
+	// accessed otherwise while in the cache
+	di_FLUSH(cep->bam1);
+	di_FLUSH(cep->bam2);
+	di_FLUSH(cep->dir);
+	if (cep->ram_ndirty > 0) {
+		di_ram_checkpoint(cep, cep->base.sync != SYNC_NONE);
+	} else
+	if (cep->Ip->handler->flush != NULL) {
+		cep->Ip->handler->flush(cep->Ip, cep->base.sync != SYNC_NONE);
 	}
+	di_img_restamp(cep);
+
+	reg_append(&di_cache_registry, cep);
+	cep->is_cached = 1;
 
-	mem_free(ep);
+	di_cache_trim();
 }
 
 static void di_ep_free(endpoint_t * ep)
@@ -322,21 +512,474 @@ static void di_ep_free(endpoint_t * ep)
 
 // OLD Style (deprectated)
 
-static inline int di_fflush(file_t * file)
+// the file written to, the journal for an image in memory
+static inline file_t *di_wrfile(di_endpoint_t * diep)
+{
+	return (diep->Jp != NULL) ? diep->Jp : diep->Ip;
+}
+
+static inline int di_fflush(file_t * file, int durable)
 {
 
 	di_endpoint_t *diep = (di_endpoint_t *) file->endpoint;
+	file_t *wrfile = di_wrfile(diep);
+
+	if (durable && wrfile == diep->Jp) {
+		diep->jnl_synced = 1;
+	}
+	return wrfile->handler->flush(wrfile, durable);
+}
+
+
+// write the image file (or journal) back, and sync it to disk as the drive's policy says
+static inline void di_fsync(di_endpoint_t * diep)
+{
+	file_t *wrfile = di_wrfile(diep);
+	int durable = diep->base.sync != SYNC_NONE;
+
+	if (durable && wrfile == diep->Jp) {
+		diep->jnl_synced = 1;
+	}
+	wrfile->handler->flush(wrfile, durable);
+}
+
+// ------------------------------------------------------------------
+// images in memory
+//
+// With the "ram" assign option, the whole image is read into memory when
+// it is mounted, and blocks are read from and written to memory only.
+// A written block is appended to the journal "<image>.jnl" next to the
+// image, and handed to the operating system (and synced to disk with the
+// "always" sync policy) before the write is acknowledged. The changed
+// blocks are written back to the image in a checkpoint - after a short
+// pause, when the journal gets too long or too old, on INITIALIZE or "XS",
+// and when the image is unmounted - and the journal is emptied.
+//
+// The journal starts with a header that names the image it belongs to, by
+// its size, serial number and modification date after the last checkpoint.
+// A journal that is not empty when the image is mounted with "ram" again
+// (e.g. after a crash) is replayed if its header matches the image, and
+// ignored and emptied otherwise. Without "ram" the journal is not looked at.
+// Without a journal, written blocks are also written to the image.
+
+// the header is the magic, flags, image size (little endian), serial
+// number and modification date (seconds and nanoseconds)
+#define	DI_JNL_MAGIC		"XDJ1"
+#define	DI_JNL_HDRLEN		32
+// header flag: the image is being written in a checkpoint, so its date has changed
+#define	DI_JNL_INCHECKPOINT	0x01
+// a journal record is the block number (LBA, little endian) and the block
+#define	DI_JNL_RECLEN		(4 + 256)
+// checkpoint after that many ms without a block written
+#define	DI_CHECKPOINT_DELAY	2000
+// checkpoint at the latest after that many records (1 MB) ...
+#define	DI_JNL_MAXRECS		4096
+// ... or after that many seconds since the first record
+#define	DI_JNL_MAXAGE		30
+
+static void di_ram_free(di_endpoint_t * diep)
+{
+	poll_set_timer(diep, NULL, -1);
+
+	if (diep->Jp != NULL) {
+		diep->Jp->handler->fclose(diep->Jp, NULL, NULL);
+		diep->Jp = NULL;
+	}
+	if (diep->ram != NULL) {
+		mem_free(diep->ram);
+		mem_free(diep->ram_dirty);
+		diep->ram = NULL;
+		diep->ram_dirty = NULL;
+	}
+	diep->ram_ndirty = 0;
+	diep->jnl_nrecs = 0;
+	diep->jnl_synced = 0;
+}
+
+static void di_ram_expired(void *data)
+{
+	di_endpoint_t *diep = (di_endpoint_t *) data;
+
+	di_ram_checkpoint(diep, diep->base.sync == SYNC_ALWAYS);
+}
+
+static void di_jnl_put(uint8_t * p, uint64_t val, int len)
+{
+	for (int i = 0; i < len; i++) {
+		p[i] = (val >> (8 * i)) & 0xff;
+	}
+}
+
+static uint64_t di_jnl_get(const uint8_t * p, int len)
+{
+	uint64_t val = 0;
+
+	for (int i = len - 1; i >= 0; i--) {
+		val = (val << 8) | p[i];
+	}
+	return val;
+}
+
+// where the next record goes
+static long di_jnl_end(di_endpoint_t * diep)
+{
+	return DI_JNL_HDRLEN + (long)DI_JNL_RECLEN * diep->jnl_nrecs;
+}
+
+// (re-)write the header for the image as it is now
+static cbm_errno_t di_jnl_header(di_endpoint_t * diep, file_t * jp, uint8_t flags)
+{
+	uint8_t hdr[DI_JNL_HDRLEN];
+
+	memset(hdr, 0, DI_JNL_HDRLEN);
+	memcpy(hdr, DI_JNL_MAGIC, 4);
+	hdr[4] = flags;
+	di_jnl_put(hdr + 8, diep->img_size, 4);
+	di_jnl_put(hdr + 12, diep->img_ino, 8);
+	di_jnl_put(hdr + 20, (uint64_t)diep->img_moddate, 8);
+	di_jnl_put(hdr + 28, (uint64_t)diep->img_moddate_ns, 4);
+
+	cbm_errno_t err = jp->handler->seek(jp, 0, SEEKFLAG_ABS);
+	if (err == CBM_ERROR_OK
+		&& jp->handler->writefile(jp, (const char *)hdr, DI_JNL_HDRLEN, 0) != DI_JNL_HDRLEN) {
+		err = CBM_ERROR_WRITE_ERROR;
+	}
+	if (err == CBM_ERROR_OK) {
+		err = jp->handler->seek(jp, di_jnl_end(diep), SEEKFLAG_ABS);
+	}
+	return err;
+}
+
+// check that the header is for the image as it is now
+static int di_jnl_matches(di_endpoint_t * diep, const uint8_t * hdr)
+{
+	if (memcmp(hdr, DI_JNL_MAGIC, 4)
+		|| di_jnl_get(hdr + 8, 4) != diep->img_size
+		|| di_jnl_get(hdr + 12, 8) != diep->img_ino) {
+		return 0;
+	}
+	if (hdr[4] & DI_JNL_INCHECKPOINT) {
+		// any date, as the image has been written
+		return 1;
+	}
+	return di_jnl_get(hdr + 20, 8) == (uint64_t)diep->img_moddate
+		&& di_jnl_get(hdr + 28, 4) == (uint64_t)diep->img_moddate_ns;
+}
+
+// empty the journal, after the image has been written
+static cbm_errno_t di_jnl_reset(di_endpoint_t * diep, file_t * jp)
+{
+	cbm_errno_t err = jp->handler->truncate(jp, 0);
+
+	if (err == CBM_ERROR_OK) {
+		diep->jnl_nrecs = 0;
+		err = di_jnl_header(diep, jp, 0);
+	}
+	if (err == CBM_ERROR_OK) {
+		err = jp->handler->flush(jp, 0);
+	}
+	return err;
+}
+
+// drop a record not completely written
+static void di_jnl_rollback(di_endpoint_t * diep, file_t * jp)
+{
+	long end = di_jnl_end(diep);
+
+	if (jp->handler->truncate(jp, end) != CBM_ERROR_OK
+		|| jp->handler->seek(jp, end, SEEKFLAG_ABS) != CBM_ERROR_OK) {
+		log_error("Could not remove the incomplete record from the journal\n");
+	}
+}
+
+// write the changed blocks back to the image, and empty the journal
+static cbm_errno_t di_ram_checkpoint(di_endpoint_t * diep, int durable)
+{
+	cbm_errno_t err = CBM_ERROR_OK;
+	file_t *ip = diep->Ip;
+	file_t *jp = diep->Jp;
+	unsigned int n = 0;
+
+	if (jp == NULL) {
+		return CBM_ERROR_OK;
+	}
+
+	poll_set_timer(diep, NULL, -1);
+
+	if (diep->jnl_nrecs == 0 && diep->ram_ndirty == 0) {
+		return CBM_ERROR_OK;
+	}
+
+	trace_t tr = trace_begin();
+
+	// the journal must be complete, and still be replayed when the
+	// image has been written only partially, before the image is changed
+	err = di_jnl_header(diep, jp, DI_JNL_INCHECKPOINT);
+	if (err == CBM_ERROR_OK) {
+		err = jp->handler->flush(jp, durable);
+	}
+	if (err == CBM_ERROR_OK && durable) {
+		diep->jnl_synced = 1;
+	}
+
+	for (unsigned int lba = 0; err == CBM_ERROR_OK && lba < diep->DI.Blocks; lba++) {
+		if (diep->ram_dirty[lba]) {
+			err = ip->handler->seek(ip, 256L * lba, SEEKFLAG_ABS);
+			if (err == CBM_ERROR_OK
+				&& ip->handler->writefile(ip, (char *)diep->ram + 256L * lba, 256, 0) < 0) {
+				err = CBM_ERROR_WRITE_ERROR;
+			}
+			if (err == CBM_ERROR_OK) {
+				diep->ram_dirty[lba] = 0;
+				diep->ram_ndirty--;
+				n++;
+			}
+		}
+	}
+	if (n > 0) {
+		diep->img_written = 1;
+	}
+	if (err == CBM_ERROR_OK) {
+		// a journal that may be on disk is only emptied when the image is as well
+		err = ip->handler->flush(ip, durable || diep->jnl_synced);
+	}
+	if (err == CBM_ERROR_OK) {
+		// the header names the image as written now
+		di_img_restamp(diep);
+		err = di_jnl_reset(diep, jp);
+	}
+	if (err == CBM_ERROR_OK) {
+		diep->jnl_synced = 0;
+	}
+
+	trace_end(tr, "di", "checkpoint", n);
+
+	if (err != CBM_ERROR_OK) {
+		// the journal is replayed when the image is mounted again
+		log_error("Checkpoint of image in memory failed (%d)\n", err);
+	} else {
+		log_debug("Checkpoint wrote %u blocks back to the image\n", n);
+	}
+	return err;
+}
+
+// apply the journal records to the image in memory; a journal that does
+// not belong to the image is emptied
+static cbm_errno_t di_jnl_replay(di_endpoint_t * diep, file_t * jp)
+{
+	cbm_errno_t err = CBM_ERROR_OK;
+	uint8_t rec[DI_JNL_RECLEN];
+	int readfl = 0;
+	int n = 0;
+
+	err = jp->handler->seek(jp, 0, SEEKFLAG_ABS);
+	if (err != CBM_ERROR_OK) {
+		return err;
+	}
+
+	int rv = jp->handler->readfile(jp, (char *)rec, DI_JNL_HDRLEN, &readfl, CHARSET_PETSCII);
+	if (rv != DI_JNL_HDRLEN || !di_jnl_matches(diep, rec)) {
+		if (rv > 0) {
+			log_warn("Ignoring a journal that is not for this image\n");
+		}
+		return di_jnl_reset(diep, jp);
+	}
 
-	return diep->Ip->handler->flush(diep->Ip);
+	while (err == CBM_ERROR_OK && !(readfl & READFLAG_EOF)) {
+		// an incomplete record at the end was not written completely, and is ignored
+		if (jp->handler->readfile(jp, (char *)rec, DI_JNL_RECLEN, &readfl,
+					CHARSET_PETSCII) != DI_JNL_RECLEN) {
+			break;
+		}
+		uint32_t lba = di_jnl_get(rec, 4);
+		if (lba >= diep->DI.Blocks) {
+			// not from this image
+			err = CBM_ERROR_FAULT;
+		} else {
+			memcpy(diep->ram + 256L * lba, rec + 4, 256);
+			if (!diep->ram_dirty[lba]) {
+				diep->ram_dirty[lba] = 1;
+				diep->ram_ndirty++;
+			}
+			n++;
+		}
+	}
+	if (n > 0) {
+		// a journal left over is on disk, and must not be lost
+		diep->jnl_synced = 1;
+		log_warn("Replayed %d blocks from the journal of the image\n", n);
+	} else
+	if (err == CBM_ERROR_OK) {
+		// drop what is left of an incomplete record
+		err = di_jnl_reset(diep, jp);
+	}
+	if (err != CBM_ERROR_OK) {
+		log_error("Could not replay the journal of the image (%d)\n", err);
+	}
+	return err;
 }
 
+// open (or create) the journal of the image
+static file_t *di_jnl_open(direntry_t * imgde)
+{
+	file_t *dir = imgde->parent;
+	file_t *jp = NULL;
+	openpars_t jpars;
+
+	if (dir == NULL || dir->handler->create == NULL) {
+		return NULL;
+	}
+	openpars_init_options(&jpars);
+
+	char *jname = mem_alloc_c(strlen((char *)imgde->name) + 5, "di_journal_name");
+	strcpy(jname, (char *)imgde->name);
+	strcat(jname, ".jnl");
 
-static inline void di_fsync(file_t * file)
+	if (dir->handler->create(dir, &jp, jname, imgde->cset, &jpars,
+					FS_OPEN_RW) != CBM_ERROR_OK) {
+		jp = NULL;
+	}
+	mem_free(jname);
+
+	if (jp != NULL && jp->handler->truncate == NULL) {
+		jp->handler->fclose(jp, NULL, NULL);
+		jp = NULL;
+	}
+	return jp;
+}
+
+// read the image into memory, and open (and replay) its journal
+static cbm_errno_t di_ram_load(di_endpoint_t * diep, direntry_t * imgde)
 {
-	// TODO
-	// if(res) log_error("os_fsync failed: (%d) %s\n", os_errno(), os_strerror(os_errno()));
+	cbm_errno_t err = CBM_ERROR_OK;
+	file_t *ip = diep->Ip;
+	size_t len = 256L * diep->DI.Blocks;
+	size_t n = 0;
+	int readfl = 0;
+
+	trace_t tr = trace_begin();
+
+	// the journal header is checked against this
+	di_img_restamp(diep);
+
+	diep->ram = mem_alloc_c(len, "di_ram_image");
+	diep->ram_dirty = mem_alloc_c(diep->DI.Blocks, "di_ram_dirty");
+	memset(diep->ram_dirty, 0, diep->DI.Blocks);
+	diep->ram_ndirty = 0;
+
+	err = ip->handler->seek(ip, 0, SEEKFLAG_ABS);
+	while (err == CBM_ERROR_OK && n < len) {
+		int rv = ip->handler->readfile(ip, (char *)diep->ram + n, len - n, &readfl,
+						CHARSET_PETSCII);
+		if (rv <= 0 || (size_t)rv > len - n) {
+			err = CBM_ERROR_FAULT;
+		} else {
+			n += rv;
+		}
+	}
+
+	trace_end(tr, "di", "load_image", diep->DI.Blocks);
+
+	if (err != CBM_ERROR_OK) {
+		log_error("Could not read image '%s' into memory\n", imgde->name);
+		di_ram_free(diep);
+		return err;
+	}
+
+	diep->Jp = di_jnl_open(imgde);
+	if (diep->Jp == NULL) {
+		log_warn("No journal for image '%s', writing blocks through\n", imgde->name);
+	} else {
+		diep->jnl_synced = 0;
+		err = di_jnl_replay(diep, diep->Jp);
+		if (err == CBM_ERROR_OK) {
+			// write back what was replayed, and empty the journal
+			err = di_ram_checkpoint(diep, diep->base.sync != SYNC_NONE);
+		}
+		if (err != CBM_ERROR_OK) {
+			// keep the journal for the next mount
+			di_ram_free(diep);
+			return err;
+		}
+	}
+
+	log_info("Image '%s' (%u blocks) is kept in memory\n", imgde->name, diep->DI.Blocks);
 
-	file->handler->flush(file);
+	return err;
+}
+
+static cbm_errno_t di_ram_read(di_endpoint_t * diep, long pos, uint8_t * buf)
+{
+	if (pos < 0 || pos >= 256L * diep->DI.Blocks) {
+		return CBM_ERROR_FAULT;
+	}
+	memcpy(buf, diep->ram + pos, 256);
+	return CBM_ERROR_OK;
+}
+
+// the block is only changed in memory when it is in the journal (or image)
+static cbm_errno_t di_ram_write(di_endpoint_t * diep, long pos, const uint8_t * buf)
+{
+	cbm_errno_t err = CBM_ERROR_OK;
+	uint8_t rec[DI_JNL_RECLEN];
+	file_t *jp = diep->Jp;
+	unsigned int lba = pos / 256;
+
+	if (pos < 0 || pos >= 256L * diep->DI.Blocks) {
+		return CBM_ERROR_FAULT;
+	}
+
+	if (jp == NULL) {
+		// write through
+		file_t *ip = diep->Ip;
+		err = ip->handler->seek(ip, pos, SEEKFLAG_ABS);
+		if (err == CBM_ERROR_OK
+			&& ip->handler->writefile(ip, (const char *)buf, 256, 0) < 0) {
+			err = CBM_ERROR_WRITE_ERROR;
+		}
+		if (err == CBM_ERROR_OK) {
+			memcpy(diep->ram + pos, buf, 256);
+			diep->img_written = 1;
+		}
+		return err;
+	}
+
+	int durable = diep->base.sync == SYNC_ALWAYS;
+
+	di_jnl_put(rec, lba, 4);
+	memcpy(rec + 4, buf, 256);
+	if (jp->handler->writefile(jp, (const char *)rec, DI_JNL_RECLEN, 0) != DI_JNL_RECLEN) {
+		err = CBM_ERROR_WRITE_ERROR;
+	}
+	if (err == CBM_ERROR_OK) {
+		err = jp->handler->flush(jp, durable);
+	}
+	if (err != CBM_ERROR_OK) {
+		log_error("Could not write block %u to the journal\n", lba);
+		di_jnl_rollback(diep, jp);
+		return err;
+	}
+	if (durable) {
+		diep->jnl_synced = 1;
+	}
+
+	memcpy(diep->ram + pos, buf, 256);
+	if (!diep->ram_dirty[lba]) {
+		diep->ram_dirty[lba] = 1;
+		diep->ram_ndirty++;
+	}
+	if (diep->jnl_nrecs++ == 0) {
+		diep->jnl_start = time(NULL);
+	}
+	if (diep->jnl_nrecs >= DI_JNL_MAXRECS
+		|| time(NULL) - diep->jnl_start >= DI_JNL_MAXAGE) {
+		// do not let a steady stream of writes grow the journal
+		di_ram_checkpoint(diep, durable);
+	} else {
+		poll_set_timer(diep, di_ram_expired, DI_CHECKPOINT_DELAY);
+	}
+
+	return CBM_ERROR_OK;
 }
 
 
@@ -467,17 +1110,24 @@ static cbm_errno_t di_RDBUF(buf_t * bufp)
 	int readfl;
 	di_endpoint_t *diep = bufp->diep;
 	file_t *file = diep->Ip;
+	trace_t tr = trace_begin();
 
 	long seekpos = 256 * diep->DI.LBA(bufp->track, bufp->sector);
-	err = file->handler->seek(file, seekpos, SEEKFLAG_ABS);
-	if (err == CBM_ERROR_OK) {
-		// TODO: error on read?
-		// TODO: CHARSET_PETSCII should not be necessary (in readfile only used for directory reads)
-		file->handler->readfile(file, (char *)(bufp->buf), 256,
-					&readfl, CHARSET_PETSCII);
+	if (diep->ram != NULL) {
+		err = di_ram_read(diep, seekpos, bufp->buf);
+	} else {
+		err = file->handler->seek(file, seekpos, SEEKFLAG_ABS);
+		if (err == CBM_ERROR_OK) {
+			// TODO: error on read?
+			// TODO: CHARSET_PETSCII should not be necessary (in readfile only used for directory reads)
+			file->handler->readfile(file, (char *)(bufp->buf), 256,
+						&readfl, CHARSET_PETSCII);
+		}
 	}
 
 	bufp->dirty = 0;
+	metrics_sector_read();
+	trace_end(tr, "di", "read_sector", seekpos / 256);
 
 	log_debug("RDBUF(%d,%d (%p)) -> %d\n", bufp->track, bufp->sector, bufp,
 		  err);
@@ -499,15 +1149,23 @@ static cbm_errno_t di_WRBUF(buf_t * p)
 	cbm_errno_t err;
 	di_endpoint_t *diep = p->diep;
 	file_t *file = diep->Ip;
+	trace_t tr = trace_begin();
 
 	long seekpos = 256 * diep->DI.LBA(p->track, p->sector);
-	err = file->handler->seek(file, seekpos, SEEKFLAG_ABS);
-	if (err == CBM_ERROR_OK) {
-		// TODO: error on write?
-		file->handler->writefile(file, (char *)(p->buf), 256, 0);
+	if (diep->ram != NULL) {
+		err = di_ram_write(diep, seekpos, p->buf);
+	} else {
+		err = file->handler->seek(file, seekpos, SEEKFLAG_ABS);
+		if (err == CBM_ERROR_OK) {
+			// TODO: error on write?
+			file->handler->writefile(file, (char *)(p->buf), 256, 0);
+			diep->img_written = 1;
+		}
 	}
 
 	p->dirty = 0;
+	metrics_sector_write();
+	trace_end(tr, "di", "write_sector", seekpos / 256);
 
 	log_debug("WRBUF(%d,%d (%p)) -> %d\n", p->track, p->sector, p, err);
 #ifdef DEBUG_DATA
@@ -574,6 +1232,7 @@ static cbm_errno_t di_REUSEFLUSHMAP(buf_t * bufp, uint8_t track, uint8_t sector)
 		}
 	} else {
 		log_debug("REUSEFM(%d,%d (%p),d=%d)\n", bufp->track, bufp->sector, bufp, bufp->dirty);
+		metrics_sector_hit();
 	}
 		
 	return err;
@@ -1062,7 +1721,7 @@ static int di_save_buffer(di_endpoint_t * diep)
 		  diep->U2_sector);
 	di_SETBUF(diep->buf[0], diep->U2_track, diep->U2_sector);
 	di_WRBUF(diep->buf[0]);
-	di_fsync(diep->Ip);
+	di_fsync(diep);
 	diep->U2_track = 0;
 	// di_dump_block(diep->buf[0]);
 	return 1;		// OK
@@ -2534,7 +3193,7 @@ di_create_entry(di_endpoint_t * diep, File * file, const char *name,
 	}
 	di_write_slot(diep, &file->Slot);
 
-	di_fflush((file_t *) file);
+	di_fflush((file_t *) file, 0);
 	// di_print_slot(&file->Slot);
 	return CBM_ERROR_OK;
 }
@@ -2752,6 +3411,37 @@ di_img_direntry2(file_t * dir, direntry_t ** outde, int isdirscan, int *readflag
 // ------------------------------------------------------------------
 // OPEN / READ / WRITE a file
 
+// ****************
+// di_truncate_file
+// ****************
+
+// free all blocks of a file behind the first one, so it can be written anew
+static void di_truncate_file(di_endpoint_t * diep, slot_t * slot)
+{
+	uint8_t t, s;
+
+	if (!slot->start_track) {
+		return;
+	}
+
+	buf_t *b = NULL;
+	di_GETBUF(&b, diep);
+
+	di_MAPBUF(b, slot->start_track, slot->start_sector);
+	t = b->buf[0];
+	s = b->buf[1];
+	while (t)		// follow chain for freeing blocks
+	{
+		di_block_free(diep, t, s);
+		di_MAPBUF(b, t, s);
+		t = b->buf[0];
+		s = b->buf[1];
+	}
+	slot->size = 1;
+	di_FLUSH_bam(diep);
+	di_FREBUF(&b);
+}
+
 // ************
 // di_open_file
 // ************
@@ -2842,6 +3532,11 @@ static int di_open_file(File * file, openpars_t * pars, int di_cmd)
 				    ("Read/Write currently only supported for REL files on disk images\n");
 				return CBM_ERROR_FAULT;
 			}
+			if (di_cmd == FS_OPEN_OW) {
+				// the old blocks would otherwise stay allocated,
+				// and still be counted in the file size
+				di_truncate_file(diep, &file->Slot);
+			}
 		}
 	}
 	file->chp = 255;
@@ -3572,11 +4267,34 @@ static void di_free_ep(registry_t *reg, void *en) {
 	di_endpoint_t *diep = (di_endpoint_t*)en;
         reg_free(&(diep->base.files), di_free_file);
 
+	if (diep->ram_ndirty > 0) {
+		di_ram_checkpoint(diep, diep->base.sync != SYNC_NONE);
+	}
+	di_ram_free(diep);
+
 	mem_free(diep);
 }
 
+// write back the changed blocks of images in memory
+static int di_sync(int force)
+{
+	int rv = CBM_ERROR_OK;
+	di_endpoint_t *diep;
+
+	for (int i = 0; (diep = reg_get(&di_endpoint_registry, i)) != NULL; i++) {
+		if (diep->ram_ndirty > 0) {
+			int err = di_ram_checkpoint(diep, force || diep->base.sync != SYNC_NONE);
+			if (rv == CBM_ERROR_OK) {
+				rv = err;
+			}
+		}
+	}
+	return rv;
+}
+
 static void di_free(void)
 {
+	reg_free(&di_cache_registry, NULL);
 	reg_free(&di_endpoint_registry, di_free_ep);
 }
 
@@ -3593,6 +4311,7 @@ static void di_init(void)
 	handler_register(&di_img_file_handler);
 
 	reg_init(&di_endpoint_registry, "di_endpoint_registry", 5);
+	reg_init(&di_cache_registry, "di_cache_registry", DI_CACHE_MAX + 1);
 }
 
 // ----------------------------------------------------------------------------------
@@ -3608,6 +4327,7 @@ static void di_dump_ep(di_endpoint_t * fsep, int indent)
 	log_debug("%sprovider='%s';\n", prefix, fsep->base.ptype->name);
 	log_debug("%sis_temporary='%d';\n", prefix, fsep->base.is_temporary);
 	log_debug("%sis_assigned='%d';\n", prefix, fsep->base.is_assigned);
+	log_debug("%sin_ram='%d'; // %u blocks changed\n", prefix, fsep->ram != NULL, fsep->ram_ndirty);
 	log_debug("%sroot_file=%p; // '%s'\n", prefix, fsep->Ip,
 		  fsep->Ip->filename);
 	log_debug("%sfiles={;\n", prefix);
@@ -3815,7 +4535,7 @@ static cbm_errno_t di_close_fd(di_endpoint_t * diep, File * f, uint8_t *tr, uint
 		log_debug("%p: Status of directory entry saved\n", diep);
 		di_FLUSH_bam(diep);	// Save BAM status
 		log_debug("%p: BAM saved.\n", diep);
-		di_fsync(diep->Ip);
+		di_fsync(diep);
 
 		int free_blocks = di_BAM_blocks_free(diep);
 		if (free_blocks == 0) {
@@ -3840,7 +4560,7 @@ static cbm_errno_t di_close_fd(di_endpoint_t * diep, File * f, uint8_t *tr, uint
 		log_debug("Status of directory entry saved\n");
 		di_FLUSH_bam(diep);	// Save BAM status
 		log_debug("BAM saved.\n");
-		di_fsync(diep->Ip);
+		di_fsync(diep);
 	} else {
 		log_debug("Closing read only file, no sync required.\n");
 	}
@@ -3926,12 +4646,12 @@ static int di_to_endpoint(file_t * file, endpoint_t ** outep)
 	*outep = ep;
 
 	// prevent it from being closed here
-	ep->is_assigned++;
+	ep->refcnt++;
 
 	di_fclose(file, NULL, NULL);
 
 	// reset counter
-	ep->is_assigned--;
+	ep->refcnt--;
 
 	log_debug("di_to_endpoint: file=%p -> diep=%p\n", file, *outep);
 
@@ -3966,6 +4686,45 @@ static file_t *di_root(endpoint_t * ep)
 	return (file_t *) file;
 }
 
+// *********
+// di_maywrap
+// *********
+//
+// check on the name only, as di_wrap2() does first; the wrapped name
+// is the name without the ".dxx" extension
+
+// length of the wrapped name, or -1 when the name has no ".dxx" extension
+static int di_img_namelen(direntry_t * dirent)
+{
+	if (dirent->mode != FS_DIR_MOD_FIL || dirent->name == NULL) {
+		return -1;
+	}
+
+	const char *name = conv_name_alloc((char*)dirent->name,
+		dirent->cset, CHARSET_ASCII);
+	if (name == NULL) {
+		return -1;
+	}
+
+	int l = strlen(name);
+	if (l < 4 || name[l - 4] != '.' || (name[l - 3] != 'd' && name[l - 3] != 'D')
+		|| !isdigit(name[l - 2]) || !isdigit(name[l - 1])) {
+		l = -1;
+	} else {
+		l -= 4;
+	}
+	mem_free(name);
+
+	return l;
+}
+
+static int di_maywrap(direntry_t * dirent)
+{
+	int l = di_img_namelen(dirent);
+
+	return (l < 0) ? WRAP_NONE : l;
+}
+
 // *********
 // di_wrap2
 // *********
@@ -3986,33 +4745,11 @@ static int di_wrap2(direntry_t * dirent, direntry_t ** outde)
 	*outde = NULL;
 
 	// first check name
-        const char *name = conv_name_alloc((char*)dirent->name,
-                dirent->cset, CHARSET_ASCII);
-
-
-	if (dirent->mode != FS_DIR_MOD_FIL) {
-		mem_free(name);
-		return err;
-	}
-
-	int l = 0;
-	if (name == NULL || (l = strlen(name)) < 4) {
-		mem_free(name);
+	int l = di_img_namelen(dirent);
+	if (l < 0) {
 		return err;
 	}
 
-	if (name[l - 4] != '.' || (name[l - 3] != 'd' && name[l - 3] != 'D')) {
-		mem_free(name);
-		return err;
-	}
-	if ((!isdigit(name[l - 2])) || ((!isdigit(name[l - 1])))) {
-		mem_free(name);
-		return err;
-	}
-
-	mem_free(name);
-	name = NULL;
-
 	Disk_Image_t di;
 	if ((err = di_load_image2(dirent, &di)) != CBM_ERROR_OK) {
 		// image not identified 
@@ -4030,13 +4767,14 @@ static int di_wrap2(direntry_t * dirent, direntry_t ** outde)
         de->de.moddate = di.Blocks * 256; // dirent->moddate;
         de->de.recordlen = 0;
         de->de.mode = FS_DIR_MOD_DIR;
-        de->de.attr = dirent->attr & FS_DIR_ATTR_LOCKED;
+        // the image file stays seekable, which tells it from a directory
+        de->de.attr = dirent->attr & (FS_DIR_ATTR_LOCKED | FS_DIR_ATTR_SEEK);
         de->de.type = FS_DIR_TYPE_UNKNOWN & FS_DIR_ATTR_TYPEMASK;
         de->de.cset = dirent->cset;
 
         de->de.name = (uint8_t*) mem_alloc_str2((char*)dirent->name, "di_wrap_dename");
 	// cut off extension
-        de->de.name[l-4] = 0;
+        de->de.name[l] = 0;
 
         de->parent_de = dirent;
 
@@ -4045,6 +4783,17 @@ static int di_wrap2(direntry_t * dirent, direntry_t ** outde)
 	return err;
 }
 
+// deleting the wrapped image deletes the image file
+static int di_img_scratch2(direntry_t *dirent) {
+
+	di_img_dirent_t *de = (di_img_dirent_t*) dirent;
+
+	if (de->parent_de->handler->scratch2 == NULL) {
+		return CBM_ERROR_FAULT;
+	}
+	return de->parent_de->handler->scratch2(de->parent_de);
+}
+
 static int di_img_declose(direntry_t *dirent) {
 
 	di_img_dirent_t *de = (di_img_dirent_t*) dirent;
@@ -4091,13 +4840,59 @@ static int di_img_fclose(file_t *file, char *rvbuf, int *rvlen)
 //***********
 
 
-static int di_img_open2(direntry_t *dirent, openpars_t *pars, int opentype, file_t **outfp) {
+// the endpoint that keeps the image in memory, if any
+static di_endpoint_t *di_img_inram(direntry_t *imgde) {
+
+	di_endpoint_t *diep;
+	file_t *imgfp = NULL;
+	openpars_t imgpars;
+	int i;
+
+	for (i = 0; (diep = reg_get(&di_endpoint_registry, i)) != NULL; i++) {
+		if (diep->ram != NULL) {
+			break;
+		}
+	}
+	if (diep == NULL) {
+		return NULL;
+	}
+
+	openpars_init_options(&imgpars);
+	if (imgde->handler->open2(imgde, &imgpars, FS_OPEN_RD, &imgfp) != CBM_ERROR_OK) {
+		return NULL;
+	}
+	for (; (diep = reg_get(&di_endpoint_registry, i)) != NULL; i++) {
+		if (diep->ram != NULL && !diep->Ip->handler->equals(diep->Ip, imgfp)) {
+			break;
+		}
+	}
+	imgfp->handler->fclose(imgfp, NULL, NULL);
+
+	return diep;
+}
 
-	(void) pars;
-	(void) opentype;
+static int di_img_open2(direntry_t *dirent, openpars_t *pars, int opentype, file_t **outfp) {
 
 	di_img_dirent_t *de = (di_img_dirent_t*) dirent;
 
+	if (opentype != FS_OPEN_DR) {
+		// opened as a file, e.g. to copy it, gives the image file itself;
+		// an image kept in memory is written back first, and can only be read
+		di_endpoint_t *diep = di_img_inram(de->parent_de);
+		if (diep != NULL) {
+			if (opentype != FS_OPEN_RD) {
+				log_error("Image '%s' is kept in memory, can not write it\n",
+					de->parent_de->name);
+				return CBM_ERROR_FILE_EXISTS;
+			}
+			int rv = di_ram_checkpoint(diep, 0);
+			if (rv != CBM_ERROR_OK) {
+				return rv;
+			}
+		}
+		return de->parent_de->handler->open2(de->parent_de, pars, opentype, outfp);
+	}
+
 	file_t *imgfp = NULL;
 	file_t *dirfp = NULL;
 	openpars_t imgpars;
@@ -4127,6 +4922,26 @@ static int di_img_open2(direntry_t *dirent, openpars_t *pars, int opentype, file
 			// root of endpoint equals the given parent file
 			// so we reuse the endpoint
 
+			if (diep->is_cached && di_img_changed(diep, de->parent_de)) {
+				// image has changed since it was mounted
+				log_debug("Dropping outdated cached ep %p\n", diep);
+				di_dropep(diep);
+				break;
+			}
+
+			if (pars != NULL && pars->inram && diep->ram == NULL) {
+				rv = di_ram_load(diep, de->parent_de);
+				if (rv != CBM_ERROR_OK) {
+					imgfp->handler->fclose(imgfp, NULL, NULL);
+					return rv;
+				}
+			}
+
+			if (diep->is_cached) {
+				reg_remove(&di_cache_registry, diep);
+				diep->is_cached = 0;
+			}
+
 			log_debug("Found ep %p to reuse with file %p\n", diep,
 				  imgfp);
 
@@ -4145,11 +4960,19 @@ static int di_img_open2(direntry_t *dirent, openpars_t *pars, int opentype, file
 		// allocate a new endpoint
 		di_endpoint_t *newep = (di_endpoint_t *) di_newep((char*)dirent->name);
 		newep->Ip = imgfp;
+		newep->base.sync = imgfp->endpoint->sync;
+		di_img_stamp(newep, de->parent_de);
 
 		newep->base.is_temporary = 1;
 
 		if ((rv = di_load_image2(de->parent_de, &newep->DI)) == CBM_ERROR_OK) {
-			// image identified correctly
+			// image identified correctly; a journal that can not be
+			// replayed makes the mount fail
+			if (pars != NULL && pars->inram) {
+				rv = di_ram_load(newep, de->parent_de);
+			}
+		}
+		if (rv == CBM_ERROR_OK) {
 			dirfp = di_root((endpoint_t *) newep);
 			dirfp->handler = &di_img_file_handler;
 
@@ -4186,6 +5009,7 @@ handler_t di_img_file_handler = {
 	"di_img_file_handler",
 	di_resolve2,		// resolve2 - not required
 	di_wrap2,		// wrap
+	di_maywrap,		// maywrap
 	di_img_fclose,		// fclose
 	di_img_declose,		// declose 
 	di_img_open2,		// open2 a direntry_t TODO
@@ -4198,8 +5022,9 @@ handler_t di_img_file_handler = {
 	di_create,		// create
 	NULL,			// flush data to disk
 	di_equals,		// check if two files are the same
+	NULL,			// info
 	NULL,			// compute and return the real linear file size TODO
-	NULL,			// scratch2 TODO
+	di_img_scratch2,	// scratch2
 	NULL,			// mkdir not supported
 	NULL,			// rmdir2 not supported
 	NULL,			// move2 a file TODO
@@ -4211,6 +5036,7 @@ handler_t di_file_handler = {
 	"di_file_handler",
 	NULL,			// resolve2 - not required
 	NULL,			// wrap
+	NULL,			// maywrap
 	di_fclose,		// fclose 
 	di_declose,		// declose
 	di_open2,		// open2 a direntry_t 
@@ -4223,6 +5049,7 @@ handler_t di_file_handler = {
 	di_create,		// create
 	di_fflush,		// flush data to disk
 	di_equals,		// check if two files are the same
+	NULL,			// info
 	di_realsize2,		// compute and return the real linear file size 
 	di_scratch2,		// scratch2
 	NULL,			// mkdir not supported
@@ -4242,5 +5069,8 @@ provider_t di_provider = {
 	di_root,		// file_t* (*root)(endpoint_t *ep);  // root directory for the endpoint
 	di_direct,
 	di_format,		// format
-	di_dump			// dump
+	di_dump,		// dump
+	di_sync,		// sync
+	di_cache_trim,		// unassigned
+	di_uptodate		// uptodate
 };
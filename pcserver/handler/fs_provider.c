@@ -56,6 +56,9 @@
 #include "openpars.h"
 #include "registry.h"
 #include "wildcard.h"
+#include "trace.h"
+#include "iopool.h"
+#include "loop.h"
 
 #include "log.h"
 
@@ -77,6 +80,49 @@ static void fsp_free(endpoint_t *ep);
 // list of endpoints
 static registry_t endpoints;
 
+// files opened for reading are read in chunks of this size, one chunk 
+// ahead of the read position, by the I/O pool
+#define	READAHEAD_LEN	16384
+
+typedef struct {
+	char		*buf[2];	// current chunk, and the next one
+	long		off[2];		// file offset of the chunks
+	long		len[2];		// valid bytes in the chunks
+	iopool_job_t	*job;		// read into the next chunk in flight, or NULL
+	long		pos;		// read position
+	long		size;		// file size, for the EOF detection
+} readahead_t;
+
+static type_t readahead_type = {
+	"fs_readahead",
+	sizeof(readahead_t),
+	NULL
+};
+
+static void readahead_close(readahead_t *ra);
+
+// files opened for writing collect the written data in a buffer of this
+// size, that is written by the I/O pool when it is full, or when no data
+// has come in for WRITEBEHIND_DELAY ms
+#define	WRITEBEHIND_LEN		65536
+#define	WRITEBEHIND_DELAY	1000
+
+typedef struct {
+	char		*buf[2];	// buffer being filled, and the one being written
+	int		len;		// bytes in buf[0]
+	long		off;		// file offset of buf[0]
+	iopool_job_t	*job;		// write of buf[1] in flight, or NULL
+	int		wlen;		// length of that write
+	long		woff;		// file offset of that write
+	int		err;		// first write error, returned on the next write or close
+} writebehind_t;
+
+static type_t writebehind_type = {
+	"fs_writebehind",
+	sizeof(writebehind_t),
+	NULL
+};
+
 typedef struct {
 	file_t		file;
 	FILE		*fp;
@@ -87,8 +133,13 @@ typedef struct {
 	direntry_t	direntry;
 	char		*block;		// direct channel block buffer, 256 byte when allocated
 	unsigned char	block_ptr;
+	readahead_t	*ra;		// read-ahead when opened read-only, reads bypass fp then
+	writebehind_t	*wb;		// write-behind when opened write-only, writes bypass fp then
+	uint8_t		written;	// set when written to since the last fsync
 } File;
 
+static int writebehind_close(File *file);
+
 static void file_init(const type_t *t, void *obj) {
 	(void) t;	// silence unused warning
 	File *fp = (File*) obj;
@@ -109,6 +160,9 @@ static void file_init(const type_t *t, void *obj) {
 	fp->block_ptr = 0;
 	fp->temp_open = 0;
 	fp->ospath = NULL;
+	fp->ra = NULL;
+	fp->wb = NULL;
+	fp->written = 0;
 }
 
 static type_t file_type = {
@@ -140,6 +194,8 @@ static void endpoint_init(const type_t *t, void *obj) {
 
 	fsep->base.is_temporary = 0;
 	fsep->base.is_assigned = 0;
+	fsep->base.refcnt = 0;
+	fsep->base.sync = SYNC_NONE;
 
 	reg_append(&endpoints, fsep);
 }
@@ -280,6 +336,13 @@ static int close_fd(File *file) {
 		mem_free((void*)file->file.filename);
 	}
 
+	if (file->ra != NULL) {
+		readahead_close(file->ra);
+		file->ra = NULL;
+	}
+	if (file->wb != NULL) {
+		writebehind_close(file);
+	}
 	if (file->fp != NULL) {
 		fflush(file->fp);
 		er = fclose(file->fp);
@@ -461,6 +524,7 @@ static int fsp_to_endpoint(file_t *file, endpoint_t **outep) {
 	// copy into current path
 	fsep->curpath = mem_alloc_str2(fsep->basepath, "fs_curpath");
 	fsep->mount = parentep;
+	fsep->base.sync = file->endpoint->sync;
 
 	// free resources
 	close_fd(fp);
@@ -1040,6 +1104,10 @@ static int fs_direntry2(file_t *fp, direntry_t **outentry, int isdirscan, int *r
 					}
 
 					dirent->moddate = sbuf.st_mtime;
+#if !defined(_WIN32)
+					dirent->moddate_ns = sbuf.st_mtim.tv_nsec;
+#endif
+					dirent->ino = sbuf.st_ino;
 					dirent->size = sbuf.st_size;
 					if (S_ISDIR(sbuf.st_mode)) {
 						dirent->mode = FS_DIR_MOD_DIR;
@@ -1073,12 +1141,153 @@ static int fs_direntry2(file_t *fp, direntry_t **outentry, int isdirscan, int *r
 
 
 
+// ----------------------------------------------------------------------------------
+// read-ahead
+
+// I/O pool callback for the read into the next chunk
+static void readahead_done(void *data, ssize_t res) {
+
+	readahead_t *ra = (readahead_t*) data;
+
+	if (res < 0) {
+		log_error("Read-ahead at %ld failed: %s\n", ra->off[1], strerror(-res));
+		res = 0;
+	}
+	ra->len[1] = res;
+	ra->job = NULL;
+}
+
+// start reading the next chunk from the given offset
+static void readahead_start(readahead_t *ra, int fd, long offset) {
+
+	ra->off[1] = offset;
+	ra->len[1] = 0;
+	ra->job = iopool_read(fd, ra->buf[1], READAHEAD_LEN, offset, readahead_done, ra);
+
+	if (ra->job == NULL) {
+		// no I/O pool, so read it right away
+		ssize_t n = pread(fd, ra->buf[1], READAHEAD_LEN, offset);
+		readahead_done(ra, (n < 0) ? -errno : n);
+	}
+}
+
+// set up read-ahead for a regular file, and start reading its first chunk
+static readahead_t *readahead_open(int fd) {
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+
+	readahead_t *ra = mem_alloc(&readahead_type);
+	ra->buf[0] = mem_alloc_c(READAHEAD_LEN, "fs_readahead_buf");
+	ra->buf[1] = mem_alloc_c(READAHEAD_LEN, "fs_readahead_buf");
+	ra->off[0] = 0;
+	ra->len[0] = 0;
+	ra->pos = 0;
+	ra->size = st.st_size;
+
+	readahead_start(ra, fd, 0);
+
+	return ra;
+}
+
+static void readahead_close(readahead_t *ra) {
+
+	// the worker must be done with the buffer before it is freed
+	if (ra->job != NULL) {
+		iopool_wait(ra->job);
+	}
+	mem_free(ra->buf[0]);
+	mem_free(ra->buf[1]);
+	mem_free(ra);
+}
+
+// make the chunk with the read position the current one, and read ahead
+// the chunk after it. Returns 0 when there is no data at the read position
+static int readahead_fill(readahead_t *ra, int fd) {
+
+	if (ra->job != NULL) {
+		trace_t tr = trace_begin();
+		iopool_wait(ra->job);
+		trace_end(tr, "fs", "readahead_wait", ra->off[1]);
+	}
+
+	if (ra->pos < ra->off[1] || ra->pos >= ra->off[1] + ra->len[1]) {
+		// not read ahead (e.g. after a seek), so read it now
+		readahead_start(ra, fd, ra->pos);
+		if (ra->job != NULL) {
+			iopool_wait(ra->job);
+		}
+		if (ra->len[1] == 0) {
+			return 0;
+		}
+	}
+
+	char *buf = ra->buf[0];
+	ra->buf[0] = ra->buf[1];
+	ra->buf[1] = buf;
+	ra->off[0] = ra->off[1];
+	ra->len[0] = ra->len[1];
+
+	long next = ra->off[0] + ra->len[0];
+	if (next < ra->size) {
+		readahead_start(ra, fd, next);
+	} else {
+		ra->off[1] = next;
+		ra->len[1] = 0;
+	}
+	return 1;
+}
+
+// read file data from the read-ahead chunks; the file size is tracked
+// to find the EOF, so it is sent with the last data
+static int read_ahead(File *file, char *retbuf, int len, int *eof) {
+
+	readahead_t *ra = file->ra;
+	int fd = fileno(file->fp);
+	int n = 0;
+
+	while (n < len) {
+		if (ra->pos < ra->off[0] || ra->pos >= ra->off[0] + ra->len[0]) {
+			if (!readahead_fill(ra, fd)) {
+				break;
+			}
+		}
+		long l = ra->off[0] + ra->len[0] - ra->pos;
+		if (l > len - n) {
+			l = len - n;
+		}
+		memcpy(retbuf + n, ra->buf[0] + (ra->pos - ra->off[0]), l);
+		n += l;
+		ra->pos += l;
+	}
+
+	if (ra->pos >= ra->size) {
+		// the file may have grown since it was opened
+		struct stat st;
+		if (fstat(fd, &st) == 0) {
+			ra->size = st.st_size;
+		}
+	}
+	if (n < len || ra->pos >= ra->size) {
+		*eof = READFLAG_EOF;
+		log_debug("EOF on read %p\n", file);
+	}
+	return n;
+}
+
 // read file data
 //
 // returns positive number of bytes read, or negative error number
 //
 static int read_file(File *file, char *retbuf, int len, int *eof) {
 
+	if (file->ra != NULL) {
+		return read_ahead(file, retbuf, len, eof);
+	}
+
 	int rv = 0;
 
 	FILE *fp = file->fp;
@@ -1106,6 +1315,184 @@ static int read_file(File *file, char *retbuf, int len, int *eof) {
 	return rv;
 }
 
+// ----------------------------------------------------------------------------------
+// write-behind
+
+// I/O pool callback for the write of buf[1]
+static void writebehind_done(void *data, ssize_t res) {
+
+	writebehind_t *wb = (writebehind_t*) data;
+
+	if (res != wb->wlen) {
+		log_error("Write-behind of %d bytes at %ld failed: %s\n", wb->wlen, wb->woff,
+			res < 0 ? strerror(-res) : "short write");
+		if (wb->err == CBM_ERROR_OK) {
+			wb->err = res < 0 ? errno_to_error(-res) : CBM_ERROR_WRITE_ERROR;
+		}
+	}
+	wb->job = NULL;
+}
+
+// wait until the write in flight is done
+static void writebehind_wait(writebehind_t *wb) {
+
+	if (wb->job != NULL) {
+		trace_t tr = trace_begin();
+		iopool_wait(wb->job);
+		trace_end(tr, "fs", "writebehind_wait", wb->woff);
+	}
+}
+
+// hand the collected data to the I/O pool, and collect into the other buffer
+static void writebehind_submit(writebehind_t *wb, int fd) {
+
+	writebehind_wait(wb);
+
+	if (wb->len == 0) {
+		return;
+	}
+
+	char *buf = wb->buf[1];
+	wb->buf[1] = wb->buf[0];
+	wb->buf[0] = buf;
+	wb->wlen = wb->len;
+	wb->woff = wb->off;
+	wb->off += wb->len;
+	wb->len = 0;
+
+	wb->job = iopool_write(fd, wb->buf[1], wb->wlen, wb->woff, writebehind_done, wb);
+
+	if (wb->job == NULL) {
+		// no I/O pool, so write it right away
+		ssize_t n = pwrite(fd, wb->buf[1], wb->wlen, wb->woff);
+		writebehind_done(wb, (n < 0) ? -errno : n);
+	}
+}
+
+// write all collected data and wait for it; returns the first write error
+static int writebehind_flush(File *file) {
+
+	writebehind_t *wb = file->wb;
+
+	poll_set_timer(file, NULL, -1);
+
+	writebehind_submit(wb, fileno(file->fp));
+	writebehind_wait(wb);
+
+	return wb->err;
+}
+
+// timer callback, no data has been written for a while
+static void writebehind_expired(void *data) {
+
+	File *file = (File*) data;
+
+	if (file->file.endpoint->sync == SYNC_ALWAYS) {
+		writebehind_flush(file);
+		if (fsync(fileno(file->fp)) < 0) {
+			log_errno("Error syncing '%s'", file->ospath);
+		}
+		file->written = 0;
+	} else {
+		writebehind_submit(file->wb, fileno(file->fp));
+	}
+}
+
+// set up write-behind for a regular file; the data is appended to what is
+// already there, as the file is either new, truncated or opened for append
+static writebehind_t *writebehind_open(int fd) {
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+
+	writebehind_t *wb = mem_alloc(&writebehind_type);
+	wb->buf[0] = mem_alloc_c(WRITEBEHIND_LEN, "fs_writebehind_buf");
+	wb->buf[1] = mem_alloc_c(WRITEBEHIND_LEN, "fs_writebehind_buf");
+	wb->len = 0;
+	wb->off = st.st_size;
+	wb->job = NULL;
+	wb->err = CBM_ERROR_OK;
+
+	return wb;
+}
+
+// write what is left, and free the write-behind; returns the first write error
+static int writebehind_close(File *file) {
+
+	int rv = writebehind_flush(file);
+
+	writebehind_t *wb = file->wb;
+	mem_free(wb->buf[0]);
+	mem_free(wb->buf[1]);
+	mem_free(wb);
+	file->wb = NULL;
+
+	return rv;
+}
+
+// collect file data in the write-behind buffer
+static int write_behind(File *file, const char *buf, int len) {
+
+	writebehind_t *wb = file->wb;
+
+	if (wb->err != CBM_ERROR_OK) {
+		return -wb->err;
+	}
+
+	int n = 0;
+	while (n < len) {
+		int l = WRITEBEHIND_LEN - wb->len;
+		if (l > len - n) {
+			l = len - n;
+		}
+		memcpy(wb->buf[0] + wb->len, buf + n, l);
+		wb->len += l;
+		n += l;
+
+		if (wb->len == WRITEBEHIND_LEN) {
+			writebehind_submit(wb, fileno(file->fp));
+		}
+	}
+
+	poll_set_timer(file, writebehind_expired, WRITEBEHIND_DELAY);
+
+	return len;
+}
+
+// write back what is buffered for the file, and with durable set
+// sync it to disk; returns the first write error
+static int sync_file(File *file, int durable) {
+
+	int rv = CBM_ERROR_OK;
+
+	if (file->wb != NULL) {
+		rv = writebehind_flush(file);
+	}
+	if (file->fp != NULL) {
+		if (fflush(file->fp) != 0) {
+			log_errno("Error writing '%s'", file->ospath);
+			if (rv == CBM_ERROR_OK) {
+				rv = errno_to_error(errno);
+			}
+		}
+		if (durable && file->written) {
+			trace_t tr = trace_begin();
+			if (fsync(fileno(file->fp)) < 0) {
+				log_errno("Error syncing '%s'", file->ospath);
+				if (rv == CBM_ERROR_OK) {
+					rv = errno_to_error(errno);
+				}
+			}
+			trace_end(tr, "fs", "fsync", 0);
+			file->written = 0;
+		}
+	}
+	return rv;
+}
+
 static int expand_relfile(File *file, long cursize, long curpos) {
 		FILE *fp = file->fp;
 				char *buf = mem_alloc(&record_type);
@@ -1196,6 +1583,10 @@ static int write_file(File *file, const char *buf, int len, int is_eof) {
 
 	int err = CBM_ERROR_OK;
 
+	if (file->wb != NULL) {
+		return write_behind(file, buf, len);
+	}
+
 	FILE *fp = file->fp;
 
 	if (file->file.recordlen > 0) {
@@ -1316,7 +1707,7 @@ static int fs_mkdir(file_t *file, const char *name, charset_t cset, openpars_t *
 
 	(void) pars;	// silence unused warning
 
-	fs_endpoint_t *fsep = (fs_endpoint_t*) file->endpoint;
+	File *dir = (File*) file;
 
 	bool matched = false;
         const char *p = cconv_scan(name, cset, dir_separator_char(), "*?", &matched);
@@ -1334,7 +1725,8 @@ static int fs_mkdir(file_t *file, const char *name, charset_t cset, openpars_t *
         // convert filename to external charset
         const char *tmpnamep = conv_name_alloc(name, cset, CHARSET_ASCII);
 
-	char *newpath = malloc_path(fsep->curpath, tmpnamep);
+	// create the directory in the directory the name was resolved to
+	char *newpath = malloc_path(dir->ospath, tmpnamep);
 
 	mem_free(tmpnamep);
 
@@ -1379,7 +1771,7 @@ static int fs_rmdir2(direntry_t *dirent) {
 		rv = errno_to_error(errno);
 	}
 
-	mem_free(newospath);
+	free((void*)newospath);
 	return rv;
 }
 
@@ -1425,7 +1817,9 @@ static int readfile(file_t *fp, char *retbuf, int len, int *readflag, charset_t
 	if (f->fp) {
 		// read a file
 		// standard file read
+		trace_t tr = trace_begin();
 		rv = read_file(f, retbuf, len, readflag);
+		trace_end(tr, "fs", "read_file", rv);
 	} else
 	if (f->block != NULL) {
 		// direct channel block buffer read
@@ -1446,7 +1840,10 @@ static int writefile(file_t *fp, const char *buf, int len, int is_eof) {
 	if (file->block != NULL) {
 		rv = write_block(file, buf, len, is_eof);
 	} else {
+		trace_t tr = trace_begin();
 		rv = write_file(file, buf, len, is_eof);
+		trace_end(tr, "fs", "write_file", rv);
+		file->written = 1;
 	}	
 	return rv;
 }
@@ -1463,6 +1860,39 @@ static int fs_seek(file_t *fp, long position, int flag) {
 
 	rv = fs_open_temp(file);
 
+	if ((rv == CBM_ERROR_OK) && (file->ra != NULL)) {
+		readahead_t *ra = file->ra;
+		if (seekflag == SEEK_END) {
+			struct stat st;
+			if (fstat(fileno(file->fp), &st) == 0) {
+				ra->size = st.st_size;
+			}
+			position += ra->size;
+		}
+		if (position < 0) {
+			rv = CBM_ERROR_FAULT;
+		} else {
+			ra->pos = position;
+		}
+	} else
+	if ((rv == CBM_ERROR_OK) && (file->wb != NULL)) {
+		rv = writebehind_flush(file);
+		if (seekflag == SEEK_END) {
+			// the write offset is not the end after a backward seek
+			struct stat st;
+			if (fstat(fileno(file->fp), &st) == 0) {
+				position += st.st_size;
+			} else {
+				rv = CBM_ERROR_FAULT;
+			}
+		}
+		if (position < 0) {
+			rv = CBM_ERROR_FAULT;
+		} else
+		if (rv == CBM_ERROR_OK) {
+			file->wb->off = position;
+		}
+	} else
 	if ((rv == CBM_ERROR_OK) && (file->fp != NULL)) {
 		if (fseek(file->fp, position, seekflag) < 0) {
 			rv = CBM_ERROR_FAULT;
@@ -1558,6 +1988,12 @@ static int fs_open(file_t *fp, openpars_t *pars, int type) {
 			if (file->fp == NULL) {
 				rv = errno_to_error(errno);
 				log_errno("Error opening file '%s'\n", file->ospath);
+			} else
+			if (type == FS_OPEN_RD && file->file.recordlen == 0) {
+				file->ra = readahead_open(fileno(file->fp));
+			} else
+			if (type != FS_OPEN_RW && file->file.recordlen == 0) {
+				file->wb = writebehind_open(fileno(file->fp));
 			}
 		}
 	}
@@ -1626,12 +2062,14 @@ static int fs_fclose(file_t *fp, char *outbuf, int *outlen) {
 
 	//fs_dump_file(fp, 0, 1);
 
+	int rv = sync_file((File*)fp, fp->endpoint->sync != SYNC_NONE);
+
 	close_fd((File*)fp);
 
 	if (outlen != NULL) {
 		*outlen = 0;
 	}
-	return CBM_ERROR_OK;
+	return rv;
 }
 
 static int fs_declose(direntry_t *de) {
@@ -1718,13 +2156,44 @@ static int fs_resolve2(const char **pattern, charset_t cset, file_t **inoutdir)
 
 // ----------------------------------------------------------------------------------
 
-static int fs_flush(file_t *fp) {
+static int fs_flush(file_t *fp, int durable) {
 	
-	File *file = (File*)fp;
-	if (file->fp != NULL) {
-		fflush(file->fp);
+	return sync_file((File*)fp, durable);
+}
+
+static int fs_truncate(file_t *fp, long size) {
+
+	File *file = (File*) fp;
+
+	int rv = fs_open_temp(file);
+	if (rv == CBM_ERROR_OK) {
+		rv = sync_file(file, 0);
 	}
-	return CBM_ERROR_OK;
+	if (rv == CBM_ERROR_OK && file->fp != NULL) {
+		if (ftruncate(fileno(file->fp), size) < 0) {
+			log_errno("Error truncating '%s'", file->ospath);
+			rv = errno_to_error(errno);
+		}
+	}
+	return rv;
+}
+
+// write back the buffered data of all open files
+static int fsp_sync(int force) {
+
+	int rv = CBM_ERROR_OK;
+	fs_endpoint_t *fsep;
+
+	for (int i = 0; (fsep = reg_get(&endpoints, i)) != NULL; i++) {
+		File *file;
+		for (int j = 0; (file = reg_get(&fsep->base.files, j)) != NULL; j++) {
+			int err = sync_file(file, force || fsep->base.sync != SYNC_NONE);
+			if (rv == CBM_ERROR_OK) {
+				rv = err;
+			}
+		}
+	}
+	return rv;
 }
 
 static int fs_equals(file_t *thisfile, file_t *otherfile) {
@@ -1733,7 +2202,36 @@ static int fs_equals(file_t *thisfile, file_t *otherfile) {
 		return 1;
 	}
 
-	return strcmp(((File*)thisfile)->ospath, ((File*)otherfile)->ospath);
+	const char *thispath = ((File*)thisfile)->ospath;
+	const char *otherpath = ((File*)otherfile)->ospath;
+
+	if (!strcmp(thispath, otherpath)) {
+		return 0;
+	}
+
+	// the same file by a different path, e.g. "//tmp//foo.d64"
+	struct stat thisbuf, otherbuf;
+	if (stat(thispath, &thisbuf) == 0 && stat(otherpath, &otherbuf) == 0
+		&& thisbuf.st_dev == otherbuf.st_dev && thisbuf.st_ino == otherbuf.st_ino) {
+		return 0;
+	}
+	return 1;
+}
+
+static int fs_info(file_t *fp, direntry_t *outde) {
+
+	struct stat sbuf;
+
+	if (stat(((File*)fp)->ospath, &sbuf) < 0) {
+		return errno_to_error(errno);
+	}
+	outde->size = sbuf.st_size;
+	outde->moddate = sbuf.st_mtime;
+#if !defined(_WIN32)
+	outde->moddate_ns = sbuf.st_mtim.tv_nsec;
+#endif
+	outde->ino = sbuf.st_ino;
+	return CBM_ERROR_OK;
 }
 
 // ----------------------------------------------------------------------------------
@@ -1831,6 +2329,7 @@ handler_t fs_file_handler = {
 	"fs_file_handler",
 	fs_resolve2,		// resolve2
 	NULL,			// wrap
+	NULL,			// maywrap
 	fs_fclose,		// close
 	fs_declose,		// close
 	fs_open2,		// open2
@@ -1838,11 +2337,12 @@ handler_t fs_file_handler = {
 	fs_seek,		// seek
 	readfile,		// readfile
 	writefile,		// writefile
-	NULL,			// truncate
+	fs_truncate,		// truncate
 	fs_direntry2,		// direntry2
 	fs_create,		// create
 	fs_flush,		// flush data out to disk
         fs_equals,		// check if two files (e.g. d64 files are the same)
+	fs_info,		// current size, date and serial number
 	fs_realsize2,		// real size of file (same as file->filesize here)
 	fs_delete2,		// delete2 file
 	fs_mkdir,		// create a directory
@@ -1862,7 +2362,10 @@ provider_t fs_provider = {
 	fsp_root,		// file_t* (*root)(endpoint_t *ep);  // root directory for the endpoint
 	fs_direct,
 	NULL,			// format
-	fs_dump			// dump
+	fs_dump,		// dump
+	fsp_sync,		// sync
+	NULL,			// unassigned
+	NULL			// uptodate
 };
 
 
@@ -38,6 +38,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <poll.h>
 
 
 #include "provider.h"
@@ -49,11 +50,19 @@
 #include "wireformat.h"
 
 #include "log.h"
+#include "loop.h"
+#include "ringbuf.h"
 
 #undef DEBUG_READ
 
 #define	MAX_BUFFER_SIZE	64
 
+// size of the per-connection receive and send ring buffers
+#define	TCP_BUFFER_SIZE	8192
+
+// how long (ms) a write waits for the peer to take data from a full send buffer
+#define	TCP_WRITE_TIMEOUT	10000
+
 #define	TELNET_PORT	"23"
 
 //#define	min(a,b)	(((a)<(b))?(a):(b))
@@ -68,9 +77,15 @@ typedef struct {
 	file_t		file;		// embedded
 	int		isroot;		// !=0 when root
 
-	char		has_lastbyte;	// lastbyte is valid when set
-	char		lastbyte;	// last byte read, to handle EOF correctly
 	int		sockfd;		// socket file descriptor
+	int		registered;	// !=0 when registered with the poll loop
+	int		is_eof;		// !=0 when peer has closed its side
+	int		error;		// CBM error from a failed socket operation
+	int		closing;	// !=0 when closed by the device, but data still queued
+	// the socket is driven from the poll loop, and 
+	// FS_READ / FS_WRITE only copy from / to these buffers
+	ringbuf_t	rx;		// data received from socket
+	ringbuf_t	tx;		// data queued to be sent to socket
 } File;
 
 static void file_init(const type_t *t, void *obj) {
@@ -82,9 +97,14 @@ static void file_init(const type_t *t, void *obj) {
         fp->file.handler = &tcp_file_handler;
         fp->file.recordlen = 0;
 
-	fp->has_lastbyte = 0;
         fp->isroot = -0;
         fp->sockfd = -1;
+	fp->registered = 0;
+	fp->is_eof = 0;
+	fp->error = CBM_ERROR_OK;
+	fp->closing = 0;
+	ringbuf_init(&fp->rx, TCP_BUFFER_SIZE, "tcp_rx");
+	ringbuf_init(&fp->tx, TCP_BUFFER_SIZE, "tcp_tx");
 }
 
 static type_t file_type = {
@@ -120,6 +140,8 @@ static void endpoint_init(const type_t *t, void *obj) {
 
         fsep->base.is_temporary = 0;
         fsep->base.is_assigned = 0;
+        fsep->base.refcnt = 0;
+        fsep->base.sync = SYNC_NONE;
 
         reg_append(&endpoints, fsep);
 }
@@ -136,10 +158,23 @@ static type_t endpoint_type = {
 static int close_fd(File *file) {
 	int er = 0;
 
+	if (file->registered) {
+		poll_unregister(file->sockfd);
+		file->registered = 0;
+	}
 	if (file->sockfd >= 0) {
 		close(file->sockfd);
 		file->sockfd = -1;
 	}
+	if (file->file.filename != NULL) {
+		mem_free(file->file.filename);
+	}
+
+	// remove file from endpoint registry
+	reg_remove(&(file->file.endpoint->files), file);
+
+	ringbuf_free(&file->rx);
+	ringbuf_free(&file->tx);
 	mem_free(file);
 	return er;
 }
@@ -232,14 +267,13 @@ static endpoint_t *tnp_temp(char **name, charset_t cset, int priv) {
 
 	(void) priv;
 
-	char *end = strchr(*name, '/');
-	
-	if (end != NULL) {
-		// no ':' separator between host and port found
-		log_error("Do not use ':' name!\n");
+	if (strchr(*name, '/') != NULL) {
+		log_error("Do not use '/' in name!\n");
 		return NULL;
 	}
-	int n = strlen(*name); //end - *name;
+
+	char *end = strchr(*name, ':');
+	int n = (end == NULL) ? (int) strlen(*name) : end - *name;
 
 	tn_endpoint_t *tnep = create_ep();
 
@@ -248,7 +282,10 @@ static endpoint_t *tnp_temp(char **name, charset_t cset, int priv) {
 	tnep->hostname = conv_name_alloc(hostname, cset, CHARSET_ASCII);
 	mem_free(hostname);
 
-	*name = *name+n;	// char after the ':'
+	*name = *name+n;
+	if (end != NULL) {
+		(*name)++;	// char after the ':'
+	}
 	
 	log_info("Telnet provider set to hostname '%s'\n", tnep->hostname);
 
@@ -287,6 +324,131 @@ static int errno_to_error(int err) {
 	}
 }
 
+// ----------------------------------------------------------------------------------
+// socket handling from the poll loop
+
+// only poll for what the buffers can currently handle
+static void update_interest(File *file) {
+
+	if (file->registered) {
+		poll_set_interest(file->sockfd, 
+			!file->closing && !file->is_eof && file->rx.len < TCP_BUFFER_SIZE,
+			file->tx.len > 0);
+	}
+}
+
+// read as much as is available without blocking into the receive buffer
+static void fill_rx(File *file) {
+
+	char *ptr;
+
+	while (!file->is_eof && file->error == CBM_ERROR_OK && file->rx.len < TCP_BUFFER_SIZE) {
+
+		int chunk = ringbuf_free_chunk(&file->rx, &ptr);
+
+		ssize_t n = read(file->sockfd, ptr, chunk);
+#ifdef DEBUG_READ
+		log_debug("Read %ld bytes from socket fd=%d\n", n, file->sockfd);
+#endif
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				// error reading from socket
+				log_errno("Error reading from socket!\n");
+				file->error = errno_to_error(errno);
+			}
+			break;
+		}
+		if (n == 0) {
+			file->is_eof = 1;
+			break;
+		}
+		file->rx.len += n;
+		if (n < chunk) {
+			break;
+		}
+	}
+}
+
+// send as much of the queued data as possible without blocking
+static void flush_tx(File *file) {
+
+	char *ptr;
+
+	while (file->tx.len > 0 && file->error == CBM_ERROR_OK) {
+
+		int chunk = ringbuf_data_chunk(&file->tx, &ptr);
+
+		ssize_t nw = send(file->sockfd, ptr, chunk, MSG_NOSIGNAL);
+		if (nw < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				log_errno("Error writing to socket\n");
+				file->error = errno_to_error(errno);
+			}
+			break;
+		}
+		ringbuf_consume(&file->tx, nw);
+		if (nw < chunk) {
+			break;
+		}
+	}
+}
+
+// wait until the socket can take more data; as the FS_WRITE reply is only sent
+// afterwards, a peer that does not read throttles the device
+static int wait_tx(File *file) {
+
+	struct pollfd pfd = { file->sockfd, POLLOUT, 0 };
+
+	int n = poll(&pfd, 1, TCP_WRITE_TIMEOUT);
+	if (n < 0 && errno != EINTR) {
+		log_errno("Error waiting for tcp socket fd=%d\n", file->sockfd);
+		file->error = errno_to_error(errno);
+	}
+	return n > 0;
+}
+
+// a file closed by the device is freed once its send queue is drained
+static int check_closing(File *file) {
+
+	if (file->closing && (file->tx.len == 0 || file->error != CBM_ERROR_OK)) {
+		log_debug("Closing tcp socket fd=%d after flushing queued data\n", file->sockfd);
+		close_fd(file);
+		return 1;
+	}
+	return 0;
+}
+
+static void sock_read(int fd, void *data) {
+	(void) fd;
+	File *file = (File*) data;
+
+	fill_rx(file);
+	update_interest(file);
+}
+
+static void sock_write(int fd, void *data) {
+	(void) fd;
+	File *file = (File*) data;
+
+	flush_tx(file);
+	if (!check_closing(file)) {
+		update_interest(file);
+	}
+}
+
+static void sock_hup(int fd, void *data) {
+	File *file = (File*) data;
+
+	// hangup is always reported, so stop polling; remaining data 
+	// is still read directly from the socket by read_file()
+	poll_unregister(fd);
+	file->registered = 0;
+
+	if (file->closing) {
+		close_fd(file);
+	}
+}
+
 
 // ----------------------------------------------------------------------------------
 // commands as sent from the device
@@ -352,13 +514,15 @@ static int open_file(File *file, openpars_t *pars, const char *mode) {
 
         freeaddrinfo(addr);           /* No longer needed */
 
-	ern = fcntl(sockfd, F_SETFL, O_NONBLOCK);
+	if (ap != NULL) {
+		ern = fcntl(sockfd, F_SETFL, O_NONBLOCK);
 
-	if (ern != 0) {
-		log_errno("Could not set to non-blocking!");
-		close(sockfd);
-		er = CBM_ERROR_FAULT;
-		ap = NULL;
+		if (ern != 0) {
+			log_errno("Could not set to non-blocking!");
+			close(sockfd);
+			er = CBM_ERROR_FAULT;
+			ap = NULL;
+		}
 	}
 
         if (ap == NULL) {               /* No address succeeded */
@@ -368,6 +532,9 @@ static int open_file(File *file, openpars_t *pars, const char *mode) {
 		log_debug("Connected with fd=%d\n", sockfd);
 
 		file->sockfd = sockfd;
+		file->registered = 1;
+		poll_register_readwrite(sockfd, file, sock_read, sock_write, sock_hup);
+		update_interest(file);
 		er = CBM_ERROR_OK;
 	}
 
@@ -378,7 +545,7 @@ static int open_file(File *file, openpars_t *pars, const char *mode) {
 }
 
 
-// read file data
+// read file data from the receive buffer
 //
 // returns positive number of bytes read, or negative error number
 //
@@ -389,85 +556,88 @@ static int read_file(file_t *fp, char *retbuf, int len, int *readflag, charset_t
 	File *file = (File*)fp;
 
 	if (file != NULL) {
-		int sockfd = file->sockfd;
-
-		int rv = CBM_ERROR_OK;
 
-		retbuf[0] = file->lastbyte;
+		if (file->rx.len == 0) {
+			// nothing buffered yet; try without waiting for the poll loop
+			fill_rx(file);
+		}
 
-		ssize_t n = read(sockfd, file->has_lastbyte ? retbuf+1 : retbuf, 
-					file->has_lastbyte ? len - 1 : len);
+		if (file->rx.len == 0 && file->error != CBM_ERROR_OK) {
+			return -file->error;
+		}
 
-#ifdef DEBUG_READ
-		log_debug("Read %ld bytes from socket fd=%d\n", n, sockfd);
-#endif
+		len = ringbuf_get(&file->rx, retbuf, len);
 
-		if (n < 0) {
-			// error condition
-			if (errno != EAGAIN && errno != EWOULDBLOCK) {
-				// error reading from socket
-				rv = errno_to_error(errno);
-				log_errno("Error reading from socket!\n");
-				return -rv;
-			}
-			// no data available, not in error, just non-blocking
-			len = 0;
-		} else 
-		if (n > 0) {
-			// got some real data
-			// what's in the buffer?
-			len = n + (file->has_lastbyte ? 1 : 0);
-
-			// NOTE: this probably belongs into an option, or
-			// make it different defaults for read only and read/write files
-
-			// keep one for EOF handling (note: len here always >= 1)
-			//len--;
-			//file->lastbyte = retbuf[len];
-			//file->has_lastbyte = 1;
-			file->has_lastbyte = 0;
-		} else
-		if (n == 0) {
-			// got an EOF
+		if (file->is_eof && file->rx.len == 0) {
 			*readflag = READFLAG_EOF;
-			len = file->has_lastbyte ? 1 : 0;
-			retbuf[0] = file->lastbyte;
 		}
+
+		update_interest(file);
+
 		return len;
 	}
 	return -CBM_ERROR_FAULT;
 }
 
-// write file data
+// queue file data for sending
 static int write_file(file_t *fp, const char *buf, int len, int is_eof) {
 	File *file = (File*)fp;
 
+	(void) is_eof;
+
 #ifdef DEBUG_WRITE
 	log_debug("Write_file (tcp): fd=%p\n", file);
 #endif
 
 	if (file != NULL) {
 
-		int sockfd = file->sockfd;
+		if (file->error != CBM_ERROR_OK) {
+			return -file->error;
+		}
 
-		while (len > 0) {
-			ssize_t nw = write(sockfd, buf, len);
+		int n = 0;
+		while (n < len) {
+			n += ringbuf_put(&file->tx, buf + n, len - n);
+			flush_tx(file);
 
-			if (nw < 0) {
-				log_errno("Error writing to socket\n");
+			if (n < len && (file->error != CBM_ERROR_OK || !wait_tx(file))) {
+				log_error("Send buffer full on tcp socket fd=%d, peer not reading\n", 
+					file->sockfd);
 				break;
 			}
-			len -= nw;
 		}
+		update_interest(file);
 
-		if (is_eof) {
-			//close_fd(file);
+		if (n == 0) {
+			return (file->error != CBM_ERROR_OK) ? -file->error : -CBM_ERROR_WRITE_ERROR;
 		}
-		return 0;
+		// short count when the peer stopped taking data
+		return n;
 	}
 	return -CBM_ERROR_FAULT;
 }
 
+static int tn_fclose(file_t *fp, char *outbuf, int *outlen) {
+	(void) outbuf;
+
+	File *file = (File*)fp;
+
+	if (outlen != NULL) {
+		*outlen = 0;
+	}
+
+	if (file->registered && file->tx.len > 0 && file->error == CBM_ERROR_OK) {
+		// keep the socket until the queued data is sent
+		file->closing = 1;
+		update_interest(file);
+		return CBM_ERROR_OK;
+	}
+
+	close_fd(file);
+
+	return CBM_ERROR_OK;
+}
+
 // ----------------------------------------------------------------------------------
 // command channel
 
@@ -534,7 +704,7 @@ static int tn_open2 (direntry_t * de, openpars_t * pars, int opentype, file_t **
 
 	int err = CBM_ERROR_OK;
 
-	File *fp = mem_alloc(&file_type);
+	File *fp = reserve_file((tn_endpoint_t*) de->parent->endpoint);
 	fp->file.filename = mem_alloc_str2((char*)de->name, "tn_filename");
 
 	switch (opentype) {
@@ -552,7 +722,8 @@ static int tn_open2 (direntry_t * de, openpars_t * pars, int opentype, file_t **
        			err = open_file(fp, pars, "rwb");
 			break;
 		default:
-			return CBM_ERROR_FAULT;
+			err = CBM_ERROR_FAULT;
+			break;
 	}
 
 	if (err == CBM_ERROR_OK) {
@@ -661,7 +832,8 @@ static handler_t tcp_file_handler = {
         "tcp_file_handler",
         tn_resolve2,            // resolve2
 	NULL,			// wrap
-	NULL,			// fclose
+	NULL,			// maywrap
+	tn_fclose,		// fclose
 	tn_declose,		// declose
         tn_open2,              	// open2
         handler_parent,         // default parent() implementation
@@ -673,6 +845,7 @@ static handler_t tcp_file_handler = {
         NULL,			// fs_create,              // create
 	NULL,			// fs_flush,               // flush data out to disk
 	NULL,			// fs_equals,              // check if two files (e.g. d64 files are the same)
+	NULL,			// info
         NULL,			// fs_realsize2,            // real size of file (same as file->filesize here)
         NULL,			// fs_delete2,              // delete file
         NULL,			// fs_mkdir,               // create a directory
@@ -693,7 +866,10 @@ provider_t tcp_provider = {
 	tnp_root,			// root - basically only a handle to open files (ports)
 	NULL,				// block
 	NULL,				// format
-	tnp_dump			// dump
+	tnp_dump,			// dump
+	NULL,				// sync
+	NULL,				// unassigned
+	NULL				// uptodate
 };
 
 
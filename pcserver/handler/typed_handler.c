@@ -70,28 +70,21 @@ static type_t typed_dirent_type = {
 
 
 /*
- * identify whether a given file is a typed file type
- *
- * returns CBM_ERROR_OK even if no match found,
- * except in case of an error
- *
- * name is the current file name
+ * check the file name for a ",<type>" ending, and get the file type and
+ * record length from it; returns the length of the wrapped name, which is
+ * the name up to the last ',', or -1 when it is not the name of a typed file
  */
-static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
-
-	log_debug("typed_resolve: infile=%s\n", dirent->name);
-
-	// check the file name of the given file_t, if it actually is a ,P file.
+static int typed_nametype(direntry_t *dirent, uint8_t *outftype, int *outrecordlen) {
 
 	// must be at least one character, plus "," plus "P" ending
 	if (dirent->name == NULL || strlen((char*)dirent->name) < 3) {
 		// not found, but no error
-		return CBM_ERROR_OK;
+		return -1;
 	}
 
         if (dirent->mode != FS_DIR_MOD_FIL) {
                 // wrong de type
-                return CBM_ERROR_OK;
+                return -1;
         }
 
 	char *name = conv_name_alloc((char*)dirent->name, dirent->cset, CHARSET_ASCII);
@@ -105,10 +98,9 @@ static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
 
 	if (p == NULL) {
 		mem_free((char*)name);
-		return CBM_ERROR_OK;
+		return -1;
 	}
-	// cut off type
-	*p = 0;
+	int len = p - name;
 
 	// which type is it?
 	p++;
@@ -141,7 +133,7 @@ static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
 	default:
 		// anything else
 		mem_free((char*)name);
-		return CBM_ERROR_OK;
+		return -1;
 		break;
 	}
 
@@ -150,7 +142,7 @@ static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
 		if (*p) {
 			// does not end with the type
 			mem_free((char*)name);
-			return CBM_ERROR_OK;
+			return -1;
 		}
 	} else {
 		// REL file record size
@@ -158,17 +150,55 @@ static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
 			int n = sscanf(p, "%d", &recordlen);
 			if (n < 1) {
 				mem_free((char*)name);
-				return CBM_ERROR_OK;
+				return -1;
 			}
 		}
 	}
 
 	// not needed anymore
 	mem_free((char*)name);
-	name = NULL;
-			
+
+	*outftype = ftype;
+	*outrecordlen = recordlen;
+	return len;
+}
+
+/*
+ * check on the name only, as typed_wrap() does first
+ */
+static int typed_maywrap(direntry_t *dirent) {
+
+	uint8_t ftype;
+	int recordlen;
+	int len = typed_nametype(dirent, &ftype, &recordlen);
+
+	return (len < 0) ? WRAP_NONE : len;
+}
+
+/*
+ * identify whether a given file is a typed file type
+ *
+ * returns CBM_ERROR_OK even if no match found,
+ * except in case of an error
+ *
+ * name is the current file name
+ */
+static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
+
+	log_debug("typed_resolve: infile=%s\n", dirent->name);
+
+	// check the file name of the given file_t, if it actually is a ,P file.
+	uint8_t ftype = 0;
+	int recordlen = 0;
+	int len = typed_nametype(dirent, &ftype, &recordlen);
+
+	if (len < 0) {
+		// not found, but no error
+		return CBM_ERROR_OK;
+	}
+
 	// ok, we found a real typed file
-	log_info("Found %c typed file '%s' addressed as '%s'\n", typechar, name, dirent->name);
+	log_info("Found typed file '%s'\n", dirent->name);
 
 	// check with the open options
 
@@ -183,6 +213,8 @@ static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
 
         de->de.size = dirent->size;
         de->de.moddate = dirent->moddate;
+        de->de.moddate_ns = dirent->moddate_ns;
+        de->de.ino = dirent->ino;
         de->de.recordlen = recordlen;
         de->de.mode = dirent->mode;
         de->de.attr = dirent->attr;
@@ -190,8 +222,8 @@ static int typed_wrap(direntry_t *dirent, direntry_t **outde) {
         de->de.cset = dirent->cset;
 
         de->de.name = (uint8_t*) mem_alloc_str2((char*)dirent->name, "typed_name");
-	p = strrchr((char*)de->de.name, ',');
-	*p = 0;
+	// cut off type
+	de->de.name[len] = 0;
 
         de->parent_de = dirent;
 
@@ -281,6 +313,7 @@ static handler_t typed_handler = {
 	"typed", 	//const char	*name;			// handler name, for debugging
 	NULL,		// resolve2
 	typed_wrap,		// wrap
+	typed_maywrap,	// maywrap
 	NULL,		// fclose
 	typed_declose,	// declose
 	typed_open2,	//int		(*open2)(direntry_t *fp); 	// open a file
@@ -293,6 +326,7 @@ static handler_t typed_handler = {
 	NULL,		// int create(file_t *fp, file_t **outentry, cont char *name, uint8_t filetype, uint8_t reclen);
 	NULL,		// flush
 	typed_equals,
+	default_info,	// info
 	NULL,		// realsize2
 	typed_scratch2,	// delete2
 	NULL,		// mkdir not supported
@@ -77,28 +77,19 @@ static type_t x00_dirent_type = {
 
 
 /*
- * identify whether a given file is an x00 file type
- *
- * returns CBM_ERROR_OK even if no match found,
- * except in case of an error
- *
- * name is the current file name
+ * check the file name for a ".x00" ending, and get the file type from it;
+ * returns 0 when it is not the name of an x00 file
  */
-static int x00_wrap(direntry_t *dirent, direntry_t **outde) {
-
-	log_debug("x00_wrap: infile=%s\n", dirent->name);
-
-	// check the file name of the given file_t, if it actually is a Pxx file.
+static int x00_nametype(direntry_t *dirent, uint8_t *outftype) {
 
 	// must be at least one character, plus "." plus "x00" ending
 	if (dirent->name == NULL || strlen((char*)dirent->name) < 5) {
-		// not found, but no error
-		return CBM_ERROR_OK;
+		return 0;
 	}
 
 	if (dirent->mode != FS_DIR_MOD_FIL) {
 		// wrong de type
-		return CBM_ERROR_OK;
+		return 0;
 	}
 
 	const char *name = conv_name_alloc((char*)dirent->name, 
@@ -106,28 +97,16 @@ static int x00_wrap(direntry_t *dirent, direntry_t **outde) {
 
 	//log_debug("x00_resolve: infile converted to=%s\n", name);
 
-	char typechar = 0;
+	size_t l = strlen(name);
+	const char *p = name + l - 4;
 	uint8_t ftype = 0;
-	const char *p = name + strlen(name) - 4;
 
-	if (*p != '.') {
-		mem_free(name);
-		return CBM_ERROR_OK;
-	}
-	p++;
-	typechar = *p;
-	p++;
-	if (!isdigit(*p)) {
-		mem_free((char*)name);
-		return CBM_ERROR_OK;
-	}
-	p++;
-	if (!isdigit(*p)) {
+	if (l < 5 || p[0] != '.' || !isdigit(p[2]) || !isdigit(p[3])) {
 		mem_free((char*)name);
-		return CBM_ERROR_OK;
+		return 0;
 	}
 
-	switch(typechar) {
+	switch(p[1]) {
 	case 'P':
 	case 'p':
 		ftype = FS_DIR_TYPE_PRG;
@@ -146,13 +125,47 @@ static int x00_wrap(direntry_t *dirent, direntry_t **outde) {
 		break;
 	default:
 		mem_free((char*)name);
-		return CBM_ERROR_OK;
-		break;
+		return 0;
 	}
 
 	// clean up
 	mem_free((char*)name);
 
+	*outftype = ftype;
+	return 1;
+}
+
+/*
+ * check on the name only, as x00_wrap() does first; the wrapped name
+ * is read from the x00 header, so it is not known before wrapping
+ */
+static int x00_maywrap(direntry_t *dirent) {
+
+	uint8_t ftype;
+
+	return x00_nametype(dirent, &ftype) ? WRAP_ANY_NAME : WRAP_NONE;
+}
+
+/*
+ * identify whether a given file is an x00 file type
+ *
+ * returns CBM_ERROR_OK even if no match found,
+ * except in case of an error
+ *
+ * name is the current file name
+ */
+static int x00_wrap(direntry_t *dirent, direntry_t **outde) {
+
+	log_debug("x00_wrap: infile=%s\n", dirent->name);
+
+	// check the file name of the given file_t, if it actually is a Pxx file.
+	uint8_t ftype = 0;
+
+	if (!x00_nametype(dirent, &ftype)) {
+		// not found, but no error
+		return CBM_ERROR_OK;
+	}
+
 	// ok, we have ensured we have an x00 file name
 	// now make sure it actually is an x00 file
 
@@ -193,7 +206,7 @@ static int x00_wrap(direntry_t *dirent, direntry_t **outde) {
 	}
 
 	// ok, we found a real x00 file
-	log_info("Found %c00 file '%s' addressed as '%s'\n", typechar, x00_buf+8, name);
+	log_info("Found x00 file '%s' addressed as '%s'\n", x00_buf+8, dirent->name);
 
 	// done, alloc x00_file and prepare for operation
 	// no seek necessary, read pointer is already at start of payload
@@ -205,6 +218,8 @@ static int x00_wrap(direntry_t *dirent, direntry_t **outde) {
 
 	de->de.size = dirent->size - X00_HEADER_LEN;
 	de->de.moddate = dirent->moddate;
+	de->de.moddate_ns = dirent->moddate_ns;
+	de->de.ino = dirent->ino;
 	de->de.recordlen = x00_buf[0x19];
 	de->de.mode = dirent->mode;
 	de->de.attr = dirent->attr;
@@ -333,6 +348,7 @@ static handler_t x00_handler = {
 	"X00", 		//const char	*name;			// handler name, for debugging
 	NULL,		// resolve2
 	x00_wrap,	// wrap
+	x00_maywrap,	// maywrap
 	default_fclose,	// fclose
 	x00_declose,	// declose
 	x00_open2,	//int		(*open2)(direntry_t *fp); 	// open a file
@@ -345,6 +361,7 @@ static handler_t x00_handler = {
 	NULL,		// int create(file_t *fp, file_t **outentry, cont char *name, uint8_t filetype, uint8_t reclen);
 	default_flush,
 	x00_equals,
+	default_info,	// info
 	x00_realsize2,
 	x00_scratch2,	// delete2
 	NULL,		// mkdir not supported
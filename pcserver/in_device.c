@@ -45,6 +45,9 @@
 #include "cmd.h"
 #include "serial.h"
 #include "cmdnames.h"
+#include "channel.h"
+#include "metrics.h"
+#include "trace.h"
 
 #define DEBUG_CMD
 #undef DEBUG_CMD_TERM
@@ -67,6 +70,8 @@ static void in_device_constructor(const type_t *t, void *o) {
 	drive_and_name_init(&d->lastdrv);
 
 	d->charset = cconv_getcharset(CHARSET_ASCII_NAME);
+
+	channel_table_init(&d->channels);
 }
 	
 static type_t in_device_type = {
@@ -122,10 +127,12 @@ static void dev_sync(serial_port_t readfd, serial_port_t writefd) {
 
 static void dev_write_packet(serial_port_t fd, char *retbuf) {
 
+	trace_t tr = trace_begin();
 	int e = os_write(fd, retbuf, 0xff & retbuf[FSP_LEN]);
 	if (e < 0) {
 		log_error("Error on write: %d\n", errno);
 	}
+	trace_end(tr, "device", "write", 0xff & retbuf[FSP_LEN]);
 #if defined(DEBUG_WRITE) //|| defined(DEBUG_CMD)
 	log_debug("write %02x %02x %02x (%s):\n", 255&retbuf[0], 255&retbuf[1],
 			255&retbuf[2], command_to_name(255&retbuf[FSP_CMD]) );
@@ -158,6 +165,32 @@ static void cmd_sendxcmd(serial_port_t writefd, char buf[]) {
 	}
 }
 
+/**
+ * send a text as a series of FS_DATA packets on channel tfd,
+ * the last one as FS_DATA_EOF; the text is mem_free'd
+ */
+static void dev_sendtext(in_device_t *dt, int tfd, char buf[], char *text) {
+
+	int len = strlen(text);
+	int p = 0;
+
+	do {
+		int n = len - p;
+		if (n > RET_BUFFER_SIZE - FSP_DATA) {
+			n = RET_BUFFER_SIZE - FSP_DATA;
+		}
+		n = cconv_converter(CHARSET_ASCII, dt->charset) (text + p, n, buf + FSP_DATA, n);
+		p += n;
+
+		buf[FSP_CMD] = (p < len) ? FS_DATA : FS_DATA_EOF;
+		buf[FSP_LEN] = FSP_DATA + n;
+		buf[FSP_FD] = tfd;
+		dev_write_packet(dt->writefd, buf);
+	} while (p < len);
+
+	mem_free(text);
+}
+
 static void dev_sendreset(serial_port_t writefd) {
 
 	char buf[FSP_DATA+1];
@@ -185,6 +218,9 @@ static void dev_dispatch(char *buf, in_device_t *dt) {
 
 	cmd = buf[FSP_CMD];		// 0
 	len = 255 & buf[FSP_LEN];	// 1
+
+	// channel numbers are per device
+	channel_use(&dt->channels);
 	
 	if (cmd == FS_TERM) {
 #ifdef DEBUG_CMD_TERM
@@ -235,6 +271,22 @@ static void dev_dispatch(char *buf, in_device_t *dt) {
 	int sendreply = 1;
 	int outlen = 0;
 
+	metrics_begin(cmd);
+
+	trace_t tr = trace_begin();
+
+	// channel commands are accounted to the drive and provider of the open file
+	if (cmd == FS_READ || cmd == FS_WRITE || cmd == FS_WRITE_EOF 
+		|| cmd == FS_POSITION || cmd == FS_CLOSE) {
+		chan_t *chan = channel_get(tfd);
+		if (chan != NULL) {
+			metrics_note_drive(chan->drive);
+			if (chan->fp != NULL) {
+				metrics_note_endpoint(chan->fp->endpoint);
+			}
+		}
+	}
+
 	// dispatch to the correct cmd_* routine.
 	// may someday be replaced by an array lookup when the routine calls have been unified...
 	switch(cmd) {
@@ -247,21 +299,36 @@ static void dev_dispatch(char *buf, in_device_t *dt) {
 		rv = cmd_open_file(tfd, buf+FSP_DATA, len-FSP_DATA, dt->charset, &dt->lastdrv, retbuf+FSP_DATA+1, &outlen, cmd);
 		retbuf[FSP_DATA] = rv;
 		retbuf[FSP_LEN] = FSP_DATA + 1 + outlen;
+		if (rv == CBM_ERROR_OK || rv == CBM_ERROR_OPEN_REL) {
+			chan_t *chan = channel_get(tfd);
+			if (chan != NULL) {
+				chan->drive = metrics_drive();
+				metrics_note_endpoint(chan->fp->endpoint);
+			}
+		}
 		break;
 	case FS_OPEN_DR:
-		rv = cmd_open_dir(tfd, buf+FSP_DATA, len-FSP_DATA, dt->charset, &dt->lastdrv);
+	case FS_OPEN_DRP:
+		rv = cmd_open_dir(tfd, buf+FSP_DATA, len-FSP_DATA, dt->charset, &dt->lastdrv, cmd);
 		retbuf[FSP_DATA] = rv;
 		retbuf[FSP_LEN] = FSP_DATA + 1;
+		if (rv == CBM_ERROR_OK) {
+			chan_t *chan = channel_get(tfd);
+			if (chan != NULL) {
+				chan->drive = metrics_drive();
+			}
+		}
 		break;
 	case FS_READ:
 		// note that on the server side, we do not need to handle FS_DATA*, as we only send those
-		rv = cmd_read(tfd, retbuf+FSP_DATA, &outlen, &readflag, dt->charset, &dt->lastdrv);
+		rv = cmd_read(tfd, retbuf+FSP_DATA, RET_BUFFER_SIZE-FSP_DATA, &outlen, &readflag, dt->charset, &dt->lastdrv);
 		if (rv != CBM_ERROR_OK) {
 			retbuf[FSP_DATA] = rv;
 			retbuf[FSP_LEN] = FSP_DATA + 1;
 		} else {
 			retbuf[FSP_CMD] = (readflag & READFLAG_EOF) ? FS_DATA_EOF : FS_DATA;
 			retbuf[FSP_LEN] = FSP_DATA + outlen;
+			metrics_add_bytes(outlen, 0);
 		}
 		break;
 	case FS_INFO:
@@ -269,11 +336,36 @@ static void dev_dispatch(char *buf, in_device_t *dt) {
 		retbuf[FSP_CMD] = FS_DATA_EOF;
 		retbuf[FSP_LEN] = FSP_DATA + outlen;
 		break;
+	case FS_METRICS:
+		// the reply is sent in multiple packets
+		metrics_end(CBM_ERROR_OK);
+		dev_sendtext(dt, tfd, retbuf, metrics_render());
+		sendreply = 0;
+		break;
+	case FS_TRACE:
+		retbuf[FSP_DATA] = CBM_ERROR_OK;
+		if (len <= FSP_DATA) {
+			retbuf[FSP_DATA] = CBM_ERROR_SYNTAX_INVAL;
+		} else
+		if (buf[FSP_DATA] == FS_TRACE_DUMP) {
+			// the reply is sent in multiple packets; don't trace sending it
+			int was_enabled = trace_enabled;
+			trace_enabled = 0;
+			dev_sendtext(dt, tfd, retbuf, trace_render());
+			trace_enabled = was_enabled;
+			sendreply = 0;
+		} else {
+			trace_enable(buf[FSP_DATA] == FS_TRACE_ON);
+		}
+		break;
 	case FS_WRITE:
 	case FS_WRITE_EOF:
 		rv = cmd_write(tfd, cmd, buf+FSP_DATA, len-FSP_DATA);
 		retbuf[FSP_DATA] = rv;
 		retbuf[FSP_LEN] = FSP_DATA + 1;
+		if (rv == CBM_ERROR_OK) {
+			metrics_add_bytes(0, len-FSP_DATA);
+		}
 		break;
 	case FS_POSITION:
 		rv = cmd_position(tfd, buf+FSP_DATA, len-FSP_DATA);
@@ -371,7 +463,11 @@ static void dev_dispatch(char *buf, in_device_t *dt) {
       		break;
 	case FS_INITIALIZE:
 		log_info("INITIALIZE: %s\n", buf+FSP_DATA);
-		retbuf[FSP_DATA] = CBM_ERROR_OK;
+		retbuf[FSP_DATA] = provider_sync(0);
+      		break;
+	case FS_FLUSH:
+		log_info("FLUSH\n");
+		retbuf[FSP_DATA] = provider_sync(1);
       		break;
 	default:
 		log_error("Received unknown command: %d in a %d byte packet\n", cmd, len);
@@ -380,9 +476,14 @@ static void dev_dispatch(char *buf, in_device_t *dt) {
 		log_hexdump(buf, n, 0);
 	}
 
+	metrics_end(retbuf[FSP_CMD] == FS_REPLY ? retbuf[FSP_DATA] : CBM_ERROR_OK);
+
 	if (sendreply) {
 		dev_write_packet(dt->writefd, retbuf);
 	}
+
+	const char *name = fs_command_to_name(cmd);
+	trace_end(tr, "dispatch", name ? name : "unknown", tfd);
 }
 
 
@@ -405,6 +506,13 @@ in_device_t *in_device_init(serial_port_t readfd, serial_port_t writefd, int do_
 	}
 	return tp;
 }
+
+void in_device_free(in_device_t *tp) {
+
+	channel_table_free(&tp->channels);
+
+	mem_free(tp);
+}
 	
 
 //------------------------------------------------------------------------------------
@@ -428,7 +536,11 @@ int in_device_loop(in_device_t *tp) {
 	int plen;
 	int cmd;
 
+	      trace_t tr = trace_begin();
 	      n = os_read(tp->readfd, tp->buf+tp->wrp, 8192-tp->wrp);
+	      if (n > 0) {
+		trace_end(tr, "device", "read", n);
+	      }
 #ifdef DEBUG_READ
 	      if(n) {
 		log_debug("read %d bytes (wrp=%d, rdp=%d: ",n,tp->wrp,tp->rdp);
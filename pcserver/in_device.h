@@ -22,6 +22,9 @@
 #ifndef IN_DEVICE_H
 #define IN_DEVICE_H
 
+#include "provider.h"
+#include "channel.h"
+
 typedef struct {
 	serial_port_t readfd;
 	serial_port_t writefd;
@@ -29,11 +32,17 @@ typedef struct {
 	int rdp;
 	drive_and_name_t lastdrv;
 	charset_t charset;
+	chantable_t channels;
 	char buf[8192];
 } in_device_t;
 
 in_device_t *in_device_init(serial_port_t readfd, serial_port_t writefd, int do_reset);
 
+/**
+ * free the device, closing all files it still has open
+ */
+void in_device_free(in_device_t *tp);
+
 /**
  *
  * Here the data is read from the given readfd, put into a packet buffer,
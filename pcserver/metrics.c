@@ -0,0 +1,368 @@
+/****************************************************************************
+
+    Serial line filesystem server
+    Copyright (C) 2012,2014 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+/*
+ * Collects the server metrics and renders them as text.
+ *
+ * The text uses the Prometheus exposition format, so it can be scraped
+ * directly: one "name{labels} value" line per value, with "# HELP" and
+ * "# TYPE" lines per metric. Commands, providers and drives are listed
+ * in a fixed order, and only when they have been used.
+ */
+
+#include "os.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "provider.h"
+#include "wireformat.h"
+#include "errors.h"
+#include "channel.h"
+#include "loop.h"
+#include "cmdnames.h"
+#include "strbuf.h"
+#include "metrics.h"
+
+
+// upper bounds of the latency histogram buckets in us; the last bucket is +Inf
+static const long bucket_le[] = {
+	10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000
+};
+
+#define	NUM_BUCKETS	(sizeof(bucket_le)/sizeof(bucket_le[0]) + 1)
+
+// FS_* command numbers are all below this
+#define	MAX_CMD		64
+
+typedef struct {
+	unsigned long		count;
+	unsigned long		errors;
+	unsigned long long	sum_us;
+	unsigned long		bucket[NUM_BUCKETS];
+	unsigned long long	rbytes;
+	unsigned long long	wbytes;
+} metric_t;
+
+typedef struct {
+	const provider_t	*prov;
+	metric_t		m;
+} prov_metric_t;
+
+static metric_t cmd_metrics[MAX_CMD];
+static prov_metric_t prov_metrics[MAX_NUMBER_OF_PROVIDERS];
+static metric_t drive_metrics[MAX_NUMBER_OF_ENDPOINTS];
+
+static unsigned long long total_rbytes = 0;
+static unsigned long long total_wbytes = 0;
+
+static unsigned long sector_hits = 0;
+static unsigned long sector_reads = 0;
+static unsigned long sector_writes = 0;
+
+static long long start_us = 0;
+
+// the request in progress
+static struct {
+	int			cmd;
+	long long		start_us;
+	int			drive;
+	const provider_t	*prov;
+	long			rbytes;
+	long			wbytes;
+} cur;
+
+static long long now_us(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void metric_add(metric_t *m, long long us, int is_error) {
+
+	unsigned int b = 0;
+	while (b < NUM_BUCKETS - 1 && us > bucket_le[b]) {
+		b++;
+	}
+	m->bucket[b]++;
+	m->count++;
+	m->sum_us += us;
+	if (is_error) {
+		m->errors++;
+	}
+	m->rbytes += cur.rbytes;
+	m->wbytes += cur.wbytes;
+}
+
+static metric_t *prov_metric(const provider_t *prov) {
+
+	for (int i = 0; i < MAX_NUMBER_OF_PROVIDERS; i++) {
+		if (prov_metrics[i].prov == prov) {
+			return &prov_metrics[i].m;
+		}
+		if (prov_metrics[i].prov == NULL) {
+			prov_metrics[i].prov = prov;
+			return &prov_metrics[i].m;
+		}
+	}
+	return NULL;
+}
+
+// ----------------------------------------------------------------------------------
+
+void metrics_init(void) {
+	start_us = now_us();
+	cur.cmd = -1;
+}
+
+void metrics_begin(int cmd) {
+	cur.cmd = cmd;
+	cur.drive = -1;
+	cur.prov = NULL;
+	cur.rbytes = 0;
+	cur.wbytes = 0;
+	cur.start_us = now_us();
+}
+
+void metrics_note_drive(int drive) {
+	if (cur.drive < 0) {
+		cur.drive = drive;
+	}
+}
+
+void metrics_note_endpoint(endpoint_t *ep) {
+	if (ep != NULL) {
+		cur.prov = ep->ptype;
+	}
+}
+
+int metrics_drive(void) {
+	return cur.drive;
+}
+
+void metrics_add_bytes(long rbytes, long wbytes) {
+	cur.rbytes += rbytes;
+	cur.wbytes += wbytes;
+	total_rbytes += rbytes;
+	total_wbytes += wbytes;
+}
+
+void metrics_end(int rv) {
+
+	if (cur.cmd < 0) {
+		return;
+	}
+
+	long long us = now_us() - cur.start_us;
+	int is_error = rv != CBM_ERROR_OK && rv != CBM_ERROR_OPEN_REL && rv != CBM_ERROR_SCRATCHED;
+
+	if (cur.cmd < MAX_CMD) {
+		metric_add(&cmd_metrics[cur.cmd], us, is_error);
+	}
+	if (cur.prov != NULL) {
+		metric_t *m = prov_metric(cur.prov);
+		if (m != NULL) {
+			metric_add(m, us, is_error);
+		}
+	}
+	if (cur.drive >= 0 && cur.drive < MAX_NUMBER_OF_ENDPOINTS) {
+		metric_add(&drive_metrics[cur.drive], us, is_error);
+	}
+	cur.cmd = -1;
+}
+
+void metrics_sector_hit(void) {
+	sector_hits++;
+}
+
+void metrics_sector_read(void) {
+	sector_reads++;
+}
+
+void metrics_sector_write(void) {
+	sector_writes++;
+}
+
+// ----------------------------------------------------------------------------------
+// rendering
+
+static void out_head(strbuf_t *t, const char *name, const char *type, const char *help) {
+	strbuf_printf(t, "# HELP %s %s\n", name, help);
+	strbuf_printf(t, "# TYPE %s %s\n", name, type);
+}
+
+// the request metrics for one label (cmd, provider or drive)
+typedef struct {
+	const char *label;
+	const char *value;
+	const metric_t *m;
+} labelled_t;
+
+static void out_family(strbuf_t *t, const char *prefix, const char *what, const labelled_t *ls, int n,
+		int with_bytes) {
+
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s_requests_total", prefix);
+	out_head(t, name, "counter", "Number of requests");
+	for (int i = 0; i < n; i++) {
+		strbuf_printf(t, "%s{%s=\"%s\"} %lu\n", name, ls[i].label, ls[i].value, ls[i].m->count);
+	}
+
+	snprintf(name, sizeof(name), "%s_errors_total", prefix);
+	out_head(t, name, "counter", "Number of requests that returned an error");
+	for (int i = 0; i < n; i++) {
+		strbuf_printf(t, "%s{%s=\"%s\"} %lu\n", name, ls[i].label, ls[i].value, ls[i].m->errors);
+	}
+
+	if (with_bytes) {
+		snprintf(name, sizeof(name), "%s_read_bytes_total", prefix);
+		out_head(t, name, "counter", "Data bytes read");
+		for (int i = 0; i < n; i++) {
+			strbuf_printf(t, "%s{%s=\"%s\"} %llu\n", name, ls[i].label, ls[i].value, ls[i].m->rbytes);
+		}
+		snprintf(name, sizeof(name), "%s_written_bytes_total", prefix);
+		out_head(t, name, "counter", "Data bytes written");
+		for (int i = 0; i < n; i++) {
+			strbuf_printf(t, "%s{%s=\"%s\"} %llu\n", name, ls[i].label, ls[i].value, ls[i].m->wbytes);
+		}
+	}
+
+	snprintf(name, sizeof(name), "%s_duration_us", prefix);
+	strbuf_printf(t, "# HELP %s Request processing time %s, in microseconds\n", name, what);
+	strbuf_printf(t, "# TYPE %s histogram\n", name);
+	for (int i = 0; i < n; i++) {
+		const metric_t *m = ls[i].m;
+		unsigned long cumul = 0;
+		for (unsigned int b = 0; b < NUM_BUCKETS; b++) {
+			cumul += m->bucket[b];
+			if (b < NUM_BUCKETS - 1) {
+				strbuf_printf(t, "%s_bucket{%s=\"%s\",le=\"%ld\"} %lu\n", name, ls[i].label, ls[i].value,
+					bucket_le[b], cumul);
+			} else {
+				strbuf_printf(t, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %lu\n", name, ls[i].label, ls[i].value,
+					cumul);
+			}
+		}
+		strbuf_printf(t, "%s_sum{%s=\"%s\"} %llu\n", name, ls[i].label, ls[i].value, m->sum_us);
+		strbuf_printf(t, "%s_count{%s=\"%s\"} %lu\n", name, ls[i].label, ls[i].value, m->count);
+	}
+}
+
+char *metrics_render(void) {
+
+	strbuf_t t;
+	labelled_t ls[MAX_CMD];
+	char drivenames[MAX_NUMBER_OF_ENDPOINTS][4];
+	char cmdbuf[MAX_CMD][8];
+	int n;
+
+	strbuf_init(&t, 4096);
+
+	long long now = now_us();
+
+	out_head(&t, "xd_uptime_seconds", "gauge", "Time since the server started");
+	strbuf_printf(&t, "xd_uptime_seconds %lld\n", (now - start_us) / 1000000);
+
+	// per command
+	n = 0;
+	for (int i = 0; i < MAX_CMD; i++) {
+		if (cmd_metrics[i].count > 0) {
+			ls[n].value = fs_command_to_name(i);
+			if (ls[n].value == NULL) {
+				snprintf(cmdbuf[i], sizeof(cmdbuf[i]), "%d", i);
+				ls[n].value = cmdbuf[i];
+			}
+			ls[n].label = "cmd";
+			ls[n].m = &cmd_metrics[i];
+			n++;
+		}
+	}
+	out_family(&t, "xd_cmd", "per FS command", ls, n, 0);
+
+	// per provider
+	n = 0;
+	for (int i = 0; i < MAX_NUMBER_OF_PROVIDERS && prov_metrics[i].prov != NULL; i++) {
+		ls[n].label = "provider";
+		ls[n].value = prov_metrics[i].prov->name;
+		ls[n].m = &prov_metrics[i].m;
+		n++;
+	}
+	out_family(&t, "xd_provider", "per provider", ls, n, 1);
+
+	// per drive
+	n = 0;
+	for (int i = 0; i < MAX_NUMBER_OF_ENDPOINTS; i++) {
+		if (drive_metrics[i].count > 0) {
+			snprintf(drivenames[i], sizeof(drivenames[i]), "%d", i);
+			ls[n].label = "drive";
+			ls[n].value = drivenames[i];
+			ls[n].m = &drive_metrics[i];
+			n++;
+		}
+	}
+	out_family(&t, "xd_drive", "per drive", ls, n, 1);
+
+	out_head(&t, "xd_read_bytes_total", "counter", "Data bytes read from files and directories");
+	strbuf_printf(&t, "xd_read_bytes_total %llu\n", total_rbytes);
+	out_head(&t, "xd_written_bytes_total", "counter", "Data bytes written to files");
+	strbuf_printf(&t, "xd_written_bytes_total %llu\n", total_wbytes);
+
+	// disk image sector buffers
+	unsigned long lookups = sector_hits + sector_reads;
+	out_head(&t, "xd_sector_cache_hits_total", "counter", "Disk image sector accesses served from a buffer");
+	strbuf_printf(&t, "xd_sector_cache_hits_total %lu\n", sector_hits);
+	out_head(&t, "xd_sector_reads_total", "counter", "Disk image sectors read from the image file");
+	strbuf_printf(&t, "xd_sector_reads_total %lu\n", sector_reads);
+	out_head(&t, "xd_sector_writes_total", "counter", "Disk image sectors written to the image file");
+	strbuf_printf(&t, "xd_sector_writes_total %lu\n", sector_writes);
+	out_head(&t, "xd_sector_cache_hit_ratio", "gauge", "Sector cache hits per sector access");
+	strbuf_printf(&t, "xd_sector_cache_hit_ratio %.4f\n", lookups ? (double) sector_hits / lookups : 0.0);
+
+	out_head(&t, "xd_open_channels", "gauge", "Number of open channels over all connections");
+	strbuf_printf(&t, "xd_open_channels %d\n", channel_num_open());
+
+	unsigned long allocs, frees;
+	mem_stats(&allocs, &frees);
+	out_head(&t, "xd_mem_allocs_total", "counter", "Number of memory allocations");
+	strbuf_printf(&t, "xd_mem_allocs_total %lu\n", allocs);
+	out_head(&t, "xd_mem_frees_total", "counter", "Number of memory frees");
+	strbuf_printf(&t, "xd_mem_frees_total %lu\n", frees);
+	out_head(&t, "xd_mem_live_allocs", "gauge", "Number of memory allocations not yet freed");
+	strbuf_printf(&t, "xd_mem_live_allocs %ld\n", (long) (allocs - frees));
+
+	long long idle_us, busy_us;
+	unsigned long wakeups;
+	poll_stats(&idle_us, &busy_us, &wakeups);
+	out_head(&t, "xd_poll_wakeups_total", "counter", "Number of poll loop wakeups");
+	strbuf_printf(&t, "xd_poll_wakeups_total %lu\n", wakeups);
+	out_head(&t, "xd_poll_busy_seconds_total", "counter", "Time spent handling events in the poll loop");
+	strbuf_printf(&t, "xd_poll_busy_seconds_total %.6f\n", busy_us / 1e6);
+	out_head(&t, "xd_poll_idle_seconds_total", "counter", "Time spent waiting in the poll loop");
+	strbuf_printf(&t, "xd_poll_idle_seconds_total %.6f\n", idle_us / 1e6);
+	out_head(&t, "xd_poll_utilisation", "gauge", "Busy time per poll loop time");
+	strbuf_printf(&t, "xd_poll_utilisation %.4f\n",
+		(idle_us + busy_us) ? (double) busy_us / (idle_us + busy_us) : 0.0);
+
+	return t.buf;
+}
+
@@ -0,0 +1,69 @@
+/****************************************************************************
+
+    Serial line filesystem server
+    Copyright (C) 2012,2014 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "provider.h"
+
+/*
+ * Server metrics: request counters and latency histograms per FS_* command,
+ * per provider and per drive, plus some global counters.
+ *
+ * dev_dispatch() brackets each request with metrics_begin() / metrics_end();
+ * the code in between notes the drive and provider the request went to.
+ * metrics_render() returns a snapshot in the Prometheus text format, which
+ * is sent to the client for an FS_METRICS request.
+ */
+
+// init the metrics, start of the uptime
+void metrics_init(void);
+
+// start a request for the FS_* command cmd
+void metrics_begin(int cmd);
+
+// note the drive of the current request; the first drive noted is used
+void metrics_note_drive(int drive);
+
+// note the endpoint of the current request; the provider of the last one noted is used
+void metrics_note_endpoint(endpoint_t *ep);
+
+// the drive noted for the current request, or -1 if none
+int metrics_drive(void);
+
+// count data bytes read / written by the current request
+void metrics_add_bytes(long rbytes, long wbytes);
+
+// finish the current request with the given CBM_ERROR_* reply
+void metrics_end(int rv);
+
+// disk image sector buffer: hit (no I/O needed), read or written
+void metrics_sector_hit(void);
+void metrics_sector_read(void);
+void metrics_sector_write(void);
+
+/**
+ * render all metrics as text; the returned string must be mem_free'd
+ */
+char *metrics_render(void);
+
+#endif
+
@@ -22,6 +22,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 #include "errors.h"
 #include "wireformat.h"
@@ -88,8 +89,15 @@ void openpars_process_options(const uint8_t *opts, openpars_t *pars) {
                                 }
                         }
                         break;
+                case 'w':
+                case 'W':
+                        // "W=0" switches off wrapping, so e.g. "foo.d64" is a file
+                        if (*p == '=' && p[1] != 0) {
+                                pars->nowrap = (p[1] == '0');
+                                p += 2;
+                        }
+                        break;
                 case ',':
-                        p++;
                         break;
                 default:
                         // syntax error
@@ -107,6 +115,18 @@ void openpars_init_options(openpars_t *pars) {
 
 	pars->filetype = FS_DIR_TYPE_UNKNOWN;
 	pars->recordlen = 0;
+	pars->inram = 0;
+	pars->nowrap = 0;
+}
+
+int openpars_assign_option(const uint8_t *opt, openpars_t *pars) {
+
+	if (opt != NULL && !strcasecmp((const char*)opt, "ram")) {
+		pars->inram = 1;
+		return CBM_ERROR_OK;
+	}
+	log_error("Unknown assign option '%s'\n", opt == NULL ? "" : (const char*)opt);
+	return CBM_ERROR_SYNTAX_UNKNOWN;
 }
 
 
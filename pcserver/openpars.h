@@ -45,4 +45,11 @@ void openpars_process_options(const uint8_t * opts, openpars_t * pars);
  */
 void openpars_init_options(openpars_t * pars);
 
+/**
+ * process an option given after the provider parameter of an assign,
+ * like the "ram" in "0:fs=games.d81,ram"; returns CBM_ERROR_SYNTAX_UNKNOWN
+ * for unknown options
+ */
+int openpars_assign_option(const uint8_t * opt, openpars_t * pars);
+
 #endif
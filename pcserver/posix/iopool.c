@@ -0,0 +1,258 @@
+/****************************************************************************
+
+    Async file I/O
+    Copyright (C) 2018 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mem.h"
+#include "log.h"
+#include "loop.h"
+#include "iopool.h"
+
+#define	IOPOOL_THREADS		4
+
+struct iopool_job_s {
+	int		fd;
+	int		iswrite;
+	char		*buf;
+	size_t		len;
+	off_t		offset;
+	ssize_t		res;
+	iopool_done_t	done;
+	void		*data;
+	iopool_job_t	*next;		// in the submission queue
+	iopool_job_t	*pnext;		// in the list of pending jobs
+};
+
+static type_t job_type = {
+	"iopool_job",
+	sizeof(iopool_job_t),
+	NULL
+};
+
+// submission queue, shared with the workers
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static iopool_job_t *head = NULL;
+static iopool_job_t *tail = NULL;
+
+// the rest is only used in the poll loop thread
+static int started = 0;
+// finished jobs are passed back through this pipe
+static int donefd[2] = { -1, -1 };
+// jobs submitted but not yet delivered
+static int inflight = 0;
+static iopool_job_t *pending = NULL;
+// pipe is registered with the poll loop
+static int registered = 0;
+
+static void *worker(void *arg) {
+	(void) arg;
+
+	while (1) {
+		pthread_mutex_lock(&lock);
+		while (head == NULL) {
+			pthread_cond_wait(&cond, &lock);
+		}
+		iopool_job_t *job = head;
+		head = job->next;
+		if (head == NULL) {
+			tail = NULL;
+		}
+		pthread_mutex_unlock(&lock);
+
+		ssize_t n;
+		do {
+			if (job->iswrite) {
+				n = pwrite(job->fd, job->buf, job->len, job->offset);
+			} else {
+				n = pread(job->fd, job->buf, job->len, job->offset);
+			}
+		} while (n < 0 && errno == EINTR);
+		job->res = (n < 0) ? -errno : n;
+
+		// a pointer is less than PIPE_BUF, so the write is atomic
+		while (write(donefd[1], &job, sizeof(job)) < 0 && errno == EINTR);
+	}
+	return NULL;
+}
+
+static int start(void) {
+
+	if (pipe(donefd) < 0) {
+		log_errno("Could not create I/O pool pipe");
+		return -1;
+	}
+	fcntl(donefd[0], F_SETFL, fcntl(donefd[0], F_GETFL) | O_NONBLOCK);
+
+	int n = 0;
+	for (int i = 0; i < IOPOOL_THREADS; i++) {
+		pthread_t th;
+		if (pthread_create(&th, NULL, worker, NULL) != 0) {
+			log_errno("Could not start I/O pool thread");
+			break;
+		}
+		pthread_detach(th);
+		n++;
+	}
+	if (n == 0) {
+		close(donefd[0]);
+		close(donefd[1]);
+		donefd[0] = -1;
+		donefd[1] = -1;
+		return -1;
+	}
+	if (n < IOPOOL_THREADS) {
+		// the running workers keep the pool going
+		log_warn("I/O pool runs with %d of %d threads\n", n, IOPOOL_THREADS);
+	}
+	started = 1;
+	return 0;
+}
+
+static int is_pending(iopool_job_t *job) {
+
+	for (iopool_job_t *p = pending; p != NULL; p = p->pnext) {
+		if (p == job) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// call the done callback, and free the job
+static void deliver(iopool_job_t *job) {
+
+	inflight--;
+	for (iopool_job_t **pp = &pending; *pp != NULL; pp = &(*pp)->pnext) {
+		if (*pp == job) {
+			*pp = job->pnext;
+			break;
+		}
+	}
+
+	if (job->done != NULL) {
+		job->done(job->data, job->res);
+	}
+	mem_free(job);
+
+	// the callback may have submitted a new job
+	if (inflight == 0 && registered) {
+		poll_unregister(donefd[0]);
+		registered = 0;
+	}
+}
+
+// poll loop callback
+static void read_done(int fd, void *data) {
+	(void) data;
+
+	iopool_job_t *job;
+
+	while (read(fd, &job, sizeof(job)) == sizeof(job)) {
+		deliver(job);
+	}
+}
+
+static void hup_done(int fd, void *data) {
+	(void) data;
+
+	log_error("Unexpected hangup on I/O pool pipe %d\n", fd);
+}
+
+static iopool_job_t *submit(int fd, int iswrite, char *buf, size_t len, off_t offset,
+		iopool_done_t done, void *data) {
+
+	if (!started && start() < 0) {
+		return NULL;
+	}
+
+	iopool_job_t *job = mem_alloc(&job_type);
+	job->fd = fd;
+	job->iswrite = iswrite;
+	job->buf = buf;
+	job->len = len;
+	job->offset = offset;
+	job->res = 0;
+	job->done = done;
+	job->data = data;
+	job->next = NULL;
+	job->pnext = pending;
+	pending = job;
+
+	inflight++;
+	if (!registered) {
+		poll_register_readwrite(donefd[0], NULL, read_done, NULL, hup_done);
+		registered = 1;
+	}
+
+	pthread_mutex_lock(&lock);
+	if (tail == NULL) {
+		head = job;
+	} else {
+		tail->next = job;
+	}
+	tail = job;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return job;
+}
+
+iopool_job_t *iopool_read(int fd, char *buf, size_t len, off_t offset, iopool_done_t done, void *data) {
+
+	return submit(fd, 0, buf, len, offset, done, data);
+}
+
+iopool_job_t *iopool_write(int fd, const char *buf, size_t len, off_t offset, iopool_done_t done, void *data) {
+
+	// the buffer is only read from
+	return submit(fd, 1, (char*) buf, len, offset, done, data);
+}
+
+ssize_t iopool_wait(iopool_job_t *wanted) {
+
+	while (1) {
+		iopool_job_t *job;
+
+		if (!is_pending(wanted)) {
+			// already delivered, e.g. from a callback, or never submitted
+			return -EINVAL;
+		}
+
+		if (read(donefd[0], &job, sizeof(job)) != sizeof(job)) {
+			struct pollfd pfd = { donefd[0], POLLIN, 0 };
+			poll(&pfd, 1, -1);
+			continue;
+		}
+
+		ssize_t res = job->res;
+		int found = (job == wanted);
+		deliver(job);
+		if (found) {
+			return res;
+		}
+	}
+}
+
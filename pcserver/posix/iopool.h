@@ -0,0 +1,70 @@
+/****************************************************************************
+
+    Async file I/O
+    Copyright (C) 2018 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#ifndef IOPOOL_H
+#define IOPOOL_H
+
+#include <sys/types.h>
+
+/*
+ * Asynchronous file reads and writes, run by a small pool of worker threads,
+ * so a slow file system does not block the poll loop.
+ *
+ * The result of a job is delivered in the poll loop thread: the workers pass
+ * finished jobs through a pipe that is registered with the poll loop while
+ * jobs are in flight, and the done callback is called from there. When the
+ * result is needed right away, iopool_wait() delivers it immediately.
+ *
+ * The workers only run pread()/pwrite(), everything else (memory, logging,
+ * the callbacks) stays in the poll loop thread.
+ */
+
+typedef struct iopool_job_s iopool_job_t;
+
+/**
+ * called in the poll loop thread when a job is done, with the number of
+ * bytes transferred or a negative errno. The job is freed afterwards.
+ */
+typedef void (*iopool_done_t)(void *data, ssize_t res);
+
+/**
+ * submit a read of len bytes at offset from fd into buf;
+ * buf must stay valid until the job is done. Returns NULL when the
+ * worker threads could not be started
+ */
+iopool_job_t *iopool_read(int fd, char *buf, size_t len, off_t offset, iopool_done_t done, void *data);
+
+/**
+ * submit a write of len bytes from buf at offset to fd;
+ * buf must stay valid until the job is done. Returns NULL when the
+ * worker threads could not be started
+ */
+iopool_job_t *iopool_write(int fd, const char *buf, size_t len, off_t offset, iopool_done_t done, void *data);
+
+/**
+ * wait until the job is done and deliver its result (calling the done
+ * callback, which may deliver other finished jobs first); returns the
+ * job's result, or -EINVAL when the job has already been delivered.
+ */
+ssize_t iopool_wait(iopool_job_t *job);
+
+#endif
+
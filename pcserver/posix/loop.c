@@ -21,6 +21,7 @@
 
 #include <poll.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "mem.h"
 #include "log.h"
@@ -38,6 +39,8 @@ typedef struct {
 	void	(*read)(int fd, void *data);
 	void 	(*write)(int fd, void *data);
 	void 	(*hup)(int fd, void *data);
+	int	want_read;
+	int	want_write;
 } poll_info_t;
 
 static void poll_info_init(const type_t *type, void *obj) {
@@ -51,6 +54,9 @@ static void poll_info_init(const type_t *type, void *obj) {
 	pinfo->read = NULL;
 	pinfo->write = NULL;
 	pinfo->hup = NULL;
+
+	pinfo->want_read = 1;
+	pinfo->want_write = 1;
 }
 
 static type_t poll_info_type = {
@@ -59,6 +65,25 @@ static type_t poll_info_type = {
 	poll_info_init
 };
 
+typedef struct {
+	void	*data;
+	void	(*expired)(void *data);
+	long long deadline;		// in ms, monotonic clock
+} poll_timer_t;
+
+static type_t poll_timer_type = {
+	"poll_timer",
+	sizeof(poll_timer_t),
+	NULL
+};
+
+static registry_t timer_list;
+
+// loop statistics: time spent waiting in poll() vs. handling events, in us
+static long long stat_idle_us = 0;
+static long long stat_busy_us = 0;
+static unsigned long stat_wakeups = 0;
+
 static type_t poll_pars_type = {
 	"pollfd",
 	sizeof(struct pollfd),
@@ -72,6 +97,7 @@ void poll_init(void) {
 
 	poll_pars = NULL;
 	reg_init(&poll_list, "poll_list", 10);
+	reg_init(&timer_list, "timer_list", 4);
 
 	update_needed = 1;
 }
@@ -85,6 +111,7 @@ void poll_free_pinfo(registry_t *reg, void *pinfo) {
 }
 void poll_free(void) {
 	reg_free(&poll_list, poll_free_pinfo);
+	reg_free(&timer_list, poll_free_pinfo);
 }
 
 /**
@@ -95,6 +122,21 @@ int poll_num_sockets() {
 	return reg_size(&poll_list);
 }
 
+static short poll_events(poll_info_t *pinfo) {
+
+	short events = 0;
+	if (pinfo->accept) {
+		events |= POLLIN;
+	}
+	if (pinfo->read && pinfo->want_read) {
+		events |= POLLIN;
+	}
+	if (pinfo->write && pinfo->want_write) {
+		events |= POLLOUT;
+	}
+	return events;
+}
+
 static void update_poll_list() {
 
 	if (!update_needed) {
@@ -129,17 +171,7 @@ static void update_poll_list() {
 
 		poll_info_t *pinfo = reg_get(&poll_list, i);
 		if (pinfo != NULL) {
-			short events = 0;
-			if (pinfo->accept) {
-				events |= POLLIN;
-			}
-			if (pinfo->read) {
-				events |= POLLIN;
-			}
-			if (pinfo->write) {
-				events |= POLLOUT;
-			}
-			poll_pars[i].events = events;
+			poll_pars[i].events = poll_events(pinfo);
 			poll_pars[i].fd = pinfo->fd;
 
 		} else {
@@ -219,6 +251,112 @@ void poll_unregister(int fd) {
         log_error("poll_unregister: Unable to remove entry for fd %d from registry %p (%s)\n", fd, &poll_list, poll_list.name);
 }
 
+/**
+ * enable or disable the read and write callbacks of a registered socket
+ */
+void poll_set_interest(int fd, int want_read, int want_write) {
+
+	int n = reg_size(&poll_list);
+
+        for (int i = 0; i < n; i++) {
+		poll_info_t *pinfo = (poll_info_t*) reg_get(&poll_list, i);
+                if (pinfo != NULL && pinfo->fd == fd) {
+			pinfo->want_read = want_read;
+			pinfo->want_write = want_write;
+			if (!update_needed) {
+				// poll list is in sync with the registry, patch in place
+				poll_pars[i].events = poll_events(pinfo);
+			}
+                        return;
+                }
+        }
+        log_error("poll_set_interest: Unable to find entry for fd %d\n", fd);
+}
+
+static long long now_ms(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long long now_us(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * set, re-schedule or cancel the timer for the data pointer
+ */
+void poll_set_timer(void *data, void (*expired)(void *data), long timeoutMs) {
+
+	poll_timer_t *timer = NULL;
+
+	for (int i = reg_size(&timer_list) - 1; i >= 0; i--) {
+		poll_timer_t *t = reg_get(&timer_list, i);
+		if (t->data == data) {
+			timer = t;
+			if (timeoutMs < 0) {
+				reg_remove_pos(&timer_list, i);
+				mem_free(t);
+				return;
+			}
+			break;
+		}
+	}
+	if (timeoutMs < 0) {
+		return;
+	}
+	if (timer == NULL) {
+		timer = mem_alloc(&poll_timer_type);
+		timer->data = data;
+		reg_append(&timer_list, timer);
+	}
+	timer->expired = expired;
+	timer->deadline = now_ms() + timeoutMs;
+}
+
+// time until the next timer expires, limited by timeoutMs
+static int next_timeout(int timeoutMs) {
+
+	long long now = now_ms();
+
+	for (int i = reg_size(&timer_list) - 1; i >= 0; i--) {
+		poll_timer_t *t = reg_get(&timer_list, i);
+		long long left = t->deadline - now;
+		if (left < 0) {
+			left = 0;
+		}
+		if (timeoutMs < 0 || left < timeoutMs) {
+			timeoutMs = left;
+		}
+	}
+	return timeoutMs;
+}
+
+// call the expired timers; they are removed before the call,
+// so they can be re-scheduled from the callback
+static void run_timers(void) {
+
+	long long now = now_ms();
+
+	for (int i = reg_size(&timer_list) - 1; i >= 0; i--) {
+		poll_timer_t *t = reg_get(&timer_list, i);
+		if (t != NULL && t->deadline <= now) {
+			void (*expired)(void *data) = t->expired;
+			void *data = t->data;
+
+			reg_remove_pos(&timer_list, i);
+			mem_free(t);
+
+			// note: may change the list; reg_get() beyond the end gives NULL
+			expired(data);
+		}
+	}
+}
+
 /**
  * return 0 when timeout
  * return <0 when no file descriptor left
@@ -238,7 +376,15 @@ int poll_loop(int timeoutMs) {
 			return -1;
 		}
 	
-		n = poll(poll_pars, nfds, timeoutMs);
+		long long before = now_us();
+
+		n = poll(poll_pars, nfds, next_timeout(timeoutMs));
+
+		long long after = now_us();
+		stat_idle_us += after - before;
+		stat_wakeups++;
+
+		run_timers();
 
 		for (int i = 0; i < nfds; i++) {
 
@@ -246,6 +392,12 @@ int poll_loop(int timeoutMs) {
 				poll_info_t *pinfo = reg_get(&poll_list, i);
 				fd = poll_pars[i].fd;
 	
+				// a callback (or a timer) may have unregistered the entry, and
+				// freed its data; then the remaining callbacks must not run
+				if (pinfo->fd < 0) {
+					n--;
+					continue;
+				}
 				if (poll_pars[i].revents & POLLIN) {
 
 					if (pinfo->accept) {
@@ -257,7 +409,7 @@ int poll_loop(int timeoutMs) {
 						log_error("unexpected POLLIN on fd %d\n", fd);
 					}
 				}
-				if (poll_pars[i].revents & POLLOUT) {
+				if ((poll_pars[i].revents & POLLOUT) && pinfo->fd >= 0) {
 
 					if (pinfo->write) {
 						pinfo->write(fd, pinfo->data);
@@ -265,7 +417,7 @@ int poll_loop(int timeoutMs) {
 						log_error("unexpected POLLOUT on fd %d\n", fd);
 					}
 				}
-				if (poll_pars[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+				if ((poll_pars[i].revents & (POLLHUP | POLLERR | POLLNVAL)) && pinfo->fd >= 0) {
 			
 					if (pinfo->hup) {
 						pinfo->hup(fd, pinfo->data);
@@ -278,11 +430,18 @@ int poll_loop(int timeoutMs) {
 				n--;
 			}
 		}
+		stat_busy_us += now_us() - after;
 	} while (n > 0);
 
 	return 0;	
 }
 
+void poll_stats(long long *idle_us, long long *busy_us, unsigned long *wakeups) {
+	*idle_us = stat_idle_us;
+	*busy_us = stat_busy_us;
+	*wakeups = stat_wakeups;
+}
+
 void poll_shutdown() {
 
 	log_info("poll_shutdown()\n");
@@ -52,6 +52,20 @@ void poll_register_readwrite(int fd, void *data,
  */
 void poll_unregister(int fd);
 
+/**
+ * enable or disable the read and write callbacks of a registered socket,
+ * so a socket with nothing to send (or no space to receive) does not wake
+ * up the loop
+ */
+void poll_set_interest(int fd, int want_read, int want_write);
+
+
+/**
+ * set a timer, where expired is called from poll_loop() after the given 
+ * number of milliseconds. There is only one timer per data pointer, setting
+ * it again re-schedules it; a negative timeout cancels it.
+ */
+void poll_set_timer(void *data, void (*expired)(void *data), long timeoutMs);
 
 /**
  * loop until timeout without activity
@@ -60,6 +74,12 @@ void poll_unregister(int fd);
  */
 int poll_loop(int timeoutMs);
 
+/**
+ * return the time (in us) spent waiting in poll() and handling the events,
+ * and the number of times poll() returned
+ */
+void poll_stats(long long *idle_us, long long *busy_us, unsigned long *wakeups);
+
 /**
  * close everything
  */
@@ -99,7 +99,7 @@ static const char* name_from_provider(const void *entry) {
  * of the "A0:=fs:foo/bar" the "0" becomes the drive, "fs" becomes the wirename,
  * and "foo/bar" becomes the assign_to.
  */
-int provider_assign(int drive, drive_and_name_t *to_addr, charset_t cset, int from_cmdline) {
+int provider_assign(int drive, drive_and_name_t *to_addr, charset_t cset, int from_cmdline, openpars_t *pars) {
 
 	int err = CBM_ERROR_FAULT;
 
@@ -108,6 +108,9 @@ int provider_assign(int drive, drive_and_name_t *to_addr, charset_t cset, int fr
 	endpoint_t *target = NULL;
 	endpoint_t *newep = NULL;
 
+	// cached paths may lead through the drive's endpoint
+	resolve_cache_invalidate(NULL);
+
 	if (to_addr->name == NULL || strlen((char*)to_addr->name) == 0) {
 		drive_unassign(drive);
 		return CBM_ERROR_OK;
@@ -129,10 +132,9 @@ int provider_assign(int drive, drive_and_name_t *to_addr, charset_t cset, int fr
 
 			file_t *dir = NULL;
 
-			openpars_t pars;
-			openpars_init_options(&pars);
-			// got the enclosing directory, now get the dir itself
-			err = resolve_open(parentdir, to_addr, cset, &pars, FS_OPEN_DR, &dir);
+			// got the enclosing directory, now get the dir itself;
+			// a disk image is opened into memory with pars->inram
+			err = resolve_open(parentdir, to_addr, cset, pars, FS_OPEN_DR, &dir);
 
 			if (err == CBM_ERROR_OK) {
 
@@ -155,6 +157,10 @@ int provider_assign(int drive, drive_and_name_t *to_addr, charset_t cset, int fr
 	}
 
 	if (newep != NULL) {
+		if (pars->inram && newep->ptype != &di_provider) {
+			log_warn("Option 'ram' is only supported for disk images, ignored\n");
+		}
+
 		// check if the drive is already in use and free it if necessary
 		// NOTE: a Map construct would be nice here...
 
@@ -169,13 +175,40 @@ int provider_assign(int drive, drive_and_name_t *to_addr, charset_t cset, int fr
 }
 
 void provider_cleanup(endpoint_t *ep) {
-	if (ep->is_temporary && !ep->is_assigned) {
+	if (ep->is_temporary && !ep->is_assigned && !ep->refcnt) {
 		log_debug("Freeing temporary endpoint %p\n", ep);
 		provider_t *prevprov = ep->ptype;
 		prevprov->freeep(ep);
 	}
 }
 
+void provider_unassigned(void) {
+
+	providers_t *p;
+
+	for (int i = 0; (p = reg_get(&providers, i)) != NULL; i++) {
+		if (p->provider->unassigned != NULL) {
+			p->provider->unassigned();
+		}
+	}
+}
+
+int provider_sync(int force) {
+
+	int rv = CBM_ERROR_OK;
+	providers_t *p;
+
+	for (int i = 0; (p = reg_get(&providers, i)) != NULL; i++) {
+		if (p->provider->sync != NULL) {
+			int err = p->provider->sync(force);
+			if (rv == CBM_ERROR_OK) {
+				rv = err;
+			}
+		}
+	}
+	return rv;
+}
+
 static void provider_free_entry(registry_t *reg, void *entry) {
 	(void)reg;
 	((providers_t*)entry)->provider->free();
@@ -224,6 +257,9 @@ int provider_chdir(int drive, drive_and_name_t *to_addr, charset_t cset) {
 	endpoint_t *target = NULL;
 	endpoint_t *newep = NULL;
 
+	// cached paths may lead through the drive's endpoint
+	resolve_cache_invalidate(NULL);
+
 	if (to_addr->name == NULL || strlen((char*)to_addr->name) == 0) {
 		drive_unassign(drive);
 		return CBM_ERROR_SYNTAX_INVAL;
@@ -91,16 +91,34 @@ typedef struct {
 
 	// dump / debug
 	void (*dump) (int indent);
+
+	// write back what is buffered for the open files; with force set, sync
+	// written files to disk, otherwise only as the endpoint's sync policy says
+	int (*sync) (int force);
+
+	// a drive has been unassigned; drop what is only kept for assigned drives
+	void (*unassigned) (void);
+
+	// check that the endpoint still matches the file it has been opened from,
+	// returns 0 when it has changed; NULL when it cannot change
+	int (*uptodate) (endpoint_t * ep);
 } provider_t;
 
 // values to be set in the out parameter readflag for readfile()
 #define	READFLAG_EOF	1
 //#define	READFLAG_DENTRY	2
 
+// when written files are synced to disk (fsync()), set per drive
+#define	SYNC_NONE	0	// leave it to the operating system
+#define	SYNC_CLOSE	1	// on close, INITIALIZE and an explicit sync
+#define	SYNC_ALWAYS	2	// also when buffered data is written back after a pause
+
 struct _endpoint {
 	provider_t *ptype;
 	int is_temporary;
 	int is_assigned;
+	int refcnt;		// other references, e.g. from the resolve cache; not freed while set
+	int sync;		// SYNC_* policy, inherited from the drive
 	registry_t files;
 };
 
@@ -149,6 +167,8 @@ struct _direntry {
 	handler_t	*handler;
 	uint32_t	size;
 	time_t		moddate;
+	long		moddate_ns;	// sub-second part of moddate, where known
+	uint64_t	ino;	// file serial number, 0 if unknown
 	uint16_t 	recordlen;	// record length (if REL file)
 	uint8_t		mode;	// mode of dir entry - FS_DIR_MOD_*, file/disk name/free bytes/subdir
 	uint8_t		attr;	// file attributes - FS_DIR_ATTR_*, splat, write prot, transient, estimate
@@ -167,6 +187,10 @@ struct _direntry {
 // server...
 
 
+// maywrap() return values
+#define	WRAP_NONE	-1	// wrap() does not wrap the entry
+#define	WRAP_ANY_NAME	-2	// the wrapped name is only known after wrapping (e.g. P00 header)
+
 struct _handler {
 	const char *name;	// handler name, for debugging
 
@@ -176,6 +200,11 @@ struct _handler {
 	// wrap files like P00 or D64 files 	
 	int (*wrap) (direntry_t *dirent, direntry_t **wrapped);
 
+	// cheap check whether wrap() may wrap the entry, on the entry (name) only;
+	// returns the length of the wrapped name when it is the start of the entry
+	// name, or one of the WRAP_* values above. NULL is the same as WRAP_ANY_NAME
+	int (*maywrap) (direntry_t *dirent);
+
 	// close the file; do so recursively by closing
 	// parents if recurse is set; rvbuf/rvlen are a return buffer to send
 	// to called. Currently used to send t/s on error messages
@@ -224,7 +253,7 @@ struct _handler {
 
 	// -------------------------
 
-	int (*flush) (file_t * fp);	// flush data out to disk
+	int (*flush) (file_t * fp, int durable);	// flush data out to disk; with durable set, fsync it
 
 	// check if the other file is the same
 	// as thisfile. Used to check if an opened
@@ -232,6 +261,10 @@ struct _handler {
 	// returns 0 on equal, 1 on different
 	int (*equals) (file_t * thisfile, file_t * otherfile);
 
+	// get the current size, date and file serial number of the file
+	// from where it is stored, to see if it has changed
+	int (*info) (file_t * fp, direntry_t * outde);
+
 	size_t(*realsize2) (direntry_t * de);	// returns the real (correct) size of the file
 
 	int (*scratch2) (direntry_t * dirent);	// delete file
@@ -256,8 +289,12 @@ struct _handler {
 #define SEEKFLAG_ABS            0	/* count from the start */
 #define SEEKFLAG_END            1	/* count from the end of the file */
 
+/**
+ * assign a drive; pars holds the assign options, like inram to keep
+ * a disk image in memory
+ */
 int provider_assign(int drive, drive_and_name_t *to_addr, charset_t cset,
-		    int from_cmdline);
+		    int from_cmdline, openpars_t *pars);
 
 provider_t *provider_find(const char *pname);
 
@@ -274,6 +311,18 @@ int provider_chdir(int drive, drive_and_name_t *to_addr, charset_t cset);
  */
 void provider_cleanup(endpoint_t * ep);
 
+/**
+ * write back what the providers buffer for open files, e.g. on INITIALIZE;
+ * with force set, sync all written files to disk, otherwise only where
+ * the drive's sync policy asks for it. Returns the first write error
+ */
+int provider_sync(int force);
+
+/**
+ * tell the providers that a drive has been unassigned
+ */
+void provider_unassigned(void);
+
 /*
  * register a new provider, usually called at startup
  */
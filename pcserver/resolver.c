@@ -33,14 +33,17 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <stdint.h>
 
 #include "log.h"
 #include "provider.h"
 #include "drives.h"
 #include "handler.h"
+#include "metrics.h"
+#include "trace.h"
 
 static int resolve_scan_int(file_t *dir, drive_and_name_t *pattern, int num_pattern, bool fixpattern, 
-		charset_t outcset, bool isdirscan, direntry_t **outde, int *rdflag);
+		charset_t outcset, bool isdirscan, bool nowrap, direntry_t **outde, int *rdflag);
 
 /** 
  * resolve the endpoint for a given pattern. This is separated from the
@@ -103,6 +106,7 @@ int resolve_endpoint(drive_and_name_t *dname, charset_t cset, int privileged, en
                                 if (ep != NULL) {
                                         log_debug("Created temporary endpoint %p\n", ep);
                                         ep->is_temporary = 1;
+					metrics_note_endpoint(ep);
 					*outep = ep;
 					return CBM_ERROR_OK;
                                 }
@@ -125,6 +129,8 @@ int resolve_endpoint(drive_and_name_t *dname, charset_t cset, int privileged, en
 	drive_t *ept = drive_find(dname->drive);
 
 	if (ept != NULL) {
+		metrics_note_drive(dname->drive);
+		metrics_note_endpoint(ept->ep);
 		*outep = ept->ep;
 		return CBM_ERROR_OK;
 	}
@@ -136,12 +142,19 @@ int resolve_endpoint(drive_and_name_t *dname, charset_t cset, int privileged, en
  * resolve a given file-path (pattern) from the directory given in *dir,
  * to the final directory (returned in *dir)
  * and the filename rest of the given file-path (returned in pattern)
+ *
+ * If outmount is not NULL, it is set to the last endpoint the path has 
+ * changed into (i.e. a mounted disk image). outmountend is set to the end of 
+ * the name that has been matched for it, and outmountnext to where the pattern
+ * continues in the mounted endpoint.
  */
-int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir) {
+static int resolve_dir_int(const char **pattern, charset_t cset, file_t **inoutdir,
+		endpoint_t **outmount, const char **outmountend, const char **outmountnext) {
 
 	int rv = CBM_ERROR_OK;
 	drive_and_name_t dnt;
 	file_t *dir = *inoutdir;
+	trace_t tr = trace_begin();
 
 	drive_and_name_init(&dnt);
 
@@ -164,13 +177,19 @@ int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir) {
 			file_t *fp = NULL;
 
 			dnt.name = p;
-			rv = resolve_scan_int(dir, &dnt, 1, true, cset, false, &de, &rdflag);
+			rv = resolve_scan_int(dir, &dnt, 1, true, cset, false, false, &de, &rdflag);
 
 			if (rv == CBM_ERROR_OK) {
 				// open the found dir entry
 				rv = de->handler->open2(de, NULL, FS_OPEN_DR, &fp);
 
 				if (rv == CBM_ERROR_OK) {
+					if (outmount != NULL && fp->endpoint != dir->endpoint) {
+						// changed into a mounted image
+						*outmount = fp->endpoint;
+						*outmountend = (const char*) dnt.name;
+						*outmountnext = p;
+					}
 					// close old dir
 					dir->handler->fclose(dir, NULL, NULL);
 					// new scan dir
@@ -201,9 +220,365 @@ int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir) {
 	if (rv == CBM_ERROR_OK) {
 		*inoutdir = dir;
 	}
+	trace_end(tr, "resolver", "resolve_dir", rv);
 	return rv;
 }
 
+int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir) {
+
+	return resolve_dir_int(pattern, cset, inoutdir, NULL, NULL, NULL);
+}
+
+
+// ----------------------------------------------------------------------------------
+// Path resolution cache. 
+//
+// Walking into a disk image means scanning its directory, wrapping the image
+// file and opening it as new endpoint. For each path prefix that ends in such 
+// a mount the cache keeps the mounted endpoint, so the next file-path with
+// the same prefix directly starts at its root directory. 
+//
+// Only paths from assigned drives are cached. The cache holds a reference
+// (refcnt) to the mounts, so they are not freed when the last file in them
+// is closed. The cache is flushed whenever a drive is (re-)assigned, and by
+// all commands that could change what a prefix resolves to. A mount whose
+// image file has been changed from outside is dropped when it is hit.
+//
+// Directories can be changed from outside as well, and are not tracked.
+// So only mounts of images in the drive's root directory are cached, with
+// the root directory as it was then; when it has changed, the entry is
+// dropped when it is hit.
+
+#define	RESOLVE_CACHE_SIZE	8
+
+typedef struct {
+	endpoint_t	*ep;		// endpoint the path starts at, NULL if unused
+	charset_t	cset;
+	char		*prefix;	// path prefix up to and including the mount name
+	size_t		len;
+	size_t		next;		// where the path continues in the mount
+	endpoint_t	*mount;		// endpoint the prefix resolves to
+	direntry_t	root;		// root directory of ep when added, from info()
+	unsigned int	used;		// for LRU replacement
+} resolve_cache_t;
+
+static resolve_cache_t resolve_cache[RESOLVE_CACHE_SIZE];
+static unsigned int resolve_cache_clock = 0;
+
+// get the root directory of the endpoint as it is now;
+// returns false when the provider can not tell
+static bool resolve_cache_root(endpoint_t *ep, direntry_t *outde) {
+
+	bool ok = false;
+	file_t *root = endpoint_root(ep);
+
+	memset(outde, 0, sizeof(*outde));
+	if (root != NULL) {
+		ok = root->handler->info != NULL
+			&& root->handler->info(root, outde) == CBM_ERROR_OK;
+		root->handler->fclose(root, NULL, NULL);
+	}
+	return ok;
+}
+
+// check the entry against changes from outside
+static bool resolve_cache_uptodate(resolve_cache_t *e) {
+
+	direntry_t de;
+
+	if (e->mount->ptype->uptodate != NULL && !e->mount->ptype->uptodate(e->mount)) {
+		return false;
+	}
+	if (!resolve_cache_root(e->ep, &de)) {
+		return true;
+	}
+	return de.moddate == e->root.moddate
+		&& de.moddate_ns == e->root.moddate_ns
+		&& de.ino == e->root.ino;
+}
+
+static void resolve_cache_drop(resolve_cache_t *e) {
+
+	endpoint_t *mount = e->mount;
+
+	log_debug("Dropping resolve cache entry '%s' -> %p\n", e->prefix, mount);
+
+	mem_free(e->prefix);
+	e->ep = NULL;
+	e->prefix = NULL;
+	e->mount = NULL;
+
+	mount->refcnt--;
+	if (mount->refcnt == 0 && reg_size(&mount->files) == 0) {
+		provider_cleanup(mount);
+	}
+}
+
+static resolve_cache_t *resolve_cache_find(endpoint_t *ep, const char *pattern, charset_t cset) {
+
+	resolve_cache_t *hit = NULL;
+
+	for (int i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+		resolve_cache_t *e = &resolve_cache[i];
+		if (e->ep == ep && e->cset == cset
+			&& (hit == NULL || e->len > hit->len)
+			&& !strncmp(pattern, e->prefix, e->len)) {
+			hit = e;
+		}
+	}
+	if (hit != NULL) {
+		hit->used = ++resolve_cache_clock;
+	}
+	return hit;
+}
+
+static void resolve_cache_add(endpoint_t *ep, const char *pattern, size_t len, size_t next,
+		charset_t cset, endpoint_t *mount) {
+
+	resolve_cache_t *e = &resolve_cache[0];
+
+	for (int i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+		if (resolve_cache[i].ep == NULL) {
+			e = &resolve_cache[i];
+			break;
+		}
+		if (resolve_cache[i].used < e->used) {
+			e = &resolve_cache[i];
+		}
+	}
+	if (e->ep != NULL) {
+		resolve_cache_drop(e);
+	}
+
+	mount->refcnt++;
+
+	resolve_cache_root(ep, &e->root);
+
+	e->ep = ep;
+	e->cset = cset;
+	e->prefix = mem_alloc_strn(pattern, len);
+	e->len = len;
+	e->next = next;
+	e->mount = mount;
+	e->used = ++resolve_cache_clock;
+
+	log_debug("Added resolve cache entry '%s' -> %p\n", e->prefix, mount);
+}
+
+void resolve_cache_invalidate(endpoint_t *ep) {
+
+	if (ep != NULL) {
+		// changes within a mounted image do not change the prefixes,
+		// unless it contains further mounts
+		bool ismount = false;
+		for (int i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+			if (resolve_cache[i].ep == ep) {
+				ismount = false;
+				break;
+			}
+			if (resolve_cache[i].mount == ep) {
+				ismount = true;
+			}
+		}
+		if (ismount) {
+			return;
+		}
+	}
+
+	for (int i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+		if (resolve_cache[i].ep != NULL) {
+			resolve_cache_drop(&resolve_cache[i]);
+		}
+	}
+}
+
+int resolve_path(endpoint_t *ep, const char **pattern, charset_t cset, file_t **outdir) {
+
+	const char *start = *pattern;
+	endpoint_t *mount = NULL;
+	const char *mountend = NULL;
+	const char *mountnext = NULL;
+	int rv;
+	trace_t tr = trace_begin();
+
+	resolve_cache_t *hit = resolve_cache_find(ep, start, cset);
+	if (hit != NULL && !resolve_cache_uptodate(hit)) {
+		// resolve it again
+		resolve_cache_drop(hit);
+		hit = NULL;
+	}
+	if (hit != NULL) {
+		log_debug("Resolve cache hit for '%s' -> %p\n", hit->prefix, hit->mount);
+
+		*outdir = endpoint_root(hit->mount);
+		*pattern = start + hit->next;
+		rv = resolve_dir_int(pattern, cset, outdir, NULL, NULL, NULL);
+		trace_end(tr, "resolver", "resolve_path_cached", rv);
+		return rv;
+	}
+
+	*outdir = endpoint_root(ep);
+	rv = resolve_dir_int(pattern, cset, outdir, &mount, &mountend, &mountnext);
+
+	if (rv == CBM_ERROR_OK && mount != NULL && ep->is_assigned > 0 && mountend > start
+		&& memchr(start, '/', mountend - start - 1) == NULL) {
+		// the image is in the root directory
+		resolve_cache_add(ep, start, mountend - start, mountnext - start, cset, mount);
+	}
+	trace_end(tr, "resolver", "resolve_path", rv);
+	return rv;
+}
+
+
+// ----------------------------------------------------------------------------------
+// Scan patterns are compiled once per scan, so each directory entry name is
+// converted to ASCII only once, and most entries are rejected by length or
+// by their first characters.
+//
+// The result is the same as from match_pattern() with classic wildcards:
+// - a '?' matches any character
+// - a '*' matches the rest of the name (at least one character), but only
+//   if the pattern ends right behind it
+// - the name must end where the pattern ends, or where the pattern has 
+//   a '/' or ','
+// When the name matches, the pattern is consumed up to that end.
+
+// short strings are converted into buffers on the stack
+#define	SCAN_PATTERN_BUFLEN	64
+#define	SCAN_NAME_BUFLEN	256
+// number of wrapped names checked before wrapping an entry
+#define	SCAN_WRAP_NAMES		8
+
+typedef struct {
+	const char	*orig;		// pattern as given, to return the end position
+	char		*pat;		// pattern converted to ASCII
+	char		buf[SCAN_PATTERN_BUFLEN];
+	size_t		lit;		// number of chars before the first '*', or the length
+	bool		star;		// there is a '*' at pat[lit]
+	size_t		minlen;		// shorter names never match, SIZE_MAX if no name matches
+} scan_pattern_t;
+
+static inline bool scan_pattern_end(char c) {
+	return c == 0 || c == '/' || c == ',';
+}
+
+// convert a string to ASCII, into buf if it fits, or into an allocated buffer
+static char *scan_to_ascii(const char *in, charset_t cset, char *buf, size_t buflen) {
+
+	size_t len = strlen(in);
+	char *out = (len < buflen) ? buf : mem_alloc_c(len + 1, "scan_ascii");
+	charconv_t conv = cconv_converter(cset, CHARSET_ASCII);
+
+	// conversion lengths are uint8_t
+	for (size_t off = 0; off < len; off += 255) {
+		uint8_t n = (len - off > 255) ? 255 : len - off;
+		conv(in + off, n, out + off, n);
+	}
+	out[len] = 0;
+	return out;
+}
+
+static void scan_pattern_compile(scan_pattern_t *sp, const char *pattern, charset_t cset) {
+
+	sp->orig = pattern;
+	sp->pat = scan_to_ascii(pattern, cset, sp->buf, SCAN_PATTERN_BUFLEN);
+
+	char *p = strchr(sp->pat, '*');
+	sp->star = (p != NULL);
+	sp->lit = sp->star ? (size_t)(p - sp->pat) : strlen(sp->pat);
+
+	// the first place the name can end
+	sp->minlen = SIZE_MAX;
+	for (size_t k = 0; k <= sp->lit; k++) {
+		if (scan_pattern_end(sp->pat[k])) {
+			sp->minlen = k;
+			break;
+		}
+	}
+	if (sp->minlen == SIZE_MAX && sp->star && scan_pattern_end(sp->pat[sp->lit + 1])) {
+		sp->minlen = sp->lit + 1;
+	}
+}
+
+static void scan_pattern_free(scan_pattern_t *sp) {
+	if (sp->pat != sp->buf) {
+		mem_free(sp->pat);
+	}
+}
+
+// match an ASCII name of length len; returns the end of the match in the pattern, 
+// or NULL if it does not match
+static const char *scan_pattern_match(const scan_pattern_t *sp, const char *name, size_t len) {
+
+	size_t end;
+
+	if (sp->pat[0] == 0) {
+		// empty pattern matches everything
+		return sp->orig;
+	}
+	if (len < sp->minlen) {
+		return NULL;
+	}
+	if (len > sp->lit) {
+		// only the '*' can take the rest of the name
+		if (!sp->star || !scan_pattern_end(sp->pat[sp->lit + 1])) {
+			return NULL;
+		}
+		end = sp->lit + 1;
+		len = sp->lit;
+	} else {
+		if (!scan_pattern_end(sp->pat[len])) {
+			return NULL;
+		}
+		end = len;
+	}
+	for (size_t k = 0; k < len; k++) {
+		if (sp->pat[k] != name[k] && sp->pat[k] != '?') {
+			return NULL;
+		}
+	}
+	return sp->orig + end;
+}
+
+// match the entry name against all patterns, return the end of the
+// matching pattern, or NULL.
+// If dowrap is not NULL, it is set when the entry needs to be wrapped, i.e.
+// when it matched, or when a name it may be wrapped under could match
+static const char *scan_match_entry(const scan_pattern_t *sp, int num_pattern, direntry_t *de,
+		bool *dowrap) {
+
+	char buf[SCAN_NAME_BUFLEN];
+	const char *rv = NULL;
+	int namelens[SCAN_WRAP_NAMES];
+
+	char *name = scan_to_ascii((const char*)de->name, de->cset, buf, SCAN_NAME_BUFLEN);
+	size_t len = strlen(name);
+
+	for (int i = 0; i < num_pattern && rv == NULL; i++) {
+		log_debug("match: pattern '%s' with name '%s'\n", sp[i].pat, name);
+		rv = scan_pattern_match(&sp[i], name, len);
+	}
+
+	if (dowrap != NULL) {
+		*dowrap = (rv != NULL);
+		if (!*dowrap) {
+			// only wrap (and open the file) when the wrapped name can match
+			int n = handler_maywrap(de, namelens, SCAN_WRAP_NAMES);
+			*dowrap = (n < 0);
+			for (int j = 0; j < n && !*dowrap; j++) {
+				for (int i = 0; i < num_pattern && !*dowrap; i++) {
+					*dowrap = (namelens[j] <= (int) len
+						&& scan_pattern_match(&sp[i], name, namelens[j]) != NULL);
+				}
+			}
+		}
+	}
+
+	if (name != buf) {
+		mem_free(name);
+	}
+	return rv;
+}
 
 /**
  * scan a given directory (dir) for a search file-pattern (pattern), returning
@@ -214,7 +589,8 @@ int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir) {
  * entries (as long as pattern is reset between calls).
  *
  * Note that the directory entry is potentially wrapped in case an encapsulated
- * file (e.g. .gz, .P00) or directory (.zip, .D64) is detected.
+ * file (e.g. .gz, .P00) or directory (.zip, .D64) is detected, unless nowrap
+ * is set.
  *
  * When isdirscan is true, the directory entries for disk header and blocks free
  * are also returned where available.
@@ -224,17 +600,25 @@ int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir) {
  * 	READFLAG_EOF	-> next read will not return further data, so set EOF
  */
 static int resolve_scan_int(file_t *dir, drive_and_name_t *pattern, int num_pattern, bool fixpattern, 
-		charset_t outcset, bool isdirscan, direntry_t **outde, int *rdflag) {
+		charset_t outcset, bool isdirscan, bool nowrap, direntry_t **outde, int *rdflag) {
 
-	log_debug("resolve_scan: pattern='%s'\n", *pattern);
+	log_debug("resolve_scan: pattern='%s'\n", pattern->name);
 
 	int rv = CBM_ERROR_OK;
+	trace_t tr = trace_begin();
 
         const char *scanpattern = NULL;
-        const char *name = NULL;
 	direntry_t *direntry = NULL;
 	direntry_t *wrapped = NULL;
-	bool found = false;
+	bool dowrap = false;
+	scan_pattern_t sp[MAX_NAMEINFO_FILES];
+
+	if (num_pattern > MAX_NAMEINFO_FILES) {
+		num_pattern = MAX_NAMEINFO_FILES;
+	}
+	for (int i = 0; i < num_pattern; i++) {
+		scan_pattern_compile(&sp[i], (const char*)pattern[i].name, outcset);
+	}
 
         do {
 		// Note: the pattern name is there so we can put it in directory headers in fs_provider
@@ -249,49 +633,33 @@ static int resolve_scan_int(file_t *dir, drive_and_name_t *pattern, int num_patt
 		}
 
 		// match unwrapped entry (to enable unwrapped "foo.d64" addressing)
-		found = false;
-		for (int i = 0; i < num_pattern; i++) {
-                	scanpattern = (char*) pattern[i].name;
-			// empty name matches
-			if (scanpattern[0] == 0) {
-				found = true;
-				break;
-			}
-                	name = (const char*)direntry->name;
-			log_debug("match: pattern '%s' with name '%s'\n", scanpattern, name);
-			if (cconv_matcher(outcset, direntry->cset) (&scanpattern, &name, false )) {
-				found = true;
-				break;
-			}
-		}
+		scanpattern = scan_match_entry(sp, num_pattern, direntry, nowrap ? NULL : &dowrap);
 
 		// wrap
-		rv = handler_wrap(direntry, &wrapped);
-		if (rv == CBM_ERROR_OK
-			&& wrapped != NULL) {
-			direntry = wrapped;
-
-			if (!found) {
-				// match wrapped entry (to enable match as in directory entry)
-				for (int i = 0; i < num_pattern; i++) {
-                			scanpattern = (char*) pattern[i].name;
-	                		name = (const char*)direntry->name;
-					log_debug("match: pattern '%s' with name '%s'\n", scanpattern, name);
-					if (cconv_matcher(outcset, direntry->cset) (&scanpattern, &name, false )) {
-						found = true;
-						break;
-					}
+		if (dowrap) {
+			rv = handler_wrap(direntry, &wrapped);
+			if (rv == CBM_ERROR_OK
+				&& wrapped != NULL) {
+				direntry = wrapped;
+
+				if (scanpattern == NULL) {
+					// match wrapped entry (to enable match as in directory entry)
+					scanpattern = scan_match_entry(sp, num_pattern, direntry, NULL);
 				}
 			}
 		}
 
-		if (!found) {
+		if (scanpattern == NULL) {
 			direntry->handler->declose(direntry);
 		}
 
-        } while (!found);
+        } while (scanpattern == NULL);
+
+	for (int i = 0; i < num_pattern; i++) {
+		scan_pattern_free(&sp[i]);
+	}
 
-	if (found && fixpattern) {
+	if (scanpattern != NULL && fixpattern) {
 		if (*scanpattern == '/') {
 			scanpattern++;
 		}
@@ -299,13 +667,14 @@ static int resolve_scan_int(file_t *dir, drive_and_name_t *pattern, int num_patt
 	}
 	*outde = direntry;
 
+	trace_end(tr, "resolver", "resolve_scan", rv);
 	return rv;
 }
 
 int resolve_scan(file_t *dir, drive_and_name_t *pattern, int num_pattern, charset_t outcset, bool isdirscan,
-	direntry_t **outde, int *rdflag) {
+	bool nowrap, direntry_t **outde, int *rdflag) {
 
-	return resolve_scan_int(dir, pattern, num_pattern, false, outcset, isdirscan, outde, rdflag);
+	return resolve_scan_int(dir, pattern, num_pattern, false, outcset, isdirscan, nowrap, outde, rdflag);
 }
 
 
@@ -320,9 +689,10 @@ int resolve_open(file_t *dir,
         file_t *file = NULL;
         int rdflag = 0;
         direntry_t *dirent;
+	trace_t tr = trace_begin();
 
         // now resolve the actual filename
-        int rv = resolve_scan_int(dir, inname, 1, true, cset, false, &dirent, &rdflag);
+        int rv = resolve_scan_int(dir, inname, 1, true, cset, false, pars->nowrap, &dirent, &rdflag);
 
 	if (rv == CBM_ERROR_OK && dirent && pars->filetype != FS_DIR_TYPE_UNKNOWN) {
 		// we have a direntry and must check file types
@@ -432,6 +802,7 @@ int resolve_open(file_t *dir,
 		}
         }
 
+	trace_end(tr, "resolver", "resolve_open", rv);
         return rv;
 }
 
@@ -53,6 +53,20 @@ int resolve_endpoint(drive_and_name_t *dname, charset_t cset, int privileged, en
  */
 int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir);
 
+/**
+ * resolve a given file-path (pattern) from the root directory of the endpoint ep,
+ * like endpoint_root() and resolve_dir(). Path prefixes that lead into a disk
+ * image are cached, so the image does not have to be searched and opened again
+ * on the next file-path with the same prefix.
+ */
+int resolve_path(endpoint_t *ep, const char **pattern, charset_t cset, file_t **outdir);
+
+/**
+ * invalidate the path resolution cache, as the file system behind the endpoint
+ * ep has been changed. A NULL ep flushes the whole cache (e.g. on assign).
+ */
+void resolve_cache_invalidate(endpoint_t *ep);
+
 
 /**
  * scan a given directory (dir) for a search file-pattern (pattern), returning
@@ -63,7 +77,8 @@ int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir);
  * entries (as long as pattern is reset between calls).
  *
  * Note that the directory entry is potentially wrapped in case an encapsulated
- * file (e.g. .gz, .P00) or directory (.zip, .D64) is detected.
+ * file (e.g. .gz, .P00) or directory (.zip, .D64) is detected, unless nowrap
+ * is set.
  *
  * When isdirscan is true, the directory entries for disk header and blocks free
  * are also returned where available.
@@ -75,7 +90,7 @@ int resolve_dir(const char **pattern, charset_t cset, file_t **inoutdir);
  * if num_pattern == 1 the found values are modified (e.g. as part of resolve_dir).
  */
 int resolve_scan(file_t *dir, drive_and_name_t *pattern, int num_pattern, charset_t cset, bool isdirscan,
-	direntry_t **outde, int *rdflag);
+	bool nowrap, direntry_t **outde, int *rdflag);
 
 /**
  * scan a directory and open the file, optionally creating it.
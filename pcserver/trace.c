@@ -0,0 +1,124 @@
+/****************************************************************************
+
+    Serial line filesystem server
+    Copyright (C) 2012,2014 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+/*
+ * Records request trace spans and renders them as Chrome trace-event JSON.
+ *
+ * The server handles all requests in the single poll loop thread, so there
+ * is a single ring buffer. When it is full, the oldest spans are overwritten.
+ * Spans are "complete" (ph "X") events, so a span whose parent has been
+ * overwritten is still shown correctly.
+ */
+
+#include "os.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "mem.h"
+#include "log.h"
+#include "strbuf.h"
+#include "trace.h"
+
+
+typedef struct {
+	trace_t		start;		// in us
+	long		dur;		// in us
+	const char	*cat;
+	const char	*name;
+	int		arg;
+} span_t;
+
+int trace_enabled = 0;
+
+static span_t spans[TRACE_MAX_SPANS];
+// next span to write
+static int wp = 0;
+// number of valid spans
+static int num = 0;
+
+trace_t trace_now(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (trace_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_record(trace_t start, const char *cat, const char *name, int arg) {
+
+	span_t *s = &spans[wp];
+
+	s->start = start;
+	s->dur = trace_now() - start;
+	s->cat = cat;
+	s->name = name;
+	s->arg = arg;
+
+	wp++;
+	if (wp >= TRACE_MAX_SPANS) {
+		wp = 0;
+	}
+	if (num < TRACE_MAX_SPANS) {
+		num++;
+	}
+}
+
+void trace_enable(int enable) {
+
+	log_info("Tracing %s\n", enable ? "enabled" : "disabled");
+
+	if (enable && !trace_enabled) {
+		wp = 0;
+		num = 0;
+	}
+	trace_enabled = enable;
+}
+
+char *trace_render(void) {
+
+	strbuf_t sb;
+
+	strbuf_init(&sb, 4096 + num * 100);
+
+	strbuf_printf(&sb, "{\"traceEvents\":[");
+
+	int p = wp - num;
+	if (p < 0) {
+		p += TRACE_MAX_SPANS;
+	}
+	for (int i = 0; i < num; i++) {
+		span_t *s = &spans[p];
+
+		// names are constant identifiers, so they need no JSON escaping
+		strbuf_printf(&sb, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%ld,"
+			"\"pid\":1,\"tid\":1,\"args\":{\"arg\":%d}}",
+			i ? "," : "", s->name, s->cat, s->start, s->dur, s->arg);
+
+		p++;
+		if (p >= TRACE_MAX_SPANS) {
+			p = 0;
+		}
+	}
+	strbuf_printf(&sb, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	return sb.buf;
+}
+
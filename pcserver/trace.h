@@ -0,0 +1,75 @@
+/****************************************************************************
+
+    Serial line filesystem server
+    Copyright (C) 2012,2014 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Request tracing. Spans (name, start, duration) are recorded into a ring
+ * buffer that keeps the most recent TRACE_MAX_SPANS, and can be rendered
+ * in the Chrome trace-event JSON format (load it in chrome://tracing or
+ * https://ui.perfetto.dev).
+ *
+ * Usage:
+ *
+ *	trace_t tr = trace_begin();
+ *	... work ...
+ *	trace_end(tr, "resolver", "resolve_path", 0);
+ *
+ * When tracing is disabled, trace_begin() returns 0 after testing a flag,
+ * and trace_end() does nothing for a 0 start.
+ */
+
+#define	TRACE_MAX_SPANS		16384
+
+// start time of a span in us, 0 when not tracing
+typedef long long trace_t;
+
+extern int trace_enabled;
+
+trace_t trace_now(void);
+
+void trace_record(trace_t start, const char *cat, const char *name, int arg);
+
+static inline trace_t trace_begin(void) {
+	return trace_enabled ? trace_now() : 0;
+}
+
+// cat and name must be constant strings, they are not copied
+static inline void trace_end(trace_t start, const char *cat, const char *name, int arg) {
+	if (start != 0) {
+		trace_record(start, cat, name, arg);
+	}
+}
+
+/**
+ * enable or disable recording; enabling clears the recorded spans
+ */
+void trace_enable(int enable);
+
+/**
+ * render the recorded spans as Chrome trace-event JSON;
+ * the returned string must be mem_free'd
+ */
+char *trace_render(void);
+
+#endif
+
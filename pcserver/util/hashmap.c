@@ -22,6 +22,13 @@
 /*
  * a hashmap is used for example to quickly find labels
  *
+ * This is an open-addressing hashmap using "Robin Hood" linear probing.
+ * All entries live in a single power-of-two sized table. Each entry caches
+ * its (mixed) hash value and its probe distance from the home slot.
+ * On insert, an entry that is "poorer" (further away from its home slot)
+ * takes the slot from a "richer" one, which keeps probe sequences short
+ * and allows a lookup to stop as soon as it reaches a richer entry.
+ * The table is doubled when the load factor exceeds HASH_MAX_LOAD.
  */
 
 #include <string.h>
@@ -33,32 +40,35 @@
 #include "hashmap.h"
 #include "astring.h"
 
+// minimum table size (must be power of two)
+#define	HASH_MIN_CAPACITY	8
+// max load factor in percent before the table is grown
+#define	HASH_MAX_LOAD		80
+
 // internal entry
 typedef struct {
-	int 		hash;
+	// cached hash value (after mixing)
+	unsigned int	hash;
+	// probe distance + 1 from home slot; 0 marks an empty slot
+	unsigned int	dist;
 	const void 	*key;
 	void	 	*data;
 } entry_t;
 
-// internal bucket
-typedef struct {
-	int		num_allocated;
-	int		num_filled;
-	entry_t		*array;
-} hash_bucket_t;
-
 struct hash_s {
-      // initial size of a new bucket
-      int             initial_bucket_size;
-      // number of buckets
-      int             n_buckets;
-      // array of ptrs to bucket
-      hash_bucket_t   *buckets;
+      // number of slots in the table (power of two)
+      unsigned int    capacity;
+      // capacity - 1, to compute slot from hash
+      unsigned int    mask;
+      // number of entries after which the table is grown
+      unsigned int    grow_at;
+      // slot table
+      entry_t         *entries;
       // ptr to hash function - hash from key
       int             (*hash_from_key)(const void *key);
       // get the key from an entry that is put into the map
       const void*     (*key_from_entry)(const void *entry);
-      // optional - when set, check newly added entries if they are equal with a 
+      // check newly added entries if they are equal with a 
       // previous entry and remove the previous one
       bool_t          (*equals_key)(const void *fromhash, const void *tobeadded);
       // modification count
@@ -69,8 +79,7 @@ struct hash_s {
 
 struct hash_iterator_s {
 	hash_t		*hash;
-	int 		bucketno;
-	int		entryinbucket;
+	unsigned int	slot;
 	int 		mod_cnt;
 };
 
@@ -86,12 +95,6 @@ static type_t hash_memtype = {
 	NULL
 };
 
-static type_t hash_bucket_memtype = {
-	"hashmap_bucket_t",
-	sizeof(hash_bucket_t),
-	NULL
-};
-
 static type_t hash_iterator_memtype = {
 	"hash_iterator_t",
 	sizeof(hash_iterator_t),
@@ -113,14 +116,79 @@ static inline void hash_check_mod(hash_iterator_t *iter) {
         }
 }
 
-static inline int bucket_from_hash(hash_t *hash, int hashval) {
-	// find bucket by computing the modulo of the hash value
-	int bucketno = hashval % hash->n_buckets;
+// The hash functions given by the users (e.g. string_hash) are cheap and
+// do not distribute well over the low bits that we use to select a slot.
+// So mix them with the murmur3 finalizer.
+static inline unsigned int mix_hash(int hashval) {
+	unsigned int h = (unsigned int) hashval;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static inline unsigned int capacity_for(unsigned int nentries) {
+	unsigned int cap = HASH_MIN_CAPACITY;
+
+	while (cap * HASH_MAX_LOAD / 100 < nentries) {
+		cap <<= 1;
+	}
+	return cap;
+}
+
+static void hash_alloc_table(hash_t *hash, unsigned int capacity) {
+
+	hash->capacity = capacity;
+	hash->mask = capacity - 1;
+	hash->grow_at = capacity * HASH_MAX_LOAD / 100;
+	// mem_alloc_n uses calloc, so all slots are empty (dist == 0)
+	hash->entries = mem_alloc_n(capacity, &entry_memtype);
+}
+
+// insert an entry that is known not to be in the table yet, starting at the
+// given slot, where newentry->dist must already match that slot
+static void hash_insert_new(hash_t *hash, entry_t *newentry, unsigned int slot) {
+
+	entry_t tmp;
+
+	while (1) {
+		entry_t *entry = &hash->entries[slot];
+
+		if (entry->dist == 0) {
+			*entry = *newentry;
+			return;
+		}
+		if (entry->dist < newentry->dist) {
+			// Robin Hood - take from the rich: swap and continue
+			// placing the displaced entry
+			tmp = *entry;
+			*entry = *newentry;
+			*newentry = tmp;
+		}
+		newentry->dist++;
+		slot = (slot + 1) & hash->mask;
+	}
+}
+
+static void hash_grow(hash_t *hash) {
 
-	if (bucketno < 0) {
-		bucketno = -bucketno;
+	entry_t *old = hash->entries;
+	unsigned int oldcap = hash->capacity;
+
+	hash_alloc_table(hash, oldcap << 1);
+
+	for (unsigned int i = 0; i < oldcap; i++) {
+		if (old[i].dist != 0) {
+			entry_t en = old[i];
+			en.dist = 1;
+			hash_insert_new(hash, &en, en.hash & hash->mask);
+		}
 	}
-	return bucketno;
+	mem_free(old);
 }
 
 hash_t *hash_init_stringkey(int approx_size, int nbuckets, 
@@ -146,108 +214,96 @@ hash_t *hash_init(int approx_size, int nbuckets,
 		const void* (*key_from_entry)(const void *entry), 
 		bool_t (*equals_key)(const void *fromhash, const void *tobeadded)) {
 
+	// nbuckets is only kept for API compatibility; the table
+	// size is derived from approx_size and grows as needed
+	(void) nbuckets;
+
 	hash_t *hash = mem_alloc(&hash_memtype);
 
-	hash->initial_bucket_size = approx_size / nbuckets;
-	if (hash->initial_bucket_size == 0) {
-		hash->initial_bucket_size = 1;
-	}
-	hash->n_buckets = nbuckets;
 	hash->hash_from_key = hash_from_key;
 	hash->key_from_entry = key_from_entry;
 	hash->equals_key = equals_key;
 
-	// allocate buckets and initialize them as empty
-	hash->buckets = mem_alloc_n(nbuckets, &hash_bucket_memtype);
-	for (int i = 0; i < nbuckets; i++) {
-		hash->buckets[i].num_allocated = 0;
-		hash->buckets[i].num_filled = 0;
-		hash->buckets[i].array = NULL;
-	}
+	hash_alloc_table(hash, capacity_for(approx_size < 0 ? 0 : approx_size));
+
 	return hash;
 }
 
 
 void *hash_put(hash_t *hash, void *value) {
 
-	void *removed = NULL;
-
 	hash->mod_cnt ++;
 
 	const void *key = hash->key_from_entry(value);
 
 	// calculate hash
-	int hashval = hash->hash_from_key(key);
+	unsigned int hashval = mix_hash(hash->hash_from_key(key));
 
-	// find bucket by computing the modulo of the hash value
-	int bucketno = bucket_from_hash(hash, hashval);
+	unsigned int slot = hashval & hash->mask;
+	unsigned int dist = 1;
 
-	// find a suitable entry in the bucket
-	entry_t *entry = NULL;
+	// look for an existing entry with the same key. Due to the Robin Hood
+	// invariant we can stop at the first empty slot or the first entry that
+	// is closer to its home slot than we would be
+	while (1) {
+		entry_t *entry = &hash->entries[slot];
 
-	hash_bucket_t *bucket_list = &hash->buckets[bucketno];
-	if (bucket_list->array == NULL) {
-		// bucket still empty, first with this value, so allocate first
-		bucket_list->num_allocated = hash->initial_bucket_size;
-		bucket_list->array = mem_alloc_n(bucket_list->num_allocated, &entry_memtype);
-		
-		entry = bucket_list->array;
-		bucket_list->num_filled = 1;
-		hash->total_cnt++;
-	} else {
-		// find the entry in the bucket
-		int i = 0;
-		for (i = 0; i < bucket_list->num_filled; i++) {
-			entry = &bucket_list->array[i];
-			if (entry->hash == hashval && hash->equals_key(entry->key, key)) {
-				// found
-				// no need to add to total_cnt
-				// return old value
-				removed = entry->data;
-				break;
-			}
+		if (entry->dist < dist) {
+			// not found; entry is empty or richer than us
+			break;
 		}
-		if (i >= bucket_list->num_filled) {
-			// not found
-			if (bucket_list->num_filled >= bucket_list->num_allocated) {
-				// no more space in the bucket, increase bucket
-				bucket_list->num_allocated = bucket_list->num_allocated * 2;
-				bucket_list->array = mem_realloc_n(bucket_list->num_allocated, &entry_memtype, bucket_list->array);
-			}
-			// now we are sure to have space in the array
-			entry = &bucket_list->array[bucket_list->num_filled];
-			bucket_list->num_filled ++;
-			hash->total_cnt++;
+		if (entry->hash == hashval && hash->equals_key(entry->key, key)) {
+			// found - replace and return old value
+			void *removed = entry->data;
+			entry->key = key;
+			entry->data = value;
+			return removed;
 		}
+		dist++;
+		slot = (slot + 1) & hash->mask;
 	}
-	entry->key = key;
-	entry->hash = hashval;
-	entry->data = value;
-	
-	return removed;
+
+	if ((unsigned int) hash->total_cnt >= hash->grow_at) {
+		hash_grow(hash);
+		slot = hashval & hash->mask;
+		dist = 1;
+	}
+
+	entry_t newentry;
+	newentry.hash = hashval;
+	newentry.dist = dist;
+	newentry.key = key;
+	newentry.data = value;
+
+	hash_insert_new(hash, &newentry, slot);
+	hash->total_cnt++;
+
+	return NULL;
 }
 
 
 void *hash_get(hash_t *hash, const void *key) {
 
 	// calculate hash
-	int hashval = hash->hash_from_key(key);
+	unsigned int hashval = mix_hash(hash->hash_from_key(key));
 
-	// find bucket by computing the modulo of the hash value
-	int bucketno = bucket_from_hash(hash, hashval);
+	unsigned int slot = hashval & hash->mask;
+	unsigned int dist = 1;
 
-	hash_bucket_t *bucket_list = &hash->buckets[bucketno];
+	while (1) {
+		const entry_t *entry = &hash->entries[slot];
 
-	entry_t *entry = NULL;
-        // find the entry in the bucket
-        for (int i = 0; i < bucket_list->num_filled; i++) {
-	        entry = &bucket_list->array[i];
+		if (entry->dist < dist) {
+			// empty slot, or an entry that would have been displaced by ours
+			return NULL;
+		}
 	        if (entry->hash == hashval && hash->equals_key(entry->key, key)) {
 		        // found
 			return entry->data;
 	        }
-        }
-	return NULL;
+		dist++;
+		slot = (slot + 1) & hash->mask;
+	}
 }
 
 long hash_size(hash_t *hash) {
@@ -257,21 +313,17 @@ long hash_size(hash_t *hash) {
 // free the hashmap
 void hash_free(hash_t *hash, void (callback)(const void* key, void* value)) {
 
-	for (int i = 0; i < hash->n_buckets; i++) {
-
-		hash_bucket_t *bucket = &hash->buckets[i];
-
-		for (int j = 0; j < bucket->num_allocated; j++) {
+	if (callback) {
+		for (unsigned int i = 0; i < hash->capacity; i++) {
 		
-			entry_t *en = &bucket->array[j];
+			entry_t *en = &hash->entries[i];
 
-			if (callback) {
+			if (en->dist != 0) {
 				callback(en->key, en->data);
 			}
 		}
-		mem_free(bucket->array);
 	}
-	mem_free(hash->buckets);
+	mem_free(hash->entries);
 	mem_free(hash);
 }
 
@@ -283,8 +335,7 @@ hash_iterator_t *hash_iterator(hash_t *hash) {
 
 	iter->hash = hash;
 	iter->mod_cnt = hash->mod_cnt;
-	iter->bucketno = 0;
-	iter->entryinbucket = 0;
+	iter->slot = 0;
 
 	return iter;
 }
@@ -293,13 +344,10 @@ void* hash_iterator_next(hash_iterator_t *iter) {
 
 	hash_check_mod(iter);
 
-	while (iter->bucketno < iter->hash->n_buckets) {
-		hash_bucket_t *bucket = &iter->hash->buckets[iter->bucketno];
-		if (iter->entryinbucket < bucket->num_filled) {
-			return bucket->array[ iter->entryinbucket++ ].data;
-		} else {
-			iter->bucketno++;
-			iter->entryinbucket = 0;
+	while (iter->slot < iter->hash->capacity) {
+		entry_t *entry = &iter->hash->entries[iter->slot++];
+		if (entry->dist != 0) {
+			return entry->data;
 		}
 	}
 	return NULL;
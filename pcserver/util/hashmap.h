@@ -36,10 +36,10 @@ typedef struct hash_s hash_t;
 
 typedef struct hash_iterator_s hash_iterator_t;
 
-// initialize a hashmap. nbuckets is the number of hash values that are actually used
-// The bucket number is computed by taking the modulo of the hash value to the base nbucket.
-// The approximate size is divided by nbuckets to determine the initial size of 
-// an allocated bucket.
+// initialize a hashmap. The approximate size is used to determine the initial
+// size of the table, which is grown automatically when it fills up.
+// nbuckets is ignored and only kept for compatibility with the earlier
+// bucket-based implementation.
 // The function key_from_entry() returns the key object from an entry, hash_from_key() then
 // computes the hash from it. equals_key() compares two key objects in the case there is 
 // a hash collision.
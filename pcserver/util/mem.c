@@ -80,6 +80,10 @@ static int mem_last = 0;
 // first unused entry lies here or behind this rec#
 static int mem_tag = 0;
 
+// number of allocations and frees, for the statistics
+static unsigned long mem_num_alloc = 0;
+static unsigned long mem_num_free = 0;
+
 #define check_alloc(ptr, file, line) check_alloc_(ptr, NULL, file, line, NULL)
 #define check_alloc_s(ptr, file, line,to_string) check_alloc_(ptr, NULL, file, line, to_string)
 #define check_alloc2(ptr, name, file, line) check_alloc_(ptr, name, file, line, NULL)
@@ -139,6 +143,8 @@ static void check_alloc_(void *ptr, const char *name, char *file, int line, cons
 	mem_records[mem_tag].line = line;
 	mem_records[mem_tag].name = name;
 	mem_records[mem_tag].to_string = to_string;
+
+	mem_num_alloc++;
 }
 
 static void check_free_(const void *ptr) {
@@ -162,6 +168,7 @@ static void check_free_(const void *ptr) {
 				// was last used entry
 				mem_last --;
 			}
+			mem_num_free++;
 			return;
 		}
 	}
@@ -172,6 +179,13 @@ static void check_free_(const void *ptr) {
 
 // --------------------------------------------------------------------------------
 
+void mem_stats(unsigned long *allocs, unsigned long *frees) {
+	*allocs = mem_num_alloc;
+	*frees = mem_num_free;
+}
+
+// --------------------------------------------------------------------------------
+
 void mem_init (void) {
 }
 
@@ -85,6 +85,12 @@ void mem_append_str5(char **baseptr, const char *s1, const char *s2,
 		     const char *s3, const char *s4, const char *s5);
 
 
+/**
+ * return the number of allocations and frees done so far
+ * (a re-alloc counts as one of each)
+ */
+void mem_stats(unsigned long *allocs, unsigned long *frees);
+
 /**
  * called on exit of program. Prints debug info resp. errors 
  * if data structs are still allocated 
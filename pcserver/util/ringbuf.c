@@ -0,0 +1,110 @@
+/****************************************************************************
+
+    ring buffer handling
+    Copyright (C) 2012 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+
+#include <string.h>
+
+#include "mem.h"
+#include "ringbuf.h"
+
+
+void ringbuf_init(ringbuf_t *ring, int size, const char *name) {
+
+	ring->data = mem_alloc_c(size, name);
+	ring->size = size;
+	ring->rp = 0;
+	ring->len = 0;
+}
+
+void ringbuf_free(ringbuf_t *ring) {
+
+	if (ring->data != NULL) {
+		mem_free(ring->data);
+		ring->data = NULL;
+	}
+	ring->size = 0;
+	ring->rp = 0;
+	ring->len = 0;
+}
+
+int ringbuf_free_chunk(ringbuf_t *ring, char **ptr) {
+
+	int wp = (ring->rp + ring->len) % ring->size;
+	*ptr = ring->data + wp;
+	if (wp >= ring->rp && ring->len < ring->size) {
+		return ring->size - wp;
+	}
+	return ring->rp - wp;
+}
+
+int ringbuf_data_chunk(ringbuf_t *ring, char **ptr) {
+
+	*ptr = ring->data + ring->rp;
+	if (ring->rp + ring->len > ring->size) {
+		return ring->size - ring->rp;
+	}
+	return ring->len;
+}
+
+void ringbuf_consume(ringbuf_t *ring, int n) {
+
+	ring->rp = (ring->rp + n) % ring->size;
+	ring->len -= n;
+	if (ring->len == 0) {
+		// keep data contiguous as long as possible
+		ring->rp = 0;
+	}
+}
+
+int ringbuf_put(ringbuf_t *ring, const char *buf, int len) {
+
+	char *ptr;
+	int n = 0;
+
+	while (n < len && ring->len < ring->size) {
+		int chunk = ringbuf_free_chunk(ring, &ptr);
+		if (chunk > len - n) {
+			chunk = len - n;
+		}
+		memcpy(ptr, buf + n, chunk);
+		ring->len += chunk;
+		n += chunk;
+	}
+	return n;
+}
+
+int ringbuf_get(ringbuf_t *ring, char *buf, int len) {
+
+	char *ptr;
+	int n = 0;
+
+	while (n < len && ring->len > 0) {
+		int chunk = ringbuf_data_chunk(ring, &ptr);
+		if (chunk > len - n) {
+			chunk = len - n;
+		}
+		memcpy(buf + n, ptr, chunk);
+		ringbuf_consume(ring, chunk);
+		n += chunk;
+	}
+	return n;
+}
+
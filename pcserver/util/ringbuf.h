@@ -0,0 +1,86 @@
+/****************************************************************************
+
+    ring buffer handling
+    Copyright (C) 2012 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+/**
+ * byte ring buffer, used to decouple network transfers driven
+ * from the poll loop from the FS_READ / FS_WRITE requests
+ */
+typedef struct {
+	char		*data;
+	int		size;
+	int		rp;		// read pointer
+	int		len;		// number of bytes in buffer
+} ringbuf_t;
+
+/**
+ * allocate the buffer memory
+ */
+void ringbuf_init(ringbuf_t *ring, int size, const char *name);
+
+/**
+ * free the buffer memory
+ */
+void ringbuf_free(ringbuf_t *ring);
+
+/**
+ * contiguous free space after the end of the data; returns its length
+ * and sets ptr to its start. Use ringbuf_commit() after filling it
+ */
+int ringbuf_free_chunk(ringbuf_t *ring, char **ptr);
+
+/**
+ * mark n bytes written into the free chunk as data
+ */
+static inline void ringbuf_commit(ringbuf_t *ring, int n) {
+	ring->len += n;
+}
+
+/**
+ * contiguous data at the read pointer; returns its length and sets
+ * ptr to its start. Use ringbuf_consume() after using it
+ */
+int ringbuf_data_chunk(ringbuf_t *ring, char **ptr);
+
+/**
+ * remove n bytes from the start of the data
+ */
+void ringbuf_consume(ringbuf_t *ring, int n);
+
+/**
+ * copy data into the buffer, returns the number of bytes copied
+ */
+int ringbuf_put(ringbuf_t *ring, const char *buf, int len);
+
+/**
+ * copy data out of the buffer, returns the number of bytes copied
+ */
+int ringbuf_get(ringbuf_t *ring, char *buf, int len);
+
+static inline int ringbuf_space(ringbuf_t *ring) {
+	return ring->size - ring->len;
+}
+
+#endif
+
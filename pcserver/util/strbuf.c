@@ -0,0 +1,64 @@
+/****************************************************************************
+
+    growing string buffer
+    Copyright (C) 2012 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "mem.h"
+#include "strbuf.h"
+
+
+static type_t strbuf_type = {
+	"strbuf_text",
+	sizeof(char),
+	NULL
+};
+
+void strbuf_init(strbuf_t *sb, int size) {
+
+	sb->buf = mem_alloc_n(size, &strbuf_type);
+	sb->buf[0] = 0;
+	sb->len = 0;
+	sb->cap = size;
+}
+
+void strbuf_printf(strbuf_t *sb, const char *fmt, ...) {
+
+	va_list args;
+
+	while (1) {
+		va_start(args, fmt);
+		int n = vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, args);
+		va_end(args);
+
+		if (n < 0) {
+			return;
+		}
+		if (sb->len + n < sb->cap) {
+			sb->len += n;
+			return;
+		}
+		sb->cap = 2 * sb->cap + n;
+		sb->buf = mem_realloc_n(sb->cap, &strbuf_type, sb->buf);
+	}
+}
+
@@ -0,0 +1,48 @@
+/****************************************************************************
+
+    growing string buffer
+    Copyright (C) 2012 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+
+#ifndef STRBUF_H
+#define STRBUF_H
+
+/**
+ * string buffer that grows as text is appended, used to render
+ * reports; buf is zero-terminated and must be mem_free'd by the user
+ */
+typedef struct {
+	char		*buf;
+	int		len;		// length of the string
+	int		cap;		// allocated size
+} strbuf_t;
+
+/**
+ * allocate the buffer with an initial size
+ */
+void strbuf_init(strbuf_t *sb, int size);
+
+/**
+ * append printf-formatted text
+ */
+void strbuf_printf(strbuf_t *sb, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+
+#endif
+
@@ -54,8 +54,11 @@
 #include "in_ui.h"
 #include "loop.h"
 #include "cmdline.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include "provider.h"
+#include "drives.h"
 #include "dir.h"
 
 
@@ -80,6 +83,13 @@ static err_t main_assign(const char *param, void *extra, int ival) {
 	return err;
 }
 
+static err_t main_sync(const char *param, void *extra, int ival) {
+	(void) extra;
+	(void) ival;
+
+	return drive_set_sync(param);
+}
+
 static err_t main_set_param(const char *param, void *extra, int ival) {
 	(void) ival;
 	char **x = (char**)extra;
@@ -114,6 +124,12 @@ static err_t main_set_verbose(int flag, void *param) {
         return E_OK;
 }
 
+static err_t main_set_trace(int flag, void *param) {
+        (void) param;
+	trace_enable(flag);
+        return E_OK;
+}
+
 static cmdline_t main_options[] = {
         { "verbose",    "v",	CMDL_INIT,	PARTYPE_FLAG,   NULL, main_set_verbose, NULL,
                 "Set verbose mode", NULL },
@@ -137,6 +153,8 @@ static cmdline_t main_options[] = {
                 "               e.g. use '-A0:fs=.' to assign the current directory\n"
                 "               to drive 0. Dirs are relative to the run_directory param\n"
                 "               Note: do not use a trailing '/' on a path.\n"
+		"               Use e.g. '-A0:fs=games.d81,ram' to keep a disk image\n"
+		"               in memory\n"
 		"               By default, drive 0: is assigned to the runtime directory\n"
 		"               (see below for -R). Use '-A0:=' to un-assign drive 0\n"
 		, NULL },
@@ -145,8 +163,17 @@ static cmdline_t main_options[] = {
 		"               e.g. to set the IEC bus to device number 9 use:\n"
                 "               -Xiec:U=9\n"
 		, NULL },
+        { "fsync", 	NULL,	CMDL_CMD,	PARTYPE_PARAM,  main_sync, NULL, NULL,
+		"Set when files written on a drive are synced to disk:\n"
+		"               'none' leaves it to the OS (default), 'close' syncs on close,\n"
+		"               INITIALIZE and 'xdcmd flush', 'always' also when buffered\n"
+		"               data is written back after a pause, e.g. '--fsync 0:close'\n"
+		, NULL },
 	{ "rundir",	"R",	CMDL_CFG,	PARTYPE_PARAM,	main_set_param, NULL, &rundir_name,
 		"Set runtime directory, to be used instead of the current directory", NULL },
+        { "trace", 	NULL,	CMDL_RUN,	PARTYPE_FLAG,   NULL, main_set_trace, NULL,
+		"Record request trace spans from the start. Get them as Chrome trace\n"
+		"               JSON with 'xdcmd trace dump'", NULL },
 };
 
 #define	BUFFER_SIZE	8192
@@ -272,6 +299,20 @@ static void fd_hup(int fd, void *data) {
 	poll_unregister(fd);
 }
 
+static void fd_dev_hup(int fd, void *data) {
+
+	log_debug("fd_dev_hup for fd=%d (%p)\n", fd, data);
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	// closes the files the device left open
+	in_device_free((in_device_t*) data);
+
+	poll_unregister(fd);
+}
+
 static void fd_read(int fd, void *data) {
 
 	//log_debug("fd_read for fd=%d (%p)\n", fd, data);
@@ -295,7 +336,7 @@ static void fd_accept(int fd, void *data) {
 
 	in_device_t *td = in_device_init(data_fd, data_fd, adata->do_reset);
 
-	poll_register_readwrite(data_fd, td, fd_read, NULL, fd_hup);
+	poll_register_readwrite(data_fd, td, fd_read, NULL, fd_dev_hup);
 }
 
 static void fd_listen(const char *socketname, int do_reset) {
@@ -318,6 +359,8 @@ int main(int argc, char *argv[]) {
 	mem_init();
 	atexit(mem_exit);
 
+	metrics_init();
+
 	// -----------------------------
 	// config init
 
@@ -414,7 +457,7 @@ int main(int argc, char *argv[]) {
 		}
 
 		in_device_t *fdp = in_device_init(fdesc, fdesc, 1);
-		poll_register_readwrite(fdesc, fdp, fd_read, NULL, fd_hup);
+		poll_register_readwrite(fdesc, fdp, fd_read, NULL, fd_dev_hup);
 		min_num_socks ++;
 	}
 
@@ -440,7 +483,7 @@ int main(int argc, char *argv[]) {
 				end(EXIT_RESPAWN_NEVER);
 			}
 			in_device_t *fdp = in_device_init(data_fd, data_fd, 1);
-			poll_register_readwrite(data_fd, fdp, fd_read, NULL, fd_hup);
+			poll_register_readwrite(data_fd, fdp, fd_read, NULL, fd_dev_hup);
 			min_num_socks ++;
 		}
         } else 
@@ -34,6 +34,9 @@ function usage() {
         echo "       -h                      show this help"
 	echo "       -t                      Trace the output of a script, to possibly create a new one"
 	echo "       -T                      Enable the tools channel"
+	echo "       -b <n>                  Benchmark: replay each script n times, and write the"
+	echo "                               machine-readable results to <script>.bench in the"
+	echo "                               current directory"
 }
 
 function hexdiff() {
@@ -86,6 +89,7 @@ CLEAN=1
 QUIET=0
 TOOLS=0
 TRACE=""
+BENCH=""
 
 DIFFCREATE=0
 DIFFIGNORE=0
@@ -156,6 +160,14 @@ while test $# -gt 0; do
 	TOOLS=1
 	shift;
 	;;
+  -b)
+	if test $# -lt 2; then
+		echo "Option -b needs the number of iterations as parameter"
+		exit -1;
+	fi;
+	BENCH="$2"
+	shift 2;
+	;;
   -R)	
 	if test $# -lt 2; then
 		echo "Option -R needs the directory path as parameter"
@@ -296,6 +308,11 @@ for script in $TESTSCRIPTS; do
 		TSOCKET="-T $TMPDIR/tools_$script"
 	fi;
 
+	BENCHOPTS=
+	if [ "x$BENCH" != "x" ]; then
+		BENCHOPTS="-b $BENCH -r `pwd`/`basename $script .trs`.bench"
+	fi;
+
 	# overwrite test files in each iteration, just in case
         for i in $TESTFILES; do
                 if [ -f ${THISDIR}/${i}.gz ]; then
@@ -327,7 +344,7 @@ for script in $TESTSCRIPTS; do
 		else
 			echo "Start test runner as: $RUNNER $RVERBOSE -w -d $TMPDIR/$SOCKET $TSOCKET $script"
 			#$RUNNER $RVERBOSE $TRACE -w -d $TMPDIR/$SOCKET $TSOCKET $script;
-                        $RUNNER $RVERBOSE $TRACE -w -d $TMPDIR/$SOCKET $TSOCKET $script | sed -e "s%$TMPDIR%%g" | tail -n +3 | tee $TMPDIR/$RUNNERLOG;
+                        $RUNNER $RVERBOSE $TRACE $BENCHOPTS -w -d $TMPDIR/$SOCKET $TSOCKET $script | sed -e "s%$TMPDIR%%g" | tail -n +3 | tee $TMPDIR/$RUNNERLOG;
                 	RESULT=${PIPESTATUS[0]}
 		fi;
 
@@ -432,7 +449,7 @@ if test $CLEAN -ge 2; then
 		rm -f $TMPDIR/_$script.log
 	done;
 
-	for i in $TESTFILES; do
+	for i in $TESTFILES $COMPAREFILES; do
 		rm -f $TMPDIR/$i;
 	done;
 
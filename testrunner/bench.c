@@ -0,0 +1,261 @@
+/****************************************************************************
+
+    xd2031 filesystem server - test runner benchmark support
+    Copyright (C) 2026 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+/**
+ * bench.c
+ *
+ * Part of the xd2031 file system server
+ *
+ * Statistics, parallel execution and reporting for the benchmark 
+ * mode of the test runners. Parallel connections are run in forked
+ * processes, as the runner code is not thread safe. The statistics are 
+ * returned to the parent process in a shared memory mapping.
+ */
+
+// MAP_ANONYMOUS is not part of POSIX
+#define	_DEFAULT_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "bench.h"
+
+// -----------------------------------------------------------------------
+
+double bench_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// bucket 0-3 are exact, then four buckets per power of two
+static int bucket_of(unsigned long us) {
+
+	if (us < 4) {
+		return us;
+	}
+	int msb = 0;
+	while ((us >> msb) > 1) {
+		msb++;
+	}
+	int b = 4 * msb + ((us >> (msb - 2)) & 3);
+
+	return b < BENCH_HIST_BUCKETS ? b : BENCH_HIST_BUCKETS - 1;
+}
+
+// upper bound (inclusive) of a bucket
+static unsigned long bucket_max(int b) {
+
+	if (b < 4) {
+		return b;
+	}
+	b++;
+	int msb = b / 4;
+	unsigned long lower = (unsigned long) (4 + (b & 3)) << (msb - 2);
+
+	return lower - 1;
+}
+
+void bench_record(bench_stats_t *st, int op, unsigned long us, unsigned long bytes) {
+
+	if (op < 0 || op >= BENCH_MAX_OPS) {
+		return;
+	}
+	bench_hist_t *h = &st->ops[op];
+
+	h->count++;
+	h->sum_us += us;
+	h->bytes += bytes;
+	if (us > h->max_us) {
+		h->max_us = us;
+	}
+	h->hist[bucket_of(us)]++;
+}
+
+unsigned long bench_percentile(const bench_hist_t *h, double fraction) {
+
+	if (h->count == 0) {
+		return 0;
+	}
+
+	unsigned long limit = (unsigned long) (h->count * fraction + 0.5);
+	if (limit < 1) {
+		limit = 1;
+	}
+	unsigned long n = 0;
+
+	for (int b = 0; b < BENCH_HIST_BUCKETS; b++) {
+		n += h->hist[b];
+		if (n >= limit) {
+			unsigned long v = bucket_max(b);
+			return v < h->max_us ? v : h->max_us;
+		}
+	}
+	return h->max_us;
+}
+
+int bench_continue(const bench_params_t *par, const bench_stats_t *st, double start) {
+
+	if (par->seconds > 0) {
+		return (bench_now() - start) < par->seconds;
+	}
+	return st->iterations < (unsigned long) par->iterations;
+}
+
+static void bench_merge(bench_stats_t *into, const bench_stats_t *from) {
+
+	into->iterations += from->iterations;
+	into->errors += from->errors;
+	into->packets_tx += from->packets_tx;
+	into->packets_rx += from->packets_rx;
+	into->bytes_tx += from->bytes_tx;
+	into->bytes_rx += from->bytes_rx;
+
+	for (int i = 0; i < BENCH_MAX_OPS; i++) {
+		bench_hist_t *t = &into->ops[i];
+		const bench_hist_t *f = &from->ops[i];
+
+		t->count += f->count;
+		t->sum_us += f->sum_us;
+		t->bytes += f->bytes;
+		if (f->max_us > t->max_us) {
+			t->max_us = f->max_us;
+		}
+		for (int b = 0; b < BENCH_HIST_BUCKETS; b++) {
+			t->hist[b] += f->hist[b];
+		}
+	}
+}
+
+double bench_run(const bench_params_t *par, 
+		void (*run)(int connno, bench_stats_t *st, void *data), void *data, 
+		bench_stats_t *total) {
+
+	int n = par->connections;
+	int err = 0;
+
+	memset(total, 0, sizeof(bench_stats_t));
+
+	bench_stats_t *shared = mmap(NULL, n * sizeof(bench_stats_t), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		log_errno("Could not allocate shared statistics memory\n");
+		return -1;
+	}
+	memset(shared, 0, n * sizeof(bench_stats_t));
+
+	pid_t *pids = malloc(n * sizeof(pid_t));
+
+	double start = bench_now();
+
+	for (int i = 0; i < n; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			run(i, &shared[i], data);
+			exit(0);
+		}
+		if (pids[i] < 0) {
+			log_errno("Could not fork benchmark connection %d\n", i);
+			err = 1;
+			break;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		int status;
+		if (pids[i] > 0 && waitpid(pids[i], &status, 0) > 0) {
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+				log_error("Benchmark connection %d terminated abnormally\n", i);
+				err = 1;
+			}
+		}
+	}
+
+	double elapsed = bench_now() - start;
+
+	for (int i = 0; i < n; i++) {
+		bench_merge(total, &shared[i]);
+	}
+
+	free(pids);
+	munmap(shared, n * sizeof(bench_stats_t));
+
+	return err ? -1 : elapsed;
+}
+
+void bench_report(FILE *fp, const bench_params_t *par, const bench_stats_t *st, double elapsed,
+		const char* (*opname)(int op), int machine) {
+
+	unsigned long packets = st->packets_tx + st->packets_rx;
+	unsigned long long bytes = st->bytes_tx + st->bytes_rx;
+	double secs = elapsed > 0 ? elapsed : 1e-9;
+
+	if (machine) {
+		fprintf(fp, "connections %d\n", par->connections);
+		fprintf(fp, "iterations %lu\n", st->iterations);
+		fprintf(fp, "errors %lu\n", st->errors);
+		fprintf(fp, "elapsed_s %.6f\n", elapsed);
+		fprintf(fp, "packets_tx %lu\n", st->packets_tx);
+		fprintf(fp, "packets_rx %lu\n", st->packets_rx);
+		fprintf(fp, "bytes_tx %llu\n", st->bytes_tx);
+		fprintf(fp, "bytes_rx %llu\n", st->bytes_rx);
+		fprintf(fp, "packets_per_s %.1f\n", packets / secs);
+		fprintf(fp, "bytes_per_s %.1f\n", bytes / secs);
+	} else {
+		fprintf(fp, "Benchmark: %d connection(s), %lu iterations, %lu errors, %.3f s\n",
+			par->connections, st->iterations, st->errors, elapsed);
+		fprintf(fp, "  packets: %lu sent, %lu received, %.1f packets/s\n",
+			st->packets_tx, st->packets_rx, packets / secs);
+		fprintf(fp, "  bytes  : %llu sent, %llu received, %.1f bytes/s\n",
+			st->bytes_tx, st->bytes_rx, bytes / secs);
+		fprintf(fp, "  %-12s %10s %10s %10s %10s %10s %12s %12s\n",
+			"op", "count", "p50 us", "p99 us", "max us", "avg us", "bytes", "bytes/s");
+	}
+
+	for (int i = 0; i < BENCH_MAX_OPS; i++) {
+		const bench_hist_t *h = &st->ops[i];
+		if (h->count == 0) {
+			continue;
+		}
+		char numname[8];
+		const char *name = opname ? opname(i) : NULL;
+		if (name == NULL) {
+			snprintf(numname, sizeof(numname), "%d", i);
+			name = numname;
+		}
+		double opsecs = h->sum_us > 0 ? h->sum_us / 1e6 : 1e-9;
+		fprintf(fp, machine ? "op %s %lu %lu %lu %lu %llu %llu %.1f\n" 
+				: "  %-12s %10lu %10lu %10lu %10lu %10llu %12llu %12.1f\n",
+			name, h->count, bench_percentile(h, 0.5), bench_percentile(h, 0.99),
+			h->max_us, h->sum_us / h->count, h->bytes, h->bytes / opsecs);
+	}
+}
+
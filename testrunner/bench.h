@@ -0,0 +1,101 @@
+/****************************************************************************
+
+    xd2031 filesystem server - test runner benchmark support
+    Copyright (C) 2026 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdio.h>
+
+// -----------------------------------------------------------------------
+// benchmark statistics
+//
+// Latencies are recorded in microseconds into a histogram with four
+// buckets per power of two, so percentiles are accurate to about 20%.
+
+#define	BENCH_HIST_BUCKETS	128
+
+// number of different operations (e.g. FS_* commands) that are tracked
+#define	BENCH_MAX_OPS		64
+
+typedef struct {
+	unsigned long		count;
+	unsigned long long	sum_us;
+	unsigned long		max_us;
+	// payload bytes transferred by the operation
+	unsigned long long	bytes;
+	unsigned long		hist[BENCH_HIST_BUCKETS];
+} bench_hist_t;
+
+typedef struct {
+	unsigned long		iterations;
+	unsigned long		errors;
+	unsigned long		packets_tx;
+	unsigned long		packets_rx;
+	unsigned long long	bytes_tx;
+	unsigned long long	bytes_rx;
+	bench_hist_t		ops[BENCH_MAX_OPS];
+} bench_stats_t;
+
+typedef struct {
+	// number of iterations per connection; 0 if time based
+	int		iterations;
+	// time budget in seconds; 0 if iteration based
+	int		seconds;
+	// number of concurrent connections
+	int		connections;
+} bench_params_t;
+
+/** monotonic time in seconds */
+double bench_now(void);
+
+/** record a latency and the number of bytes transferred for the given operation */
+void bench_record(bench_stats_t *st, int op, unsigned long us, unsigned long bytes);
+
+/** returns the latency (upper bucket bound) below which the given fraction of samples lies */
+unsigned long bench_percentile(const bench_hist_t *h, double fraction);
+
+/** true if the benchmark should run another iteration */
+int bench_continue(const bench_params_t *par, const bench_stats_t *st, double start);
+
+/**
+ * run the given function in params->connections parallel processes, and
+ * merge their statistics into total. Returns the elapsed wall clock time
+ * in seconds, or a negative value on error
+ */
+double bench_run(const bench_params_t *par, 
+		void (*run)(int connno, bench_stats_t *st, void *data), void *data, 
+		bench_stats_t *total);
+
+/**
+ * print the results. If machine is set, print the line oriented format that 
+ * is meant for regression checks:
+ *
+ *   <key> <value>
+ *   op <name> <count> <p50_us> <p99_us> <max_us> <avg_us> <bytes> <bytes_per_s>
+ *
+ * where the per-op bytes_per_s is the effective throughput while the op was running.
+ * opname() translates the op number to a name; ops with NULL names are printed as numbers.
+ */
+void bench_report(FILE *fp, const bench_params_t *par, const bench_stats_t *st, double elapsed,
+		const char* (*opname)(int op), int machine);
+
+#endif
+
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <inttypes.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -47,6 +48,8 @@
 #include "sock488.h"
 #include "script.h"
 #include "connect.h"
+#include "bench.h"
+#include "errors.h"
 
 void usage(int rv) {
         printf("Usage: fsser [options] run_directory\n"
@@ -54,6 +57,17 @@ void usage(int rv) {
                 "   -d <device> define serial device to use\n"
                 "   -v          set verbose\n"
                 "   -t          trace all send/receive data\n"
+		"   -L <loads>  load generator mode instead of a script: comma separated list of\n"
+		"               load, save, dir, rel, seq or all\n"
+		"   -b <n>      load generator: run the workload n times (default 1)\n"
+		"   -B <secs>   load generator: run the workload for the given number of seconds\n"
+		"   -a <addr>   load generator: device address (default 8)\n"
+		"   -s <size>   load generator: size of LOAD/SAVE file and total size\n"
+		"               of the SEQ files (default 40000)\n"
+		"   -n <num>    load generator: number of parallel SEQ channels (default 4)\n"
+		"   -r <file>   load generator: write machine-readable results to file\n"
+		"   -c <cmd>    load generator: send this command to the device before\n"
+		"               the workload, e.g. \"A0:FAT=/\" for the firmware FAT provider\n"
                 "   -?          gives you this help text\n"
         );
         exit(rv);
@@ -416,6 +430,468 @@ int execute_script(int sockfd, registry_t *script) {
 	return numerrs;
 }
 
+// -----------------------------------------------------------------------
+// load generator
+//
+// Instead of running a script, generate the bus traffic of typical 
+// C64/PET workloads, and measure the effective bus level throughput 
+// through sockserv and the server.
+
+#define	LG_LOAD		0
+#define	LG_SAVE		1
+#define	LG_DIR		2
+#define	LG_RELWRITE	3
+#define	LG_RELREAD	4
+#define	LG_SEQWRITE	5
+#define	LG_SEQREAD	6
+
+static const char *lg_names[] = {
+	"LOAD", "SAVE", "DIR", "REL_WRITE", "REL_READ", "SEQ_WRITE", "SEQ_READ"
+};
+
+#define	LG_MASK_LOADSAVE	((1 << LG_LOAD) | (1 << LG_SAVE))
+#define	LG_MASK_DIR		(1 << LG_DIR)
+#define	LG_MASK_REL		((1 << LG_RELWRITE) | (1 << LG_RELREAD))
+#define	LG_MASK_SEQ		((1 << LG_SEQWRITE) | (1 << LG_SEQREAD))
+
+#define	LG_REC_LEN		64
+#define	LG_REC_NUM		50
+#define	LG_SEQ_CHUNK		254
+#define	LG_MAX_CHANNELS		8
+#define	LG_SA_REL		2
+#define	LG_SA_SEQ		3
+
+// IEEE488 / IEC bus commands
+#define	BUS_LISTEN		0x20
+#define	BUS_UNLISTEN		0x3f
+#define	BUS_TALK		0x40
+#define	BUS_UNTALK		0x5f
+#define	BUS_DATA		0x60
+#define	BUS_CLOSE		0xe0
+#define	BUS_OPEN		0xf0
+
+typedef struct {
+	int		fd;
+	int		device;
+	int		size;
+	int		channels;
+	int		mask;
+	char		*buffer;
+	bench_stats_t	*stats;
+	const char	*setup;		// command to send before the workload
+} loadgen_t;
+
+static const char *lg_opname(int op) {
+	return (op >= 0 && op <= LG_SEQREAD) ? lg_names[op] : NULL;
+}
+
+static int lg_parse(const char *loads) {
+
+	int mask = 0;
+	char *list = strdup(loads);
+
+	for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (!strcmp("load", tok) || !strcmp("save", tok)) {
+			mask |= LG_MASK_LOADSAVE;
+		} else
+		if (!strcmp("dir", tok)) {
+			mask |= LG_MASK_DIR;
+		} else
+		if (!strcmp("rel", tok)) {
+			mask |= LG_MASK_REL;
+		} else
+		if (!strcmp("seq", tok)) {
+			mask |= LG_MASK_SEQ;
+		} else
+		if (!strcmp("all", tok)) {
+			mask |= LG_MASK_LOADSAVE | LG_MASK_DIR | LG_MASK_REL | LG_MASK_SEQ;
+		} else {
+			log_error("Unknown load type %s\n", tok);
+			mask = -1;
+			break;
+		}
+	}
+	free(list);
+	return mask;
+}
+
+// send bytes under ATN
+static int lg_atn(loadgen_t *lg, uint8_t b1, uint8_t b2) {
+
+	char out[4] = { S488_ATN, b1, S488_ATN, b2 };
+
+	return write_byte(lg->fd, out, b2 ? 4 : 2) < 0 ? -1 : 0;
+}
+
+// send data bytes, with EOF on the last one if eof is set.
+// Collect the bytes into larger writes
+static int lg_send(loadgen_t *lg, const char *data, int len, int eof) {
+
+	char out[1024];
+	int p = 0;
+
+	for (int i = 0; i < len; i++) {
+		out[p++] = S488_SEND | ((eof && (i + 1) == len) ? S488_EOF : 0);
+		out[p++] = data[i];
+		if (p >= (int) sizeof(out) || (i + 1) == len) {
+			if (write_byte(lg->fd, out, p) < 0) {
+				return -1;
+			}
+			lg->stats->packets_tx++;
+			p = 0;
+		}
+	}
+	lg->stats->bytes_tx += len;
+	return 0;
+}
+
+// talk and read up to len bytes, or until EOF from the device
+static int lg_talk(loadgen_t *lg, uint8_t sa, char *buf, int len, int *eof) {
+
+	if (lg_atn(lg, BUS_TALK | lg->device, BUS_DATA | sa) < 0) {
+		return -1;
+	}
+	int n = read_packet(lg->fd, buf, len, eof);
+	if (lg_atn(lg, BUS_UNTALK, 0) < 0) {
+		return -1;
+	}
+	if (n > 0) {
+		lg->stats->packets_rx++;
+		lg->stats->bytes_rx += n;
+	}
+	return n;
+}
+
+// listen and send the data
+static int lg_listen(loadgen_t *lg, uint8_t sa, const char *data, int len, int eof) {
+
+	if (lg_atn(lg, BUS_LISTEN | lg->device, sa) < 0
+		|| lg_send(lg, data, len, eof) < 0
+		|| lg_atn(lg, BUS_UNLISTEN, 0) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+// read the error channel; returns the error number, or -1 on error
+static int lg_status(loadgen_t *lg) {
+
+	char msg[64];
+	int eof;
+
+	int n = lg_talk(lg, 15, msg, sizeof(msg) - 1, &eof);
+	if (n < 2) {
+		return -1;
+	}
+	msg[n] = 0;
+	int err = atoi(msg);
+	if (err >= 20 && err != 50) {
+		// 50 (record not present) is expected when extending REL files
+		log_error("Load generator: device status %s\n", msg);
+	}
+	return err;
+}
+
+static int lg_open(loadgen_t *lg, uint8_t sa, const char *name, int namelen) {
+
+	if (lg_listen(lg, BUS_OPEN | sa, name, namelen, 1) < 0) {
+		return -1;
+	}
+	int err = lg_status(lg);
+	return (err < 0 || err >= 20) ? -1 : 0;
+}
+
+static int lg_close(loadgen_t *lg, uint8_t sa) {
+
+	return lg_atn(lg, BUS_LISTEN | lg->device, BUS_CLOSE | sa) < 0
+		|| lg_atn(lg, BUS_UNLISTEN, 0) < 0 ? -1 : 0;
+}
+
+// send a command on the command channel
+static int lg_command(loadgen_t *lg, const char *cmd, int len) {
+
+	return lg_listen(lg, BUS_DATA | 15, cmd, len, 1);
+}
+
+// open the relative file; returns 1 when the device cannot handle REL files
+// (it then passes the server's internal "open REL" code through as status)
+static int lg_open_rel(loadgen_t *lg) {
+
+	char name[] = "0:LOADREL,L,?";
+
+	name[sizeof(name) - 2] = LG_REC_LEN;
+
+	if (lg_listen(lg, BUS_OPEN | LG_SA_REL, name, sizeof(name) - 1, 1) < 0) {
+		return -1;
+	}
+	int err = lg_status(lg);
+	if (err == CBM_ERROR_OPEN_REL) {
+		log_warn("Load generator: device does not support REL files, skipping\n");
+		lg_close(lg, LG_SA_REL);
+		lg->mask &= ~((1 << LG_RELWRITE) | (1 << LG_RELREAD));
+		return 1;
+	}
+	return (err < 0 || err >= 20) ? -1 : 0;
+}
+
+static int lg_position(loadgen_t *lg, uint8_t sa, int record) {
+
+	char cmd[5] = { 'P', sa, record & 0xff, (record >> 8) & 0xff, 0x0d };
+
+	return lg_command(lg, cmd, sizeof(cmd));
+}
+
+// scratch a file, ignoring whether it exists
+static int lg_scratch(loadgen_t *lg, const char *name) {
+
+	char cmd[32];
+
+	snprintf(cmd, sizeof(cmd), "S0:%s", name);
+
+	if (lg_command(lg, cmd, strlen(cmd)) < 0) {
+		return -1;
+	}
+	return lg_status(lg) < 0 ? -1 : 0;
+}
+
+// run the workload step and record its latency and payload
+static void lg_step(loadgen_t *lg, int op, int (*step)(loadgen_t *lg)) {
+
+	if ((lg->mask & (1 << op)) == 0) {
+		return;
+	}
+	unsigned long long bytes = lg->stats->bytes_tx + lg->stats->bytes_rx;
+	double start = bench_now();
+
+	int rv = step(lg);
+	if (rv > 0) {
+		// step not supported by the device
+		return;
+	}
+	if (rv < 0) {
+		log_error("Load generator: %s failed\n", lg_names[op]);
+		lg->stats->errors++;
+	}
+
+	bench_record(lg->stats, op, (bench_now() - start) * 1e6, 
+		lg->stats->bytes_tx + lg->stats->bytes_rx - bytes);
+}
+
+static int lg_save(loadgen_t *lg) {
+
+	const char *name = "0:LOADGEN,P,W";
+
+	// load address, then a pattern
+	lg->buffer[0] = 0x01;
+	lg->buffer[1] = 0x08;
+	for (int i = 2; i < lg->size; i++) {
+		lg->buffer[i] = i & 0xff;
+	}
+
+	if (lg_scratch(lg, "LOADGEN") < 0
+		|| lg_open(lg, 1, name, strlen(name)) < 0
+		|| lg_listen(lg, BUS_DATA | 1, lg->buffer, lg->size, 1) < 0
+		|| lg_close(lg, 1) < 0) {
+		return -1;
+	}
+	return lg_status(lg) == 0 ? 0 : -1;
+}
+
+static int lg_load(loadgen_t *lg) {
+
+	const char *name = "0:LOADGEN";
+	int eof = 0;
+
+	if (lg_open(lg, 0, name, strlen(name)) < 0) {
+		return -1;
+	}
+	int n = lg_talk(lg, 0, lg->buffer, lg->size + 1, &eof);
+
+	if (lg_close(lg, 0) < 0) {
+		return -1;
+	}
+	if (n != lg->size || !eof) {
+		log_error("Load generator: LOAD returned %d bytes, expected %d\n", n, lg->size);
+		return -1;
+	}
+	return 0;
+}
+
+static int lg_dir(loadgen_t *lg) {
+
+	int eof = 0;
+
+	if (lg_open(lg, 0, "$", 1) < 0) {
+		return -1;
+	}
+	int n = lg_talk(lg, 0, lg->buffer, lg->size, &eof);
+
+	return (lg_close(lg, 0) < 0 || n <= 0) ? -1 : 0;
+}
+
+static int lg_relwrite(loadgen_t *lg) {
+
+	char rec[LG_REC_LEN];
+
+	int rv = lg_open_rel(lg);
+	if (rv != 0) {
+		return rv;
+	}
+	for (int r = 1; r <= LG_REC_NUM; r++) {
+		memset(rec, 'A' + (r % 26), sizeof(rec));
+		if (lg_position(lg, LG_SA_REL, r) < 0
+			|| lg_listen(lg, BUS_DATA | LG_SA_REL, rec, sizeof(rec), 1) < 0) {
+			return -1;
+		}
+	}
+	return lg_close(lg, LG_SA_REL);
+}
+
+static int lg_relread(loadgen_t *lg) {
+
+	char rec[LG_REC_LEN];
+	int eof = 0;
+
+	int rv = lg_open_rel(lg);
+	if (rv != 0) {
+		return rv;
+	}
+	for (int r = 1; r <= LG_REC_NUM; r++) {
+		if (lg_position(lg, LG_SA_REL, r) < 0
+			|| lg_talk(lg, LG_SA_REL, rec, sizeof(rec), &eof) <= 0) {
+			return -1;
+		}
+	}
+	return lg_close(lg, LG_SA_REL);
+}
+
+// write files on several channels in parallel, interleaving the chunks;
+// the size is split across the channels so the total fits on a disk image
+static int lg_seqwrite(loadgen_t *lg) {
+
+	char name[32];
+	int size = lg->size / lg->channels;
+
+	for (int c = 0; c < lg->channels; c++) {
+		snprintf(name, sizeof(name), "LOADSEQ%d", c);
+		if (lg_scratch(lg, name) < 0) {
+			return -1;
+		}
+		snprintf(name, sizeof(name), "0:LOADSEQ%d,S,W", c);
+		if (lg_open(lg, LG_SA_SEQ + c, name, strlen(name)) < 0) {
+			return -1;
+		}
+	}
+	for (int offset = 0; offset < size; offset += LG_SEQ_CHUNK) {
+		int len = size - offset;
+		if (len > LG_SEQ_CHUNK) {
+			len = LG_SEQ_CHUNK;
+		}
+		for (int c = 0; c < lg->channels; c++) {
+			if (lg_listen(lg, BUS_DATA | (LG_SA_SEQ + c), lg->buffer + offset, len, 0) < 0) {
+				return -1;
+			}
+		}
+	}
+	for (int c = 0; c < lg->channels; c++) {
+		if (lg_close(lg, LG_SA_SEQ + c) < 0) {
+			return -1;
+		}
+	}
+	int err = lg_status(lg);
+	return (err < 0 || err >= 20) ? -1 : 0;
+}
+
+static int lg_seqread(loadgen_t *lg) {
+
+	char name[32];
+	char chunk[LG_SEQ_CHUNK];
+	int open = 0;
+	int eof;
+
+	for (int c = 0; c < lg->channels; c++) {
+		snprintf(name, sizeof(name), "0:LOADSEQ%d,S,R", c);
+		if (lg_open(lg, LG_SA_SEQ + c, name, strlen(name)) < 0) {
+			return -1;
+		}
+		open |= 1 << c;
+	}
+	while (open) {
+		for (int c = 0; c < lg->channels; c++) {
+			if (open & (1 << c)) {
+				if (lg_talk(lg, LG_SA_SEQ + c, chunk, sizeof(chunk), &eof) <= 0) {
+					return -1;
+				}
+				if (eof) {
+					open &= ~(1 << c);
+				}
+			}
+		}
+	}
+	for (int c = 0; c < lg->channels; c++) {
+		if (lg_close(lg, LG_SA_SEQ + c) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int run_loadgen(loadgen_t *lg, bench_params_t *par, const char *resultfile) {
+
+	bench_stats_t *st = calloc(1, sizeof(bench_stats_t));
+
+	lg->stats = st;
+	lg->buffer = malloc(lg->size > 65536 ? lg->size + 1 : 65536);
+
+	if (lg->setup != NULL) {
+		int err = -1;
+		if (lg_command(lg, lg->setup, strlen(lg->setup)) < 0
+			|| (err = lg_status(lg)) < 0 || err >= 20) {
+			log_error("Load generator: setup command %s failed\n", lg->setup);
+			free(lg->buffer);
+			free(st);
+			return 1;
+		}
+		// do not count the setup in the results
+		memset(st, 0, sizeof(bench_stats_t));
+	}
+
+	double start = bench_now();
+
+	while (bench_continue(par, st, start)) {
+		// SAVE before LOAD and write before read, so the files exist
+		lg_step(lg, LG_SAVE, lg_save);
+		lg_step(lg, LG_LOAD, lg_load);
+		lg_step(lg, LG_DIR, lg_dir);
+		lg_step(lg, LG_RELWRITE, lg_relwrite);
+		lg_step(lg, LG_RELREAD, lg_relread);
+		lg_step(lg, LG_SEQWRITE, lg_seqwrite);
+		lg_step(lg, LG_SEQREAD, lg_seqread);
+		st->iterations++;
+	}
+
+	double elapsed = bench_now() - start;
+
+	bench_report(stdout, par, st, elapsed, lg_opname, 0);
+
+	if (resultfile) {
+		FILE *fp = fopen(resultfile, "w");
+		if (fp == NULL) {
+			log_errno("Could not open result file %s\n", resultfile);
+		} else {
+			bench_report(fp, par, st, elapsed, lg_opname, 1);
+			fclose(fp);
+		}
+	}
+
+	int rv = st->errors ? 1 : 0;
+
+	free(lg->buffer);
+	free(st);
+
+	return rv;
+}
+
 // -----------------------------------------------------------------------
 
 int main(int argc, char *argv[]) {
@@ -428,6 +904,11 @@ int main(int argc, char *argv[]) {
 	// wait for socket if not there right away?
 	int dowait = 0;
 
+	// load generator
+	loadgen_t lg = { -1, 8, 40000, 4, 0, NULL, NULL, NULL };
+	bench_params_t params = { 1, 0, 1 };
+	const char *resultfile = NULL;
+
 	terminal_init();
 
 
@@ -449,6 +930,64 @@ int main(int argc, char *argv[]) {
                   		exit(1);
                 	}
                 	break;
+		case 'L':
+                	assert_single_char(argv[i]);
+                	if (i < argc-1) {
+                  		i++;
+                  		lg.mask = lg_parse(argv[i]);
+				if (lg.mask <= 0) {
+					usage(1);
+				}
+                	} else {
+                  		log_error("-L requires <loads> parameter\n");
+                  		exit(1);
+                	}
+                	break;
+		case 'b':
+		case 'B':
+		case 'a':
+		case 's':
+		case 'n':
+                	assert_single_char(argv[i]);
+                	if (i < argc-1) {
+				int v = atoi(argv[i+1]);
+				if (v <= 0) {
+					log_error("%s requires a positive number\n", argv[i]);
+					exit(1);
+				}
+				switch (argv[i][1]) {
+				case 'b': params.iterations = v; params.seconds = 0; break;
+				case 'B': params.seconds = v; params.iterations = 0; break;
+				case 'a': lg.device = v & 0x1f; break;
+				case 's': lg.size = v; break;
+				case 'n': lg.channels = v > LG_MAX_CHANNELS ? LG_MAX_CHANNELS : v; break;
+				}
+                  		i++;
+                	} else {
+                  		log_error("%s requires <number> parameter\n", argv[i]);
+                  		exit(1);
+                	}
+                	break;
+            	case 'r':
+                	assert_single_char(argv[i]);
+                	if (i < argc-1) {
+                  		i++;
+                  		resultfile = argv[i];
+                	} else {
+                  		log_error("-r requires <file> parameter\n");
+                  		exit(1);
+                	}
+                	break;
+            	case 'c':
+                	assert_single_char(argv[i]);
+                	if (i < argc-1) {
+                  		i++;
+                  		lg.setup = argv[i];
+                	} else {
+                  		log_error("-c requires <command> parameter\n");
+                  		exit(1);
+                	}
+                	break;
 		case 'v':
 			set_verbose(1);
 			break;
@@ -466,6 +1005,18 @@ int main(int argc, char *argv[]) {
           	i++;
         }
 
+	if (lg.mask > 0) {
+		lg.fd = socket_open(device, dowait);
+
+		// let the server and firmware negotiate the character set
+		sleep(1);
+
+		if (lg.fd >= 0) {
+			rv = run_loadgen(&lg, &params, resultfile);
+		}
+		return rv;
+	}
+
 	// next parameter is the script name
 	if (i >= argc) {
 		log_error("Script name parameter missing!\n");
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -46,11 +47,16 @@
 #include "terminal.h"
 #include "registry.h"
 #include "wireformat.h"
+#include "cmdnames.h"
 #include "script.h"
 #include "connect.h"
+#include "bench.h"
 
 static int trace = 0;
 
+// statistics when in benchmark mode, NULL otherwise
+static bench_stats_t *stats = NULL;
+
 
 void usage(int rv) {
         printf("Usage: pcrunner [options] run_directory\n"
@@ -60,6 +66,14 @@ void usage(int rv) {
                 "   -t          trace send/received data\n"
                 "   -w          wait for socket or device to appear\n"
                 "   -T <sock>   connect to tools socket in parallel\n"
+		"   -b <n>      benchmark: replay the script n times per connection\n"
+		"   -B <secs>   benchmark: replay the script for the given number of seconds\n"
+		"   -c <n>      benchmark: use n concurrent connections (default 1). The server\n"
+		"               device socket only takes a single connection, so all further\n"
+		"               connections go to the tools socket given with -T\n"
+		"   -o <offs>   benchmark: add connection number times offs to the channel\n"
+		"               numbers, so connections do not collide (default 16)\n"
+		"   -r <file>   benchmark: write machine-readable results to file\n"
                 "   -?          gives you this help text\n"
         );
         exit(rv);
@@ -232,6 +246,10 @@ int compare_packet(int fd, const char *inbuffer, const char *mask, const int inb
 
 	cnt = read_packet(fd, buffer, sizeof(buffer));
 
+	if (stats && cnt > 0) {
+		stats->packets_rx++;
+		stats->bytes_rx += cnt;
+	}
 
 	if (cnt < 0) {
 		log_errno("Error reading from socket at line %d\n", curpos);
@@ -276,8 +294,11 @@ int compare_packet(int fd, const char *inbuffer, const char *mask, const int inb
  * returns the status of the execution
  *  0 = normal end
  *  1 = expect mismatch
+ *
+ * When replay is set (benchmark mode after the first iteration), init
+ * lines and messages are skipped. 
  */
-int execute_script(int sockfd, int toolsfd, registry_t *script) {
+int execute_script(int sockfd, int toolsfd, registry_t *script, int replay) {
 
 	// current "pc" pointer to script line
 	int curpos = 0;	
@@ -292,6 +313,12 @@ int execute_script(int sockfd, int toolsfd, registry_t *script) {
 	// guaranteed to be valid; toolsfd may be not set (<0)
 	int curfd = sockfd;
 
+	// benchmark: command, length and time of the last sent packet
+	int sentcmd = -1;
+	int sentlen = 0;
+	double senttime = 0;
+	unsigned long long rxbytes = 0;
+
 	while ( (err == 0) && (line = reg_get(script, curpos)) != NULL) {
 
 		lineno = line->num;
@@ -303,6 +330,9 @@ int execute_script(int sockfd, int toolsfd, registry_t *script) {
 			}
 			// fall-through
 		case CMD_MESSAGE:
+			if (replay) {
+				break;
+			}
 			log_info("> %s\n", line->buffer);
 			break;
 		case CMD_ERRMSG:
@@ -318,6 +348,15 @@ int execute_script(int sockfd, int toolsfd, registry_t *script) {
 				log_hexdump2(line->buffer, line->length, 0, "Send  : ");
 			}
 
+			if (stats) {
+				sentcmd = 255 & line->buffer[FSP_CMD];
+				sentlen = line->length;
+				rxbytes = stats->bytes_rx;
+				senttime = bench_now();
+				stats->packets_tx++;
+				stats->bytes_tx += line->length;
+			}
+
 			size = write_byte(curfd, line->buffer, line->length);
 			if (size < 0) {
 				log_errno("Error writing to socket at line %d\n", lineno);
@@ -336,6 +375,12 @@ int execute_script(int sockfd, int toolsfd, registry_t *script) {
 			mem_free(line->mask);
 			line->mask = NULL;
 
+			if (stats && sentcmd >= 0) {
+				bench_record(stats, sentcmd, (bench_now() - senttime) * 1e6,
+					sentlen + (stats->bytes_rx - rxbytes));
+				sentcmd = -1;
+			}
+
 			if (err != 0) {
 				if (errmsg != NULL) {
 					log_error("> %d: %s -> %d\n", lineno, errmsg->buffer, err);
@@ -344,6 +389,9 @@ int execute_script(int sockfd, int toolsfd, registry_t *script) {
 			}
 			break;
 		case CMD_INIT:
+			if (replay) {
+				break;
+			}
 			send_sync(curfd);
 			err = compare_packet(curfd, line->buffer, NULL, line->length, lineno);
 			if (err != 0) {
@@ -371,6 +419,109 @@ int execute_script(int sockfd, int toolsfd, registry_t *script) {
 	return 0;
 }
 
+// -----------------------------------------------------------------------
+// benchmark mode
+
+typedef struct {
+	const char	*device;
+	const char	*tsocket;
+	int		dowait;
+	int		chanoffset;
+	registry_t	*script;
+	bench_params_t	params;
+} bench_data_t;
+
+/*
+ * move the channel numbers of all packets in the script by the given offset,
+ * so that parallel connections do not use the same channels on the server.
+ * Special channels like FSFD_CMD or FSFD_SETOPT are kept.
+ */
+static void remap_channels(registry_t *script, int offset) {
+
+	line_t *line = NULL;
+
+	for (int i = 0; (line = reg_get(script, i)) != NULL; i++) {
+		if ((line->cmd == CMD_SEND || line->cmd == CMD_EXPECT) 
+				&& line->length > FSP_FD
+				&& (255 & line->buffer[FSP_FD]) < FSFD_CMD) {
+			line->buffer[FSP_FD] += offset;
+		}
+	}
+}
+
+static const char *opname(int op) {
+	return (op >= 0 && op < 256) ? fs_command_to_name(op) : NULL;
+}
+
+// runs in a forked child process for each connection.
+// Connection 0 uses the device socket, all others the tools socket,
+// where the init lines (that expect the reset reply) are skipped.
+static void bench_connection(int connno, bench_stats_t *st, void *data) {
+
+	bench_data_t *bd = (bench_data_t*) data;
+	int sockfd;
+
+	stats = st;
+
+	if (connno == 0) {
+		sockfd = socket_open(bd->device, bd->dowait);
+	} else {
+		remap_channels(bd->script, connno * bd->chanoffset);
+
+		sockfd = socket_open(bd->tsocket, 1);
+		if (sockfd >= 0) {
+			send_sync(sockfd);
+		}
+	}
+	if (sockfd < 0) {
+		exit(1);
+	}
+
+	double start = bench_now();
+
+	while (bench_continue(&bd->params, st, start)) {
+		if (execute_script(sockfd, -1, bd->script, connno > 0 || st->iterations > 0)) {
+			st->errors++;
+		}
+		st->iterations++;
+	}
+
+	close(sockfd);
+}
+
+static int run_benchmark(bench_data_t *bd, const char *resultfile) {
+
+	bench_stats_t total;
+
+	if (bd->params.connections > 1 && bd->tsocket == NULL) {
+		log_error("Concurrent connections need the tools socket (-T)\n");
+		return -1;
+	}
+	if ((FSFD_CMD - 1) < (bd->params.connections - 1) * bd->chanoffset) {
+		log_error("Too many connections for channel offset %d\n", bd->chanoffset);
+		return -1;
+	}
+
+	double elapsed = bench_run(&bd->params, bench_connection, bd, &total);
+	if (elapsed < 0) {
+		return -1;
+	}
+
+	bench_report(stdout, &bd->params, &total, elapsed, opname, 0);
+
+	if (resultfile) {
+		FILE *fp = fopen(resultfile, "w");
+		if (fp == NULL) {
+			log_errno("Could not open result file %s\n", resultfile);
+			return -1;
+		}
+		bench_report(fp, &bd->params, &total, elapsed, opname, 1);
+		fclose(fp);
+	}
+
+	return total.errors ? 1 : 0;
+}
+
 // -----------------------------------------------------------------------
 
 int main(int argc, char *argv[]) {
@@ -384,6 +535,10 @@ int main(int argc, char *argv[]) {
 	// wait for socket if not there right away?
 	int dowait = 0;
 
+	// benchmark mode
+	bench_data_t bench = { NULL, NULL, 0, 16, NULL, { 0, 0, 1 } };
+	const char *resultfile = NULL;
+
 	terminal_init();
 
 
@@ -416,6 +571,39 @@ int main(int argc, char *argv[]) {
                   		exit(1);
                 	}
                 	break;
+		case 'b':
+		case 'B':
+		case 'c':
+		case 'o':
+                	assert_single_char(argv[i]);
+                	if (i < argc-1) {
+				int v = atoi(argv[i+1]);
+				if (v <= 0) {
+					log_error("%s requires a positive number\n", argv[i]);
+					exit(1);
+				}
+				switch (argv[i][1]) {
+				case 'b': bench.params.iterations = v; break;
+				case 'B': bench.params.seconds = v; break;
+				case 'c': bench.params.connections = v; break;
+				case 'o': bench.chanoffset = v; break;
+				}
+                  		i++;
+                	} else {
+                  		log_error("%s requires <number> parameter\n", argv[i]);
+                  		exit(1);
+                	}
+                	break;
+            	case 'r':
+                	assert_single_char(argv[i]);
+                	if (i < argc-1) {
+                  		i++;
+                  		resultfile = argv[i];
+                	} else {
+                  		log_error("-r requires <file> parameter\n");
+                  		exit(1);
+                	}
+                	break;
 		case 'v':
 			set_verbose(1);
 			break;
@@ -444,6 +632,16 @@ int main(int argc, char *argv[]) {
 
 	registry_t *script = load_script_from_file(scriptname);
 
+	if (script != NULL && (bench.params.iterations > 0 || bench.params.seconds > 0)) {
+
+		bench.device = device;
+		bench.tsocket = tsocket;
+		bench.dowait = dowait;
+		bench.script = script;
+
+		rv = run_benchmark(&bench, resultfile);
+
+	} else
 	if (script != NULL) {
 
 		int sockfd = socket_open(device, dowait);
@@ -457,7 +655,7 @@ int main(int argc, char *argv[]) {
 	
 		if (sockfd >= 0) {
 
-			rv = execute_script(sockfd, toolsfd, script);
+			rv = execute_script(sockfd, toolsfd, script, 0);
 
 			close(sockfd);
 		}
@@ -44,7 +44,7 @@
 
 
 /*
- * translate the command numbers into names, and vice versa;
+ * translate the command names into numbers;
  * Note: NOT speed optimized!
  */
 
@@ -84,6 +84,11 @@ int numofcmd(const char *name) {
 	if (!strcmp("COPY", name)) 	return FS_COPY;
 	if (!strcmp("DUPLICATE", name)) return FS_DUPLICATE;
 	if (!strcmp("INITIALIZE", name)) return FS_INITIALIZE;
+	if (!strcmp("INFO", name)) 	return FS_INFO;
+	if (!strcmp("METRICS", name)) 	return FS_METRICS;
+	if (!strcmp("TRACE", name)) 	return FS_TRACE;
+	if (!strcmp("OPEN_DRP", name)) 	return FS_OPEN_DRP;
+	if (!strcmp("FLUSH", name)) 	return FS_FLUSH;
 
 	return -1;
 }
@@ -23,6 +23,14 @@
 #ifndef _SCRIPT_H
 #define _SCRIPT_H
 
+// -----------------------------------------------------------------------
+// command names
+
+/** translate FS_* command name (without "FS_") to number, -1 if unknown */
+int numofcmd(const char *name);
+
+// for the number to name translation see fs_command_to_name() in cmdnames.h
+
 // -----------------------------------------------------------------------
 // script handling
 
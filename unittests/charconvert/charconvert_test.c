@@ -0,0 +1,119 @@
+/****************************************************************************
+
+    character conversion unit tests
+    Copyright (C) 2026 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "myunit.h"
+
+#include "charconvert.h"
+
+// the translation tables must give the same as the functions in petscii.h
+static void tables_match_petscii_h() {
+	char in[256], out[256];
+
+	for (int i = 0; i < 256; i++) {
+		in[i] = i;
+	}
+	cconv_converter(CHARSET_PETSCII, CHARSET_ASCII) (in, 255, out, 255);
+	for (int i = 0; i < 255; i++) {
+		mu_assert_info("petscii to ascii", (uint8_t) out[i] == petscii_to_ascii(i));
+	}
+	cconv_converter(CHARSET_ASCII, CHARSET_PETSCII) (in, 255, out, 255);
+	for (int i = 0; i < 255; i++) {
+		mu_assert_info("ascii to petscii", (uint8_t) out[i] == ascii_to_petscii(i));
+	}
+	// the last byte, as the lengths are uint8_t
+	cconv_converter(CHARSET_PETSCII, CHARSET_ASCII) (in + 255, 1, out, 1);
+	mu_assert_info("petscii to ascii 0xff", (uint8_t) out[0] == petscii_to_ascii(0xff));
+}
+
+static void in_place_and_lengths() {
+	char buf[] = "Hello\0World";
+	char out[4];
+	int n;
+
+	n = cconv_converter(CHARSET_ASCII, CHARSET_PETSCII) (buf, sizeof(buf) - 1, buf, sizeof(buf) - 1);
+	mu_assert_info("in place length", n == sizeof(buf) - 1);
+	mu_assert_info_str_eq("in place first", buf, "\310ELLO");
+	mu_assert_info_str_eq("in place second", buf + 6, "\327ORLD");
+
+	n = cconv_converter(CHARSET_PETSCII, CHARSET_ASCII) (buf, sizeof(buf) - 1, out, sizeof(out));
+	mu_assert_info("output length", n == sizeof(out));
+	mu_assert_info("output", !memcmp(out, "Hell", 4));
+
+	n = cconv_converter(CHARSET_ASCII, CHARSET_ASCII) (buf, 3, buf, 3);
+	mu_assert_info("identity in place", n == 0);
+}
+
+static void scan() {
+	bool matched;
+	const char *p;
+
+	p = cconv_scan("ab*/cd", CHARSET_ASCII, '/', "*?", &matched);
+	mu_assert_info_str_eq("ascii scan", p, "cd");
+	mu_assert_info("ascii scan match", matched);
+
+	p = cconv_scan("\301\302/cd", CHARSET_PETSCII, '/', "*?", &matched);
+	mu_assert_info_str_eq("petscii scan", p, "cd");
+	mu_assert_info("petscii scan no match", !matched);
+
+	p = cconv_scan("abc", CHARSET_ASCII, '/', "*?", &matched);
+	mu_assert_info("scan without delimiter", p == NULL);
+}
+
+static void match() {
+	const char *pattern, *name;
+
+	pattern = "Ab*";
+	name = "\301\102\303\104";	// "AbCd"
+	mu_assert_info("ascii pattern, petscii name",
+		cconv_matcher(CHARSET_ASCII, CHARSET_PETSCII) (&pattern, &name, false));
+
+	pattern = "\301\102?\104";	// "Ab?d"
+	name = "AbCd";
+	mu_assert_info("petscii pattern, ascii name",
+		cconv_matcher(CHARSET_PETSCII, CHARSET_ASCII) (&pattern, &name, false));
+
+	pattern = "\301\102?\304";	// "Ab?D"
+	name = "AbCd";
+	mu_assert_info("case differs",
+		!cconv_matcher(CHARSET_PETSCII, CHARSET_ASCII) (&pattern, &name, false));
+}
+
+int main(int argc, const char *argv[]) {
+
+	mu_init(argc, argv);
+
+	mu_add("tables_match_petscii_h", tables_match_petscii_h);
+	mu_add("in_place_and_lengths", in_place_and_lengths);
+	mu_add("scan", scan);
+	mu_add("match", match);
+
+	mu_run();
+
+	return (mu_numerr == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
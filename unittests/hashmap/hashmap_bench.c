@@ -0,0 +1,120 @@
+/****************************************************************************
+
+    hashmap micro benchmark
+    Copyright (C) 2026 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+/*
+ * Benchmark for the hash_put/hash_get API. The same source is linked 
+ * against the current pcserver hashmap and against the previous bucket 
+ * based implementation (hashmap_bucket.c), so both can be compared with
+ * "make bench".
+ *
+ * Usage: hashbench [number of entries] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "hashmap.h"
+
+typedef struct {
+	char	name[24];
+	int	value;
+} item_t;
+
+static const char *key_from_item(const void *entry) {
+	return ((const item_t*)entry)->name;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, long ops, double secs) {
+	printf("%-8s %10ld ops %8.3f s %8.1f ns/op\n", what, ops, secs, secs * 1e9 / ops);
+}
+
+int main(int argc, char *argv[]) {
+
+	int n = (argc > 1) ? atoi(argv[1]) : 100000;
+	int rounds = (argc > 2) ? atoi(argv[2]) : 10;
+
+	item_t *items = malloc(n * sizeof(item_t));
+	char (*misses)[24] = malloc(n * sizeof(*misses));
+
+	for (int i = 0; i < n; i++) {
+		snprintf(items[i].name, sizeof(items[i].name), "FILE%d.PRG", i);
+		items[i].value = i;
+		snprintf(misses[i], sizeof(misses[i]), "MISS%d.SEQ", i);
+	}
+
+	// use the same sizing as the server code does (cmdline.c)
+	hash_t *hash = hash_init_stringkey(50, 25, key_from_item);
+
+	double t = now();
+	for (int i = 0; i < n; i++) {
+		hash_put(hash, &items[i]);
+	}
+	report("put", n, now() - t);
+
+	long found = 0;
+	t = now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < n; i++) {
+			found += (hash_get(hash, items[i].name) != NULL);
+		}
+	}
+	report("get-hit", (long) n * rounds, now() - t);
+
+	t = now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < n; i++) {
+			found += (hash_get(hash, misses[i]) != NULL);
+		}
+	}
+	report("get-miss", (long) n * rounds, now() - t);
+
+	long iterated = 0;
+	t = now();
+	for (int r = 0; r < rounds; r++) {
+		hash_iterator_t *iter = hash_iterator(hash);
+		while (hash_iterator_next(iter) != NULL) {
+			iterated++;
+		}
+		hash_iterator_free(iter);
+	}
+	report("iterate", iterated, now() - t);
+
+	if (found != (long) n * rounds) {
+		fprintf(stderr, "Error: found %ld entries, expected %ld\n", found, (long) n * rounds);
+		return EXIT_FAILURE;
+	}
+
+	hash_free(hash, NULL);
+	free(items);
+	free(misses);
+
+	return EXIT_SUCCESS;
+}
+
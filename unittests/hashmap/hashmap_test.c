@@ -0,0 +1,156 @@
+/****************************************************************************
+
+    hashmap unit tests
+    Copyright (C) 2026 Andre Fachat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "myunit.h"
+
+#include "log.h"
+#include "hashmap.h"
+
+#define	NUM_ENTRIES	5000
+
+typedef struct {
+	char	name[16];
+	int	value;
+} item_t;
+
+static item_t items[NUM_ENTRIES];
+
+static const char *key_from_item(const void *entry) {
+	return ((const item_t*)entry)->name;
+}
+
+static void setup_items(const char *fmt) {
+	for (int i = 0; i < NUM_ENTRIES; i++) {
+		snprintf(items[i].name, sizeof(items[i].name), fmt, i);
+		items[i].value = i;
+	}
+}
+
+static int freecnt;
+
+static void free_cb(const void *key, void *value) {
+	(void) key;
+	(void) value;
+	freecnt++;
+}
+
+void put_and_get_grows()
+{
+	setup_items("key%d");
+
+	// start small to force several table resizes
+	hash_t *hash = hash_init_stringkey(2, 1, key_from_item);
+
+	for (int i = 0; i < NUM_ENTRIES; i++) {
+		mu_assert_info("put new returns NULL", hash_put(hash, &items[i]) == NULL);
+	}
+	mu_assert_info("size", hash_size(hash) == NUM_ENTRIES);
+
+	for (int i = 0; i < NUM_ENTRIES; i++) {
+		item_t *it = hash_get(hash, items[i].name);
+		mu_assert_info("get finds entry", it == &items[i]);
+	}
+	mu_assert_info("get unknown", hash_get(hash, "nokey") == NULL);
+	mu_assert_info("contains unknown", !hash_contains(hash, "key-1"));
+
+	freecnt = 0;
+	hash_free(hash, free_cb);
+	mu_assert_info("free callback count", freecnt == NUM_ENTRIES);
+}
+
+void put_replaces()
+{
+	static item_t a = { "samekey", 1 };
+	static item_t b = { "samekey", 2 };
+
+	hash_t *hash = hash_init_stringkey(10, 7, key_from_item);
+
+	mu_assert_info("first put", hash_put(hash, &a) == NULL);
+	mu_assert_info("second put returns replaced", hash_put(hash, &b) == &a);
+	mu_assert_info("size after replace", hash_size(hash) == 1);
+	mu_assert_info("get replaced", hash_get(hash, "samekey") == &b);
+
+	hash_free(hash, NULL);
+}
+
+void nocase_keys()
+{
+	setup_items("Name%d");
+
+	hash_t *hash = hash_init_stringkey_nocase(10, 7, key_from_item);
+
+	for (int i = 0; i < 100; i++) {
+		hash_put(hash, &items[i]);
+	}
+	mu_assert_info("get lower case", hash_get(hash, "name42") == &items[42]);
+	mu_assert_info("get upper case", hash_get(hash, "NAME99") == &items[99]);
+
+	hash_free(hash, NULL);
+}
+
+void iterate_all()
+{
+	static char seen[NUM_ENTRIES];
+
+	setup_items("it%d");
+	memset(seen, 0, sizeof(seen));
+
+	hash_t *hash = hash_init_stringkey(100, 25, key_from_item);
+
+	for (int i = 0; i < NUM_ENTRIES; i++) {
+		hash_put(hash, &items[i]);
+	}
+
+	int n = 0;
+	item_t *it;
+	hash_iterator_t *iter = hash_iterator(hash);
+	while ((it = hash_iterator_next(iter)) != NULL) {
+		mu_assert_info("iterated entry not seen before", seen[it->value] == 0);
+		seen[it->value] = 1;
+		n++;
+	}
+	hash_iterator_free(iter);
+
+	mu_assert_info("iterated all entries", n == NUM_ENTRIES);
+
+	hash_free(hash, NULL);
+}
+
+int main(int argc, const char *argv[]) {
+
+	mu_init(argc, argv);
+
+	mu_add("put_and_get_grows", put_and_get_grows);
+	mu_add("put_replaces", put_replaces);
+	mu_add("nocase_keys", nocase_keys);
+	mu_add("iterate_all", iterate_all);
+
+	mu_run();
+
+	return (mu_numerr == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+